@@ -43,6 +43,19 @@ struct fy_node;
 struct fy_node_pair;
 struct fy_anchor;
 struct fy_node_mapping_sort_ctx;
+struct fy_overlay;
+struct fy_overlay_node;
+struct fy_snapshot;
+struct fy_snapshot_slot;
+struct fy_tape;
+struct fy_walk;
+struct fy_ypath;
+struct fy_document_index;
+struct fy_pipeline;
+struct fy_pipeline_stage;
+struct fy_schema;
+struct fy_schema_validator;
+struct fy_executor;
 
 #ifndef FY_BIT
 #define FY_BIT(x) (1U << (x))
@@ -140,6 +153,36 @@ enum fy_error_module {
 	FYEM_MAX,
 };
 
+/**
+ * struct fy_diag_report - A structured diagnostic report
+ *
+ * Passed to the &fy_parse_cfg->diag callback instead of a formatted
+ * text message. The message itself is not formatted; use
+ * fy_diag_report_format_message() from within the callback if the
+ * text is required. The report (and the input contents it points to)
+ * is only valid for the duration of the callback.
+ *
+ * @type: The severity of the diagnostic
+ * @module: The module which generated the diagnostic
+ * @code: The printf format of the message; it is constant for each
+ *        diagnostic site and can be used as an error code
+ * @name: The name of the input (i.e. the file name) or NULL
+ * @start_mark: The start mark of the offending content
+ * @end_mark: The end mark of the offending content
+ * @input: Pointer to the start of the input contents, or NULL
+ * @input_size: Size of the input contents
+ */
+struct fy_diag_report {
+	enum fy_error_type type;
+	enum fy_error_module module;
+	const char *code;
+	const char *name;
+	struct fy_mark start_mark;
+	struct fy_mark end_mark;
+	const void *input;
+	size_t input_size;
+};
+
 /* Shift amount to apply for color option */
 #define FYPCF_COLOR_SHIFT		2
 /* Mask of bits of the color option */
@@ -192,6 +235,18 @@ enum fy_error_module {
  * @FYPCF_RESOLVE_DOCUMENT: When producing documents, automatically resolve them
  * @FYPCF_DISABLE_MMAP_OPT: Disable mmap optimization
  * @FYPCF_DISABLE_RECYCLING: Disable recycling optimization
+ * @FYPCF_PARSE_AHEAD: Scan and parse on a separate thread while documents
+ *                     are built; memory and mmaped file inputs only, and
+ *                     without an executor ignored on a single CPU
+ * @FYPCF_STREAM_LOW_LATENCY: Read stream inputs with read(2), producing events
+ *                            as soon as their input has arrived instead of
+ *                            waiting for a full buffer (for interactive pipes);
+ *                            the stream must not have been read with stdio
+ * @FYPCF_DEDUP_SCALARS: When loading documents, let repeated scalars share a
+ *                       single token (see fy_document_get_dedup_stats())
+ * @FYPCF_SPILL: Keep the tokens, nodes and pairs of documents in an unlinked
+ *               temporary file mapped in memory instead of the heap, so that
+ *               documents larger than the memory can be loaded (see @spill_dir)
  */
 enum fy_parse_cfg_flags {
 	FYPCF_QUIET			= FY_BIT(0),
@@ -218,7 +273,11 @@ enum fy_parse_cfg_flags {
 	FYPCF_DEBUG_DIAG_MODULE		= FY_BIT(FYPCF_DEBUG_DIAG_SHIFT + 3),
 	FYPCF_RESOLVE_DOCUMENT		= FY_BIT(20),
 	FYPCF_DISABLE_MMAP_OPT		= FY_BIT(21),
-	FYPCF_DISABLE_RECYCLING		= FY_BIT(22)
+	FYPCF_DISABLE_RECYCLING		= FY_BIT(22),
+	FYPCF_PARSE_AHEAD		= FY_BIT(23),
+	FYPCF_STREAM_LOW_LATENCY	= FY_BIT(24),
+	FYPCF_DEDUP_SCALARS		= FY_BIT(25),
+	FYPCF_SPILL			= FY_BIT(26)
 };
 
 /* Enable diagnostic output by all modules */
@@ -243,14 +302,41 @@ void fy_set_default_parser_cfg_flags(enum fy_parse_cfg_flags pflags);
  * Argument to the fy_parser_create() method which
  * perform parsing of YAML files.
  *
+ * The fields after @userdata were added in library version 1 (soname
+ * libfyaml-X.Y.so.1), which is why it is not binary compatible with
+ * version 0; callers have to be rebuilt. Zero out the whole structure
+ * before setting the fields of interest, so that fields added later
+ * keep their defaults.
+ *
  * @search_path: Search path when accessing files, seperate with ':'
  * @flags: Configuration flags
  * @userdata: Opaque user data pointer
+ * @diag: Optional structured diagnostic callback; when set, errors and
+ *        diagnostics are not formatted nor output, but reported via it
+ * @budget_bytes: Abort parsing after this many input bytes are consumed,
+ *                0 for no limit
+ * @budget_events: Abort parsing after this many events are produced,
+ *                 0 for no limit
+ * @budget_ms: Abort parsing when this many milliseconds have elapsed
+ *             since the input was set, 0 for no limit
+ * @executor: Optional executor to parse ahead on (FYPCF_PARSE_AHEAD);
+ *            its workers are never kept waiting, so parsers may
+ *            outnumber them. NULL for a thread of the parser's own
+ * @spill_dir: Directory of the temporary files of FYPCF_SPILL;
+ *             NULL for $TMPDIR, or /var/tmp if not set. It should be
+ *             on disk; on a memory backed tmpfs nothing is saved
  */
 struct fy_parse_cfg {
 	const char *search_path;
 	enum fy_parse_cfg_flags flags;
 	void *userdata;
+	void (*diag)(struct fy_parser *fyp, const struct fy_diag_report *report,
+		     void *userdata);
+	size_t budget_bytes;
+	size_t budget_events;
+	unsigned int budget_ms;
+	struct fy_executor *executor;
+	const char *spill_dir;
 };
 
 /**
@@ -570,6 +656,77 @@ void fy_parser_free(struct fy_parser *fyp, void *data);
  */
 bool fy_parser_get_stream_error(struct fy_parser *fyp);
 
+/**
+ * fy_parser_budget_exceeded() - Check whether the parse budget was exceeded
+ *
+ * Check whether parsing was aborted because one of the byte, event
+ * or time budgets of the parser configuration was exceeded.
+ * When this happens a stream error is generated as well.
+ *
+ * @fyp: The parser
+ *
+ * Returns:
+ * true if a parse budget was exceeded, false otherwise.
+ */
+bool fy_parser_budget_exceeded(struct fy_parser *fyp);
+
+/**
+ * fy_parser_parse_slice() - Parse ahead a bounded number of events
+ *
+ * Perform the parsing work for at most @max_events events and
+ * return control to the caller. The events are queued and returned,
+ * without further parsing work, by subsequent calls to fy_parser_parse()
+ * or consumed by fy_parse_load_document(). This allows event loop
+ * based callers to interleave parsing of a large input with other work.
+ *
+ * The queue never holds more than @max_events events; the events
+ * queued by earlier slices and not consumed yet count against it.
+ * To build a document a slice at a time without queueing the whole
+ * of it use fy_parse_load_document_slice().
+ *
+ * @fyp: The parser
+ * @max_events: Maximum number of events to parse in this slice
+ *
+ * Returns:
+ * The number of events parsed in this slice, 0 when the stream
+ * is completely parsed or @max_events events are already queued,
+ * or -1 on error (including an exceeded budget)
+ */
+int fy_parser_parse_slice(struct fy_parser *fyp, int max_events);
+
+/**
+ * fy_parser_get_slice_mark() - Get the position where the last slice stopped
+ *
+ * Get the input position right after the last event processed by
+ * fy_parser_parse_slice() or fy_parse_load_document_slice(), which
+ * is where the next slice picks up.
+ *
+ * @fyp: The parser
+ *
+ * Returns:
+ * A pointer to the mark, or NULL if no slice processed an event yet.
+ * The mark is valid until the next slice.
+ */
+const struct fy_mark *fy_parser_get_slice_mark(struct fy_parser *fyp);
+
+/**
+ * fy_diag_report_format_message() - Format the message of a diagnostic report
+ *
+ * Format the message text of a diagnostic report received via
+ * the &fy_parse_cfg->diag callback. It may only be called from
+ * within the callback.
+ *
+ * @report: The diagnostic report
+ * @buf: The buffer to format the message into
+ * @size: The size of the buffer
+ *
+ * Returns:
+ * The number of characters of the full message (excluding the
+ * terminating '\0') like snprintf(), or -1 on error
+ */
+int fy_diag_report_format_message(const struct fy_diag_report *report,
+				  char *buf, size_t size);
+
 /**
  * fy_token_scalar_style() - Get the style of a scalar token
  *
@@ -657,6 +814,30 @@ size_t fy_token_get_text_length(struct fy_token *fyt);
  */
 struct fy_document *fy_parse_load_document(struct fy_parser *fyp);
 
+/**
+ * fy_parse_load_document_slice() - Load the next document a slice at a time
+ *
+ * Works like fy_parse_load_document(), but consumes at most @max_events
+ * events per call. When the document is not complete after a slice the
+ * nodes built so far stay with the parser and the next call resumes
+ * from there, so that loading can be interleaved with other work with
+ * no more than a slice worth of events in memory at a time.
+ * Use fy_parser_get_slice_mark() to find where in the input a slice
+ * stopped. A document in progress is discarded when the parser is
+ * reset or destroyed.
+ *
+ * @fyp: The parser
+ * @max_events: Maximum number of events to consume in this slice
+ * @fydp: Pointer to the place to store the document when complete
+ *
+ * Returns:
+ * 1 when the slice ended before the document was complete,
+ * 0 when done, with the document stored in @fydp, or NULL stored
+ * there at the end of the stream, or -1 on error
+ */
+int fy_parse_load_document_slice(struct fy_parser *fyp, int max_events,
+				 struct fy_document **fydp);
+
 /**
  * fy_parse_document_destroy() - Destroy a document created by fy_parse_load_document()
  *
@@ -718,6 +899,92 @@ bool fy_document_has_explicit_document_start(const struct fy_document *fyd);
  */
 bool fy_document_has_explicit_document_end(const struct fy_document *fyd);
 
+/**
+ * fy_document_get_dedup_stats() - Scalar sharing statistics of a document
+ *
+ * Retrieves how well the scalars of a document loaded with
+ * %FYPCF_DEDUP_SCALARS were deduplicated. Repeated scalars (of the same
+ * style and text, on a single line and without comments) share the token
+ * of their first occurrence, so their text is kept (and converted) once;
+ * each node still reports its own position. Only scalars are shared:
+ * identical collections are loaded as separate nodes, since a node has a
+ * single parent. Changing a node that shares its token replaces the token
+ * of that node only.
+ *
+ * Any of the output pointers may be NULL.
+ *
+ * @fyd: The document
+ * @scalarsp: Pointer to store the number of scalars considered
+ * @sharedp: Pointer to store how many of them share an earlier token
+ * @bytesp: Pointer to store the source bytes of the shared scalars
+ *
+ * Returns:
+ * 0 on success, -1 on error
+ */
+int fy_document_get_dedup_stats(const struct fy_document *fyd, size_t *scalarsp,
+				size_t *sharedp, size_t *bytesp);
+
+/**
+ * struct fy_memory_report - Memory used by a node
+ *
+ * Bytes of the memory a node (or a subtree) is responsible for.
+ * A token referenced more than once (i.e. one shared by
+ * %FYPCF_DEDUP_SCALARS) is not freed along with a single node, so it
+ * is counted in @shared instead of @tokens and @text. The input a token
+ * refers to is kept alive for as long as the token is.
+ *
+ * @nodes: Bytes of the nodes
+ * @pairs: Bytes of the mapping pairs
+ * @tokens: Bytes of the tokens no other node refers to
+ * @text: Bytes of the text materialized for those tokens (i.e. escaped
+ *        or folded scalars, and the ones zero terminated on request)
+ * @shared: Bytes of the shared tokens and their text
+ * @input: Bytes of the input the tokens refer to
+ * @total: Bytes freed when the node is freed, @nodes + @pairs + @tokens + @text
+ * @count: Number of nodes
+ */
+struct fy_memory_report {
+	size_t nodes;
+	size_t pairs;
+	size_t tokens;
+	size_t text;
+	size_t shared;
+	size_t input;
+	size_t total;
+	size_t count;
+};
+
+/**
+ * fy_node_memory_usage() - Memory used by a subtree
+ *
+ * Attributes the memory used by the node, and everything under it,
+ * to the categories of a &struct fy_memory_report. The anchors of
+ * the document are not attributed to their nodes.
+ *
+ * @fyn: The node
+ * @report: Pointer to the report to fill
+ *
+ * Returns:
+ * 0 on success, -1 on error
+ */
+int fy_node_memory_usage(struct fy_node *fyn, struct fy_memory_report *report);
+
+/**
+ * fy_node_memory_usage_self() - Memory used by a node itself
+ *
+ * Like fy_node_memory_usage(), but without the items of a sequence,
+ * or the keys and values of a mapping (its pairs are counted).
+ * The usage of a subtree is that of its node and of its children;
+ * walking a tree bottom up with this is linear in its size.
+ *
+ * @fyn: The node
+ * @report: Pointer to the report to fill
+ *
+ * Returns:
+ * 0 on success, -1 on error
+ */
+int fy_node_memory_usage_self(struct fy_node *fyn, struct fy_memory_report *report);
+
 /*
  * enum fy_emitter_write_type - Type of the emitted output
  *
@@ -745,6 +1012,8 @@ bool fy_document_has_explicit_document_end(const struct fy_document *fyd);
  * @fyewt_single_quoted_scalar_key: Output chunk is an single quoted scalar key
  * @fyewt_double_quoted_scalar_key: Output chunk is an double quoted scalar key
  * @fyewt_comment: Output chunk is a comment
+ * @fyewt_flush: Empty chunk; a document is complete and the output
+ *               should be flushed (only with FYECF_FLUSH_DOCUMENT)
  *
  */
 enum fy_emitter_write_type {
@@ -768,6 +1037,7 @@ enum fy_emitter_write_type {
 	fyewt_single_quoted_scalar_key,
 	fyewt_double_quoted_scalar_key,
 	fyewt_comment,
+	fyewt_flush,
 };
 
 #define FYECF_INDENT_SHIFT	8
@@ -805,6 +1075,14 @@ enum fy_emitter_write_type {
  *
  * @FYECF_SORT_KEYS: Sort key when emitting
  * @FYECF_OUTPUT_COMMENTS: Output comments (experimental)
+ * @FYECF_FLUSH_DOCUMENT: Flush the output at the end of every document
+ * @FYECF_AUTO_ANCHORS: When emitting a document, output repeated subtrees
+ *                      as aliases to the first one, which gets a generated
+ *                      anchor (see @auto_anchor_min of &struct fy_emitter_cfg)
+ * @FYECF_EXPAND_ALIASES: When emitting a document, output aliases as copies
+ *                        of the nodes they refer to, except in merge keys
+ *                        and within their own target; anchors are kept
+ *                        (takes precedence over %FYECF_AUTO_ANCHORS)
  * @FYECF_INDENT_DEFAULT: Default emit output indent
  * @FYECF_INDENT_1: Output indent is 1
  * @FYECF_INDENT_2: Output indent is 2
@@ -843,6 +1121,9 @@ enum fy_emitter_write_type {
 enum fy_emitter_cfg_flags {
 	FYECF_SORT_KEYS			= FY_BIT(0),
 	FYECF_OUTPUT_COMMENTS		= FY_BIT(1),
+	FYECF_FLUSH_DOCUMENT		= FY_BIT(2),
+	FYECF_AUTO_ANCHORS		= FY_BIT(3),
+	FYECF_EXPAND_ALIASES		= FY_BIT(4),
 	FYECF_INDENT_DEFAULT		= FYECF_INDENT(0),
 	FYECF_INDENT_1			= FYECF_INDENT(1),
 	FYECF_INDENT_2			= FYECF_INDENT(2),
@@ -891,12 +1172,17 @@ enum fy_emitter_cfg_flags {
  * @flags: Configuration flags
  * @output: Pointer to the method that will perform output.
  * @userdata: Opaque user data pointer
+ * @auto_anchor_min: With %FYECF_AUTO_ANCHORS, the smallest subtree (in
+ *                   nodes) replaced by an alias; 0 for the default (4).
+ *                   Keys, subtrees holding anchors and aliases are never
+ *                   replaced.
  */
 struct fy_emitter_cfg {
 	enum fy_emitter_cfg_flags flags;
 	int (*output)(struct fy_emitter *emit, enum fy_emitter_write_type type,
 		      const char *str, int len, void *userdata);
 	void *userdata;
+	unsigned int auto_anchor_min;
 };
 
 /**
@@ -1172,6 +1458,47 @@ struct fy_node *fy_node_copy(struct fy_document *fyd, struct fy_node *fyn_from);
  */
 int fy_node_insert(struct fy_node *fyn_to, struct fy_node *fyn_from);
 
+/**
+ * fy_node_steal() - Take a node out of its document
+ *
+ * Removes the node from its document and hands it over to @fyd as a
+ * free standing node, ready to be inserted. The tokens of the subtree
+ * (and the inputs they refer to) are taken over without copying, and
+ * so are its anchors unless already present in @fyd. Afterwards the
+ * source document may be destroyed.
+ *
+ * The node must be the root, a sequence item, a mapping value (whose
+ * pair is removed along with it) or free standing. A mapping key
+ * can't be taken, and NULL is returned leaving it in place; on any
+ * other error the node is destroyed.
+ *
+ * @fyd: The document which the resulting node will be associated with
+ * @fyn: The node to take
+ *
+ * Returns:
+ * The node on success, NULL on error
+ */
+struct fy_node *fy_node_steal(struct fy_document *fyd, struct fy_node *fyn);
+
+/**
+ * fy_node_insert_move() - Insert a node to the given node, moving it
+ *
+ * Same as fy_node_insert(), but the source node is taken out of its
+ * document with fy_node_steal() instead of being copied, so that the
+ * source document may be destroyed afterwards. The source node is
+ * consumed, even on error; it is taken out of its document and freed
+ * when it can't be moved (for instance when the target is one of its
+ * descendants, which goes away with it). A mapping key can't be moved
+ * and is left in place.
+ *
+ * @fyn_to: The target node
+ * @fyn_from: The source node
+ *
+ * Returns:
+ * 0 on success, -1 on error
+ */
+int fy_node_insert_move(struct fy_node *fyn_to, struct fy_node *fyn_from);
+
 /**
  * fy_document_insert_at() - Insert a node to the given path in the document
  *
@@ -1413,7 +1740,9 @@ struct fy_node *fy_document_root(struct fy_document *fyd);
  * fy_document_set_root() - Set the root of the document
  *
  * Set the root of a document. If the document was not empty
- * the old root will be freed.
+ * the old root will be freed. The new root must have been created
+ * in (or copied to) the same document; a node of another document
+ * is not set and an error is reported on the document's diagnostics.
  *
  * @fyd: The document
  * @fyn: The new root of the document.
@@ -1716,6 +2045,24 @@ int fy_node_set_tag(struct fy_node *fyn, const char *data, size_t len);
  */
 const char *fy_node_get_tag(struct fy_node *fyn, size_t *lenp);
 
+/**
+ * fy_node_get_tag_id() - Get the interned id of the tag of the node
+ *
+ * Tags are resolved once and interned in the document state, each
+ * distinct tag getting a small integer id. Nodes of documents sharing
+ * a document state (i.e. of the same stream) have the same tag if and
+ * only if they have the same id, so this can be used to compare or
+ * switch on tags without looking at their text. Tags are interned
+ * when they are loaded or set, so this method does not modify anything
+ * and can be called concurrently with other readers of the document.
+ *
+ * @fyn: The node
+ *
+ * Returns:
+ * The id of the tag, or -1 if the node has no tag (or on error)
+ */
+int fy_node_get_tag_id(struct fy_node *fyn);
+
 /**
  * fy_node_get_scalar() - Get the scalar content of the node
  *
@@ -1823,7 +2170,8 @@ struct fy_node *fy_node_sequence_get_by_index(struct fy_node *fyn, int index);
 /**
  * fy_node_sequence_append() - Append a node item to a sequence
  *
- * Append a node item to a sequence.
+ * Append a node item to a sequence. The node must belong to the
+ * same document as the sequence (see fy_node_copy()).
  *
  * @fyn_seq: The sequence node
  * @fyn: The node item to append
@@ -2034,7 +2382,8 @@ struct fy_node *fy_node_pair_value(struct fy_node_pair *fynp);
  * It will ovewrite any previous key.
  *
  * Note that no checks for duplicate keys are going to be
- * performed.
+ * performed. A node of another document is not set, and an
+ * error is reported on the document's diagnostics.
  *
  * @fynp: The node pair
  * @fyn: The key node
@@ -2045,7 +2394,8 @@ void fy_node_pair_set_key(struct fy_node_pair *fynp, struct fy_node *fyn);
  * fy_node_pair_set_value() - Sets the value of a node pair
  *
  * This method will set the value part of the node pair.
- * It will ovewrite any previous value.
+ * It will ovewrite any previous value. A node of another document
+ * is not set, and an error is reported on the document's diagnostics.
  *
  * @fynp: The node pair
  * @fyn: The value node
@@ -2055,7 +2405,8 @@ void fy_node_pair_set_value(struct fy_node_pair *fynp, struct fy_node *fyn);
 /**
  * fy_node_mapping_append() - Append a node item to a mapping
  *
- * Append a node pair to a mapping.
+ * Append a node pair to a mapping. The nodes must belong to the
+ * same document as the mapping (see fy_node_copy()).
  *
  * @fyn_map: The mapping node
  * @fyn_key: The node pair's key
@@ -2129,13 +2480,18 @@ typedef int (*fy_node_mapping_sort_fn)(const struct fy_node_pair *fynp_a,
  *
  * Recursively sort all mappings of the given node, using the given
  * comparison method (if NULL use the default one).
+ * The mappings of FYPCF_SPILL documents are sorted in place by a stable
+ * sort that walks their pairs sequentially, without allocating memory;
+ * their pairs are not linked in the mapping while it is being sorted,
+ * so only the default comparison method can be used for them.
  *
  * @fyn: The node to sort
  * @key_cmp: The comparison method
  * @arg: An opaque user pointer for the comparison method
  *
  * Returns:
- * 0 on success, -1 on error
+ * 0 on success, -1 on error (including a comparison method
+ * for a FYPCF_SPILL document)
  */
 int fy_node_sort(struct fy_node *fyn, fy_node_mapping_sort_fn key_cmp, void *arg);
 
@@ -2445,4 +2801,1193 @@ struct fy_anchor *fy_node_get_anchor(struct fy_node *fyn);
  */
 struct fy_node *fy_node_create_alias(struct fy_document *fyd, const char *alias);
 
+/**
+ * fy_overlay_create() - Create an overlay view of layered documents
+ *
+ * Create a read only view of an ordered list of documents, as if
+ * they were merged one over the other. Mappings are merged key by key
+ * (recursively), while for everything else the node of the highest
+ * layer that contains it wins. Nothing is copied; a lookup consults
+ * the layers for just the entry it asks for, and a mapping is merged
+ * and indexed by key hash only when iterated, counted, or looked up
+ * repeatedly.
+ *
+ * The documents must not be modified or destroyed while the overlay
+ * is in use. Aliases are not followed, so resolve the documents first
+ * if needed.
+ *
+ * @fyds: The documents, lowest priority (i.e. the base) first
+ * @count: The number of documents
+ *
+ * Returns:
+ * The created overlay, or NULL on error
+ */
+struct fy_overlay *fy_overlay_create(struct fy_document * const *fyds, int count);
+
+/**
+ * fy_overlay_destroy() - Destroy an overlay
+ *
+ * Destroy an overlay created earlier via fy_overlay_create().
+ * The layer documents are not affected.
+ *
+ * @fyo: The overlay to destroy
+ */
+void fy_overlay_destroy(struct fy_overlay *fyo);
+
+/**
+ * fy_overlay_root() - Return the root node of an overlay
+ *
+ * @fyo: The overlay
+ *
+ * Returns:
+ * The root overlay node, or NULL if there's none
+ */
+struct fy_overlay_node *fy_overlay_root(struct fy_overlay *fyo);
+
+/**
+ * fy_overlay_node_get_type() - Get the type of an overlay node
+ *
+ * @fyon: The overlay node
+ *
+ * Returns:
+ * The node type of the effective (highest layer) node
+ */
+enum fy_node_type fy_overlay_node_get_type(struct fy_overlay_node *fyon);
+
+/**
+ * fy_overlay_node_get_node() - Get the effective node of an overlay node
+ *
+ * Return the node of the highest layer at this point of the view.
+ * For mappings this is the highest layer mapping only; the merged
+ * contents are accessed via the overlay node methods.
+ *
+ * @fyon: The overlay node
+ *
+ * Returns:
+ * The effective node (which may be NULL for a null value)
+ */
+struct fy_node *fy_overlay_node_get_node(struct fy_overlay_node *fyon);
+
+/**
+ * fy_overlay_node_get_key() - Get the key of an overlay mapping entry
+ *
+ * @fyon: The overlay node
+ *
+ * Returns:
+ * The key node (from the highest layer containing it) if the overlay
+ * node is the value of a mapping entry, NULL otherwise
+ */
+struct fy_node *fy_overlay_node_get_key(struct fy_overlay_node *fyon);
+
+/**
+ * fy_overlay_node_item_count() - Return the item count of an overlay node
+ *
+ * @fyon: The overlay node
+ *
+ * Returns:
+ * The count of merged mapping entries or sequence items, -1 for scalars
+ */
+int fy_overlay_node_item_count(struct fy_overlay_node *fyon);
+
+/**
+ * fy_overlay_node_iterate() - Iterate over the items of an overlay node
+ *
+ * Iterate over the merged mapping entries (in order of first appearance
+ * in the layers) or the sequence items of an overlay node.
+ *
+ * @fyon: The overlay node
+ * @prevp: The previous item iterator, NULL to start
+ *
+ * Returns:
+ * The next overlay node in sequence, NULL at the end
+ */
+struct fy_overlay_node *fy_overlay_node_iterate(struct fy_overlay_node *fyon, void **prevp);
+
+/**
+ * fy_overlay_node_mapping_lookup_by_string() - Lookup a merged mapping entry
+ *
+ * @fyon: The overlay mapping node
+ * @key: The YAML source of the key to lookup
+ *
+ * Returns:
+ * The overlay node of the value, or NULL if not found
+ */
+struct fy_overlay_node *
+fy_overlay_node_mapping_lookup_by_string(struct fy_overlay_node *fyon, const char *key);
+
+/**
+ * fy_overlay_node_sequence_get_by_index() - Return a sequence item
+ *
+ * @fyon: The overlay sequence node
+ * @index: The index of the item, negative values count from the end
+ *
+ * Returns:
+ * The overlay node of the item, or NULL if out of range
+ */
+struct fy_overlay_node *
+fy_overlay_node_sequence_get_by_index(struct fy_overlay_node *fyon, int index);
+
+/**
+ * fy_overlay_node_by_path() - Retrieve an overlay node using a path spec
+ *
+ * Works exactly like fy_node_by_path(), but traverses the merged view.
+ *
+ * @fyon: The overlay node to start the traversal from
+ * @path: The path spec
+ *
+ * Returns:
+ * The retrieved overlay node, or NULL if not found
+ */
+struct fy_overlay_node *fy_overlay_node_by_path(struct fy_overlay_node *fyon, const char *path);
+
+/**
+ * fy_overlay_flatten() - Materialize an overlay into a document
+ *
+ * Create a new document with the merged contents of the overlay.
+ *
+ * @fyo: The overlay
+ *
+ * Returns:
+ * The created document, or NULL on error
+ */
+struct fy_document *fy_overlay_flatten(struct fy_overlay *fyo);
+
+/**
+ * fy_emit_overlay_to_string() - Emit an overlay as if it were merged
+ *
+ * The merged view is walked and emitted directly from the nodes of the
+ * layers, without creating a flattened document first. Aliases are
+ * output as they are, so FYECF_EXPAND_ALIASES and FYECF_AUTO_ANCHORS
+ * have no effect.
+ *
+ * @fyo: The overlay
+ * @flags: The emitter flags to use
+ *
+ * Returns:
+ * An allocated string with the emitted YAML (to be freed by the caller),
+ * or NULL on error
+ */
+char *fy_emit_overlay_to_string(struct fy_overlay *fyo, enum fy_emitter_cfg_flags flags);
+
+
+/**
+ * fy_snapshot_create() - Create a snapshot from a document
+ *
+ * Create an immutable, reference counted snapshot out of a document.
+ * The snapshot takes ownership of the document, which must not be
+ * modified (or destroyed) afterwards.
+ *
+ * @fyd: The document
+ *
+ * Returns:
+ * The created snapshot with a reference count of 1, or NULL on error
+ */
+struct fy_snapshot *fy_snapshot_create(struct fy_document *fyd);
+
+/**
+ * fy_snapshot_ref() - Take a reference to a snapshot
+ *
+ * @fys: The snapshot
+ *
+ * Returns:
+ * The snapshot
+ */
+struct fy_snapshot *fy_snapshot_ref(struct fy_snapshot *fys);
+
+/**
+ * fy_snapshot_unref() - Drop a reference to a snapshot
+ *
+ * Drop a reference; when the last one is dropped the snapshot
+ * is freed, along with any snapshots only it was referencing.
+ *
+ * @fys: The snapshot
+ */
+void fy_snapshot_unref(struct fy_snapshot *fys);
+
+/**
+ * fy_snapshot_overlay() - Get a view of the contents of a snapshot
+ *
+ * Create an overlay presenting the contents of the snapshot.
+ * Each reader should create its own; the snapshot must be kept
+ * referenced for as long as the overlay is in use. Creating it
+ * merges nothing, the layers are resolved as the reader goes.
+ *
+ * @fys: The snapshot
+ *
+ * Returns:
+ * The created overlay (destroy with fy_overlay_destroy()), or NULL on error
+ */
+struct fy_overlay *fy_snapshot_overlay(struct fy_snapshot *fys);
+
+/**
+ * fy_document_update_path() - Create an updated snapshot
+ *
+ * Create a new snapshot with the node at the given path replaced
+ * by a copy of @fyn. The original snapshot is unchanged. Only the
+ * nodes on the path are created in the new snapshot: mappings merge
+ * with the layers below by key and sequences are patched by index,
+ * so everything off the path is shared between the two. Missing
+ * mapping keys along the path are created; sequence indices must
+ * be in range.
+ *
+ * @fys: The snapshot to update
+ * @path: The path of the node to replace
+ * @fyn: The new node
+ *
+ * Returns:
+ * The new snapshot with a reference count of 1, or NULL on error
+ */
+struct fy_snapshot *fy_document_update_path(struct fy_snapshot *fys, const char *path,
+					    struct fy_node *fyn);
+
+/**
+ * fy_snapshot_slot_create() - Create a snapshot publication slot
+ *
+ * A slot holds the current snapshot. Readers acquire it without
+ * locking, while publishers replace it atomically.
+ *
+ * @fys: The initial snapshot (a reference is taken)
+ *
+ * Returns:
+ * The created slot, or NULL on error
+ */
+struct fy_snapshot_slot *fy_snapshot_slot_create(struct fy_snapshot *fys);
+
+/**
+ * fy_snapshot_slot_destroy() - Destroy a snapshot publication slot
+ *
+ * Drops the reference of the slot to the current snapshot.
+ * There must be no concurrent users of the slot.
+ *
+ * @slot: The slot
+ */
+void fy_snapshot_slot_destroy(struct fy_snapshot_slot *slot);
+
+/**
+ * fy_snapshot_acquire() - Acquire the current snapshot of a slot
+ *
+ * Get a reference to the currently published snapshot.
+ * The call never blocks.
+ *
+ * @slot: The slot
+ *
+ * Returns:
+ * The current snapshot, to be released with fy_snapshot_unref()
+ */
+struct fy_snapshot *fy_snapshot_acquire(struct fy_snapshot_slot *slot);
+
+/**
+ * fy_snapshot_publish() - Publish a new snapshot
+ *
+ * Atomically make @fys the current snapshot of the slot (a reference
+ * is taken). The previous one is released after all the readers
+ * that might be acquiring it are done; it is freed when its last
+ * reader drops it.
+ *
+ * @slot: The slot
+ * @fys: The snapshot to publish
+ */
+void fy_snapshot_publish(struct fy_snapshot_slot *slot, struct fy_snapshot *fys);
+
+
+/**
+ * fy_parse_load_tape() - Parse the next document from the parser stream as a tape
+ *
+ * Works like fy_parse_load_document(), but instead of a tree of nodes
+ * the document is loaded, in a single pass over the events, into a tape;
+ * a flat read-only array of entries where collections are bracketed by
+ * start and end entries. Scalars are kept as spans of the input, which
+ * must outlive the tape, while larger mappings get a key index. Duplicate
+ * keys are only checked by fy_tape_to_document(), and aliases are not
+ * resolved.
+ *
+ * The nodes of a tape are referred to by their (integer) position
+ * in it.
+ *
+ * @fyp: The parser
+ *
+ * Returns:
+ * The next document as a tape, or NULL at the end of the stream or on error
+ */
+struct fy_tape *fy_parse_load_tape(struct fy_parser *fyp);
+
+/**
+ * fy_tape_build_from_string() - Load a tape from a string
+ *
+ * @cfg: The parse options (or NULL for the defaults)
+ * @str: The YAML source
+ *
+ * Returns:
+ * The tape of the first document of @str, or NULL on error
+ */
+struct fy_tape *fy_tape_build_from_string(const struct fy_parse_cfg *cfg, const char *str);
+
+/**
+ * fy_tape_destroy() - Destroy a tape
+ *
+ * @fytp: The tape to destroy
+ */
+void fy_tape_destroy(struct fy_tape *fytp);
+
+/**
+ * fy_tape_root() - Get the position of the root of a tape
+ *
+ * @fytp: The tape
+ *
+ * Returns:
+ * The position of the root node, or -1 for an empty tape
+ */
+int fy_tape_root(struct fy_tape *fytp);
+
+/**
+ * fy_tape_get_type() - Get the type of a tape node
+ *
+ * @fytp: The tape
+ * @pos: The position of the node
+ *
+ * Returns:
+ * The node type (aliases are scalars)
+ */
+enum fy_node_type fy_tape_get_type(struct fy_tape *fytp, int pos);
+
+/**
+ * fy_tape_get_style() - Get the style of a tape node
+ *
+ * @fytp: The tape
+ * @pos: The position of the node
+ *
+ * Returns:
+ * The node style, or FYNS_ANY for an invalid position
+ */
+enum fy_node_style fy_tape_get_style(struct fy_tape *fytp, int pos);
+
+/**
+ * fy_tape_get_scalar() - Get the contents of a tape scalar
+ *
+ * Aliases return the name of the anchor.
+ *
+ * @fytp: The tape
+ * @pos: The position of the node
+ * @lenp: Pointer to store the length of the contents
+ *
+ * Returns:
+ * The contents of the scalar (not NUL terminated), or NULL if
+ * the node is not a scalar
+ */
+const char *fy_tape_get_scalar(struct fy_tape *fytp, int pos, size_t *lenp);
+
+/**
+ * fy_tape_skip() - Skip over a tape node
+ *
+ * Skip over a node along with all its contents, in constant time.
+ *
+ * @fytp: The tape
+ * @pos: The position of the node
+ *
+ * Returns:
+ * The position right after the node, or -1 on error
+ */
+int fy_tape_skip(struct fy_tape *fytp, int pos);
+
+/**
+ * fy_tape_item_count() - Get the number of items of a tape collection
+ *
+ * @fytp: The tape
+ * @pos: The position of the collection
+ *
+ * Returns:
+ * The number of items (pairs for mappings), or -1 if not a collection
+ */
+int fy_tape_item_count(struct fy_tape *fytp, int pos);
+
+/**
+ * fy_tape_iterate() - Iterate over the contents of a tape collection
+ *
+ * Returns the items of a sequence, or the keys of a mapping; the
+ * value of a key is found at fy_tape_skip() of the key.
+ *
+ * @fytp: The tape
+ * @pos: The position of the collection
+ * @prev: The previously returned position, or -1 to start
+ *
+ * Returns:
+ * The position of the next item (or key), or -1 when done
+ */
+int fy_tape_iterate(struct fy_tape *fytp, int pos, int prev);
+
+/**
+ * fy_tape_sequence_get_by_index() - Get a tape sequence item by index
+ *
+ * @fytp: The tape
+ * @pos: The position of the sequence
+ * @index: The index of the item; negative counts from the end
+ *
+ * Returns:
+ * The position of the item, or -1 if not found
+ */
+int fy_tape_sequence_get_by_index(struct fy_tape *fytp, int pos, int index);
+
+/**
+ * fy_tape_mapping_lookup_by_string() - Lookup a value of a tape mapping
+ *
+ * Only scalar keys are considered, compared by their contents. When
+ * there are more than one with the same contents, the first is found.
+ *
+ * @fytp: The tape
+ * @pos: The position of the mapping
+ * @key: The key
+ *
+ * Returns:
+ * The position of the value, or -1 if not found
+ */
+int fy_tape_mapping_lookup_by_string(struct fy_tape *fytp, int pos, const char *key);
+
+/**
+ * fy_tape_by_path() - Lookup a tape node using a path spec
+ *
+ * Works like fy_node_by_path() on a tape.
+ *
+ * @fytp: The tape
+ * @pos: The position to start the traversal from
+ * @path: The path spec
+ *
+ * Returns:
+ * The position of the node, or -1 if not found
+ */
+int fy_tape_by_path(struct fy_tape *fytp, int pos, const char *path);
+
+/**
+ * fy_tape_to_document() - Convert a tape to a document
+ *
+ * The document does not depend on the tape, which may be destroyed
+ * right after, but it does on the input of the tape. Duplicate keys
+ * are an error, just as when loading a document.
+ *
+ * @fytp: The tape
+ *
+ * Returns:
+ * A newly created document with the contents of the tape, or NULL on error
+ */
+struct fy_document *fy_tape_to_document(struct fy_tape *fytp);
+
+
+/**
+ * enum fy_walk_event_type - Walker event type
+ *
+ * @FYWE_ENTER: Entering a node (before its contents)
+ * @FYWE_LEAVE: Leaving a node (after its contents)
+ */
+enum fy_walk_event_type {
+	FYWE_ENTER,
+	FYWE_LEAVE,
+};
+
+/**
+ * struct fy_walk_event - Walker event
+ *
+ * @type: Entering or leaving the node
+ * @fyn: The node
+ * @fynp: The pair the node is the key or value of, NULL if the node
+ *        is a sequence item or the start of the walk
+ * @is_key: True if the node is the key of @fynp
+ * @depth: The depth of the node (the start of the walk is 0)
+ */
+struct fy_walk_event {
+	enum fy_walk_event_type type;
+	struct fy_node *fyn;
+	struct fy_node_pair *fynp;
+	bool is_key;
+	int depth;
+};
+
+/**
+ * fy_walk_begin() - Start a depth first walk of a node tree
+ *
+ * Start walking the tree of @fyn. The walk does not recurse,
+ * so it is safe to use on arbitrarily deep trees.
+ * Null (NULL) keys and values are not reported.
+ *
+ * @fyn: The node to start from
+ *
+ * Returns:
+ * The walker, or NULL on error
+ */
+struct fy_walk *fy_walk_begin(struct fy_node *fyn);
+
+/**
+ * fy_walk_next() - Get the next walker event
+ *
+ * Every node produces an enter event, followed by the events of
+ * its contents (keys and values alternating for mappings), and
+ * finally a leave event. The tree must not be modified during the walk.
+ *
+ * @fyw: The walker
+ *
+ * Returns:
+ * The next event (valid until the next call), or NULL when done
+ */
+const struct fy_walk_event *fy_walk_next(struct fy_walk *fyw);
+
+/**
+ * fy_walk_skip_subtree() - Skip the contents of the entered node
+ *
+ * After an enter event, skip the contents of the node; the next
+ * event is the leave event of the node.
+ *
+ * @fyw: The walker
+ */
+void fy_walk_skip_subtree(struct fy_walk *fyw);
+
+/**
+ * fy_walk_end() - End a walk
+ *
+ * @fyw: The walker
+ */
+void fy_walk_end(struct fy_walk *fyw);
+
+/**
+ * typedef fy_ypath_match_fn - Path query match callback
+ *
+ * @fyn: The matching node
+ * @user: The opaque user pointer of the query
+ *
+ * Returns:
+ * 0 to continue the query, non-zero to stop it
+ */
+typedef int (*fy_ypath_match_fn)(struct fy_node *fyn, void *user);
+
+/**
+ * fy_ypath_compile() - Compile a path query
+ *
+ * Compile a query for use with fy_ypath_exec() and fy_ypath_exec_parser().
+ * A query is a list of steps separated by '/', each selecting
+ * children of the nodes selected by the previous one.
+ * A step is one of:
+ *   key       - the value of the mapping key (quote with '' or "" if needed)
+ *   * or [*]  - any mapping value or sequence item
+ *   [n]       - the sequence item n, negative counts from the end
+ *   [a:b]     - the sequence items a up to (not including) b;
+ *               either bound can be omitted or negative
+ * and can be followed by predicates of the form [key=value], which
+ * require the selected node to be a mapping with that scalar value for
+ * key. A step preceded by '//' selects at any depth below instead of
+ * just the children, and key[n] is shorthand for key/[n].
+ * For example: "/spec/containers/[*]/image", "//metadata/labels",
+ * "/items/[*][kind=Pod]/metadata/name", "/items[-1]".
+ *
+ * @expr: The query
+ *
+ * Returns:
+ * The compiled query, or NULL on error
+ */
+struct fy_ypath *fy_ypath_compile(const char *expr);
+
+/**
+ * fy_ypath_destroy() - Destroy a compiled path query
+ *
+ * @ypath: The query to destroy
+ */
+void fy_ypath_destroy(struct fy_ypath *ypath);
+
+/**
+ * fy_ypath_exec() - Run a path query over a node tree
+ *
+ * Find the nodes of the tree of @fyn (which is the start of the query)
+ * matching the query, calling @cb for each in document order.
+ *
+ * @ypath: The compiled query
+ * @fyn: The node to start from
+ * @cb: The match callback (may be NULL when only counting)
+ * @user: Opaque user pointer passed to the callback
+ *
+ * Returns:
+ * The number of matches, or -1 on error
+ */
+int fy_ypath_exec(struct fy_ypath *ypath, struct fy_node *fyn,
+		  fy_ypath_match_fn cb, void *user);
+
+/**
+ * fy_ypath_exec_parser() - Run a path query over a parser event stream
+ *
+ * Run the query over the root of every document the parser produces,
+ * in a single pass without loading the documents. Only the subtrees
+ * of the matches are loaded (along with nodes selected by steps with
+ * predicates or negative indexes, which need to be seen whole), and
+ * the nodes passed to @cb are only valid during the callback.
+ * When the callback stops the query, the rest of the stream is left
+ * unread.
+ *
+ * @ypath: The compiled query
+ * @fyp: The parser
+ * @cb: The match callback (may be NULL when only counting)
+ * @user: Opaque user pointer passed to the callback
+ *
+ * Returns:
+ * The number of matches, or -1 on error
+ */
+int fy_ypath_exec_parser(struct fy_ypath *ypath, struct fy_parser *fyp,
+			 fy_ypath_match_fn cb, void *user);
+
+/**
+ * fy_document_build_index() - Build a value index of a document
+ *
+ * Build an index from the scalar values found at @key_path (relative
+ * to each collection of the document) to the collections containing
+ * them. For example an index built with "kind" finds all the mappings
+ * with a given kind, and one with "metadata/name" the mappings
+ * by name. The key path is a path query (see fy_ypath_compile()).
+ *
+ * The index tracks the changes made to the document through the
+ * node API and is brought up to date on its next use, by looking
+ * only at the parts of the document that changed; a few changes
+ * (such as setting a new root, sorting or replacing a key) index
+ * the whole document again. It is destroyed along with the document.
+ *
+ * @fyd: The document
+ * @key_path: The key path of the indexed values
+ *
+ * Returns:
+ * The index, or NULL on error
+ */
+struct fy_document_index *fy_document_build_index(struct fy_document *fyd,
+						  const char *key_path);
+
+/**
+ * fy_document_index_destroy() - Destroy a document index
+ *
+ * @fydi: The index to destroy
+ */
+void fy_document_index_destroy(struct fy_document_index *fydi);
+
+/**
+ * fy_document_index_invalidate() - Mark a document index out of date
+ *
+ * Force a rebuild on the next use, for when the document was modified
+ * directly instead of via the node API.
+ *
+ * @fydi: The index
+ */
+void fy_document_index_invalidate(struct fy_document_index *fydi);
+
+/**
+ * fy_document_index_lookup() - Look up a value in a document index
+ *
+ * @fydi: The index
+ * @value: The value to look for
+ * @len: Size of the value, or (size_t)-1 for '\0' terminated.
+ *
+ * Returns:
+ * The first (in the order of fy_document_index_iterate()) node
+ * containing the value, or NULL if none does
+ */
+struct fy_node *fy_document_index_lookup(struct fy_document_index *fydi,
+					 const char *value, size_t len);
+
+/**
+ * fy_document_index_iterate() - Iterate over the nodes containing a value
+ *
+ * This method iterates over all the nodes containing the value,
+ * in document order as of the last time the whole document was
+ * indexed, followed by those indexed by later updates in the order
+ * they were found. The document must not be modified while iterating.
+ *
+ * @fydi: The index
+ * @value: The value to look for
+ * @len: Size of the value, or (size_t)-1 for '\0' terminated.
+ * @prevp: The previous state of the iterator (start with NULL)
+ *
+ * Returns:
+ * The next node in sequence, or NULL at the end of the sequence
+ */
+struct fy_node *fy_document_index_iterate(struct fy_document_index *fydi,
+					  const char *value, size_t len, void **prevp);
+
+/**
+ * fy_document_apply_json_patch() - Apply a JSON patch to a document
+ *
+ * Apply a JSON patch (RFC 6902), i.e. a sequence of add, remove,
+ * replace, move, copy and test operations, to the document.
+ * The keys of big mappings are hashed while the patch is applied,
+ * so many operations on the same mapping don't search it linearly,
+ * and moves relink the nodes instead of copying them.
+ *
+ * Application stops at the first failing operation, leaving the
+ * ones before it applied.
+ *
+ * @fyd: The document to patch
+ * @fyn_patch: The patch (a sequence of operation mappings)
+ *
+ * Returns:
+ * 0 on success, -1 on error
+ */
+int fy_document_apply_json_patch(struct fy_document *fyd, struct fy_node *fyn_patch);
+
+/**
+ * fy_node_apply_merge_patch() - Apply a merge patch to a node
+ *
+ * Apply a JSON merge patch (RFC 7386) to the node. Mappings are
+ * merged in place, members with null values are removed, and anything
+ * else replaces the node (in its parent or as the document root).
+ *
+ * @fyn: The node to patch
+ * @fyn_patch: The merge patch
+ *
+ * Returns:
+ * The patched node (@fyn itself, or the node that replaced it),
+ * or NULL on error
+ */
+struct fy_node *fy_node_apply_merge_patch(struct fy_node *fyn, struct fy_node *fyn_patch);
+
+/**
+ * fy_node_diff_json_patch() - Create the JSON patch between two nodes
+ *
+ * Create the JSON patch that transforms @fyn_from into @fyn_to when
+ * applied to the document of @fyn_from (when it's the root).
+ * Mappings are compared key by key and sequences item by item, so
+ * only the differences end up in the patch.
+ *
+ * @fyn_from: The original node
+ * @fyn_to: The target node
+ *
+ * Returns:
+ * A new document containing the patch, or NULL on error
+ */
+struct fy_document *fy_node_diff_json_patch(struct fy_node *fyn_from, struct fy_node *fyn_to);
+
+/**
+ * fy_node_mapping_create_ordered_index() - Create the key order index of a mapping
+ *
+ * Create (or bring up to date) an index of the scalar keys of the
+ * mapping in key order, independent of the order of the pairs.
+ * Prefix and range queries create the index on demand, so calling
+ * this method is optional; it only moves the cost of building it.
+ * The pairs appended, prepended or removed later are put in or taken
+ * out of the index as it happens; after other modifications of the
+ * document it is built again on use. It is destroyed along with the
+ * mapping.
+ *
+ * Keys are ordered bytewise; pairs with equal keys keep their mapping
+ * order. Pairs with non scalar or alias keys are not indexed.
+ *
+ * @fyn: The mapping node
+ *
+ * Returns:
+ * 0 on success, -1 on error
+ */
+int fy_node_mapping_create_ordered_index(struct fy_node *fyn);
+
+/**
+ * fy_node_mapping_destroy_ordered_index() - Destroy the key order index of a mapping
+ *
+ * @fyn: The mapping node
+ */
+void fy_node_mapping_destroy_ordered_index(struct fy_node *fyn);
+
+/**
+ * fy_node_mapping_lookup_prefix() - Iterate over the pairs with a key prefix
+ *
+ * This method iterates, in key order, over the pairs of the mapping
+ * whose (scalar) key starts with @prefix, using a binary search of the
+ * key order index (see fy_node_mapping_create_ordered_index()).
+ * The iteration ends if the document is modified while iterating.
+ *
+ * @fyn: The mapping node
+ * @prefix: The key prefix
+ * @len: Size of the prefix, or (size_t)-1 for '\0' terminated.
+ * @prevp: The previous state of the iterator (start with NULL)
+ *
+ * Returns:
+ * The next pair in sequence, or NULL at the end of the sequence
+ */
+struct fy_node_pair *fy_node_mapping_lookup_prefix(struct fy_node *fyn,
+						   const char *prefix, size_t len,
+						   void **prevp);
+
+/**
+ * fy_node_mapping_range_iterate() - Iterate over the pairs in a key range
+ *
+ * This method iterates, in key order, over the pairs of the mapping
+ * whose (scalar) key is not less than @first and less than @last,
+ * using the key order index (see fy_node_mapping_create_ordered_index()).
+ * A NULL @first starts from the smallest key, and a NULL @last
+ * continues to the largest.
+ * The iteration ends if the document is modified while iterating.
+ *
+ * @fyn: The mapping node
+ * @first: The first key of the range, or NULL
+ * @first_len: Size of @first, or (size_t)-1 for '\0' terminated.
+ * @last: The key ending the range (not included), or NULL
+ * @last_len: Size of @last, or (size_t)-1 for '\0' terminated.
+ * @prevp: The previous state of the iterator (start with NULL)
+ *
+ * Returns:
+ * The next pair in sequence, or NULL at the end of the sequence
+ */
+struct fy_node_pair *fy_node_mapping_range_iterate(struct fy_node *fyn,
+						   const char *first, size_t first_len,
+						   const char *last, size_t last_len,
+						   void **prevp);
+
+/**
+ * fy_emit_event() - Emit an event using the emitter
+ *
+ * Emits a single event, as produced by fy_parser_parse(), so that
+ * a stream of events can be output without building documents.
+ * The event stream must be well formed; the event remains owned by
+ * the caller. Comments are not available to event output, and the
+ * sort keys configuration flag does not apply.
+ *
+ * A collection start is output along with the next event, since
+ * the style of empty collections differs.
+ *
+ * @emit: The emitter
+ * @fye: The event to emit
+ *
+ * Returns:
+ * 0 on success, -1 on error
+ */
+int fy_emit_event(struct fy_emitter *emit, struct fy_event *fye);
+
+/**
+ * typedef fy_pipeline_stage_fn - Pipeline stage event method
+ *
+ * Called for every event reaching a stage. The stage passes events on
+ * with fy_pipeline_stage_forward() (possibly modified, or other events
+ * built in their place), drops them by not doing so, and adds new ones
+ * with fy_pipeline_stage_inject_scalar() and fy_pipeline_stage_inject().
+ * The event is only valid during the call.
+ *
+ * @stage: The pipeline stage
+ * @fye: The event
+ * @user: The user pointer of the stage
+ *
+ * Returns:
+ * 0 to continue, -1 to stop the pipeline with an error
+ */
+typedef int (*fy_pipeline_stage_fn)(struct fy_pipeline_stage *stage,
+				    struct fy_event *fye, void *user);
+
+/**
+ * fy_pipeline_create() - Create an event pipeline
+ *
+ * Create a pipeline feeding the events of the parser through a chain
+ * of stages to the emitter, in a single streaming pass. The events are
+ * passed by reference from stage to stage, without copying, and only
+ * the structure (nesting) of the stream is tracked, so memory use does
+ * not depend on the size of the documents.
+ *
+ * @fyp: The parser producing the events
+ * @emit: The emitter consuming them (or NULL to discard them)
+ *
+ * Returns:
+ * The pipeline, or NULL on error
+ */
+struct fy_pipeline *fy_pipeline_create(struct fy_parser *fyp, struct fy_emitter *emit);
+
+/**
+ * fy_pipeline_destroy() - Destroy an event pipeline
+ *
+ * Destroy the pipeline along with its stages. The parser and the
+ * emitter are not destroyed.
+ *
+ * @fypl: The pipeline to destroy
+ */
+void fy_pipeline_destroy(struct fy_pipeline *fypl);
+
+/**
+ * fy_pipeline_add_stage() - Append a stage to a pipeline
+ *
+ * @fypl: The pipeline
+ * @fn: The event method of the stage
+ * @user: The stage user pointer (holding its state)
+ *
+ * Returns:
+ * The stage, or NULL on error
+ */
+struct fy_pipeline_stage *
+fy_pipeline_add_stage(struct fy_pipeline *fypl, fy_pipeline_stage_fn fn, void *user);
+
+/**
+ * fy_pipeline_run() - Run a pipeline
+ *
+ * Parse the whole stream, passing every event through the pipeline.
+ *
+ * @fypl: The pipeline
+ *
+ * Returns:
+ * 0 on success, -1 on a parse, stage or emitter error
+ */
+int fy_pipeline_run(struct fy_pipeline *fypl);
+
+/**
+ * fy_pipeline_process() - Pass a single event through a pipeline
+ *
+ * Use this instead of fy_pipeline_run() when driving the parser
+ * directly. The event remains owned by the caller.
+ *
+ * @fypl: The pipeline
+ * @fye: The event
+ *
+ * Returns:
+ * 0 on success, -1 on error
+ */
+int fy_pipeline_process(struct fy_pipeline *fypl, struct fy_event *fye);
+
+/**
+ * fy_pipeline_stage_forward() - Pass an event to the next stage
+ *
+ * @stage: The current stage
+ * @fye: The event
+ *
+ * Returns:
+ * 0 on success, -1 on error
+ */
+int fy_pipeline_stage_forward(struct fy_pipeline_stage *stage, struct fy_event *fye);
+
+/**
+ * fy_pipeline_stage_inject_scalar() - Pass a new scalar to the next stage
+ *
+ * Synthesize a scalar event and pass it to the next stage. The text
+ * is not copied; it must only stay valid during the call.
+ *
+ * @stage: The current stage
+ * @text: The scalar text
+ * @len: Size of the text, or (size_t)-1 for '\0' terminated.
+ * @style: The scalar style, or FYSS_ANY to pick one from the content
+ *
+ * Returns:
+ * 0 on success, -1 on error
+ */
+int fy_pipeline_stage_inject_scalar(struct fy_pipeline_stage *stage, const char *text,
+				    size_t len, enum fy_scalar_style style);
+
+/**
+ * fy_pipeline_stage_inject() - Pass a new collection event to the next stage
+ *
+ * Synthesize a (block style) sequence or mapping start or end event,
+ * without tag or anchor, and pass it to the next stage.
+ *
+ * @stage: The current stage
+ * @type: One of FYET_SEQUENCE_START, FYET_SEQUENCE_END,
+ *        FYET_MAPPING_START or FYET_MAPPING_END
+ *
+ * Returns:
+ * 0 on success, -1 on error
+ */
+int fy_pipeline_stage_inject(struct fy_pipeline_stage *stage, enum fy_event_type type);
+
+/**
+ * fy_pipeline_stage_skip() - Drop the node of the current event
+ *
+ * Called for an event starting a node; the rest of the events of the
+ * node are not passed to the stage. When the node is a mapping key,
+ * the value of the pair is dropped too. The current event itself must
+ * not be forwarded.
+ *
+ * @stage: The current stage
+ */
+void fy_pipeline_stage_skip(struct fy_pipeline_stage *stage);
+
+/**
+ * fy_pipeline_stage_depth() - Get the nesting depth at a stage
+ *
+ * @stage: The current stage
+ *
+ * Returns:
+ * The number of open collections in the input of the stage,
+ * not counting the collection the current event starts or ends
+ */
+int fy_pipeline_stage_depth(struct fy_pipeline_stage *stage);
+
+/**
+ * fy_pipeline_stage_is_key() - Check whether the current event is a key
+ *
+ * @stage: The current stage
+ *
+ * Returns:
+ * true if the current event starts a mapping key in the input of
+ * the stage, false otherwise
+ */
+bool fy_pipeline_stage_is_key(struct fy_pipeline_stage *stage);
+
+/**
+ * fy_schema_compile() - Compile a schema
+ *
+ * Compiles a schema, given as a JSON schema style mapping node, to a
+ * table of states that validates the event stream directly, without
+ * building document nodes. The keywords supported are ``type``,
+ * ``enum``, ``minimum``, ``maximum``, ``exclusiveMinimum``,
+ * ``exclusiveMaximum``, ``minLength``, ``maxLength``, ``pattern``
+ * (a POSIX extended regular expression), ``properties``, ``required``,
+ * ``additionalProperties``, ``items``, ``minItems`` and ``maxItems``;
+ * the rest are ignored. The schema node is not referenced after the
+ * call returns.
+ *
+ * @fyn: The schema node
+ *
+ * Returns:
+ * The compiled schema, or NULL when the schema is invalid
+ */
+struct fy_schema *fy_schema_compile(struct fy_node *fyn);
+
+/**
+ * fy_schema_destroy() - Destroy a compiled schema
+ *
+ * @fysc: The schema to destroy
+ */
+void fy_schema_destroy(struct fy_schema *fysc);
+
+/**
+ * fy_schema_validator_create() - Create a validator for an event stream
+ *
+ * The validator checks the events of every document in the stream
+ * against the schema. Violations are reported through the diagnostics
+ * of the parser, with the marks of the offending token.
+ *
+ * @fysc: The compiled schema
+ * @fyp: The parser to report errors to
+ *
+ * Returns:
+ * The validator, or NULL on error
+ */
+struct fy_schema_validator *
+fy_schema_validator_create(struct fy_schema *fysc, struct fy_parser *fyp);
+
+/**
+ * fy_schema_validator_destroy() - Destroy a validator
+ *
+ * @fysv: The validator to destroy
+ */
+void fy_schema_validator_destroy(struct fy_schema_validator *fysv);
+
+/**
+ * fy_schema_validator_process() - Validate an event
+ *
+ * Scalars are typed according to their tag, or the YAML 1.2 core
+ * schema when plain; integers are numbers too. Aliases and complex
+ * keys are not checked. Once an event is invalid, every following
+ * call fails.
+ *
+ * @fysv: The validator
+ * @fye: The event
+ *
+ * Returns:
+ * 0 while the stream is valid, -1 otherwise
+ */
+int fy_schema_validator_process(struct fy_schema_validator *fysv, struct fy_event *fye);
+
+/**
+ * fy_schema_validate_parser() - Validate the stream of a parser
+ *
+ * Parses the events of the parser and validates them, stopping at the
+ * first invalid one.
+ *
+ * @fysc: The compiled schema
+ * @fyp: The parser
+ *
+ * Returns:
+ * 0 when the stream is valid, -1 on a validation or parse error
+ */
+int fy_schema_validate_parser(struct fy_schema *fysc, struct fy_parser *fyp);
+
+/**
+ * struct fy_executor_cfg - executor configuration structure.
+ *
+ * Argument to the fy_executor_create() method. An executor runs the
+ * internal parallel work of the library; either on its own work
+ * stealing pool of threads, or on an external one when @submit
+ * is set.
+ *
+ * @num_threads: Number of worker threads, 0 for one per online CPU.
+ *               With an external executor, the number of tasks it
+ *               can run at once (a hint for partitioning work)
+ * @submit: Optional method that hands a task to an external executor,
+ *          which must call @fn(@arg) exactly once, on any thread;
+ *          returns 0 on success, -1 when the task was not accepted
+ * @pool: Opaque pointer passed to @submit
+ */
+struct fy_executor_cfg {
+	unsigned int num_threads;
+	int (*submit)(void *pool, void (*fn)(void *arg), void *arg);
+	void *pool;
+};
+
+/**
+ * fy_executor_create() - Create an executor
+ *
+ * Creates an executor using the supplied configuration.
+ * The executor must outlive the parsers using it.
+ *
+ * @cfg: The executor configuration, or NULL for the defaults
+ *
+ * Returns:
+ * The newly created executor or NULL on error.
+ */
+struct fy_executor *fy_executor_create(const struct fy_executor_cfg *cfg);
+
+/**
+ * fy_executor_destroy() - Destroy an executor
+ *
+ * The tasks already submitted are run before it is destroyed.
+ *
+ * @fyx: The executor to destroy
+ */
+void fy_executor_destroy(struct fy_executor *fyx);
+
+/**
+ * fy_executor_get_cfg() - Get the configuration of an executor
+ *
+ * @fyx: The executor
+ *
+ * Returns:
+ * The configuration of the executor
+ */
+const struct fy_executor_cfg *fy_executor_get_cfg(struct fy_executor *fyx);
+
+/**
+ * fy_executor_num_threads() - Get the number of threads of an executor
+ *
+ * @fyx: The executor
+ *
+ * Returns:
+ * The number of tasks the executor can run at once
+ */
+unsigned int fy_executor_num_threads(struct fy_executor *fyx);
+
+/**
+ * fy_executor_submit() - Submit a task to an executor
+ *
+ * The task is run at some point later on one of the threads of the
+ * executor. It may block, but while it does it keeps a thread busy.
+ *
+ * @fyx: The executor
+ * @fn: The task method
+ * @arg: The argument of the task method
+ *
+ * Returns:
+ * 0 on success, -1 on error
+ */
+int fy_executor_submit(struct fy_executor *fyx, void (*fn)(void *arg), void *arg);
+
+/**
+ * fy_executor_run() - Run tasks in parallel and wait for them
+ *
+ * Calls @fn once for each of the @count arguments, in parallel, and
+ * returns when all of them are done. The calling thread takes part,
+ * so it's safe to call from within a task of the same executor.
+ * On an external executor the caller also runs the tasks that have
+ * not been started by the time it's done with its own, so nested runs
+ * finish even when none of the external threads are free.
+ *
+ * @fyx: The executor
+ * @fn: The task method
+ * @args: The arguments, one per task
+ * @count: The number of tasks
+ *
+ * Returns:
+ * 0 on success, -1 on error
+ */
+int fy_executor_run(struct fy_executor *fyx, void (*fn)(void *arg),
+		    void * const *args, unsigned int count);
+
 #endif
@@ -18,6 +18,8 @@
 #include <unistd.h>
 #include <limits.h>
 #include <ctype.h>
+#include <time.h>
+#include <sys/resource.h>
 
 #include <libfyaml.h>
 
@@ -67,7 +69,7 @@ static struct option lopts[] = {
 #define LIBYAML_MODES	""
 #endif
 
-#define MODES	"parse|scan|copy|testsuite|dump|build" LIBYAML_MODES
+#define MODES	"parse|scan|copy|testsuite|dump|build|bench|bench-mem" LIBYAML_MODES
 
 static void display_usage(FILE *fp, char *progname)
 {
@@ -336,6 +338,82 @@ int do_parse(struct fy_parser *fyp)
 	return fyp->stream_error ? -1 : 0;
 }
 
+int do_bench(struct fy_parser *fyp)
+{
+	struct fy_eventp *fyep;
+	struct fy_event *fye;
+	struct timespec before, after;
+	unsigned long long events = 0, text = 0;
+	size_t len;
+	double secs;
+
+	clock_gettime(CLOCK_MONOTONIC, &before);
+
+	while ((fyep = fy_parse_private(fyp)) != NULL) {
+		fye = &fyep->e;
+		events++;
+		/* scalars are formatted, like every real consumer would */
+		if (fye->type == FYET_SCALAR && fye->scalar.value) {
+			fy_token_get_text(fye->scalar.value, &len);
+			text += len;
+		}
+		fy_parse_eventp_recycle(fyp, fyep);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &after);
+
+	secs = (double)(after.tv_sec - before.tv_sec) +
+	       (double)(after.tv_nsec - before.tv_nsec) / 1e9;
+
+	fprintf(stderr, "events=%llu scalar-text=%llu time=%.3fs rate=%.1fMB/s\n",
+			events, text, secs,
+			secs > 0 ? (double)fyp->current_pos / (secs * 1024 * 1024) : 0.0);
+
+	return fyp->stream_error ? -1 : 0;
+}
+
+/* loads the documents, reporting what their nodes and pairs take */
+int do_bench_mem(struct fy_parser *fyp)
+{
+	struct fy_document *fyd;
+	struct timespec before, after;
+	struct rusage ru;
+	size_t nodes = 0, pairs = 0, reserved = 0, peak_nodes = 0, peak_pairs = 0;
+	size_t node_reserved = 0, pair_reserved = 0;
+	double secs;
+
+	clock_gettime(CLOCK_MONOTONIC, &before);
+
+	while ((fyd = fy_parse_load_document(fyp)) != NULL) {
+		nodes += fyd->node_pool.used;
+		pairs += fyd->pair_pool.used;
+		reserved += fyd->node_pool.reserved + fyd->pair_pool.reserved;
+		/* the largest document is what the peak is made of */
+		if (fyd->node_pool.used > peak_nodes) {
+			peak_nodes = fyd->node_pool.used;
+			peak_pairs = fyd->pair_pool.used;
+			node_reserved = fyd->node_pool.reserved;
+			pair_reserved = fyd->pair_pool.reserved;
+		}
+		fy_parse_document_destroy(fyp, fyd);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &after);
+	getrusage(RUSAGE_SELF, &ru);
+
+	secs = (double)(after.tv_sec - before.tv_sec) +
+	       (double)(after.tv_nsec - before.tv_nsec) / 1e9;
+
+	fprintf(stderr, "nodes=%zu (%zu bytes each) pairs=%zu (%zu bytes each) pools=%zu bytes\n",
+			nodes, sizeof(struct fy_node), pairs, sizeof(struct fy_node_pair),
+			reserved);
+	fprintf(stderr, "largest: nodes=%zu pairs=%zu pools=%zu bytes\n",
+			peak_nodes, peak_pairs, node_reserved + pair_reserved);
+	fprintf(stderr, "time=%.3fs maxrss=%ldkB\n", secs, ru.ru_maxrss);
+
+	return fyp->stream_error ? -1 : 0;
+}
+
 void dump_testsuite_event(struct fy_parser *fyp, struct fy_event *fye)
 {
 	const char *anchor = NULL, *tag = NULL, *value = NULL;
@@ -2001,7 +2079,9 @@ int main(int argc, char *argv[])
 	    strcmp(mode, "copy") &&
 	    strcmp(mode, "testsuite") &&
 	    strcmp(mode, "dump") &&
-	    strcmp(mode, "build")
+	    strcmp(mode, "build") &&
+	    strcmp(mode, "bench") &&
+	    strcmp(mode, "bench-mem")
 #if defined(HAVE_LIBYAML) && HAVE_LIBYAML
 	    && strcmp(mode, "libyaml-scan")
 	    && strcmp(mode, "libyaml-parse")
@@ -2161,6 +2241,18 @@ int main(int argc, char *argv[])
 			/* fprintf(stderr, "do_testsuite() error %d\n", rc); */
 			goto cleanup;
 		}
+	} else if (!strcmp(mode, "bench")) {
+		rc = do_bench(fyp);
+		if (rc < 0) {
+			fprintf(stderr, "do_bench() error %d\n", rc);
+			goto cleanup;
+		}
+	} else if (!strcmp(mode, "bench-mem")) {
+		rc = do_bench_mem(fyp);
+		if (rc < 0) {
+			fprintf(stderr, "do_bench_mem() error %d\n", rc);
+			goto cleanup;
+		}
 	} else if (!strcmp(mode, "dump")) {
 		rc = do_dump(fyp, indent, width, resolve, sort);
 		if (rc < 0) {
@@ -523,6 +523,17 @@ static int fy_atom_format_internal(const struct fy_atom *atom,
 		/* is the next run indented in? */
 		next_is_indented = is_block && nnlbnws > nnlb && (nnlbnws - nnlb) > chomp;
 
+		/* literal fast path; an indented line with a single break
+		 * is output verbatim (less the indentation) in one go */
+		if (style == FYAS_LITERAL && chomp && !is_empty_line && !is_last &&
+		    has_break && !has_trailing_breaks && leading_line_ws >= chomp) {
+			O_CPY(s + chomp, lbe - s - chomp);
+			last_need_sep = need_sep;
+			is_first = false;
+			s = nnlb;
+			continue;
+		}
+
 		fy_atom_out_debug(atom, out, "s->lb: '%s'\n",
 			fy_utf8_format_text_a(s, lb - s, fyue_singlequote));
 		fy_atom_out_debug(atom, out, "s->fnws: '%s'\n",
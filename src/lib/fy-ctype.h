@@ -126,7 +126,7 @@ static inline bool fy_is_print(int c)
 	       (c >= 0xe000 && c <= 0xfffd && c != FY_UTF8_BOM);
 }
 
-#define FY_CTYPE_AT_BUILDER(_kind) \
+#define FY_CTYPE_FIND_BUILDER(_kind) \
 static inline const void * \
 fy_find_ ## _kind (const void *s, size_t len) \
 { \
@@ -139,6 +139,9 @@ fy_find_ ## _kind (const void *s, size_t len) \
 	} \
 	return NULL; \
 } \
+struct useless_struct_for_semicolon
+
+#define FY_CTYPE_FIND_NON_BUILDER(_kind) \
 static inline const void * \
 fy_find_non_ ## _kind (const void *s, size_t len) \
 { \
@@ -154,6 +157,10 @@ fy_find_non_ ## _kind (const void *s, size_t len) \
 } \
 struct useless_struct_for_semicolon
 
+#define FY_CTYPE_AT_BUILDER(_kind) \
+FY_CTYPE_FIND_BUILDER(_kind); \
+FY_CTYPE_FIND_NON_BUILDER(_kind)
+
 FY_CTYPE_AT_BUILDER(first_alpha);
 FY_CTYPE_AT_BUILDER(alpha);
 FY_CTYPE_AT_BUILDER(num);
@@ -164,7 +171,7 @@ FY_CTYPE_AT_BUILDER(tab);
 FY_CTYPE_AT_BUILDER(ws);
 FY_CTYPE_AT_BUILDER(hex);
 FY_CTYPE_AT_BUILDER(uri);
-FY_CTYPE_AT_BUILDER(lb);
+FY_CTYPE_FIND_NON_BUILDER(lb);
 FY_CTYPE_AT_BUILDER(z);
 FY_CTYPE_AT_BUILDER(break);
 FY_CTYPE_AT_BUILDER(breakz);
@@ -174,6 +181,118 @@ FY_CTYPE_AT_BUILDER(blankz);
 FY_CTYPE_AT_BUILDER(ws_lb);
 FY_CTYPE_AT_BUILDER(print);
 
+/*
+ * Word at a time helpers, working on 8 octets in one go.
+ * The has_* methods flag (at least) the first matching octet of
+ * a word; false positives are only possible on octets following a
+ * real match, so callers need only locate the first flagged octet.
+ */
+#define FY_WORD_ONES	0x0101010101010101ULL
+#define FY_WORD_HIGHS	0x8080808080808080ULL
+
+static inline uint64_t fy_word_load(const void *ptr)
+{
+	uint64_t v;
+
+	memcpy(&v, ptr, sizeof(v));
+	return v;
+}
+
+/* any octet less than n (n <= 0x80) */
+static inline uint64_t fy_word_has_less(uint64_t v, uint8_t n)
+{
+	return (v - FY_WORD_ONES * n) & ~v & FY_WORD_HIGHS;
+}
+
+/* any octet equal to b */
+static inline uint64_t fy_word_has_byte(uint64_t v, uint8_t b)
+{
+	return fy_word_has_less(v ^ (FY_WORD_ONES * b), 1);
+}
+
+/* any octet with the high bit set (i.e. non ascii) */
+static inline uint64_t fy_word_has_high(uint64_t v)
+{
+	return v & FY_WORD_HIGHS;
+}
+
+/* length of the run of printable ascii (0x20-0x7e) at ptr */
+static inline size_t fy_ascii_print_run(const void *ptr, size_t len)
+{
+	const uint8_t *s = ptr, *e = s + len;
+	uint64_t v;
+
+	while ((size_t)(e - s) >= sizeof(v)) {
+		v = fy_word_load(s);
+		if (fy_word_has_less(v, 0x20) | fy_word_has_byte(v, 0x7f) |
+		    fy_word_has_high(v))
+			break;
+		s += sizeof(v);
+	}
+	while (s < e && *s >= 0x20 && *s < 0x7f)
+		s++;
+
+	return s - (const uint8_t *)ptr;
+}
+
+/* length of the run of printable ascii at ptr, stopping at c1 or c2 */
+static inline size_t fy_ascii_print_run_until(const void *ptr, size_t len,
+					      uint8_t c1, uint8_t c2)
+{
+	const uint8_t *s = ptr, *e = s + len;
+	uint64_t v;
+
+	while ((size_t)(e - s) >= sizeof(v)) {
+		v = fy_word_load(s);
+		if (fy_word_has_less(v, 0x20) | fy_word_has_byte(v, 0x7f) |
+		    fy_word_has_high(v) |
+		    fy_word_has_byte(v, c1) | fy_word_has_byte(v, c2))
+			break;
+		s += sizeof(v);
+	}
+	while (s < e && *s >= 0x20 && *s < 0x7f && *s != c1 && *s != c2)
+		s++;
+
+	return s - (const uint8_t *)ptr;
+}
+
+/* find a linebreak; ascii octets other than \r and \n are skipped
+ * a word at a time, everything else is utf8 decoded and checked
+ */
+static inline const void *fy_find_lb(const void *ptr, size_t len)
+{
+	const uint8_t *s = ptr, *e = s + len;
+	uint64_t v;
+	int c, w;
+
+	while (s < e) {
+		while ((size_t)(e - s) >= sizeof(v)) {
+			v = fy_word_load(s);
+			if (fy_word_has_byte(v, '\n') | fy_word_has_byte(v, '\r') |
+			    fy_word_has_high(v))
+				break;
+			s += sizeof(v);
+		}
+		if (s >= e)
+			break;
+
+		if (*s < 0x80) {
+			if (*s == '\n' || *s == '\r')
+				return s;
+			s++;
+			continue;
+		}
+
+		c = fy_utf8_get(s, e - s, &w);
+		if (c < 0)
+			break;
+		if (fy_is_lb(c))
+			return s;
+		s += w;
+	}
+	return NULL;
+}
+
 /*
  * Very special linebreak/ws methods
  * Things get interesting due to \r\n and
@@ -57,6 +57,54 @@ static const char *fy_error_module_str(enum fy_error_module module)
 	return txt[module];
 }
 
+void fy_diag_vreport_send(struct fy_parser *fyp,
+			  enum fy_error_type type, enum fy_error_module module,
+			  const struct fy_mark *start_mark,
+			  const struct fy_mark *end_mark,
+			  struct fy_input *fyi,
+			  const char *fmt, va_list ap)
+{
+	struct fy_diag_report_ctx ctx;
+	struct fy_diag_report *rpt = &ctx.report;
+
+	memset(rpt, 0, sizeof(*rpt));
+	rpt->type = type;
+	rpt->module = module;
+	rpt->code = fmt;
+	if (start_mark)
+		rpt->start_mark = *start_mark;
+	if (end_mark)
+		rpt->end_mark = *end_mark;
+	if (fyi) {
+		rpt->name = fy_input_get_name(fyi);
+		rpt->input_size = fy_input_size(fyi);
+		rpt->input = rpt->input_size ? fy_input_start(fyi) : NULL;
+	}
+
+	va_copy(ctx.ap, ap);
+	fyp->cfg.diag(fyp, rpt, fyp->cfg.userdata);
+	va_end(ctx.ap);
+}
+
+int fy_diag_report_format_message(const struct fy_diag_report *report,
+				  char *buf, size_t size)
+{
+	struct fy_diag_report_ctx *ctx;
+	va_list ap;
+	int rc;
+
+	if (!report || !report->code)
+		return -1;
+
+	ctx = container_of(report, struct fy_diag_report_ctx, report);
+
+	va_copy(ap, ctx->ap);
+	rc = vsnprintf(buf, size, report->code, ap);
+	va_end(ap);
+
+	return rc;
+}
+
 int fy_vdiag(struct fy_parser *fyp, unsigned int flags,
 	     const char *file, int line, const char *func,
 	     const char *fmt, va_list ap)
@@ -83,6 +131,16 @@ int fy_vdiag(struct fy_parser *fyp, unsigned int flags,
 	if (!(pflags & (1U << (module + FYPCF_MODULE_SHIFT))))
 		return 0;
 
+	/* structured diagnostics, no formatting */
+	if (fyp && fyp->cfg.diag) {
+		struct fy_mark mark;
+
+		fy_get_mark(fyp, &mark);
+		fy_diag_vreport_send(fyp, type, module, &mark, &mark,
+				     fyp->current_input, fmt, ap);
+		return 0;
+	}
+
 	va_copy(ap_orig, ap);
 	size = vsnprintf(NULL, 0, fmt, ap_orig);
 	if (size == -1) {
@@ -54,6 +54,21 @@ struct fy_input_cfg;
 #define FYDF_INTERNAL		FYDF_MODULE(FYEM_INTERNAL)
 #define FYDF_SYSTEM		FYDF_MODULE(FYEM_SYSTEM)
 
+struct fy_input;
+
+/* a report with the deferred message format arguments */
+struct fy_diag_report_ctx {
+	struct fy_diag_report report;
+	va_list ap;
+};
+
+void fy_diag_vreport_send(struct fy_parser *fyp,
+			  enum fy_error_type type, enum fy_error_module module,
+			  const struct fy_mark *start_mark,
+			  const struct fy_mark *end_mark,
+			  struct fy_input *fyi,
+			  const char *fmt, va_list ap);
+
 int fy_vdiag(struct fy_parser *fyp, unsigned int flags,
 	     const char *file, int line, const char *func,
 	     const char *fmt, va_list ap);
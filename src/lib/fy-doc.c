@@ -15,6 +15,7 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include <errno.h>
+#include <limits.h>
 
 #include <libfyaml.h>
 
@@ -22,6 +23,8 @@
 #include "fy-doc.h"
 
 #include "fy-utils.h"
+#include "fy-index.h"
+#include "fy-spill.h"
 
 struct fy_document_state *fy_document_state_alloc(void)
 {
@@ -34,8 +37,10 @@ struct fy_document_state *fy_document_state_alloc(void)
 
 	fyds->fyt_vd = NULL;
 	fy_token_list_init(&fyds->fyt_td);
+	fy_interned_tag_list_init(&fyds->tags);
+	fyds->next_tag_id = 0;
 
-	fyds->refs = 1;
+	atomic_init(&fyds->refs, 1);
 
 	/* fy_notice(NULL, "%s: %p #%d", __func__, fyds, fyds->refs); */
 
@@ -44,16 +49,23 @@ struct fy_document_state *fy_document_state_alloc(void)
 
 void fy_document_state_free(struct fy_document_state *fyds)
 {
+	struct fy_interned_tag *fytag;
+
 	if (!fyds)
 		return;
 
-	assert(fyds->refs == 1);
+	/* the last reference was dropped by fy_document_state_unref() */
+	assert(!fyds->refs);
 
 	/* fy_notice(NULL, "%s: %p #%d", __func__, fyds, fyds->refs); */
 
 	fy_token_unref(fyds->fyt_vd);
 	fy_token_list_unref_all(&fyds->fyt_td);
 
+	while ((fytag = fy_interned_tag_list_pop(&fyds->tags)) != NULL)
+		fy_interned_tag_unref(fytag);
+	free(fyds->tag_buckets);
+
 	free(fyds);
 }
 
@@ -65,7 +77,7 @@ struct fy_document_state *fy_document_state_ref(struct fy_document_state *fyds)
 
 	assert(fyds->refs + 1 > 0);
 
-	fyds->refs++;
+	atomic_fetch_add(&fyds->refs, 1);
 
 	/* fy_notice(NULL, "%s: %p #%d", __func__, fyds, fyds->refs); */
 
@@ -81,10 +93,8 @@ void fy_document_state_unref(struct fy_document_state *fyds)
 
 	/* fy_notice(NULL, "%s: %p #%d", __func__, fyds, fyds->refs); */
 
-	if (fyds->refs == 1)
+	if (atomic_fetch_sub(&fyds->refs, 1) == 1)
 		fy_document_state_free(fyds);
-	else
-		fyds->refs--;
 }
 
 struct fy_document_state *fy_parse_document_state_alloc(struct fy_parser *fyp)
@@ -106,9 +116,6 @@ void fy_parse_document_state_recycle(struct fy_parser *fyp, struct fy_document_s
 	fy_document_state_unref(fyds);
 }
 
-static void fy_resolve_parent_node(struct fy_document *fyd, struct fy_node *fyn, struct fy_node *fyn_parent);
-int fy_document_state_merge(struct fy_document *fyd, struct fy_document *fydc);
-
 void fy_anchor_destroy(struct fy_anchor *fya)
 {
 	if (!fya)
@@ -214,6 +221,16 @@ struct fy_anchor *fy_node_get_anchor(struct fy_node *fyn)
 	return fy_document_lookup_anchor_by_node(fyn->fyd, fyn);
 }
 
+static void fy_token_dedup_destroy(struct fy_token_dedup *fytd)
+{
+	if (!fytd)
+		return;
+
+	free(fytd->buckets);
+	free(fytd->entries);
+	free(fytd);
+}
+
 void fy_parse_document_destroy(struct fy_parser *fyp, struct fy_document *fyd)
 {
 	struct fy_anchor *fya;
@@ -221,6 +238,10 @@ void fy_parse_document_destroy(struct fy_parser *fyp, struct fy_document *fyd)
 	if (!fyp || !fyd)
 		return;
 
+	fy_document_destroy_indexes(fyd);
+
+	fy_token_dedup_destroy(fyd->dedup);
+
 	if (fyd->errfp)
 		fclose(fyd->errfp);
 
@@ -237,10 +258,27 @@ void fy_parse_document_destroy(struct fy_parser *fyp, struct fy_document *fyd)
 
 	/* and release all the remaining tracked memory */
 	fy_tfree_all(&fyd->tallocs);
+	fy_spill_unref(fyd->spill);
 
 	fy_parse_free(fyp, fyd);
 }
 
+/* the nodes and pairs go to a spill file of the document's own */
+static int fy_document_setup_spill(struct fy_document *fyd)
+{
+	if (!(fyd->fyp->cfg.flags & FYPCF_SPILL))
+		return 0;
+
+	fyd->spill = fy_spill_create(fyd->fyp->cfg.spill_dir);
+	if (!fyd->spill)
+		return -1;
+
+	fyd->node_pool.spill = fyd->spill;
+	fyd->pair_pool.spill = fyd->spill;
+
+	return 0;
+}
+
 struct fy_token *fy_document_state_lookup_tag_directive(struct fy_document_state *fyds,
 		const char *handle, size_t handle_size)
 {
@@ -264,12 +302,99 @@ struct fy_token *fy_document_state_lookup_tag_directive(struct fy_document_state
 	return NULL;
 }
 
+static int fy_document_state_grow_tags(struct fy_document_state *fyds)
+{
+	struct fy_interned_tag **buckets, *fytag;
+	unsigned int bucket_count, mask;
+
+	bucket_count = fyds->tag_bucket_count ? fyds->tag_bucket_count * 2 : 16;
+	buckets = calloc(bucket_count, sizeof(*buckets));
+	if (!buckets)
+		return -1;
+
+	mask = bucket_count - 1;
+	for (fytag = fy_interned_tag_list_head(&fyds->tags); fytag;
+			fytag = fy_interned_tag_next(&fyds->tags, fytag)) {
+		fytag->hash_next = buckets[fytag->hash & mask];
+		buckets[fytag->hash & mask] = fytag;
+	}
+
+	free(fyds->tag_buckets);
+	fyds->tag_buckets = buckets;
+	fyds->tag_bucket_count = bucket_count;
+
+	return 0;
+}
+
+struct fy_interned_tag *fy_document_state_intern_tag(struct fy_document_state *fyds,
+		struct fy_token *fyt)
+{
+	struct fy_interned_tag *fytag = NULL;
+	char buf[256], *text;
+	uint32_t hash;
+	int len;
+
+	if (!fyds || !fyt || fyt->type != FYTT_TAG)
+		return NULL;
+
+	/* already resolved */
+	if (fyt->tag.interned)
+		return fyt->tag.interned;
+
+	len = fy_tag_token_format_text_length(fyt);
+	if (len < 0)
+		return NULL;
+
+	/* tags are short, but their length is up to the input */
+	text = (size_t)len < sizeof(buf) ? buf : malloc(len + 1);
+	if (!text)
+		return NULL;
+	fy_tag_token_format_text(fyt, text, len + 1);
+
+	hash = fy_hash_bytes(FY_HASH_INIT, text, len);
+
+	if (fyds->tag_bucket_count) {
+		for (fytag = fyds->tag_buckets[hash & (fyds->tag_bucket_count - 1)]; fytag;
+				fytag = fytag->hash_next) {
+			if (fytag->hash == hash && fytag->len == (size_t)len &&
+			    !memcmp(fytag->text, text, len))
+				break;
+		}
+	}
+
+	if (!fytag) {
+		/* keep the load factor at most one */
+		if ((unsigned int)fyds->next_tag_id >= fyds->tag_bucket_count &&
+		    fy_document_state_grow_tags(fyds))
+			goto out;
+
+		fytag = fy_interned_tag_create(text, len, fyds->next_tag_id);
+		if (!fytag)
+			goto out;
+		fyds->next_tag_id++;
+
+		fytag->hash = hash;
+		fytag->hash_next = fyds->tag_buckets[hash & (fyds->tag_bucket_count - 1)];
+		fyds->tag_buckets[hash & (fyds->tag_bucket_count - 1)] = fytag;
+		fy_interned_tag_list_add_tail(&fyds->tags, fytag);
+	}
+
+	fyt->tag.interned = fy_interned_tag_ref(fytag);
+
+out:
+	if (text != buf)
+		free(text);
+
+	return fytag;
+}
+
 struct fy_document *fy_parse_document_create(struct fy_parser *fyp, struct fy_eventp *fyep)
 {
 	struct fy_document *fyd = NULL;
 	struct fy_document_state *fyds;
 	struct fy_event *fye = NULL;
 	struct fy_error_ctx ec;
+	int rc;
 
 	if (!fyp || !fyep)
 		return NULL;
@@ -287,6 +412,8 @@ struct fy_document *fy_parse_document_create(struct fy_parser *fyp, struct fy_ev
 
 	fyd->fyp = fyp;
 	fy_talloc_list_init(&fyd->tallocs);
+	fy_tpool_init_indexed(&fyd->node_pool, &fyd->tallocs, sizeof(struct fy_node));
+	fy_tpool_init_indexed(&fyd->pair_pool, &fyd->tallocs, sizeof(struct fy_node_pair));
 
 	fy_anchor_list_init(&fyd->anchors);
 	fyd->root = NULL;
@@ -308,6 +435,12 @@ struct fy_document *fy_parse_document_create(struct fy_parser *fyp, struct fy_ev
 	fyd->errsz = 0;
 
 	fy_document_list_init(&fyd->children);
+	fy_document_index_list_init(&fyd->indexes);
+	fy_ordered_index_list_init(&fyd->ordered_indexes);
+
+	rc = fy_document_setup_spill(fyd);
+	fy_error_check(fyp, !rc, err_out_doc,
+			"fy_document_setup_spill() failed");
 
 	return fyd;
 
@@ -316,22 +449,22 @@ err_out:
 	fy_parse_eventp_recycle(fyp, fyep);
 	return NULL;
 
+err_out_doc:
+	fy_parse_document_destroy(fyp, fyd);
+	return NULL;
+
 err_stream_start:
 	fy_error_report(fyp, &ec, "invalid start of event stream");
 	goto err_out;
 }
 
-struct fy_anchor *fy_document_lookup_anchor(struct fy_document *fyd, const char *anchor)
+static struct fy_anchor *
+fy_document_lookup_anchor_len(struct fy_document *fyd, const char *anchor, size_t len)
 {
 	struct fy_anchor *fya;
 	struct fy_anchor_list *fyal;
 	const char *text;
-	size_t len, text_len;
-
-	if (!fyd || !anchor)
-		return NULL;
-
-	len = strlen(anchor);
+	size_t text_len;
 
 	fyal = &fyd->anchors;
 	for (fya = fy_anchor_list_head(fyal); fya; fya = fy_anchor_next(fyal, fya)) {
@@ -346,11 +479,18 @@ struct fy_anchor *fy_document_lookup_anchor(struct fy_document *fyd, const char
 	return NULL;
 }
 
+struct fy_anchor *fy_document_lookup_anchor(struct fy_document *fyd, const char *anchor)
+{
+	if (!fyd || !anchor)
+		return NULL;
+
+	return fy_document_lookup_anchor_len(fyd, anchor, strlen(anchor));
+}
+
 struct fy_anchor *fy_document_lookup_anchor_by_token(struct fy_document *fyd, struct fy_token *anchor)
 {
 	const char *text;
 	size_t len;
-	char *text0;
 
 	if (!fyd || !anchor)
 		return NULL;
@@ -358,11 +498,8 @@ struct fy_anchor *fy_document_lookup_anchor_by_token(struct fy_document *fyd, st
 	text = fy_token_get_text(anchor, &len);
 	if (!text)
 		return NULL;
-	text0 = alloca(len + 1);
-	memcpy(text0, text, len);
-	text0[len] = '\0';
 
-	return fy_document_lookup_anchor(fyd, text0);
+	return fy_document_lookup_anchor_len(fyd, text, len);
 }
 
 struct fy_anchor *fy_document_lookup_anchor_by_node(struct fy_document *fyd, struct fy_node *fyn)
@@ -401,10 +538,11 @@ void fy_node_pair_free(struct fy_node_pair *fynp)
 	if (!fynp)
 		return;
 
+	fy_node_pair_removed(fynp);
 	fy_node_free(fynp->key);
 	fy_node_free(fynp->value);
 
-	free(fynp);
+	fy_tpool_free(&fynp->fyd->pair_pool, fynp);
 }
 
 struct fy_node_pair *fy_node_pair_alloc(struct fy_document *fyd)
@@ -412,10 +550,14 @@ struct fy_node_pair *fy_node_pair_alloc(struct fy_document *fyd)
 	struct fy_parser *fyp = fyd->fyp;
 	struct fy_node_pair *fynp = NULL;
 
-	fynp = malloc(sizeof(*fynp));
+	fynp = fy_tpool_alloc(&fyd->pair_pool);
 	fy_error_check(fyp, fynp, err_out,
-			"malloc() failed");
+			"fy_tpool_alloc() failed");
 
+	/* the id stays, it's where the pair is in the pool */
+	fynp->prev = 0;
+	fynp->next = 0;
+	fynp->parent = 0;
 	fynp->key = NULL;
 	fynp->value = NULL;
 	fynp->fyd = fyd;
@@ -462,6 +604,8 @@ void fy_node_free(struct fy_node *fyn)
 		fy_token_unref(fyn->sequence_end);
 		break;
 	case FYNT_MAPPING:
+		if (!fy_ordered_index_list_empty(&fyd->ordered_indexes))
+			fy_node_mapping_destroy_ordered_index(fyn);
 		while ((fynp = fy_node_pair_list_pop(&fyn->mapping)) != NULL)
 			fy_node_pair_free(fynp);
 		fy_token_unref(fyn->mapping_start);
@@ -469,7 +613,7 @@ void fy_node_free(struct fy_node *fyn)
 		break;
 	}
 
-	free(fyn);
+	fy_tpool_free(&fyd->node_pool, fyn);
 }
 
 struct fy_node *fy_node_alloc(struct fy_document *fyd, enum fy_node_type type)
@@ -477,10 +621,11 @@ struct fy_node *fy_node_alloc(struct fy_document *fyd, enum fy_node_type type)
 	struct fy_parser *fyp = fyd->fyp;
 	struct fy_node *fyn = NULL;
 
-	fyn = malloc(sizeof(*fyn));
+	fyn = fy_tpool_alloc(&fyd->node_pool);
 	fy_error_check(fyp, fyn, err_out,
-			"malloc() failed");
-	memset(fyn, 0, sizeof(*fyn));
+			"fy_tpool_alloc() failed");
+	/* the id stays, it's where the node is in the pool */
+	memset((char *)fyn + sizeof(fyn->id), 0, sizeof(*fyn) - sizeof(fyn->id));
 	fyn->type = type;
 	fyn->style = FYNS_ANY;
 	fyn->fyd = fyd;
@@ -513,7 +658,8 @@ const struct fy_mark *fy_node_get_start_mark(struct fy_node *fyn)
 
 	switch (fyn->type) {
 	case FYNT_SCALAR:
-		fym = fy_token_start_mark(fyn->scalar);
+		fym = fyn->scalar_marks ? &fyn->scalar_marks[0] :
+					  fy_token_start_mark(fyn->scalar);
 		break;
 
 	case FYNT_SEQUENCE:
@@ -550,7 +696,8 @@ const struct fy_mark *fy_node_get_end_mark(struct fy_node *fyn)
 
 	switch (fyn->type) {
 	case FYNT_SCALAR:
-		fym = fy_token_end_mark(fyn->scalar);
+		fym = fyn->scalar_marks ? &fyn->scalar_marks[1] :
+					  fy_token_end_mark(fyn->scalar);
 		break;
 
 	case FYNT_SEQUENCE:
@@ -757,6 +904,45 @@ bool fy_node_compare_string(struct fy_node *fyn, const char *str)
 	return ret;
 }
 
+uint32_t fy_node_hash(struct fy_node *fyn)
+{
+	struct fy_node *fyni;
+	struct fy_node_pair *fynp;
+	const char *text;
+	size_t len;
+	uint32_t hash, khash, vhash;
+
+	/* null and empty scalars compare equal, so they hash equal */
+	if (!fyn)
+		return FY_HASH_INIT;
+
+	switch (fyn->type) {
+	case FYNT_SCALAR:
+		text = fy_token_get_text(fyn->scalar, &len);
+		return fy_hash_bytes(FY_HASH_INIT, text, text ? len : 0);
+
+	case FYNT_SEQUENCE:
+		hash = fy_hash_bytes(FY_HASH_INIT, "[", 1);
+		for (fyni = fy_node_list_head(&fyn->sequence); fyni;
+				fyni = fy_node_next(&fyn->sequence, fyni))
+			hash = hash * 31 + fy_node_hash(fyni);
+		return hash;
+
+	case FYNT_MAPPING:
+		/* order independent, mappings compare equal regardless of order */
+		hash = fy_hash_bytes(FY_HASH_INIT, "{", 1);
+		for (fynp = fy_node_pair_list_head(&fyn->mapping); fynp;
+				fynp = fy_node_pair_next(&fyn->mapping, fynp)) {
+			khash = fy_node_hash(fynp->key);
+			vhash = fy_node_hash(fynp->value);
+			hash += (khash * 0x9e3779b1U) ^ vhash;
+		}
+		return hash;
+	}
+
+	return FY_HASH_INIT;
+}
+
 struct fy_node_pair *fy_node_mapping_lookup_pair(struct fy_node *fyn, struct fy_node *fyn_key)
 {
 	struct fy_node_pair *fynpi;
@@ -786,13 +972,11 @@ int fy_node_mapping_get_pair_index(struct fy_node *fyn, const struct fy_node_pai
 	return -1;
 }
 
-static bool fy_node_mapping_key_is_duplicate(struct fy_node *fyn, struct fy_node *fyn_key)
+bool fy_node_mapping_key_is_duplicate(struct fy_node *fyn, struct fy_node *fyn_key)
 {
 	return fy_node_mapping_lookup_pair(fyn, fyn_key) != NULL;
 }
 
-int fy_parse_document_load_node(struct fy_parser *fyp, struct fy_document *fyd, struct fy_eventp *fyep, struct fy_node **fynp);
-
 int fy_parse_document_load_alias(struct fy_parser *fyp, struct fy_document *fyd, struct fy_eventp *fyep, struct fy_node **fynp)
 {
 	*fynp = NULL;
@@ -804,6 +988,158 @@ int fy_parse_document_load_alias(struct fy_parser *fyp, struct fy_document *fyd,
 	return 0;
 }
 
+static struct fy_token_dedup *fy_token_dedup_create(void)
+{
+	struct fy_token_dedup *fytd;
+
+	fytd = malloc(sizeof(*fytd));
+	if (!fytd)
+		return NULL;
+	memset(fytd, 0, sizeof(*fytd));
+
+	return fytd;
+}
+
+/* only what is certain to have the same value when the text is the same */
+static bool fy_token_dedup_eligible(struct fy_token *fyt)
+{
+	const struct fy_atom *atom;
+	int i;
+
+	if (!fyt || fyt->type != FYTT_SCALAR)
+		return false;
+
+	atom = &fyt->handle;
+	if (!fy_atom_is_set(atom))
+		return false;
+
+	/* block scalars and multi line scalars depend on their indentation */
+	if (fyt->scalar.style == FYSS_LITERAL || fyt->scalar.style == FYSS_FOLDED ||
+	    atom->start_mark.line != atom->end_mark.line)
+		return false;
+
+	for (i = 0; i < fycp_max; i++) {
+		if (fy_atom_is_set(&fyt->comment[i]))
+			return false;
+	}
+
+	return true;
+}
+
+static bool fy_token_dedup_match(struct fy_token *fyt_a, struct fy_token *fyt_b)
+{
+	const struct fy_atom *a = &fyt_a->handle, *b = &fyt_b->handle;
+	size_t size = fy_atom_size(a);
+
+	return fyt_a->scalar.style == fyt_b->scalar.style &&
+	       a->style == b->style && a->chomp == b->chomp &&
+	       a->increment == b->increment &&
+	       a->direct_output == b->direct_output &&
+	       a->storage_hint == b->storage_hint &&
+	       size == fy_atom_size(b) &&
+	       !memcmp(fy_atom_data(a), fy_atom_data(b), size);
+}
+
+static int fy_token_dedup_grow(struct fy_token_dedup *fytd)
+{
+	struct fy_token_dedup_entry *entries, *fytde;
+	unsigned int bucket_count, mask;
+	int *buckets, alloc, i;
+
+	alloc = fytd->alloc ? fytd->alloc * 2 : 64;
+	entries = realloc(fytd->entries, alloc * sizeof(*entries));
+	if (!entries)
+		return -1;
+	fytd->entries = entries;
+	fytd->alloc = alloc;
+
+	/* keep the load factor under one half */
+	bucket_count = fytd->bucket_count ? fytd->bucket_count : 16;
+	while (bucket_count < (unsigned int)alloc * 2)
+		bucket_count <<= 1;
+
+	if (bucket_count == fytd->bucket_count)
+		return 0;
+
+	buckets = realloc(fytd->buckets, bucket_count * sizeof(*buckets));
+	if (!buckets)
+		return -1;
+	fytd->buckets = buckets;
+	fytd->bucket_count = bucket_count;
+	memset(buckets, 0xff, bucket_count * sizeof(*buckets));
+
+	mask = bucket_count - 1;
+	for (i = fytd->count - 1; i >= 0; i--) {
+		fytde = &fytd->entries[i];
+		fytde->next = buckets[fytde->hash & mask];
+		buckets[fytde->hash & mask] = i;
+	}
+
+	return 0;
+}
+
+/* sets the value of @fyn to @fyt (consumed), or to an earlier token just like it */
+static void fy_document_dedup_scalar(struct fy_document *fyd, struct fy_node *fyn,
+				     struct fy_token *fyt)
+{
+	struct fy_token_dedup *fytd = fyd->dedup;
+	struct fy_token_dedup_entry *fytde;
+	const struct fy_atom *atom;
+	struct fy_mark *marks;
+	uint32_t hash;
+	unsigned int mask;
+	int i;
+
+	fyn->scalar = fyt;
+
+	if (!fytd || !fy_token_dedup_eligible(fyt))
+		return;
+
+	fyd->dedup_scalars++;
+
+	atom = &fyt->handle;
+	hash = fy_hash_bytes(FY_HASH_INIT, fy_atom_data(atom), fy_atom_size(atom));
+	hash = fy_hash_bytes(hash, &fyt->scalar.style, sizeof(fyt->scalar.style));
+
+	if (fytd->bucket_count) {
+		mask = fytd->bucket_count - 1;
+		for (i = fytd->buckets[hash & mask]; i >= 0; i = fytde->next) {
+			fytde = &fytd->entries[i];
+			if (fytde->hash != hash || !fy_token_dedup_match(fytde->fyt, fyt))
+				continue;
+
+			/* the node still reports where it is */
+			marks = fy_talloc(&fyd->tallocs, 2 * sizeof(*marks));
+			if (!marks)
+				return;
+			marks[0] = atom->start_mark;
+			marks[1] = atom->end_mark;
+
+			fyd->dedup_shared++;
+			fyd->dedup_bytes += fy_atom_size(atom);
+			fyn->scalar = fy_token_ref(fytde->fyt);
+			fyn->scalar_marks = marks;
+			fy_token_unref(fyt);
+			return;
+		}
+	}
+
+	/* sharing is best effort; carry on without it */
+	if (fytd->count >= fytd->alloc && fy_token_dedup_grow(fytd)) {
+		fy_token_dedup_destroy(fytd);
+		fyd->dedup = NULL;
+		return;
+	}
+
+	/* the entry lives as long as the node holding the token, the load */
+	mask = fytd->bucket_count - 1;
+	fytde = &fytd->entries[fytd->count];
+	fytde->hash = hash;
+	fytde->fyt = fyt;
+	fytde->next = fytd->buckets[hash & mask];
+	fytd->buckets[hash & mask] = fytd->count++;
+}
+
 int fy_parse_document_load_scalar(struct fy_parser *fyp, struct fy_document *fyd, struct fy_eventp *fyep, struct fy_node **fynp)
 {
 	struct fy_node *fyn = NULL;
@@ -838,7 +1174,7 @@ int fy_parse_document_load_scalar(struct fy_parser *fyp, struct fy_document *fyd
 		fyn->tag = fye->scalar.tag;
 		fye->scalar.tag = NULL;
 
-		fyn->scalar = fye->scalar.value;
+		fy_document_dedup_scalar(fyd, fyn, fye->scalar.value);
 		fye->scalar.value = NULL;
 
 		if (fye->scalar.anchor) {
@@ -871,277 +1207,304 @@ err_stream_end:
 	goto err_out;
 }
 
-int fy_parse_document_load_sequence(struct fy_parser *fyp, struct fy_document *fyd, struct fy_eventp *fyep, struct fy_node **fynp)
+/* the node of a sequence or a mapping, taking over its start event */
+static struct fy_node *
+fy_parse_document_collection_create(struct fy_parser *fyp, struct fy_document *fyd,
+				    struct fy_event *fye)
 {
-	struct fy_node *fyn = NULL, *fyn_item = NULL;
-	struct fy_event *fye = NULL;
-	struct fy_token *fyt_ss = NULL;
-	struct fy_error_ctx ec;
+	struct fy_node *fyn = NULL;
+	struct fy_token **fyt_startp, **fyt_tagp, *fyt_anchor;
+	enum fy_token_type flow_type;
 	int rc;
 
-	fy_error_check(fyp, fyep || !fyp->stream_error, err_out,
-			"no event to process");
-
-	FY_ERROR_CHECK(fyp, NULL, &ec, FYEM_DOC,
-			fyep, err_stream_end);
-
-	fy_doc_debug(fyp, "in %s [%s]", __func__, fy_event_type_txt[fyep->e.type]);
-
-	*fynp = NULL;
-
-	fye = &fyep->e;
-
-	fyt_ss = fye->sequence_start.sequence_start;
+	if (fye->type == FYET_SEQUENCE_START) {
+		fyt_startp = &fye->sequence_start.sequence_start;
+		fyt_tagp = &fye->sequence_start.tag;
+		fyt_anchor = fye->sequence_start.anchor;
+		flow_type = FYTT_FLOW_SEQUENCE_START;
+	} else {
+		fyt_startp = &fye->mapping_start.mapping_start;
+		fyt_tagp = &fye->mapping_start.tag;
+		fyt_anchor = fye->mapping_start.anchor;
+		flow_type = FYTT_FLOW_MAPPING_START;
+	}
 
 	/* we don't free nodes that often, so no need for recycling */
-	fyn = fy_node_alloc(fyd, FYNT_SEQUENCE);
+	fyn = fy_node_alloc(fyd, fye->type == FYET_SEQUENCE_START ?
+				FYNT_SEQUENCE : FYNT_MAPPING);
 	fy_error_check(fyp, fyn, err_out,
 			"fy_node_alloc() failed");
 
-	fyn->style = fyt_ss && fyt_ss->type == FYTT_FLOW_SEQUENCE_START ? FYNS_FLOW : FYNS_BLOCK;
+	fyn->style = *fyt_startp && (*fyt_startp)->type == flow_type ? FYNS_FLOW : FYNS_BLOCK;
 
-	fyn->tag = fye->sequence_start.tag;
-	fye->sequence_start.tag = NULL;
+	fyn->tag = *fyt_tagp;
+	*fyt_tagp = NULL;
 
-	if (fye->sequence_start.anchor) {
-		rc = fy_parse_document_register_anchor(fyp, fyd, fyn, fye->sequence_start.anchor);
-		fy_error_check(fyp, !rc, err_out_rc,
+	if (fyt_anchor) {
+		rc = fy_parse_document_register_anchor(fyp, fyd, fyn, fyt_anchor);
+		fy_error_check(fyp, !rc, err_out,
 				"fy_parse_document_register_anchor() failed");
 	}
 
-	if (fye->sequence_start.sequence_start) {
-		fyn->sequence_start = fye->sequence_start.sequence_start;
-		fye->sequence_start.sequence_start = NULL;
+	/* sequence_start and mapping_start share storage */
+	if (*fyt_startp) {
+		fyn->sequence_start = *fyt_startp;
+		*fyt_startp = NULL;
 	}
 
-	/* done with this */
-	fy_parse_eventp_recycle(fyp, fyep);
-	fyep = NULL;
+	return fyn;
 
-	while ((fyep = fy_parse_private(fyp)) != NULL) {
-		fye = &fyep->e;
-		if (fye->type == FYET_SEQUENCE_END)
-			break;
+err_out:
+	fy_node_free(fyn);
+	return NULL;
+}
 
-		rc = fy_parse_document_load_node(fyp, fyd, fyep, &fyn_item);
-		fyep = NULL;
-		fy_error_check(fyp, !rc, err_out_rc,
-				"fy_parse_document_load_node() failed");
+/*
+ * A node loaded from the events one at a time. The collections still
+ * open are kept on a stack in place of recursion, so that loading can
+ * stop after any event and pick up from there, which is how
+ * fy_parse_load_document_slice() loads a document a slice at a time.
+ */
+struct fy_document_load_frame {
+	struct fy_node *fyn;		/* the open sequence or mapping */
+	struct fy_node_pair *fynp;	/* of a mapping, the key waiting for its value */
+};
 
-		fy_node_list_add_tail(&fyn->sequence, fyn_item);
-		fyn_item = NULL;
-	}
+struct fy_document_load {
+	struct fy_document *fyd;
+	struct fy_node *fyn_root;	/* the node loaded, once complete */
+	struct fy_document_load_frame *frames;
+	unsigned int depth;
+	unsigned int alloc;
+};
 
-	if (fye->sequence_end.sequence_end) {
-		fyn->sequence_end = fye->sequence_end.sequence_end;
-		fye->sequence_end.sequence_end = NULL;
+static void fy_document_load_release(struct fy_document_load *fydl)
+{
+	/* the open collections are not linked to their parents yet */
+	while (fydl->depth > 0) {
+		fydl->depth--;
+		fy_node_pair_free(fydl->frames[fydl->depth].fynp);
+		fy_node_free(fydl->frames[fydl->depth].fyn);
 	}
-
-	*fynp = fyn;
-	fyn = NULL;
-
-	fy_parse_eventp_recycle(fyp, fyep);
-	return 0;
-
-	/* fallthrough */
-err_out:
-	rc = -1;
-err_out_rc:
-	fy_parse_eventp_recycle(fyp, fyep);
-	fy_node_free(fyn_item);
-	fy_node_free(fyn);
-	return rc;
-err_stream_end:
-	fy_error_report(fyp, &ec, "premature end of event stream");
-	goto err_out;
+	free(fydl->frames);
+	fydl->frames = NULL;
+	fydl->alloc = 0;
 }
 
-int fy_parse_document_load_mapping(struct fy_parser *fyp, struct fy_document *fyd, struct fy_eventp *fyep, struct fy_node **fynp)
+/* link a complete node to the open collection (or make it the root) */
+static int fy_parse_document_load_link(struct fy_parser *fyp, struct fy_document_load *fydl,
+				       struct fy_node *fyn)
 {
-	struct fy_node *fyn = NULL, *fyn_key = NULL, *fyn_value = NULL;
-	struct fy_node_pair *fynp_item = NULL;
-	struct fy_event *fye = NULL;
-	struct fy_token *fyt_ms = NULL;
+	struct fy_document_load_frame *fr;
 	struct fy_error_ctx ec;
 	bool duplicate;
-	int rc;
 
-	fy_error_check(fyp, fyep || !fyp->stream_error, err_out,
-			"no event to process");
+	if (!fydl->depth) {
+		fydl->fyn_root = fyn;
+		return 0;
+	}
 
-	FY_ERROR_CHECK(fyp, NULL, &ec, FYEM_DOC,
-			fyep, err_stream_end);
+	fr = &fydl->frames[fydl->depth - 1];
 
-	fy_doc_debug(fyp, "in %s [%s]", __func__, fy_event_type_txt[fyep->e.type]);
+	if (fr->fyn->type == FYNT_SEQUENCE) {
+		fy_node_list_add_tail(&fr->fyn->sequence, fyn);
+		return 0;
+	}
 
-	*fynp = NULL;
+	/* the value completes the pair */
+	if (fr->fynp) {
+		fr->fynp->value = fyn;
+		fy_node_pair_list_add_tail(&fr->fyn->mapping, fr->fynp);
+		fr->fynp = NULL;
+		return 0;
+	}
 
-	fye = &fyep->e;
+	/* make sure we don't add an already existing key */
+	duplicate = fy_node_mapping_key_is_duplicate(fr->fyn, fyn);
 
-	fyt_ms = fye->mapping_start.mapping_start;
+	FY_ERROR_CHECK(fyp, NULL, &ec, FYEM_DOC,
+			!duplicate, err_duplicate_key);
 
-	/* we don't free nodes that often, so no need for recycling */
-	fyn = fy_node_alloc(fyd, FYNT_MAPPING);
-	fy_error_check(fyp, fyn, err_out,
-			"fy_node_alloc() failed");
+	fr->fynp = fy_node_pair_alloc(fydl->fyd);
+	fy_error_check(fyp, fr->fynp, err_out,
+			"fy_node_pair_alloc() failed");
 
-	fyn->style = fyt_ms && fyt_ms->type == FYTT_FLOW_MAPPING_START ? FYNS_FLOW : FYNS_BLOCK;
+	fy_node_pair_link_key(fr->fynp, fyn);
+	return 0;
+
+err_out:
+	fy_node_free(fyn);
+	return -1;
 
-	fyn->tag = fye->mapping_start.tag;
-	fye->mapping_start.tag = NULL;
+err_duplicate_key:
+	ec.start_mark = *fy_node_get_start_mark(fyn);
+	ec.end_mark = *fy_node_get_end_mark(fyn);
+	ec.fyi = fy_node_get_input(fyn);
+	fy_error_report(fyp, &ec, "duplicate key");
+	goto err_out;
+}
 
-	if (fye->mapping_start.anchor) {
-		rc = fy_parse_document_register_anchor(fyp, fyd, fyn, fye->mapping_start.anchor);
-		fy_error_check(fyp, !rc, err_out_rc,
-				"fy_parse_document_register_anchor() failed");
-	}
+static int fy_parse_document_load_push(struct fy_parser *fyp, struct fy_document_load *fydl,
+				       struct fy_node *fyn)
+{
+	struct fy_document_load_frame *frames;
+	unsigned int alloc;
 
-	if (fye->mapping_start.mapping_start) {
-		fyn->mapping_start = fye->mapping_start.mapping_start;
-		fye->mapping_start.mapping_start = NULL;
+	if (fydl->depth >= fydl->alloc) {
+		alloc = fydl->alloc ? fydl->alloc * 2 : 16;
+		frames = realloc(fydl->frames, sizeof(*frames) * alloc);
+		fy_error_check(fyp, frames, err_out,
+				"realloc() failed");
+		fydl->frames = frames;
+		fydl->alloc = alloc;
 	}
 
-	/* done with this */
-	fy_parse_eventp_recycle(fyp, fyep);
-	fyep = NULL;
-
-	while ((fyep = fy_parse_private(fyp)) != NULL) {
-		fye = &fyep->e;
-		if (fye->type == FYET_MAPPING_END)
-			break;
+	fydl->frames[fydl->depth].fyn = fyn;
+	fydl->frames[fydl->depth].fynp = NULL;
+	fydl->depth++;
 
-		fynp_item = fy_node_pair_alloc(fyd);
-		fy_error_check(fyp, fynp_item, err_out,
-				"fy_node_pair_alloc() failed");
+	return 0;
 
-		fyn_key = NULL;
-		fyn_value = NULL;
+err_out:
+	fy_node_free(fyn);
+	return -1;
+}
 
-		rc = fy_parse_document_load_node(fyp, fyd, fyep, &fyn_key);
-		fyep = NULL;
+/* load an event of the node (consuming it); it's complete once fyn_root is set */
+static int fy_parse_document_load_event(struct fy_parser *fyp, struct fy_document_load *fydl,
+					struct fy_eventp *fyep)
+{
+	struct fy_document *fyd = fydl->fyd;
+	struct fy_document_load_frame *fr;
+	struct fy_event *fye;
+	struct fy_node *fyn;
+	struct fy_error_ctx ec;
+	int rc;
 
-		assert(fyn_key);
+	fy_doc_debug(fyp, "in %s [%s]", __func__, fy_event_type_txt[fyep->e.type]);
 
-		fy_error_check(fyp, !rc, err_out_rc,
-				"fy_parse_document_load_node() failed");
+	fye = &fyep->e;
+	fr = fydl->depth ? &fydl->frames[fydl->depth - 1] : NULL;
 
-		/* make sure we don't add an already existing key */
-		duplicate = fy_node_mapping_key_is_duplicate(fyn, fyn_key);
+	switch (fye->type) {
+	case FYET_ALIAS:
+	case FYET_SCALAR:
+		rc = fy_parse_document_load_scalar(fyp, fyd, fyep, &fyn);
+		fyep = NULL;
+		fy_error_check(fyp, !rc, err_out,
+				"fy_parse_document_load_scalar() failed");
 
-		FY_ERROR_CHECK(fyp, NULL, &ec, FYEM_DOC,
-				!duplicate, err_duplicate_key);
+		rc = fy_parse_document_load_link(fyp, fydl, fyn);
+		fy_error_check(fyp, !rc, err_out,
+				"fy_parse_document_load_link() failed");
+		break;
 
-		fyep = fy_parse_private(fyp);
+	case FYET_SEQUENCE_START:
+	case FYET_MAPPING_START:
+		fyn = fy_parse_document_collection_create(fyp, fyd, fye);
+		fy_error_check(fyp, fyn, err_out,
+				"fy_parse_document_collection_create() failed");
 
-		fy_error_check(fyp, fyep || !fyp->stream_error, err_out,
-				"fy_parse_private() failed");
+		fy_parse_eventp_recycle(fyp, fyep);
+		fyep = NULL;
 
-		FY_ERROR_CHECK(fyp, NULL, &ec, FYEM_DOC,
-				fyep, err_missing_mapping_value);
+		rc = fy_parse_document_load_push(fyp, fydl, fyn);
+		fy_error_check(fyp, !rc, err_out,
+				"fy_parse_document_load_push() failed");
+		break;
 
-		fye = &fyep->e;
+	case FYET_SEQUENCE_END:
+		FY_ERROR_CHECK(fyp, fy_document_event_get_token(fye), &ec, FYEM_DOC,
+				fr && fr->fyn->type == FYNT_SEQUENCE,
+				err_bad_event);
+
+		fyn = fr->fyn;
+		fyn->sequence_end = fye->sequence_end.sequence_end;
+		fye->sequence_end.sequence_end = NULL;
+		fydl->depth--;
 
-		rc = fy_parse_document_load_node(fyp, fyd, fyep, &fyn_value);
+		fy_parse_eventp_recycle(fyp, fyep);
 		fyep = NULL;
-		fy_error_check(fyp, !rc, err_out_rc,
-				"fy_parse_document_load_node() failed");
 
-		assert(fyn_value);
+		rc = fy_parse_document_load_link(fyp, fydl, fyn);
+		fy_error_check(fyp, !rc, err_out,
+				"fy_parse_document_load_link() failed");
+		break;
 
-		fynp_item->key = fyn_key;
-		fynp_item->value = fyn_value;
-		fy_node_pair_list_add_tail(&fyn->mapping, fynp_item);
-		fynp_item = NULL;
-		fyn_key = NULL;
-		fyn_value = NULL;
-	}
+	case FYET_MAPPING_END:
+		FY_ERROR_CHECK(fyp, fy_document_event_get_token(fye), &ec, FYEM_DOC,
+				fr && fr->fyn->type == FYNT_MAPPING && !fr->fynp,
+				err_bad_event);
 
-	if (fye->mapping_end.mapping_end) {
+		fyn = fr->fyn;
 		fyn->mapping_end = fye->mapping_end.mapping_end;
 		fye->mapping_end.mapping_end = NULL;
-	}
+		fydl->depth--;
 
-	*fynp = fyn;
-	fyn = NULL;
+		fy_parse_eventp_recycle(fyp, fyep);
+		fyep = NULL;
 
-	fy_parse_eventp_recycle(fyp, fyep);
+		rc = fy_parse_document_load_link(fyp, fydl, fyn);
+		fy_error_check(fyp, !rc, err_out,
+				"fy_parse_document_load_link() failed");
+		break;
+
+	default:
+		FY_ERROR_CHECK(fyp, fy_document_event_get_token(fye), &ec, FYEM_DOC,
+				false, err_bad_event);
+		break;
+	}
 
 	return 0;
 
 err_out:
-	rc = -1;
-err_out_rc:
 	fy_parse_eventp_recycle(fyp, fyep);
-	fy_node_pair_free(fynp_item);
-	fy_node_free(fyn_key);
-	fy_node_free(fyn_value);
-	fy_node_free(fyn);
-	return rc;
-
-err_duplicate_key:
-	ec.start_mark = *fy_node_get_start_mark(fyn_key);
-	ec.end_mark = *fy_node_get_end_mark(fyn_key);
-	ec.fyi = fy_node_get_input(fyn_key);
-	fy_error_report(fyp, &ec, "duplicate key");
-	goto err_out;
+	return -1;
 
-err_missing_mapping_value:
-	fy_error_report(fyp, &ec, "missing mapping value");
-	goto err_out;
-err_stream_end:
-	fy_error_report(fyp, &ec, "premature end of event stream");
+err_bad_event:
+	fy_error_report(fyp, &ec, "bad event");
 	goto err_out;
 }
 
 int fy_parse_document_load_node(struct fy_parser *fyp, struct fy_document *fyd, struct fy_eventp *fyep, struct fy_node **fynp)
 {
-	struct fy_event *fye;
-	enum fy_event_type type;
+	struct fy_document_load fydl;
 	struct fy_error_ctx ec;
+	int rc;
 
 	*fynp = NULL;
 
-	fy_error_check(fyp, fyep || !fyp->stream_error, err_out,
-			"no event to process");
-
-	FY_ERROR_CHECK(fyp, NULL, &ec, FYEM_DOC,
-			fyep, err_stream_end);
+	memset(&fydl, 0, sizeof(fydl));
+	fydl.fyd = fyd;
 
-	fy_doc_debug(fyp, "in %s [%s]", __func__, fy_event_type_txt[fyep->e.type]);
-
-	fye = &fyep->e;
-
-	type = fye->type;
+	for (;;) {
+		fy_error_check(fyp, fyep || !fyp->stream_error, err_out,
+				"no event to process");
 
-	FY_ERROR_CHECK(fyp, fy_document_event_get_token(fye), &ec, FYEM_DOC,
-			type == FYET_ALIAS || type == FYET_SCALAR ||
-			type == FYET_SEQUENCE_START || type == FYET_MAPPING_START,
-			err_bad_event);
+		FY_ERROR_CHECK(fyp, NULL, &ec, FYEM_DOC,
+				fyep, err_stream_end);
 
-	switch (type) {
+		rc = fy_parse_document_load_event(fyp, &fydl, fyep);
+		fyep = NULL;
+		fy_error_check(fyp, !rc, err_out,
+				"fy_parse_document_load_event() failed");
 
-	case FYET_ALIAS:
-	case FYET_SCALAR:
-		return fy_parse_document_load_scalar(fyp, fyd, fyep, fynp);
+		if (fydl.fyn_root)
+			break;
 
-	case FYET_SEQUENCE_START:
-		return fy_parse_document_load_sequence(fyp, fyd, fyep, fynp);
+		fyep = fy_parse_private(fyp);
+	}
 
-	case FYET_MAPPING_START:
-		return fy_parse_document_load_mapping(fyp, fyd, fyep, fynp);
+	free(fydl.frames);
+	*fynp = fydl.fyn_root;
 
-	default:
-		break;
-	}
+	return 0;
 
 err_out:
 	fy_parse_eventp_recycle(fyp, fyep);
+	fy_document_load_release(&fydl);
 	return -1;
 
-err_bad_event:
-	fy_error_report(fyp, &ec, "bad event");
-	goto err_out;
-
 err_stream_end:
 	fy_error_report(fyp, &ec, "premature end of event stream");
 	goto err_out;
@@ -1182,87 +1545,204 @@ err_stream_end:
 	goto err_out;
 }
 
-struct fy_document *fy_parse_load_document(struct fy_parser *fyp)
+void fy_parse_document_load_abort(struct fy_parser *fyp)
 {
-	struct fy_document *fyd = NULL;
+	struct fy_document_load *fydl;
+
+	if (!fyp || !fyp->doc_load)
+		return;
+
+	fydl = fyp->doc_load;
+	fyp->doc_load = NULL;
+
+	fy_document_load_release(fydl);
+	fy_parse_document_destroy(fyp, fydl->fyd);
+	free(fydl);
+}
+
+static struct fy_document *fy_parse_document_load_finish(struct fy_parser *fyp)
+{
+	struct fy_document_load *fydl = fyp->doc_load;
+	struct fy_document *fyd = fydl->fyd;
+	int rc;
+
+	fyp->doc_load = NULL;
+	free(fydl->frames);
+	free(fydl);
+
+	/* the shared tokens stay, the table is not needed anymore */
+	fy_token_dedup_destroy(fyd->dedup);
+	fyd->dedup = NULL;
+
+	/* always resolve parents */
+	fy_resolve_parent_node(fyd, fyd->root, NULL);
+
+	if (fyp->cfg.flags & FYPCF_RESOLVE_DOCUMENT) {
+		rc = fy_document_resolve(fyd);
+		fy_error_check(fyp, !rc, err_out,
+				"fy_document_resolve() failed");
+	}
+
+	return fyd;
+
+err_out:
+	fy_parse_document_destroy(fyp, fyd);
+	return NULL;
+}
+
+int fy_parse_load_document_slice(struct fy_parser *fyp, int max_events,
+				 struct fy_document **fydp)
+{
+	struct fy_document_load *fydl;
+	struct fy_document *fyd;
 	struct fy_eventp *fyep = NULL;
-	struct fy_event *fye = NULL;
+	struct fy_event *fye;
 	struct fy_error_ctx ec;
-	int rc;
-	bool was_stream_start;
+	enum fy_event_type type;
+	int count, rc;
+
+	if (!fyp || max_events <= 0 || !fydp)
+		return -1;
+
+	*fydp = NULL;
+
+	for (count = 0; count < max_events; count++) {
 
-again:
-	was_stream_start = false;
-	do {
-		/* get next event */
 		fyep = fy_parse_private(fyp);
+		fydl = fyp->doc_load;
+
+		/* the end of the stream is only fine between documents */
+		fy_error_check(fyp, fyep || !fyp->stream_error, err_out,
+				"fy_parse_private() failed");
+
+		FY_ERROR_CHECK(fyp, NULL, &ec, FYEM_DOC,
+				fyep || !fydl, err_stream_end);
 
-		/* no more */
 		if (!fyep)
-			return NULL;
+			return 0;
 
-		was_stream_start = fyep->e.type == FYET_STREAM_START;
+		fye = &fyep->e;
 
-		if (was_stream_start) {
-			fy_parse_eventp_recycle(fyp, fyep);
-			fyep = NULL;
-		}
+		fy_parse_set_slice_mark(fyp, fye);
 
-	} while (was_stream_start);
+		if (!fydl) {
+			type = fye->type;
+			if (type == FYET_STREAM_START || type == FYET_STREAM_END) {
+				fy_parse_eventp_recycle(fyp, fyep);
+				fyep = NULL;
 
-	fye = &fyep->e;
+				/* final STREAM_END? */
+				if (type == FYET_STREAM_END && fyp->state == FYPS_END)
+					return 0;
+				continue;
+			}
 
-	/* STREAM_END */
-	if (fye->type == FYET_STREAM_END) {
-		fy_parse_eventp_recycle(fyp, fyep);
+			FY_ERROR_CHECK(fyp, fy_document_event_get_token(fye), &ec, FYEM_DOC,
+					type == FYET_DOCUMENT_START,
+					err_bad_event);
 
-		/* final STREAM_END? */
-		if (fyp->state == FYPS_END)
-			return NULL;
+			fydl = malloc(sizeof(*fydl));
+			fy_error_check(fyp, fydl, err_out,
+					"malloc() failed");
+			memset(fydl, 0, sizeof(*fydl));
+			fyp->doc_load = fydl;
 
-		/* multi-stream */
-		goto again;
-	}
+			fyd = fy_parse_document_create(fyp, fyep);
+			fyep = NULL;
 
-	FY_ERROR_CHECK(fyp, fy_document_event_get_token(fye), &ec, FYEM_DOC,
-			fye->type == FYET_DOCUMENT_START,
-			err_bad_event);
+			fy_error_check(fyp, fyd, err_out,
+					"fy_parse_document_create() failed");
 
-	fyd = fy_parse_document_create(fyp, fyep);
-	fyep = NULL;
+			fydl->fyd = fyd;
 
-	fy_error_check(fyp, fyd, err_out,
-			"fy_parse_document_create() failed");
+			if (fyp->cfg.flags & FYPCF_DEDUP_SCALARS) {
+				fyd->dedup = fy_token_dedup_create();
+				fy_error_check(fyp, fyd->dedup, err_out,
+						"fy_token_dedup_create() failed");
+			}
+			continue;
+		}
 
-	fy_doc_debug(fyp, "calling load_node() for root");
-	rc = fy_parse_document_load_node(fyp, fyd, fy_parse_private(fyp), &fyd->root);
-	fy_error_check(fyp, !rc, err_out,
-			"fy_parse_document_load_node() failed");
+		fyd = fydl->fyd;
 
-	rc = fy_parse_document_load_end(fyp, fyd, fy_parse_private(fyp));
-	fy_error_check(fyp, !rc, err_out,
-			"fy_parse_document_load_node() failed");
+		/* only the end of the document is left */
+		if (fyd->root) {
+			rc = fy_parse_document_load_end(fyp, fyd, fyep);
+			if (!rc)
+				fy_parse_eventp_recycle(fyp, fyep);
+			fyep = NULL;
+			fy_error_check(fyp, !rc, err_out,
+					"fy_parse_document_load_end() failed");
 
-	/* always resolve parents */
-	fy_resolve_parent_node(fyd, fyd->root, NULL);
+			*fydp = fy_parse_document_load_finish(fyp);
+			return *fydp ? 0 : -1;
+		}
 
-	if (fyp->cfg.flags & FYPCF_RESOLVE_DOCUMENT) {
-		rc = fy_document_resolve(fyd);
+		rc = fy_parse_document_load_event(fyp, fydl, fyep);
+		fyep = NULL;
 		fy_error_check(fyp, !rc, err_out,
-				"fy_document_resolve() failed");
+				"fy_parse_document_load_event() failed");
+
+		/* the document owns the root once it's complete */
+		fyd->root = fydl->fyn_root;
 	}
 
-	return fyd;
+	/* suspended, the next call picks up from here */
+	return 1;
 
 err_out:
 	fy_parse_eventp_recycle(fyp, fyep);
-	fy_parse_document_destroy(fyp, fyd);
-	return NULL;
+	fy_parse_document_load_abort(fyp);
+	return -1;
 
 err_bad_event:
 	fy_error_report(fyp, &ec, "bad event");
 	goto err_out;
 
+err_stream_end:
+	fy_error_report(fyp, &ec, "premature end of event stream");
+	goto err_out;
+}
+
+struct fy_document *fy_parse_load_document(struct fy_parser *fyp)
+{
+	struct fy_document *fyd = NULL;
+	int rc;
+
+	/* build while parsing ahead, if asked to (falls back silently) */
+	if (fy_parse_ahead_worthwhile(fyp))
+		fy_parse_ahead_start(fyp);
+
+	/* the same as loading it in slices, just with no limit */
+	do {
+		rc = fy_parse_load_document_slice(fyp, INT_MAX, &fyd);
+	} while (rc > 0);
+
+	return fyd;
+}
+
+/* the marks of a shared scalar for a node of fyd, which keeps them */
+static int fy_node_scalar_marks_get(struct fy_document *fyd, struct fy_node *fyn_from,
+				    struct fy_mark **marksp)
+{
+	struct fy_mark *marks;
+
+	*marksp = NULL;
+	if (fyn_from->type != FYNT_SCALAR || !fyn_from->scalar_marks)
+		return 0;
+
+	if (fyn_from->fyd == fyd) {
+		*marksp = fyn_from->scalar_marks;
+		return 0;
+	}
+
+	marks = fy_talloc(&fyd->tallocs, 2 * sizeof(*marks));
+	if (!marks)
+		return -1;
+	marks[0] = fyn_from->scalar_marks[0];
+	marks[1] = fyn_from->scalar_marks[1];
+	*marksp = marks;
+	return 0;
 }
 
 struct fy_node *fy_node_copy(struct fy_document *fyd, struct fy_node *fyn_from)
@@ -1293,6 +1773,9 @@ struct fy_node *fy_node_copy(struct fy_document *fyd, struct fy_node *fyn_from)
 	switch (fyn->type) {
 	case FYNT_SCALAR:
 		fyn->scalar = fy_token_ref(fyn_from->scalar);
+		rc = fy_node_scalar_marks_get(fyd, fyn_from, &fyn->scalar_marks);
+		fy_error_check(fyp, !rc, err_out,
+				"fy_node_scalar_marks_get() failed");
 		break;
 
 	case FYNT_SEQUENCE:
@@ -1315,7 +1798,7 @@ struct fy_node *fy_node_copy(struct fy_document *fyd, struct fy_node *fyn_from)
 			fy_error_check(fyp, fynpt, err_out,
 					"fy_node_pair_alloc() failed");
 
-			fynpt->key = fy_node_copy(fyd, fynp->key);
+			fy_node_pair_link_key(fynpt, fy_node_copy(fyd, fynp->key));
 			fynpt->value = fy_node_copy(fyd, fynp->value);
 
 			fy_node_pair_list_add_tail(&fyn->mapping, fynpt);
@@ -1358,16 +1841,25 @@ int fy_node_copy_to_scalar(struct fy_document *fyd, struct fy_node *fyn_to, stru
 {
 	struct fy_node *fyn, *fyni;
 	struct fy_node_pair *fynp;
+	struct fy_mark *marks;
 
 	fyn = fy_node_copy(fyd, fyn_from);
 	if (!fyn)
 		return -1;
 
+	if (fy_node_scalar_marks_get(fyn_to->fyd, fyn, &marks)) {
+		fy_node_free(fyn);
+		return -1;
+	}
+
+	fy_document_modified(fyn_to->fyd);
+
 	/* the node is guaranteed to be a scalar */
 	fy_token_unref(fyn_to->tag);
 	fyn_to->tag = NULL;
 	fy_token_unref(fyn_to->scalar);
 	fyn_to->scalar = NULL;
+	fyn_to->scalar_marks = NULL;
 
 	fyn_to->type = fyn->type;
 	fyn_to->tag = fy_token_ref(fyn->tag);
@@ -1377,6 +1869,7 @@ int fy_node_copy_to_scalar(struct fy_document *fyd, struct fy_node *fyn_to, stru
 	case FYNT_SCALAR:
 		fyn_to->scalar = fyn->scalar;
 		fyn->scalar = NULL;
+		fyn_to->scalar_marks = marks;
 		break;
 	case FYNT_SEQUENCE:
 		fy_node_list_init(&fyn_to->sequence);
@@ -1396,7 +1889,264 @@ int fy_node_copy_to_scalar(struct fy_document *fyd, struct fy_node *fyn_to, stru
 	return 0;
 }
 
-int fy_node_insert(struct fy_node *fyn_to, struct fy_node *fyn_from)
+/* an anchor of a moved node, and the node it moved to */
+struct fy_node_move_anchor {
+	struct fy_anchor *fya;
+	struct fy_node *fyn;
+};
+
+struct fy_node_move {
+	struct fy_text_hash anchors;	/* source node (its address) to its anchors */
+	struct fy_node_move_anchor *moved;
+	int moved_count;
+	int moved_alloc;
+};
+
+/* note the anchors of a node that moved, they follow it at the end */
+static int fy_node_move_anchors(struct fy_node_move *fym, struct fy_node *fyn_from,
+				struct fy_node *fyn)
+{
+	struct fy_node_move_anchor *moved;
+	struct fy_anchor *fya;
+	int iter = 0, alloc;
+
+	while ((fya = fy_text_hash_iterate(&fym->anchors, (const char *)&fyn_from,
+					   sizeof(fyn_from), &iter)) != NULL) {
+		if (fym->moved_count >= fym->moved_alloc) {
+			alloc = fym->moved_alloc ? fym->moved_alloc * 2 : 16;
+			moved = realloc(fym->moved, alloc * sizeof(*moved));
+			if (!moved)
+				return -1;
+			fym->moved = moved;
+			fym->moved_alloc = alloc;
+		}
+		fym->moved[fym->moved_count].fya = fya;
+		fym->moved[fym->moved_count].fyn = fyn;
+		fym->moved_count++;
+	}
+	return 0;
+}
+
+/* rebuild a detached node in fyd, taking over its tokens; the source is released */
+static struct fy_node *fy_node_move_node(struct fy_document *fyd, struct fy_node *fyn_from,
+					 struct fy_node_move *fym)
+{
+	struct fy_parser *fyp = fyd->fyp;
+	struct fy_document *fyd_from = fyn_from->fyd;
+	struct fy_node *fyn, *fyni, *fynit, *fyn_key, *fyn_value;
+	struct fy_node_pair *fynp, *fynpt;
+	int rc;
+
+	fyn = fy_node_alloc(fyd, fyn_from->type);
+	fy_error_check(fyp, fyn, err_out,
+			"fy_node_alloc() failed");
+
+	fyn->tag = fyn_from->tag;
+	fyn_from->tag = NULL;
+	fyn->style = fyn_from->style;
+
+	switch (fyn->type) {
+	case FYNT_SCALAR:
+		fyn->scalar = fyn_from->scalar;
+		fyn_from->scalar = NULL;
+		/* the marks go to the document the node moves to */
+		rc = fy_node_scalar_marks_get(fyd, fyn_from, &fyn->scalar_marks);
+		fy_error_check(fyp, !rc, err_out,
+				"fy_node_scalar_marks_get() failed");
+		break;
+
+	case FYNT_SEQUENCE:
+		fyn->sequence_start = fyn_from->sequence_start;
+		fyn_from->sequence_start = NULL;
+		fyn->sequence_end = fyn_from->sequence_end;
+		fyn_from->sequence_end = NULL;
+
+		while ((fyni = fy_node_list_pop(&fyn_from->sequence)) != NULL) {
+			fynit = fy_node_move_node(fyd, fyni, fym);
+			fy_error_check(fyp, fynit, err_out,
+					"fy_node_move_node() failed");
+
+			fy_node_set_parent(fynit, fyn);
+			fy_node_list_add_tail(&fyn->sequence, fynit);
+		}
+		break;
+
+	case FYNT_MAPPING:
+		fyn->mapping_start = fyn_from->mapping_start;
+		fyn_from->mapping_start = NULL;
+		fyn->mapping_end = fyn_from->mapping_end;
+		fyn_from->mapping_end = NULL;
+
+		if (!fy_ordered_index_list_empty(&fyd_from->ordered_indexes))
+			fy_node_mapping_destroy_ordered_index(fyn_from);
+
+		while ((fynp = fy_node_pair_list_pop(&fyn_from->mapping)) != NULL) {
+			fyn_key = fynp->key;
+			fyn_value = fynp->value;
+			fynp->key = NULL;
+			fynp->value = NULL;
+			fy_node_pair_free(fynp);
+
+			fynpt = fy_node_pair_alloc(fyd);
+			if (fynpt) {
+				fy_node_pair_set_parent(fynpt, fyn);
+				fy_node_pair_list_add_tail(&fyn->mapping, fynpt);
+				if (fyn_key)
+					fy_node_pair_link_key(fynpt, fy_node_move_node(fyd, fyn_key, fym));
+				if (fyn_value)
+					fynpt->value = fy_node_move_node(fyd, fyn_value, fym);
+			} else {
+				fy_node_free(fyn_key);
+				fy_node_free(fyn_value);
+			}
+			fy_error_check(fyp, fynpt && (!fyn_key || fynpt->key) &&
+					(!fyn_value || fynpt->value), err_out,
+					"fy_node_move_node() failed");
+
+			if (fynpt->value)
+				fy_node_set_parent(fynpt->value, fyn);
+		}
+		break;
+	}
+
+	if (fym->anchors.count) {
+		rc = fy_node_move_anchors(fym, fyn_from, fyn);
+		fy_error_check(fyp, !rc, err_out,
+				"fy_node_move_anchors() failed");
+	}
+
+	/* only the empty shell is left, its anchors are taken care of */
+	fy_tpool_free(&fyd_from->node_pool, fyn_from);
+
+	return fyn;
+
+err_out:
+	fy_node_free(fyn);
+	fy_node_free(fyn_from);
+	return NULL;
+}
+
+static struct fy_node *fy_node_move_internal(struct fy_document *fyd, struct fy_node *fyn_from)
+{
+	struct fy_document *fyd_from = fyn_from->fyd;
+	struct fy_node_move fym;
+	struct fy_text_hash names;
+	struct fy_anchor *fya;
+	struct fy_node *fyn;
+	const char *text;
+	size_t len;
+	int i;
+
+	memset(&fym, 0, sizeof(fym));
+	fy_text_hash_init(&names);
+
+	/* the anchors of the source, by node */
+	for (fya = fy_anchor_list_head(&fyd_from->anchors); fya;
+	     fya = fy_anchor_next(&fyd_from->anchors, fya)) {
+		if (fy_text_hash_add(&fym.anchors, (const char *)&fya->fyn,
+				     sizeof(fya->fyn), fya) < 0) {
+			fy_node_free(fyn_from);
+			goto err_out;
+		}
+	}
+
+	fyn = fy_node_move_node(fyd, fyn_from, &fym);
+	if (!fyn)
+		goto err_out;
+
+	/* the names taken in the target */
+	if (fym.moved_count) {
+		for (fya = fy_anchor_list_head(&fyd->anchors); fya;
+		     fya = fy_anchor_next(&fyd->anchors, fya)) {
+			text = fy_anchor_get_text(fya, &len);
+			if (text && fy_text_hash_add(&names, text, len, fya) < 0)
+				goto err_out_node;
+		}
+	}
+
+	/* each anchor follows its node, unless its name is taken there */
+	for (i = 0; i < fym.moved_count; i++) {
+		fya = fym.moved[i].fya;
+		fy_anchor_list_del(&fyd_from->anchors, fya);
+		text = fy_anchor_get_text(fya, &len);
+		if (!text || fy_text_hash_lookup(&names, text, len) ||
+		    fy_text_hash_add(&names, text, len, fya) < 0) {
+			fy_anchor_destroy(fya);
+			continue;
+		}
+		fya->fyn = fym.moved[i].fyn;
+		fy_anchor_list_add_tail(&fyd->anchors, fya);
+	}
+
+	fy_text_hash_cleanup(&names);
+	fy_text_hash_cleanup(&fym.anchors);
+	free(fym.moved);
+	return fyn;
+
+err_out_node:
+	fy_node_free(fyn);
+err_out:
+	/* the nodes of the anchors noted so far are gone */
+	for (i = 0; i < fym.moved_count; i++) {
+		fy_anchor_list_del(&fyd_from->anchors, fym.moved[i].fya);
+		fy_anchor_destroy(fym.moved[i].fya);
+	}
+	fy_text_hash_cleanup(&names);
+	fy_text_hash_cleanup(&fym.anchors);
+	free(fym.moved);
+	return NULL;
+}
+
+struct fy_node *fy_node_steal(struct fy_document *fyd, struct fy_node *fyn)
+{
+	struct fy_document *fyd_from;
+	struct fy_node *fyn_parent;
+	struct fy_node_pair *fynp;
+
+	/* a key can't leave its pair */
+	if (!fyd || !fyn || !fyn->fyd || fyn->is_key)
+		return NULL;
+
+	fyd_from = fyn->fyd;
+	fyn_parent = fy_node_parent(fyn);
+
+	/* the subtree leaves the indexes of where it is */
+	if (fyn != fyd_from->root && fyn_parent)
+		fy_node_detached(fyn);
+
+	/* detach it from where it is */
+	if (fyn == fyd_from->root) {
+		fyd_from->root = NULL;
+	} else if (fyn_parent && fyn_parent->type == FYNT_SEQUENCE) {
+		fy_node_list_del(&fyn_parent->sequence, fyn);
+	} else if (fyn_parent && fyn_parent->type == FYNT_MAPPING) {
+		for (fynp = fy_node_pair_list_head(&fyn_parent->mapping); fynp;
+				fynp = fy_node_pair_next(&fyn_parent->mapping, fynp)) {
+			if (fynp->value == fyn)
+				break;
+		}
+		/* the pair goes along with its value */
+		if (fynp) {
+			fy_node_detached(fynp->key);
+			fy_node_pair_list_del(&fyn_parent->mapping, fynp);
+			fynp->value = NULL;
+			fy_node_pair_free(fynp);
+		}
+	}
+	fy_node_set_parent(fyn, NULL);
+	if (fyn_parent)
+		fy_node_modified(fyn_parent, NULL);
+	else
+		fy_document_modified(fyd_from);
+
+	/* in the same document there's nothing more to do */
+	if (fyd_from == fyd)
+		return fyn;
+
+	return fy_node_move_internal(fyd, fyn);
+}
+
+static int fy_node_insert_internal(struct fy_node *fyn_to, struct fy_node *fyn_from, bool move)
 {
 	struct fy_document *fyd;
 	struct fy_parser *fyp;
@@ -1412,7 +2162,9 @@ int fy_node_insert(struct fy_node *fyn_to, struct fy_node *fyn_from)
 	fyp = fyd->fyp;
 	assert(fyp);
 
-	fyn_parent = fyn_to->parent;
+	fy_document_modified(fyd);
+
+	fyn_parent = fy_node_parent(fyn_to);
 	fynp = NULL;
 	if (fyn_parent) {
 		fy_error_check(fyp, fyn_parent->type != FYNT_SCALAR, err_out,
@@ -1436,7 +2188,7 @@ int fy_node_insert(struct fy_node *fyn_to, struct fy_node *fyn_from)
 
 	/* deleting target */
 	if (!fyn_from) {
-		fyn_to->parent = NULL;
+		fy_node_set_parent(fyn_to, NULL);
 
 		if (!fyn_parent) {
 			fy_doc_debug(fyp, "Deleting root node");
@@ -1488,9 +2240,10 @@ int fy_node_insert(struct fy_node *fyn_to, struct fy_node *fyn_from)
 	/* if types of `from` and `to` differ (or it's a scalar), it's a replace */
 	if (fyn_from->type != fyn_to->type || fyn_from->type == FYNT_SCALAR) {
 
-		fyn_cpy = fy_node_copy(fyd, fyn_from);
+		fyn_cpy = move ? fyn_from : fy_node_copy(fyd, fyn_from);
 		fy_error_check(fyp, fyn_cpy, err_out,
 				"fy_node_copy() failed");
+		fy_node_set_parent(fyn_cpy, fyn_parent);
 
 		if (!fyn_parent) {
 			fy_doc_debug(fyp, "Replacing root node");
@@ -1531,6 +2284,11 @@ int fy_node_insert(struct fy_node *fyn_to, struct fy_node *fyn_from)
 
 		fy_doc_debug(fyp, "Appending to sequence node");
 
+		while (move && (fyni = fy_node_list_pop(&fyn_from->sequence)) != NULL) {
+			fy_node_set_parent(fyni, fyn_to);
+			fy_node_list_add_tail(&fyn_to->sequence, fyni);
+		}
+
 		for (fyni = fy_node_list_head(&fyn_from->sequence); fyni;
 				fyni = fy_node_next(&fyn_from->sequence, fyni)) {
 
@@ -1543,9 +2301,11 @@ int fy_node_insert(struct fy_node *fyn_to, struct fy_node *fyn_from)
 	} else {
 		/* only mapping is possible here */
 
-		/* iterate over all the keys in the `from` */
-		for (fynpi = fy_node_pair_list_head(&fyn_from->mapping); fynpi;
-			fynpi = fy_node_pair_next(&fyn_from->mapping, fynpi)) {
+		/* iterate over all the keys in the `from` (taking them when moving) */
+		for (fynpi = move ? fy_node_pair_list_pop(&fyn_from->mapping) :
+				    fy_node_pair_list_head(&fyn_from->mapping); fynpi;
+			fynpi = move ? fy_node_pair_list_pop(&fyn_from->mapping) :
+				       fy_node_pair_next(&fyn_from->mapping, fynpi)) {
 
 			/* find whether the key already exists */
 			for (fynpj = fy_node_pair_list_head(&fyn_to->mapping); fynpj;
@@ -1555,7 +2315,15 @@ int fy_node_insert(struct fy_node *fyn_to, struct fy_node *fyn_from)
 					break;
 			}
 
-			if (!fynpj) {
+			if (!fynpj && move) {
+				fy_doc_debug(fyp, "Moving to mapping node");
+
+				fy_node_pair_set_parent(fynpi, fyn_to);
+				if (fynpi->value)
+					fy_node_set_parent(fynpi->value, fyn_to);
+				fy_node_pair_list_add_tail(&fyn_to->mapping, fynpi);
+
+			} else if (!fynpj) {
 				fy_doc_debug(fyp, "Appending to mapping node");
 
 				/* not found? append it */
@@ -1563,7 +2331,7 @@ int fy_node_insert(struct fy_node *fyn_to, struct fy_node *fyn_from)
 				fy_error_check(fyp, fynpj, err_out,
 						"fy_node_pair_alloc() failed");
 
-				fynpj->key = fy_node_copy(fyd, fynpi->key);
+				fy_node_pair_link_key(fynpj, fy_node_copy(fyd, fynpi->key));
 				fy_error_check(fyp, !fynpi->key || fynpj->key, err_out,
 						"fy_node_copy() failed");
 				fynpj->value = fy_node_copy(fyd, fynpi->value);
@@ -1572,6 +2340,18 @@ int fy_node_insert(struct fy_node *fyn_to, struct fy_node *fyn_from)
 
 				fy_node_pair_list_add_tail(&fyn_to->mapping, fynpj);
 
+			} else if (move) {
+
+				fy_doc_debug(fyp, "Updating mapping node value");
+
+				/* found? replace value, dropping the moved key */
+				fy_node_free(fynpj->value);
+				fynpj->value = fynpi->value;
+				fynpi->value = NULL;
+				if (fynpj->value)
+					fy_node_set_parent(fynpj->value, fyn_to);
+				fy_node_pair_free(fynpi);
+
 			} else {
 
 				fy_doc_debug(fyp, "Updating mapping node value");
@@ -1585,6 +2365,12 @@ int fy_node_insert(struct fy_node *fyn_to, struct fy_node *fyn_from)
 		}
 	}
 
+	/* the emptied source is all that's left */
+	if (move) {
+		fy_node_free(fyn_from);
+		return 0;
+	}
+
 	/* if the documents differ, merge their states */
 	if (fyn_to->fyd != fyn_from->fyd) {
 		rc = fy_document_state_merge(fyn_to->fyd, fyn_from->fyd);
@@ -1595,6 +2381,50 @@ int fy_node_insert(struct fy_node *fyn_to, struct fy_node *fyn_from)
 	return 0;
 
 err_out:
+	/* a moved node is consumed either way */
+	if (move)
+		fy_node_free(fyn_from);
+	return -1;
+}
+
+int fy_node_insert(struct fy_node *fyn_to, struct fy_node *fyn_from)
+{
+	return fy_node_insert_internal(fyn_to, fyn_from, false);
+}
+
+int fy_node_insert_move(struct fy_node *fyn_to, struct fy_node *fyn_from)
+{
+	struct fy_node *fyn;
+	int rc;
+
+	if (!fyn_from)
+		return fy_node_insert_internal(fyn_to, NULL, false);
+
+	if (!fyn_to || !fyn_to->fyd)
+		goto err_out;
+
+	/* can't move a node into itself */
+	for (fyn = fyn_to; fyn; fyn = fy_node_parent(fyn)) {
+		if (fyn == fyn_from)
+			goto err_out;
+	}
+
+	/* the tag directives are needed while the source is still there */
+	if (fyn_to->fyd != fyn_from->fyd) {
+		rc = fy_document_state_merge(fyn_to->fyd, fyn_from->fyd);
+		if (rc)
+			goto err_out;
+	}
+
+	fyn = fy_node_steal(fyn_to->fyd, fyn_from);
+	if (!fyn)
+		return -1;
+
+	return fy_node_insert_internal(fyn_to, fyn, true);
+
+err_out:
+	/* consumed even though it can't be moved */
+	fy_node_free(fy_node_steal(fyn_from->fyd, fyn_from));
 	return -1;
 }
 
@@ -1644,7 +2474,17 @@ static int fy_document_node_update_tags(struct fy_document *fyd, struct fy_node
 			fy_token_unref(fyn->tag->tag.fyt_td);
 			fyn->tag->tag.fyt_td = fy_token_ref(fyt_td);
 
+			/* the resolved text might differ now */
+			fy_interned_tag_unref(fyn->tag->tag.interned);
+			fyn->tag->tag.interned = NULL;
+			if (fyn->tag->text0) {
+				free(fyn->tag->text0);
+				fyn->tag->text0 = NULL;
+			}
+			fyn->tag->text = NULL;
 		}
+
+		fy_document_state_intern_tag(fyd->fyds, fyn->tag);
 	}
 
 
@@ -1993,7 +2833,7 @@ static int fy_resolve_merge_key_populate(struct fy_document *fyd, struct fy_node
 		fy_error_check(fyd->fyp, fynpn, err_out,
 				"fy_node_pair_alloc() failed");
 
-		fynpn->key = fy_node_copy(fyd, fynpi->key);
+		fy_node_pair_link_key(fynpn, fy_node_copy(fyd, fynpi->key));
 		fynpn->value = fy_node_copy(fyd, fynpi->value);
 
 
@@ -2116,7 +2956,7 @@ static int fy_resolve_anchor_node(struct fy_document *fyd, struct fy_node *fyn)
 	return ret_rc;
 }
 
-static void fy_resolve_parent_node(struct fy_document *fyd, struct fy_node *fyn, struct fy_node *fyn_parent)
+void fy_resolve_parent_node(struct fy_document *fyd, struct fy_node *fyn, struct fy_node *fyn_parent)
 {
 	struct fy_node *fyni;
 	struct fy_node_pair *fynp, *fynpi;
@@ -2124,7 +2964,7 @@ static void fy_resolve_parent_node(struct fy_document *fyd, struct fy_node *fyn,
 	if (!fyn)
 		return;
 
-	fyn->parent = fyn_parent;
+	fy_node_set_parent(fyn, fyn_parent);
 
 	switch (fyn->type) {
 	case FYNT_SCALAR:
@@ -2146,7 +2986,7 @@ static void fy_resolve_parent_node(struct fy_document *fyd, struct fy_node *fyn,
 			/* the parent of the key is always NULL */
 			fy_resolve_parent_node(fyd, fynp->key, NULL);
 			fy_resolve_parent_node(fyd, fynp->value, fyn);
-			fynp->parent = fyn;
+			fy_node_pair_set_parent(fynp, fyn);
 		}
 		break;
 	}
@@ -2159,6 +2999,9 @@ int fy_document_resolve(struct fy_document *fyd)
 	if (!fyd)
 		return 0;
 
+	/* aliases and merge keys are replaced in place */
+	fy_document_modified(fyd);
+
 	rc = fy_resolve_anchor_node(fyd, fyd->root);
 
 	/* redo parent resolution */
@@ -2229,6 +3072,7 @@ struct fy_document *fy_document_create(const struct fy_parse_cfg *cfg)
 {
 	struct fy_parser *fyp = NULL;
 	struct fy_document *fyd = NULL;
+	int rc;
 
 	if (!cfg)
 		cfg = &doc_parse_default_cfg;
@@ -2244,6 +3088,8 @@ struct fy_document *fy_document_create(const struct fy_parse_cfg *cfg)
 
 	fyd->fyp = fyp;
 	fy_talloc_list_init(&fyd->tallocs);
+	fy_tpool_init_indexed(&fyd->node_pool, &fyd->tallocs, sizeof(struct fy_node));
+	fy_tpool_init_indexed(&fyd->pair_pool, &fyd->tallocs, sizeof(struct fy_node_pair));
 
 	fy_anchor_list_init(&fyd->anchors);
 	fyd->root = NULL;
@@ -2260,6 +3106,12 @@ struct fy_document *fy_document_create(const struct fy_parse_cfg *cfg)
 	fyd->errsz = 0;
 
 	fy_document_list_init(&fyd->children);
+	fy_document_index_list_init(&fyd->indexes);
+	fy_ordered_index_list_init(&fyd->ordered_indexes);
+
+	rc = fy_document_setup_spill(fyd);
+	fy_error_check(fyp, !rc, err_out,
+			"fy_document_setup_spill() failed");
 
 	return fyd;
 
@@ -2279,6 +3131,18 @@ static int parser_setup_from_string(struct fy_parser *fyp, void *user)
 	return fy_parser_set_string(fyp, user);
 }
 
+struct fy_malloc_string_ctx {
+	char *str;
+	size_t len;
+};
+
+static int parser_setup_from_malloc_string(struct fy_parser *fyp, void *user)
+{
+	struct fy_malloc_string_ctx *msctx = user;
+
+	return fy_parser_set_malloc_string(fyp, msctx->str, msctx->len);
+}
+
 static int parser_setup_from_file(struct fy_parser *fyp, void *user)
 {
 	return fy_parser_set_input_file(fyp, user);
@@ -2446,18 +3310,34 @@ void fy_node_pair_set_key(struct fy_node_pair *fynp, struct fy_node *fyn)
 {
 	if (!fynp)
 		return;
+	/* the node is freed to the pool of its own document */
+	if (fyn && fyn->fyd != fynp->fyd) {
+		fy_error(fynp->fyd->fyp, "fy_node_pair_set_key() node of another document");
+		return;
+	}
+	if (fynp->parent)
+		fy_document_modified(fynp->fyd);
 	if (fynp->key)
 		fy_node_free(fynp->key);
-	fynp->key = fyn;
+	fy_node_pair_link_key(fynp, fyn);
 }
 
 void fy_node_pair_set_value(struct fy_node_pair *fynp, struct fy_node *fyn)
 {
 	if (!fynp)
 		return;
-	if (fynp->value)
+	/* the node is freed to the pool of its own document */
+	if (fyn && fyn->fyd != fynp->fyd) {
+		fy_error(fynp->fyd->fyp, "fy_node_pair_set_value() node of another document");
+		return;
+	}
+	if (fynp->value) {
+		fy_node_detached(fynp->value);
 		fy_node_free(fynp->value);
+	}
 	fynp->value = fyn;
+	if (fynp->parent)
+		fy_node_modified(fy_node_pair_parent(fynp), fyn);
 }
 
 struct fy_node *fy_document_root(struct fy_document *fyd)
@@ -2481,6 +3361,15 @@ const char *fy_node_get_tag(struct fy_node *fyn, size_t *lenp)
 
 }
 
+int fy_node_get_tag_id(struct fy_node *fyn)
+{
+	/* interned when the tag was set, so this only reads */
+	if (!fyn || !fyn->tag || fyn->tag->type != FYTT_TAG || !fyn->tag->tag.interned)
+		return -1;
+
+	return fyn->tag->tag.interned->id;
+}
+
 const char *fy_node_get_scalar(struct fy_node *fyn, size_t *lenp)
 {
 	size_t tmplen;
@@ -2648,57 +3537,38 @@ struct fy_node *fy_node_mapping_lookup_by_string(struct fy_node *fyn, const char
 	return fyn_value;
 }
 
-struct fy_node *fy_node_by_path(struct fy_node *fyn, const char *path)
+const char *fy_path_parse_seq_index(const char *path, int *idxp)
 {
-	const char *s, *e;
+	const char *s;
 	char *end_idx;
-	char *keybuf, *d;
-	char c;
-	int idx;
 
-	if (!fyn || !path)
+	s = path;
+	while (*s && isspace(*s))
+		s++;
+	if (*s++ != '[')
 		return NULL;
-
-	/* skip all prefixed / */
-	while (*path && *path == '/')
-		path++;
-
-	/* for a last component / always match this one */
-	if (!*path)
-		return fyn;
-
-	/* scalar can't match (it has no key) */
-	if (fy_node_is_scalar(fyn))
+	*idxp = (int)strtol(s, &end_idx, 10);
+	s = end_idx;
+	while (*s && isspace(*s))
+		s++;
+	if (*s++ != ']')
 		return NULL;
+	while (*s && isspace(*s))
+		s++;
+	return s;
+}
 
-	/* for a sequence the only allowed key is [n] where n is the index to follow */
-	if (fy_node_is_sequence(fyn)) {
-		s = path;
-		while (*s && isspace(*s))
-			s++;
-		if (*s++ != '[')
-			return NULL;
-		idx = (int)strtol(s, &end_idx, 10);
-		s = end_idx;
-		while (*s && isspace(*s))
-			s++;
-		if (*s++ != ']')
-			return NULL;
-		while (*s && isspace(*s))
-			s++;
-		path = s;
-		return fy_node_by_path(fy_node_sequence_get_by_index(fyn, idx), path);
-	}
-
-	/* be a little bit paranoid */
-	assert(fy_node_is_mapping(fyn));
+const char *fy_path_parse_map_key(const char *path, char *keybuf)
+{
+	const char *s, *e;
+	char *d;
+	char c;
 
 	/* scan ahead for the end of the path component
 	 * note that we don't do UTF8 here, because all the
 	 * escapes are regular ascii characters, i.e.
 	 * '/', '*', '&', '.', '{', '}', '[', ']' and '\\'
 	 */
-	keybuf = alloca(strlen(path) + 1);
 	d = keybuf;
 
 	s = path;
@@ -2749,8 +3619,45 @@ struct fy_node *fy_node_by_path(struct fy_node *fyn, const char *path)
 	/* terminate component */
 	*d = '\0';
 
-	/* point path to the next component (or NULL is end */
-	path = s;
+	/* point to the next component */
+	return s;
+}
+
+struct fy_node *fy_node_by_path(struct fy_node *fyn, const char *path)
+{
+	char *keybuf;
+	int idx;
+
+	if (!fyn || !path)
+		return NULL;
+
+	/* skip all prefixed / */
+	while (*path && *path == '/')
+		path++;
+
+	/* for a last component / always match this one */
+	if (!*path)
+		return fyn;
+
+	/* scalar can't match (it has no key) */
+	if (fy_node_is_scalar(fyn))
+		return NULL;
+
+	/* for a sequence the only allowed key is [n] where n is the index to follow */
+	if (fy_node_is_sequence(fyn)) {
+		path = fy_path_parse_seq_index(path, &idx);
+		if (!path)
+			return NULL;
+		return fy_node_by_path(fy_node_sequence_get_by_index(fyn, idx), path);
+	}
+
+	/* be a little bit paranoid */
+	assert(fy_node_is_mapping(fyn));
+
+	keybuf = alloca(strlen(path) + 1);
+	path = fy_path_parse_map_key(path, keybuf);
+	if (!path)
+		return NULL;
 
 	return fy_node_by_path(fy_node_mapping_lookup_by_string(fyn, keybuf), path);
 }
@@ -2762,10 +3669,10 @@ char *fy_node_get_parent_address(struct fy_node *fyn)
 	char *path = NULL;
 	int idx, ret;
 
-	if (!fyn || !fyn->parent)
+	if (!fyn || !fy_node_parent(fyn))
 		return NULL;
 
-	parent = fyn->parent;
+	parent = fy_node_parent(fyn);
 
 	if (fy_node_is_sequence(parent)) {
 		/* for a sequence, find the index */
@@ -2808,7 +3715,7 @@ char *fy_node_get_path(struct fy_node *fyn)
 		return NULL;
 
 	/* easy on the root */
-	if (!fyn->parent)
+	if (!fy_node_parent(fyn))
 		return strdup("/");
 
 	track = NULL;
@@ -2822,7 +3729,7 @@ char *fy_node_get_path(struct fy_node *fyn)
 
 		len += strlen(path) + 1;
 
-		fyn = fyn->parent;
+		fyn = fy_node_parent(fyn);
 	}
 	len += 2;
 
@@ -2985,6 +3892,21 @@ struct fy_node *fy_node_build_from_string(struct fy_document *fyd, const char *s
 	return fy_node_build_internal(fyd, parser_setup_from_string, (void *)str);
 }
 
+struct fy_node *fy_node_build_from_malloc_string(struct fy_document *fyd, char *str, size_t len)
+{
+	struct fy_malloc_string_ctx msctx;
+
+	/* the string is ours to free if we don't get as far as the parser */
+	if (!fyd || !fyd->fyp) {
+		free(str);
+		return NULL;
+	}
+
+	msctx.str = str;
+	msctx.len = len;
+	return fy_node_build_internal(fyd, parser_setup_from_malloc_string, &msctx);
+}
+
 struct fy_node *fy_node_build_from_file(struct fy_document *fyd, const char *file)
 {
 	return fy_node_build_internal(fyd, parser_setup_from_file, (void *)file);
@@ -2996,16 +3918,31 @@ struct fy_node *fy_node_build_from_fp(struct fy_document *fyd, FILE *fp)
 }
 
 void fy_document_set_root(struct fy_document *fyd, struct fy_node *fyn)
+{
+	if (fy_document_replace_root(fyd, fyn) && fyd)
+		fy_error(fyd->fyp, "fy_document_set_root() node of another document");
+}
+
+int fy_document_replace_root(struct fy_document *fyd, struct fy_node *fyn)
 {
 	if (!fyd)
-		return;
+		return -1;
+
+	/* the node is freed to the pool of its own document */
+	if (fyn && fyn->fyd != fyd)
+		return -1;
+
+	fy_document_modified(fyd);
 
 	if (fyd->root) {
 		fy_node_free(fyd->root);
 		fyd->root = NULL;
 	}
-	fyn->parent = NULL;
+	if (fyn)
+		fy_node_set_parent(fyn, NULL);
 	fyd->root = fyn;
+
+	return 0;
 }
 
 struct fy_node *fy_node_create_scalar(struct fy_document *fyd, const char *data, size_t size)
@@ -3290,6 +4227,8 @@ int fy_node_set_tag(struct fy_node *fyn, const char *data, size_t len)
 	if (!fyt)
 		return -1;
 
+	fy_document_state_intern_tag(fyd->fyds, fyt);
+
 	fy_token_unref(fyn->tag);
 	fyn->tag = fyt;
 
@@ -3311,7 +4250,12 @@ static int fy_node_sequence_insert_prepare(struct fy_node *fyn_seq, struct fy_no
 	if (!fyn_seq || !fyn || fyn_seq->type != FYNT_SEQUENCE)
 		return -1;
 
-	fyn->parent = fyn_seq;
+	/* the node is freed to the pool of its own document */
+	if (fyn->fyd != fyn_seq->fyd)
+		return -1;
+
+	fy_node_set_parent(fyn, fyn_seq);
+	fy_node_modified(fyn_seq, fyn);
 	return 0;
 }
 
@@ -3392,8 +4336,10 @@ struct fy_node *fy_node_sequence_remove(struct fy_node *fyn_seq, struct fy_node
 	if (!fy_node_sequence_contains_node(fyn_seq, fyn))
 		return NULL;
 
+	fy_node_detached(fyn);
 	fy_node_list_del(&fyn_seq->sequence, fyn);
-	fyn->parent = NULL;
+	fy_node_set_parent(fyn, NULL);
+	fy_node_modified(fyn_seq, NULL);
 	return fyn;
 }
 
@@ -3404,25 +4350,36 @@ fy_node_mapping_pair_insert_prepare(struct fy_node *fyn_map,
 	struct fy_document *fyd;
 	struct fy_node_pair *fynp;
 
-	if (!fyn_map || fyn_map->type != FYNT_MAPPING ||
-	    fy_node_mapping_key_is_duplicate(fyn_map, fyn_key))
+	if (!fyn_map || fyn_map->type != FYNT_MAPPING)
 		return NULL;
 
 	fyd = fyn_map->fyd;
 	assert(fyd);
 
+	/* the nodes are freed to the pool of their own document */
+	if ((fyn_key && fyn_key->fyd != fyd) || (fyn_value && fyn_value->fyd != fyd))
+		return NULL;
+
+	if (fy_node_mapping_key_is_duplicate(fyn_map, fyn_key))
+		return NULL;
+
 	fynp = fy_node_pair_alloc(fyd);
 	if (!fynp)
 		return NULL;
 
 	if (fyn_key)
-		fyn_key->parent = NULL;
+		fy_node_set_parent(fyn_key, NULL);
 	if (fyn_value)
-		fyn_value->parent = fyn_map;
+		fy_node_set_parent(fyn_value, fyn_map);
 
-	fynp->key = fyn_key;
+	fy_node_pair_link_key(fynp, fyn_key);
 	fynp->value = fyn_value;
-	fynp->parent = fyn_map;
+	fy_node_pair_set_parent(fynp, fyn_map);
+
+	fy_node_modified(fyn_map, fyn_value);
+	/* the collections in a key are indexed along with the mapping */
+	if (fyn_key && fyn_key->type != FYNT_SCALAR)
+		fy_node_modified(fyn_map, fyn_map);
 
 	return fynp;
 }
@@ -3437,6 +4394,7 @@ int fy_node_mapping_append(struct fy_node *fyn_map,
 		return -1;
 
 	fy_node_pair_list_add_tail(&fyn_map->mapping, fynp);
+	fy_node_pair_added(fynp);
 
 	return 0;
 }
@@ -3451,6 +4409,7 @@ int fy_node_mapping_prepend(struct fy_node *fyn_map,
 		return -1;
 
 	fy_node_pair_list_add(&fyn_map->mapping, fynp);
+	fy_node_pair_added(fynp);
 
 	return 0;
 }
@@ -3474,12 +4433,16 @@ int fy_node_mapping_remove(struct fy_node *fyn_map, struct fy_node_pair *fynp)
 	if (!fy_node_mapping_contains_pair(fyn_map, fynp))
 		return -1;
 
+	fy_node_detached(fynp->key);
+	fy_node_detached(fynp->value);
+	fy_node_pair_removed(fynp);
 	fy_node_pair_list_del(&fyn_map->mapping, fynp);
 
 	if (fynp->value)
-		fynp->value->parent = NULL;
+		fy_node_set_parent(fynp->value, NULL);
 
-	fynp->parent = NULL;
+	fy_node_pair_set_parent(fynp, NULL);
+	fy_node_modified(fyn_map, NULL);
 
 	return 0;
 }
@@ -3494,9 +4457,13 @@ struct fy_node *fy_node_mapping_remove_by_key(struct fy_node *fyn_map, struct fy
 	if (!fynp)
 		return NULL;
 
+	fy_node_detached(fynp->key);
+	fy_node_detached(fynp->value);
+	fy_node_modified(fyn_map, NULL);
+
 	fyn_value = fynp->value;
 	if (fyn_value)
-		fyn_value->parent = NULL;
+		fy_node_set_parent(fyn_value, NULL);
 
 	/* do not free the key if it's the same pointer */
 	if (fyn_key != fynp->key)
@@ -3532,27 +4499,24 @@ const void *a, const void *b, void *arg
 	return ctx->key_cmp(*fynppa, *fynppb, ctx->arg);
 }
 
-/* the default sort method */
-static int fy_node_mapping_sort_cmp_default(const struct fy_node_pair *fynp_a,
-					    const struct fy_node_pair *fynp_b,
-					    void *arg __attribute__((__unused__)))
+/* complex keys of the same type compare equal */
+int fy_node_mapping_key_cmp(const struct fy_node *fyn_a, const struct fy_node *fyn_b)
 {
 	const char *str_a, *str_b;
-	int idx_a, idx_b;
 	size_t len_a = 0, len_b = 0, min_len;
 
 	/* order is: maps first, followed by sequences, and last scalars sorted */
-	if (!fynp_a->key)
+	if (!fyn_a)
 		str_a = "";
-	else if (fy_node_is_scalar(fynp_a->key))
-		str_a = fy_token_get_text(fynp_a->key->scalar, &len_a);
+	else if (fyn_a->type == FYNT_SCALAR)
+		str_a = fy_token_get_text(fyn_a->scalar, &len_a);
 	else
 		str_a = NULL;
 
-	if (!fynp_b->key)
+	if (!fyn_b)
 		str_b = "";
-	else if (fy_node_is_scalar(fynp_b->key))
-		str_b = fy_token_get_text(fynp_b->key->scalar, &len_b);
+	else if (fyn_b->type == FYNT_SCALAR)
+		str_b = fy_token_get_text(fyn_b->scalar, &len_b);
 	else
 		str_b = NULL;
 
@@ -3571,16 +4535,42 @@ static int fy_node_mapping_sort_cmp_default(const struct fy_node_pair *fynp_a,
 		return 1;
 
 	/* different types, mappings win */
-	if (fynp_a->key->type != fynp_b->key->type)
-		return fynp_a->key->type == FYNT_MAPPING ? -1 : 1;
+	if (fyn_a->type != fyn_b->type)
+		return fyn_a->type == FYNT_MAPPING ? -1 : 1;
+
+	return 0;
+}
+
+/* without an index, complex keys compare equal (and keep their order) */
+static int fy_node_mapping_sort_cmp_keys(const struct fy_node_pair *fynp_a,
+					 const struct fy_node_pair *fynp_b,
+					 bool by_index)
+{
+	int idx_a, idx_b, rc;
+
+	rc = fy_node_mapping_key_cmp(fynp_a->key, fynp_b->key);
+	if (rc || !by_index)
+		return rc;
+
+	/* only complex keys get here */
+	if (!fynp_a->key || fy_node_is_scalar(fynp_a->key))
+		return 0;
 
 	/* ok, need to compare indices now */
-	idx_a = fy_node_mapping_get_pair_index(fynp_a->parent, fynp_a);
-	idx_b = fy_node_mapping_get_pair_index(fynp_b->parent, fynp_b);
+	idx_a = fy_node_mapping_get_pair_index(fy_node_pair_parent(fynp_a), fynp_a);
+	idx_b = fy_node_mapping_get_pair_index(fy_node_pair_parent(fynp_b), fynp_b);
 
 	return idx_a > idx_b ? 1 : (idx_a < idx_b ? -1 : 0);
 }
 
+/* the default sort method */
+static int fy_node_mapping_sort_cmp_default(const struct fy_node_pair *fynp_a,
+					    const struct fy_node_pair *fynp_b,
+					    void *arg __attribute__((__unused__)))
+{
+	return fy_node_mapping_sort_cmp_keys(fynp_a, fynp_b, true);
+}
+
 void fy_node_mapping_perform_sort(struct fy_node *fyn_map,
 		fy_node_mapping_sort_fn key_cmp, void *arg,
 		struct fy_node_pair **fynpp, int count)
@@ -3641,6 +4631,67 @@ void fy_node_mapping_sort_release_array(struct fy_node *fyn_map, struct fy_node_
 	free(fynpp);
 }
 
+/*
+ * Bottom up merge sort of the pairs, linked through their next ids
+ * only while sorting. Every pass walks the runs from start to end, so
+ * there's no extra memory to allocate, and a mapping paged out to a
+ * spill file is paged back in sequentially, a run at a time. Equal
+ * keys keep their order, so there's no need for their indices.
+ */
+static void fy_node_mapping_sort_list(struct fy_node *fyn_map)
+{
+	struct fy_node_pair_list *fynpl = &fyn_map->mapping;
+	struct fy_node_pair *list, *tail, *p, *q, *e;
+	int insize, merges, psize, qsize;
+
+	list = fy_node_pair_list_head(fynpl);
+	if (!list)
+		return;
+
+	for (insize = 1; ; insize <<= 1) {
+		p = list;
+		list = tail = NULL;
+		merges = 0;
+
+		while (p) {
+			merges++;
+			for (q = p, psize = 0; q && psize < insize; psize++)
+				q = fy_node_pair_next(fynpl, q);
+			qsize = insize;
+
+			/* equal ones are taken from the left run, keeping their order */
+			while (psize > 0 || (qsize > 0 && q)) {
+				if (!psize || (qsize > 0 && q && fy_node_mapping_sort_cmp_keys(q, p, false) < 0)) {
+					e = q;
+					q = fy_node_pair_next(fynpl, q);
+					qsize--;
+				} else {
+					e = p;
+					p = fy_node_pair_next(fynpl, p);
+					psize--;
+				}
+				if (tail)
+					tail->next = e->id;
+				else
+					list = e;
+				tail = e;
+			}
+			p = q;
+		}
+		tail->next = 0;
+
+		if (merges <= 1)
+			break;
+	}
+
+	/* and thread them back in the list */
+	fy_node_pair_list_init(fynpl);
+	for (e = list; e; e = p) {
+		p = fy_node_pair_next(fynpl, e);
+		fy_node_pair_list_add_tail(fynpl, e);
+	}
+}
+
 int fy_node_mapping_sort(struct fy_node *fyn_map,
 		fy_node_mapping_sort_fn key_cmp,
 		void *arg)
@@ -3648,10 +4699,28 @@ int fy_node_mapping_sort(struct fy_node *fyn_map,
 	int count, i;
 	struct fy_node_pair **fynpp, *fynpi;
 
+	if (!fyn_map || fyn_map->type != FYNT_MAPPING)
+		return -1;
+
+	/*
+	 * No pointer array for a mapping that might not fit in memory.
+	 * The pairs are out of the mapping while sorting, which only the
+	 * default method is known to be fine with; for it, keeping the
+	 * order of equal keys is the same as comparing their indices.
+	 */
+	if (fyn_map->fyd->spill) {
+		if (key_cmp)
+			return -1;
+		fy_document_modified(fyn_map->fyd);
+		fy_node_mapping_sort_list(fyn_map);
+		return 0;
+	}
+
 	fynpp = fy_node_mapping_sort_array(fyn_map, key_cmp, arg, &count);
 	if (!fynpp)
 		return -1;
 
+	fy_document_modified(fyn_map->fyd);
 	fy_node_pair_list_init(&fyn_map->mapping);
 	for (i = 0; i < count; i++) {
 		fynpi = fynpp[i];
@@ -3680,7 +4749,9 @@ int fy_node_sort(struct fy_node *fyn, fy_node_mapping_sort_fn key_cmp, void *arg
 		for (fyni = fy_node_list_head(&fyn->sequence); fyni;
 				fyni = fy_node_next(&fyn->sequence, fyni)) {
 
-			fy_node_sort(fyni, key_cmp, arg);
+			ret = fy_node_sort(fyni, key_cmp, arg);
+			if (ret)
+				return ret;
 		}
 		break;
 
@@ -3702,7 +4773,7 @@ int fy_node_sort(struct fy_node *fyn, fy_node_mapping_sort_fn key_cmp, void *arg
 			if (ret)
 				return ret;
 
-			fynp->parent = fyn;
+			fy_node_pair_set_parent(fynp, fyn);
 		}
 		break;
 	}
@@ -3997,3 +5068,105 @@ bool fy_document_has_explicit_document_end(const struct fy_document *fyd)
 {
 	return fyd ? !fyd->fyds->end_implicit : false;
 }
+
+int fy_document_get_dedup_stats(const struct fy_document *fyd, size_t *scalarsp,
+				size_t *sharedp, size_t *bytesp)
+{
+	if (!fyd)
+		return -1;
+
+	if (scalarsp)
+		*scalarsp = fyd->dedup_scalars;
+	if (sharedp)
+		*sharedp = fyd->dedup_shared;
+	if (bytesp)
+		*bytesp = fyd->dedup_bytes;
+
+	return 0;
+}
+
+static void fy_token_memory_usage(struct fy_token *fyt, struct fy_memory_report *report)
+{
+	size_t text;
+
+	if (!fyt)
+		return;
+
+	text = fyt->text0 ? fyt->text_len + 1 : 0;
+	if (fyt->refs > 1) {
+		report->shared += sizeof(*fyt) + text;
+	} else {
+		report->tokens += sizeof(*fyt);
+		report->text += text;
+	}
+
+	if (fy_atom_is_set(&fyt->handle))
+		report->input += fyt->handle.end_mark.input_pos -
+				 fyt->handle.start_mark.input_pos;
+}
+
+static void fy_node_memory_usage_add(struct fy_node *fyn, struct fy_memory_report *report,
+				     bool recursive)
+{
+	struct fy_node *fyni;
+	struct fy_node_pair *fynp;
+
+	if (!fyn)
+		return;
+
+	report->nodes += sizeof(*fyn);
+	report->count++;
+	fy_token_memory_usage(fyn->tag, report);
+
+	switch (fyn->type) {
+	case FYNT_SCALAR:
+		fy_token_memory_usage(fyn->scalar, report);
+		break;
+
+	case FYNT_SEQUENCE:
+		fy_token_memory_usage(fyn->sequence_start, report);
+		fy_token_memory_usage(fyn->sequence_end, report);
+		if (!recursive)
+			break;
+		for (fyni = fy_node_list_head(&fyn->sequence); fyni;
+				fyni = fy_node_next(&fyn->sequence, fyni))
+			fy_node_memory_usage_add(fyni, report, true);
+		break;
+
+	case FYNT_MAPPING:
+		fy_token_memory_usage(fyn->mapping_start, report);
+		fy_token_memory_usage(fyn->mapping_end, report);
+		for (fynp = fy_node_pair_list_head(&fyn->mapping); fynp;
+				fynp = fy_node_pair_next(&fyn->mapping, fynp)) {
+			report->pairs += sizeof(*fynp);
+			if (!recursive)
+				continue;
+			fy_node_memory_usage_add(fynp->key, report, true);
+			fy_node_memory_usage_add(fynp->value, report, true);
+		}
+		break;
+	}
+}
+
+static int fy_node_memory_report(struct fy_node *fyn, struct fy_memory_report *report,
+				 bool recursive)
+{
+	if (!fyn || !report)
+		return -1;
+
+	memset(report, 0, sizeof(*report));
+	fy_node_memory_usage_add(fyn, report, recursive);
+	report->total = report->nodes + report->pairs + report->tokens + report->text;
+
+	return 0;
+}
+
+int fy_node_memory_usage(struct fy_node *fyn, struct fy_memory_report *report)
+{
+	return fy_node_memory_report(fyn, report, true);
+}
+
+int fy_node_memory_usage_self(struct fy_node *fyn, struct fy_memory_report *report)
+{
+	return fy_node_memory_report(fyn, report, false);
+}
@@ -16,6 +16,7 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 
 #include <libfyaml.h>
 
@@ -30,10 +31,13 @@
 struct fy_eventp;
 
 FY_TYPE_FWD_DECL_LIST(document);
+FY_TYPE_FWD_DECL_LIST(document_index);
+FY_TYPE_FWD_DECL_LIST(ordered_index);
+struct fy_text_hash;
 
 struct fy_document_state {
 	struct list_head node;
-	int refs;
+	atomic_int refs;
 	struct fy_version version;
 	bool version_explicit : 1;
 	bool tags_explicit : 1;
@@ -43,28 +47,52 @@ struct fy_document_state {
 	struct fy_mark end_mark;
 	struct fy_token *fyt_vd;		/* version directive */
 	struct fy_token_list fyt_td;		/* tag directives */
+	struct fy_interned_tag_list tags;	/* interned resolved tags */
+	struct fy_interned_tag **tag_buckets;	/* the same, hashed on the text */
+	unsigned int tag_bucket_count;
+	int next_tag_id;			/* also the number of tags */
 };
 FY_PARSE_TYPE_DECL(document_state);
 
 struct fy_node;
 
+/*
+ * Nodes and pairs live in the pools of their document and refer to
+ * each other by their 32-bit pool ids (0 for none) instead of by
+ * pointer: a parent, and the previous and next of the siblings. The
+ * children lists keep the ids of the first and the last child.
+ */
+struct fy_node_list {
+	uint32_t head;
+	uint32_t tail;
+};
+
+struct fy_node_pair_list {
+	uint32_t head;
+	uint32_t tail;
+};
+
 struct fy_node_pair {
-	struct list_head node;
+	uint32_t id;			/* in the pair pool, keep it first */
+	uint32_t prev;
+	uint32_t next;
+	uint32_t parent;		/* the mapping, in the node pool */
 	struct fy_node *key;
 	struct fy_node *value;
 	struct fy_document *fyd;
-	struct fy_node *parent;
 };
-FY_TYPE_FWD_DECL_LIST(node_pair);
-FY_TYPE_DECL_LIST(node_pair);
 
-FY_TYPE_FWD_DECL_LIST(node);
 struct fy_node {
-	struct list_head node;
-	enum fy_node_type type;
+	uint32_t id;			/* in the node pool, keep it first */
+	uint32_t prev;
+	uint32_t next;
+	uint32_t parent;
+	enum fy_node_type type : 2;
+	enum fy_node_style style : 5;	/* FYNS_ANY is -1 */
+	bool reindex : 1;		/* indexed anew on the next index update */
+	bool is_key : 1;		/* the key of a pair (keys have no parent) */
+	unsigned int changed;		/* generation of the last change under it */
 	struct fy_token *tag;
-	enum fy_node_style style;
-	struct fy_node *parent;
 	struct fy_document *fyd;
 	union {
 		struct fy_token *scalar;
@@ -74,18 +102,146 @@ struct fy_node {
 	union {
 		struct fy_token *sequence_start;
 		struct fy_token *mapping_start;
+		struct fy_mark *scalar_marks;	/* start and end of a shared scalar */
 	};
 	union {
 		struct fy_token *sequence_end;
 		struct fy_token *mapping_end;
 	};
 };
-FY_TYPE_DECL_LIST(node);
+
+/*
+ * The methods of the typed lists, on the id links. A list is always
+ * the children of a node, which is where the pool comes from.
+ */
+#define FY_NODE_DECL_ID_LIST(_type, _member, _pool) \
+static inline struct fy_tpool *fy_ ## _type ## _list_pool(struct fy_ ## _type ## _list *_l) \
+{ \
+	return &container_of(_l, struct fy_node, _member)->fyd->_pool; \
+} \
+static inline struct fy_ ## _type *fy_ ## _type ## _of(struct fy_ ## _type ## _list *_l, uint32_t _id) \
+{ \
+	return fy_tpool_ptr(fy_ ## _type ## _list_pool(_l), _id); \
+} \
+static inline void fy_ ## _type ## _list_init(struct fy_ ## _type ## _list *_l) \
+{ \
+	_l->head = _l->tail = 0; \
+} \
+static inline bool fy_ ## _type ## _list_empty(struct fy_ ## _type ## _list *_l) \
+{ \
+	return _l ? !_l->head : true; \
+} \
+static inline void fy_ ## _type ## _list_add(struct fy_ ## _type ## _list *_l, struct fy_ ## _type *_n) \
+{ \
+	if (!_l || !_n) \
+		return; \
+	_n->prev = 0; \
+	_n->next = _l->head; \
+	if (_l->head) \
+		fy_ ## _type ## _of(_l, _l->head)->prev = _n->id; \
+	else \
+		_l->tail = _n->id; \
+	_l->head = _n->id; \
+} \
+static inline void fy_ ## _type ## _list_add_tail(struct fy_ ## _type ## _list *_l, struct fy_ ## _type *_n) \
+{ \
+	if (!_l || !_n) \
+		return; \
+	_n->next = 0; \
+	_n->prev = _l->tail; \
+	if (_l->tail) \
+		fy_ ## _type ## _of(_l, _l->tail)->next = _n->id; \
+	else \
+		_l->head = _n->id; \
+	_l->tail = _n->id; \
+} \
+static inline void fy_ ## _type ## _list_del(struct fy_ ## _type ## _list *_l, struct fy_ ## _type *_n) \
+{ \
+	if (!_l || !_n) \
+		return; \
+	if (_n->prev) \
+		fy_ ## _type ## _of(_l, _n->prev)->next = _n->next; \
+	else \
+		_l->head = _n->next; \
+	if (_n->next) \
+		fy_ ## _type ## _of(_l, _n->next)->prev = _n->prev; \
+	else \
+		_l->tail = _n->prev; \
+	_n->prev = _n->next = 0; \
+} \
+static inline void fy_ ## _type ## _list_insert_after(struct fy_ ## _type ## _list *_l, \
+		struct fy_ ## _type *_p, struct fy_ ## _type *_n) \
+{ \
+	if (!_l || !_p || !_n) \
+		return; \
+	_n->prev = _p->id; \
+	_n->next = _p->next; \
+	if (_p->next) \
+		fy_ ## _type ## _of(_l, _p->next)->prev = _n->id; \
+	else \
+		_l->tail = _n->id; \
+	_p->next = _n->id; \
+} \
+static inline void fy_ ## _type ## _list_insert_before(struct fy_ ## _type ## _list *_l, \
+		struct fy_ ## _type *_p, struct fy_ ## _type *_n) \
+{ \
+	if (!_l || !_p || !_n) \
+		return; \
+	_n->next = _p->id; \
+	_n->prev = _p->prev; \
+	if (_p->prev) \
+		fy_ ## _type ## _of(_l, _p->prev)->next = _n->id; \
+	else \
+		_l->head = _n->id; \
+	_p->prev = _n->id; \
+} \
+static inline struct fy_ ## _type *fy_ ## _type ## _list_head(struct fy_ ## _type ## _list *_l) \
+{ \
+	return _l ? fy_ ## _type ## _of(_l, _l->head) : NULL; \
+} \
+static inline struct fy_ ## _type *fy_ ## _type ## _list_tail(struct fy_ ## _type ## _list *_l) \
+{ \
+	return _l ? fy_ ## _type ## _of(_l, _l->tail) : NULL; \
+} \
+static inline struct fy_ ## _type *fy_ ## _type ## _list_pop(struct fy_ ## _type ## _list *_l) \
+{ \
+	struct fy_ ## _type *_n; \
+	\
+	_n = fy_ ## _type ## _list_head(_l); \
+	if (!_n) \
+		return NULL; \
+	fy_ ## _type ## _list_del(_l, _n); \
+	return _n; \
+} \
+static inline struct fy_ ## _type *fy_ ## _type ## _next(struct fy_ ## _type ## _list *_l, struct fy_ ## _type *_n) \
+{ \
+	return _l && _n ? fy_ ## _type ## _of(_l, _n->next) : NULL; \
+} \
+static inline struct fy_ ## _type *fy_ ## _type ## _prev(struct fy_ ## _type ## _list *_l, struct fy_ ## _type *_n) \
+{ \
+	return _l && _n ? fy_ ## _type ## _of(_l, _n->prev) : NULL; \
+} \
+struct __useless_struct_to_allow_semicolon
 
 struct fy_node *fy_node_alloc(struct fy_document *fyd, enum fy_node_type type);
+const struct fy_mark *fy_node_get_start_mark(struct fy_node *fyn);
+const struct fy_mark *fy_node_get_end_mark(struct fy_node *fyn);
+/* the node's text is owned by its input, so it may be copied to another document */
+struct fy_node *fy_node_build_from_malloc_string(struct fy_document *fyd, char *str, size_t len);
 struct fy_node_pair *fy_node_pair_alloc(struct fy_document *fyd);
+bool fy_node_mapping_key_is_duplicate(struct fy_node *fyn, struct fy_node *fyn_key);
+/* fy_document_set_root(), failing for a node of another document */
+int fy_document_replace_root(struct fy_document *fyd, struct fy_node *fyn);
 void fy_node_pair_free(struct fy_node_pair *fynp);
 
+/* set the key of a pair, which it stays for the rest of its life */
+static inline void fy_node_pair_link_key(struct fy_node_pair *fynp, struct fy_node *fyn)
+{
+	fynp->key = fyn;
+	if (fyn)
+		fyn->is_key = true;
+}
+
 struct fy_anchor {
 	struct list_head node;
 	struct fy_node *fyn;
@@ -94,6 +250,26 @@ struct fy_anchor {
 FY_TYPE_FWD_DECL_LIST(anchor);
 FY_TYPE_DECL_LIST(anchor);
 
+struct fy_token_dedup_entry {
+	uint32_t hash;
+	int next;			/* next entry of the bucket, -1 for none */
+	struct fy_token *fyt;		/* the first of its kind (not referenced) */
+};
+
+/*
+ * The scalar tokens loaded so far, hashed on their style and source
+ * text; a repeated scalar is replaced by a reference to the first one,
+ * and its node keeps its own marks. Tokens are immutable, so a node
+ * changed later gets a token of its own while the others keep sharing.
+ */
+struct fy_token_dedup {
+	struct fy_token_dedup_entry *entries;
+	int count;
+	int alloc;
+	int *buckets;
+	unsigned int bucket_count;
+};
+
 struct fy_document {
 	struct list_head node;
 	struct fy_talloc_list tallocs;
@@ -101,8 +277,20 @@ struct fy_document {
 	struct fy_document_state *fyds;
 	struct fy_parser *fyp;
 	struct fy_node *root;
+	struct fy_tpool node_pool;
+	struct fy_tpool pair_pool;
+	struct fy_spill *spill;		/* the pools' storage, for FYPCF_SPILL */
 	bool owns_parser : 1;
 	bool parse_error : 1;
+	unsigned int generation;	/* bumped on every structural change */
+	unsigned int rebuild_generation; /* of the last one indexes can't follow */
+	struct fy_document_index_list indexes;
+	struct fy_ordered_index_list ordered_indexes;
+	struct fy_text_hash *ordered_maps; /* mapping (its address) to its ordered index */
+	struct fy_token_dedup *dedup;	/* only while loading */
+	size_t dedup_scalars;		/* scalars loaded */
+	size_t dedup_shared;		/* of them, sharing a token */
+	size_t dedup_bytes;		/* source bytes of the shared ones */
 
 	FILE *errfp;
 	char *errbuf;
@@ -114,6 +302,55 @@ struct fy_document {
 /* only the list declaration/methods */
 FY_TYPE_DECL_LIST(document);
 
+FY_NODE_DECL_ID_LIST(node, sequence, node_pool);
+FY_NODE_DECL_ID_LIST(node_pair, mapping, pair_pool);
+
+static inline struct fy_node *fy_node_parent(const struct fy_node *fyn)
+{
+	return fyn ? fy_tpool_ptr(&fyn->fyd->node_pool, fyn->parent) : NULL;
+}
+
+static inline void fy_node_set_parent(struct fy_node *fyn, struct fy_node *fyn_parent)
+{
+	if (fyn)
+		fyn->parent = fy_tpool_id(fyn_parent);
+}
+
+static inline struct fy_node *fy_node_pair_parent(const struct fy_node_pair *fynp)
+{
+	return fynp ? fy_tpool_ptr(&fynp->fyd->node_pool, fynp->parent) : NULL;
+}
+
+static inline void fy_node_pair_set_parent(struct fy_node_pair *fynp, struct fy_node *fyn_parent)
+{
+	if (fynp)
+		fynp->parent = fy_tpool_id(fyn_parent);
+}
+
+/* anything derived from the tree (like indexes) is out of date now */
+static inline void fy_document_modified(struct fy_document *fyd)
+{
+	if (fyd)
+		fyd->rebuild_generation = ++fyd->generation;
+}
+
+/*
+ * The same, for a change the value indexes can follow: the children of
+ * @fyn_parent changed, and @fyn (if set, usually a node added there) is
+ * to be indexed anew. A node about to leave the tree is reported while
+ * it is still intact, since its entries point into it.
+ */
+void fy_node_modified(struct fy_node *fyn_parent, struct fy_node *fyn);
+void fy_node_detached(struct fy_node *fyn);
+
+/*
+ * And for the key order indexes, which follow the pairs: @fynp was
+ * linked in the mapping it has for parent, or is about to leave it
+ * (to be freed or not) while its key is still intact.
+ */
+void fy_node_pair_added(struct fy_node_pair *fynp);
+void fy_node_pair_removed(struct fy_node_pair *fynp);
+
 struct fy_document_state *fy_document_state_alloc(void);
 void fy_document_state_free(struct fy_document_state *fyds);
 struct fy_document_state *fy_document_state_ref(struct fy_document_state *fyds);
@@ -121,6 +358,8 @@ void fy_document_state_unref(struct fy_document_state *fyds);
 
 struct fy_token *fy_document_state_lookup_tag_directive(struct fy_document_state *fyds,
 		const char *handle, size_t handle_size);
+struct fy_interned_tag *fy_document_state_intern_tag(struct fy_document_state *fyds,
+		struct fy_token *fyt);
 struct fy_document *fy_parse_document_create(struct fy_parser *fyp, struct fy_eventp *fyep);
 
 void fy_document_dump_tag_directives(struct fy_document *fyd, const char *banner);
@@ -142,6 +381,23 @@ struct fy_node_pair **fy_node_mapping_sort_array(struct fy_node *fyn_map,
 
 void fy_node_mapping_sort_release_array(struct fy_node *fyn_map, struct fy_node_pair **fynpp);
 
+/* the order of the keys in the default sort, without the index */
+int fy_node_mapping_key_cmp(const struct fy_node *fyn_a, const struct fy_node *fyn_b);
+
+uint32_t fy_node_hash(struct fy_node *fyn);
+
+const char *fy_path_parse_seq_index(const char *path, int *idxp);
+const char *fy_path_parse_map_key(const char *path, char *keybuf);
+
+int fy_document_state_merge(struct fy_document *fyd, struct fy_document *fydc);
+int fy_parse_document_register_anchor(struct fy_parser *fyp, struct fy_document *fyd,
+				      struct fy_node *fyn, struct fy_token *anchor);
+int fy_parse_document_load_node(struct fy_parser *fyp, struct fy_document *fyd,
+				struct fy_eventp *fyep, struct fy_node **fynp);
+void fy_parse_document_load_abort(struct fy_parser *fyp);
+void fy_resolve_parent_node(struct fy_document *fyd, struct fy_node *fyn,
+			    struct fy_node *fyn_parent);
+
 int fy_parser_move_log_to_document(struct fy_parser *fyp, struct fy_document *fyd);
 bool fy_document_has_error(struct fy_document *fyd);
 const char *fy_document_get_log(struct fy_document *fyd, size_t *sizep);
@@ -0,0 +1,465 @@
+/*
+ * fy-emit-anchor.c - generated anchors for repeated subtrees on output
+ *
+ * Copyright (c) 2019 Pantelis Antoniou <pantelis.antoniou@konsulko.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <libfyaml.h>
+
+#include "fy-parse.h"
+#include "fy-doc.h"
+#include "fy-emit.h"
+#include "fy-utils.h"
+
+static inline uint32_t fy_emit_anchors_node_hash(struct fy_node *fyn)
+{
+	return fy_hash_bytes(FY_HASH_INIT, &fyn, sizeof(fyn));
+}
+
+static int fy_emit_anchors_lookup(struct fy_emit_anchors *fyea, struct fy_node *fyn)
+{
+	uint32_t hash;
+	int i;
+
+	if (!fyn || !fyea->bucket_count)
+		return -1;
+
+	hash = fy_emit_anchors_node_hash(fyn);
+	for (i = fyea->node_buckets[hash & (fyea->bucket_count - 1)]; i >= 0;
+			i = fyea->entries[i].node_next) {
+		if (fyea->entries[i].fyn == fyn)
+			return i;
+	}
+
+	return -1;
+}
+
+static int fy_emit_anchors_rep(struct fy_emit_anchors *fyea, struct fy_node *fyn)
+{
+	int i;
+
+	i = fy_emit_anchors_lookup(fyea, fyn);
+	return i >= 0 ? fyea->entries[i].rep : -1;
+}
+
+static int fy_emit_anchors_grow(struct fy_emit_anchors *fyea)
+{
+	struct fy_emit_anchor_entry *entries, *fyeae;
+	unsigned int bucket_count, mask;
+	int *buckets, *node_buckets, alloc, i;
+
+	alloc = fyea->alloc ? fyea->alloc * 2 : 64;
+	entries = realloc(fyea->entries, alloc * sizeof(*entries));
+	if (!entries)
+		return -1;
+	fyea->entries = entries;
+	fyea->alloc = alloc;
+
+	/* keep the load factor under one half */
+	bucket_count = fyea->bucket_count ? fyea->bucket_count : 16;
+	while (bucket_count < (unsigned int)alloc * 2)
+		bucket_count <<= 1;
+
+	if (bucket_count == fyea->bucket_count)
+		return 0;
+
+	buckets = realloc(fyea->buckets, bucket_count * sizeof(*buckets));
+	if (!buckets)
+		return -1;
+	fyea->buckets = buckets;
+
+	node_buckets = realloc(fyea->node_buckets, bucket_count * sizeof(*node_buckets));
+	if (!node_buckets)
+		return -1;
+	fyea->node_buckets = node_buckets;
+
+	fyea->bucket_count = bucket_count;
+	memset(buckets, 0xff, bucket_count * sizeof(*buckets));
+	memset(node_buckets, 0xff, bucket_count * sizeof(*node_buckets));
+
+	mask = bucket_count - 1;
+	for (i = 0; i < fyea->count; i++) {
+		fyeae = &fyea->entries[i];
+		fyeae->node_next = node_buckets[fyeae->node_hash & mask];
+		node_buckets[fyeae->node_hash & mask] = i;
+
+		/* only the representatives of the classes found so far */
+		if (fyeae->rep != i)
+			continue;
+		fyeae->next = buckets[fyeae->hash & mask];
+		buckets[fyeae->hash & mask] = i;
+	}
+
+	return 0;
+}
+
+static bool fy_emit_anchors_tag_eq(struct fy_node *fyn_a, struct fy_node *fyn_b)
+{
+	const char *text_a, *text_b;
+	size_t len_a, len_b;
+
+	if (!fyn_a->tag || !fyn_b->tag)
+		return !fyn_a->tag && !fyn_b->tag;
+
+	text_a = fy_token_get_text(fyn_a->tag, &len_a);
+	text_b = fy_token_get_text(fyn_b->tag, &len_b);
+
+	return text_a && text_b && len_a == len_b && !memcmp(text_a, text_b, len_a);
+}
+
+/* the children are classified already, so comparing their classes is enough */
+static bool fy_emit_anchors_eq(struct fy_emit_anchors *fyea, struct fy_node *fyn_a,
+			       struct fy_node *fyn_b)
+{
+	struct fy_node *fyni_a, *fyni_b;
+	struct fy_node_pair *fynp_a, *fynp_b;
+	const char *text_a, *text_b;
+	size_t len_a, len_b;
+
+	if (fyn_a->type != fyn_b->type || !fy_emit_anchors_tag_eq(fyn_a, fyn_b))
+		return false;
+
+	switch (fyn_a->type) {
+	case FYNT_SCALAR:
+		/* the style tells plain 1 from '1' */
+		if (fyn_a->style != fyn_b->style)
+			return false;
+		text_a = fy_token_get_text(fyn_a->scalar, &len_a);
+		text_b = fy_token_get_text(fyn_b->scalar, &len_b);
+		if (!text_a || !text_b)
+			return !text_a && !text_b;
+		return len_a == len_b && !memcmp(text_a, text_b, len_a);
+
+	case FYNT_SEQUENCE:
+		fyni_a = fy_node_list_head(&fyn_a->sequence);
+		fyni_b = fy_node_list_head(&fyn_b->sequence);
+		while (fyni_a && fyni_b) {
+			if (fy_emit_anchors_rep(fyea, fyni_a) != fy_emit_anchors_rep(fyea, fyni_b))
+				return false;
+			fyni_a = fy_node_next(&fyn_a->sequence, fyni_a);
+			fyni_b = fy_node_next(&fyn_b->sequence, fyni_b);
+		}
+		return !fyni_a && !fyni_b;
+
+	case FYNT_MAPPING:
+		fynp_a = fy_node_pair_list_head(&fyn_a->mapping);
+		fynp_b = fy_node_pair_list_head(&fyn_b->mapping);
+		while (fynp_a && fynp_b) {
+			if (fy_emit_anchors_rep(fyea, fynp_a->key) != fy_emit_anchors_rep(fyea, fynp_b->key) ||
+			    fy_emit_anchors_rep(fyea, fynp_a->value) != fy_emit_anchors_rep(fyea, fynp_b->value))
+				return false;
+			fynp_a = fy_node_pair_next(&fyn_a->mapping, fynp_a);
+			fynp_b = fy_node_pair_next(&fyn_b->mapping, fynp_b);
+		}
+		return !fynp_a && !fynp_b;
+	}
+
+	return false;
+}
+
+static uint32_t fy_emit_anchors_struct_hash(struct fy_emit_anchors *fyea, struct fy_node *fyn)
+{
+	struct fy_node *fyni;
+	struct fy_node_pair *fynp;
+	enum fy_node_type type = fyn->type;
+	const char *text;
+	size_t len;
+	uint32_t hash;
+	int rep;
+
+	hash = fy_hash_bytes(FY_HASH_INIT, &type, sizeof(type));
+
+	if (fyn->tag) {
+		text = fy_token_get_text(fyn->tag, &len);
+		if (text)
+			hash = fy_hash_bytes(hash, text, len);
+	}
+
+	switch (type) {
+	case FYNT_SCALAR:
+		text = fy_token_get_text(fyn->scalar, &len);
+		if (text)
+			hash = fy_hash_bytes(hash, text, len);
+		break;
+
+	case FYNT_SEQUENCE:
+		for (fyni = fy_node_list_head(&fyn->sequence); fyni;
+				fyni = fy_node_next(&fyn->sequence, fyni)) {
+			rep = fy_emit_anchors_rep(fyea, fyni);
+			hash = fy_hash_bytes(hash, &rep, sizeof(rep));
+		}
+		break;
+
+	case FYNT_MAPPING:
+		for (fynp = fy_node_pair_list_head(&fyn->mapping); fynp;
+				fynp = fy_node_pair_next(&fyn->mapping, fynp)) {
+			rep = fy_emit_anchors_rep(fyea, fynp->key);
+			hash = fy_hash_bytes(hash, &rep, sizeof(rep));
+			rep = fy_emit_anchors_rep(fyea, fynp->value);
+			hash = fy_hash_bytes(hash, &rep, sizeof(rep));
+		}
+		break;
+	}
+
+	return hash;
+}
+
+static void fy_emit_anchors_classify(struct fy_emit_anchors *fyea, int idx)
+{
+	struct fy_emit_anchor_entry *fyeae = &fyea->entries[idx], *fyeae_rep;
+	unsigned int mask = fyea->bucket_count - 1;
+	int i;
+
+	fyeae->hash = fy_emit_anchors_struct_hash(fyea, fyeae->fyn);
+
+	for (i = fyea->buckets[fyeae->hash & mask]; i >= 0; i = fyeae_rep->next) {
+		fyeae_rep = &fyea->entries[i];
+		if (fyeae_rep->hash == fyeae->hash &&
+		    fy_emit_anchors_eq(fyea, fyeae_rep->fyn, fyeae->fyn)) {
+			fyeae->rep = i;
+			return;
+		}
+	}
+
+	/* the first of its kind */
+	fyeae->rep = idx;
+	fyeae->next = fyea->buckets[fyeae->hash & mask];
+	fyea->buckets[fyeae->hash & mask] = idx;
+}
+
+/* returns the index of the entry of the node, -1 on error */
+static int fy_emit_anchors_scan(struct fy_emit_anchors *fyea, struct fy_node *fyn,
+				int parent, bool key)
+{
+	struct fy_emit_anchor_entry *fyeae;
+	struct fy_node *fyni;
+	struct fy_node_pair *fynp;
+	unsigned int mask, size;
+	int idx, i;
+
+	if (fyea->count >= fyea->alloc && fy_emit_anchors_grow(fyea))
+		return -1;
+
+	/* the entry is taken before the children, which point to it */
+	idx = fyea->count++;
+	fyeae = &fyea->entries[idx];
+	memset(fyeae, 0, sizeof(*fyeae));
+	fyeae->fyn = fyn;
+	fyeae->node_hash = fy_emit_anchors_node_hash(fyn);
+	fyeae->parent = parent;
+	fyeae->rep = -1;
+	fyeae->next = -1;
+	fyeae->source = -1;
+	/* keys are never replaced by aliases, and aliases can't have anchors */
+	fyeae->no_alias = key || (fyn->type == FYNT_SCALAR && fyn->style == FYNS_ALIAS);
+
+	mask = fyea->bucket_count - 1;
+	fyeae->node_next = fyea->node_buckets[fyeae->node_hash & mask];
+	fyea->node_buckets[fyeae->node_hash & mask] = idx;
+
+	size = 1;
+	switch (fyn->type) {
+	case FYNT_SCALAR:
+		break;
+
+	case FYNT_SEQUENCE:
+		for (fyni = fy_node_list_head(&fyn->sequence); fyni;
+				fyni = fy_node_next(&fyn->sequence, fyni)) {
+			i = fy_emit_anchors_scan(fyea, fyni, idx, key);
+			if (i < 0)
+				return -1;
+			size += fyea->entries[i].size;
+		}
+		break;
+
+	case FYNT_MAPPING:
+		for (fynp = fy_node_pair_list_head(&fyn->mapping); fynp;
+				fynp = fy_node_pair_next(&fyn->mapping, fynp)) {
+			if (fynp->key) {
+				i = fy_emit_anchors_scan(fyea, fynp->key, idx, true);
+				if (i < 0)
+					return -1;
+				size += fyea->entries[i].size;
+			}
+			if (fynp->value) {
+				i = fy_emit_anchors_scan(fyea, fynp->value, idx, key);
+				if (i < 0)
+					return -1;
+				size += fyea->entries[i].size;
+			}
+		}
+		break;
+	}
+
+	/* the entries may have moved */
+	fyea->entries[idx].size = size;
+	fy_emit_anchors_classify(fyea, idx);
+
+	return idx;
+}
+
+/* walks the nodes in the order they are output, deciding which become aliases */
+static int fy_emit_anchors_plan(struct fy_emit_anchors *fyea, struct fy_node *fyn,
+				bool sort_keys)
+{
+	struct fy_emit_anchor_entry *fyeae, *fyeae_rep;
+	struct fy_node *fyni;
+	struct fy_node_pair *fynp, **fynpp = NULL;
+	int idx, i, rc = 0;
+
+	idx = fy_emit_anchors_lookup(fyea, fyn);
+	if (idx < 0)
+		return 0;
+
+	fyeae = &fyea->entries[idx];
+	fyeae_rep = &fyea->entries[fyeae->rep];
+
+	/* a copy of something output before with an anchor */
+	if (fyeae_rep->source >= 0 && !fyeae->no_alias && fyeae->size >= fyea->min_size) {
+		fyeae->alias = true;
+		fyea->entries[fyeae_rep->source].referenced = true;
+		return 0;
+	}
+
+	/* aliases can't have anchors, and small subtrees are never referred to */
+	if (fyeae_rep->source < 0 &&
+	    (fyeae->has_anchor ||
+	     (fyeae->size >= fyea->min_size && !(fyn->type == FYNT_SCALAR && fyn->style == FYNS_ALIAS))))
+		fyeae_rep->source = idx;
+
+	switch (fyn->type) {
+	case FYNT_SCALAR:
+		break;
+
+	case FYNT_SEQUENCE:
+		for (fyni = fy_node_list_head(&fyn->sequence); fyni && !rc;
+				fyni = fy_node_next(&fyn->sequence, fyni))
+			rc = fy_emit_anchors_plan(fyea, fyni, sort_keys);
+		break;
+
+	case FYNT_MAPPING:
+		/* in the same order as fy_emit_mapping() */
+		if (sort_keys) {
+			fynpp = fy_node_mapping_sort_array(fyn, NULL, NULL, NULL);
+			if (!fynpp)
+				return -1;
+		}
+		for (i = 0, fynp = fynpp ? fynpp[0] : fy_node_pair_list_head(&fyn->mapping); fynp && !rc;
+		     fynp = fynpp ? fynpp[++i] : fy_node_pair_next(&fyn->mapping, fynp)) {
+			rc = fy_emit_anchors_plan(fyea, fynp->key, sort_keys);
+			if (!rc)
+				rc = fy_emit_anchors_plan(fyea, fynp->value, sort_keys);
+		}
+		fy_node_mapping_sort_release_array(fyn, fynpp);
+		break;
+	}
+
+	return rc;
+}
+
+struct fy_emit_anchors *fy_emit_anchors_create(struct fy_document *fyd, unsigned int min_size,
+					       bool sort_keys)
+{
+	struct fy_emit_anchors *fyea;
+	struct fy_anchor *fya;
+	int i;
+
+	if (!fyd)
+		return NULL;
+
+	fyea = malloc(sizeof(*fyea));
+	if (!fyea)
+		return NULL;
+	memset(fyea, 0, sizeof(*fyea));
+
+	fyea->fyd = fyd;
+	fyea->min_size = min_size ? min_size : FY_EMIT_AUTO_ANCHOR_MIN_DEFAULT;
+
+	if (fyd->root && fy_emit_anchors_scan(fyea, fyd->root, -1, false) < 0)
+		goto err_out;
+
+	/* an anchor can not be dropped, so what holds it is never an alias */
+	for (fya = fy_anchor_list_head(&fyd->anchors); fya;
+			fya = fy_anchor_next(&fyd->anchors, fya)) {
+		i = fy_emit_anchors_lookup(fyea, fya->fyn);
+		if (i >= 0)
+			fyea->entries[i].has_anchor = true;
+		for (; i >= 0 && !fyea->entries[i].anchored; i = fyea->entries[i].parent) {
+			fyea->entries[i].anchored = true;
+			fyea->entries[i].no_alias = true;
+		}
+	}
+
+	if (fyd->root && fy_emit_anchors_plan(fyea, fyd->root, sort_keys))
+		goto err_out;
+
+	return fyea;
+
+err_out:
+	fy_emit_anchors_destroy(fyea);
+	return NULL;
+}
+
+void fy_emit_anchors_destroy(struct fy_emit_anchors *fyea)
+{
+	if (!fyea)
+		return;
+
+	free(fyea->node_buckets);
+	free(fyea->buckets);
+	free(fyea->entries);
+	free(fyea);
+}
+
+enum fy_emit_anchor_action fy_emit_anchors_get(struct fy_emit_anchors *fyea, struct fy_node *fyn,
+					       char *buf, size_t bufsz,
+					       const char **namep, size_t *lenp)
+{
+	struct fy_emit_anchor_entry *fyeae, *fyeae_src;
+	int i, len;
+
+	*namep = NULL;
+	*lenp = 0;
+
+	i = fy_emit_anchors_lookup(fyea, fyn);
+	if (i < 0)
+		return fyeaa_none;
+
+	fyeae = &fyea->entries[i];
+
+	/* the source is output first, and has its anchor by now */
+	if (fyeae->alias) {
+		fyeae_src = &fyea->entries[fyea->entries[fyeae->rep].source];
+		if (fyeae_src->has_anchor) {
+			*namep = fy_anchor_get_text(fy_document_lookup_anchor_by_node(fyea->fyd,
+							fyeae_src->fyn), lenp);
+			return *namep ? fyeaa_alias : fyeaa_none;
+		}
+		len = snprintf(buf, bufsz, "a%d", fyeae_src->id);
+		*namep = buf;
+		*lenp = len;
+		return fyeaa_alias;
+	}
+
+	if (!fyeae->referenced || fyeae->has_anchor)
+		return fyeaa_none;
+
+	/* skip the names already taken by the document */
+	do {
+		fyeae->id = ++fyea->last_id;
+		len = snprintf(buf, bufsz, "a%d", fyeae->id);
+	} while (fy_document_lookup_anchor(fyea->fyd, buf));
+
+	*namep = buf;
+	*lenp = len;
+	return fyeaa_anchor;
+}
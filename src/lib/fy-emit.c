@@ -87,6 +87,7 @@ void fy_emit_node_internal(struct fy_emitter *emit, struct fy_node *fyn, int fla
 void fy_emit_scalar(struct fy_emitter *emit, struct fy_node *fyn, int flags, int indent);
 void fy_emit_sequence(struct fy_emitter *emit, struct fy_node *fyn, int flags, int indent);
 void fy_emit_mapping(struct fy_emitter *emit, struct fy_node *fyn, int flags, int indent);
+void fy_emit_write_alias(struct fy_emitter *emit, int flags, int indent, const char *str, size_t len);
 
 void fy_emit_write(struct fy_emitter *emit, enum fy_emitter_write_type type, const char *str, int len)
 {
@@ -438,30 +439,21 @@ void fy_emit_node_comment(struct fy_emitter *emit, struct fy_node *fyn, int flag
 	}
 }
 
-void fy_emit_node_internal(struct fy_emitter *emit, struct fy_node *fyn, int flags, int indent)
+/* anchor and tag of a node, common for node and event output */
+static void fy_emit_common_node_preamble(struct fy_emitter *emit,
+					 const char *anchor, size_t anchor_len,
+					 struct fy_token *fyt_tag, int flags, int indent)
 {
-	enum fy_node_type type;
-	struct fy_anchor *fya = NULL;
-	const char *anchor = NULL;
 	const char *tag = NULL;
 	const char *td_prefix __FY_DEBUG_UNUSED__;
 	const char *td_handle;
 	size_t td_prefix_size, td_handle_size;
-	size_t tag_len = 0, anchor_len = 0;
-	bool json_mode = false;
+	size_t tag_len = 0;
 
-	if (!fyn)
-		return;
-
-	json_mode = fy_emit_is_json_mode(emit);
-
-	if (!json_mode) {
-		fya = fy_document_lookup_anchor_by_node(emit->fyd, fyn);
-		if (fya)
-			anchor = fy_anchor_get_text(fya, &anchor_len);
+	if (!fy_emit_is_json_mode(emit)) {
 
-		if (fyn->tag)
-			tag = fy_token_get_text(fyn->tag, &tag_len);
+		if (fyt_tag)
+			tag = fy_token_get_text(fyt_tag, &tag_len);
 
 		if (anchor) {
 			fy_emit_write_indicator(emit, di_ambersand, flags, indent, fyewt_anchor);
@@ -472,9 +464,9 @@ void fy_emit_node_internal(struct fy_emitter *emit, struct fy_node *fyn, int fla
 			if (!fy_emit_whitespace(emit))
 				fy_emit_write_ws(emit);
 
-			td_handle = fy_tag_token_get_directive_handle(fyn->tag, &td_handle_size);
+			td_handle = fy_tag_token_get_directive_handle(fyt_tag, &td_handle_size);
 			assert(td_handle);
-			td_prefix = fy_tag_token_get_directive_prefix(fyn->tag, &td_prefix_size);
+			td_prefix = fy_tag_token_get_directive_prefix(fyt_tag, &td_prefix_size);
 			assert(td_prefix);
 
 			if (!td_handle_size)
@@ -494,6 +486,104 @@ void fy_emit_node_internal(struct fy_emitter *emit, struct fy_node *fyn, int fla
 		fy_emit_putc(emit, fyewt_linebreak, '\n');
 		emit->flags = FYEF_WHITESPACE | FYEF_INDENTATION;
 	}
+}
+
+/* merge keys are resolved only when their values are aliases */
+static bool fy_emit_is_merge_key(struct fy_node *fyn)
+{
+	const char *text;
+	size_t len;
+
+	if (!fyn || fyn->type != FYNT_SCALAR || fyn->style != FYNS_PLAIN)
+		return false;
+
+	text = fy_token_get_text(fyn->scalar, &len);
+	return text && len == 2 && !memcmp(text, "<<", 2);
+}
+
+/* the node an alias is output as when expanding, NULL to output it as is */
+static struct fy_node *fy_emit_alias_target(struct fy_emitter *emit, struct fy_node *fyn)
+{
+	struct fy_node *fyn_target;
+	int i;
+
+	if (!(emit->cfg->flags & FYECF_EXPAND_ALIASES) || !emit->fyd || !fyn ||
+	    fyn->type != FYNT_SCALAR || fyn->style != FYNS_ALIAS || emit->merge_value)
+		return NULL;
+
+	fyn_target = fy_anchor_node(fy_document_lookup_anchor_by_token(emit->fyd, fyn->scalar));
+	if (!fyn_target)
+		return NULL;
+
+	/* an alias within its own target stays an alias */
+	for (i = 0; i < emit->expanding_count; i++) {
+		if (emit->expanding[i] == fyn_target)
+			return NULL;
+	}
+
+	return fyn_target;
+}
+
+static void fy_emit_expand_alias(struct fy_emitter *emit, struct fy_node *fyn_target,
+				 int flags, int indent)
+{
+	struct fy_node **expanding;
+	int alloc;
+
+	if (emit->expanding_count >= emit->expanding_alloc) {
+		alloc = emit->expanding_alloc ? emit->expanding_alloc * 2 : 16;
+		expanding = realloc(emit->expanding, alloc * sizeof(*expanding));
+		if (!expanding) {
+			emit->output_error = true;
+			return;
+		}
+		emit->expanding = expanding;
+		emit->expanding_alloc = alloc;
+	}
+
+	emit->expanding[emit->expanding_count++] = fyn_target;
+	fy_emit_node_internal(emit, fyn_target, flags, indent);
+	emit->expanding_count--;
+}
+
+void fy_emit_node_internal(struct fy_emitter *emit, struct fy_node *fyn, int flags, int indent)
+{
+	enum fy_node_type type;
+	enum fy_emit_anchor_action action = fyeaa_none;
+	struct fy_anchor *fya = NULL;
+	struct fy_node *fyn_target;
+	const char *anchor = NULL;
+	size_t anchor_len = 0;
+	char buf[24];
+
+	if (!fyn)
+		return;
+
+	fyn_target = fy_emit_alias_target(emit, fyn);
+	if (fyn_target) {
+		fy_emit_expand_alias(emit, fyn_target, flags, indent);
+		return;
+	}
+
+	/* the anchors of expanded copies would be duplicates */
+	if (!fy_emit_is_json_mode(emit) && !emit->expanding_count) {
+		fya = fy_document_lookup_anchor_by_node(emit->fyd, fyn);
+		if (fya)
+			anchor = fy_anchor_get_text(fya, &anchor_len);
+		else if (emit->anchors)
+			action = fy_emit_anchors_get(emit->anchors, fyn, buf, sizeof(buf),
+						     &anchor, &anchor_len);
+	}
+
+	if (action == fyeaa_alias) {
+		indent = fy_emit_increase_indent(emit, flags, indent);
+		if (!fy_emit_whitespace(emit))
+			fy_emit_write_ws(emit);
+		fy_emit_write_alias(emit, flags, indent, anchor, anchor_len);
+		return;
+	}
+
+	fy_emit_common_node_preamble(emit, anchor, anchor_len, fyn->tag, flags, indent);
 
 	type = fyn ? fyn->type : FYNT_SCALAR;
 
@@ -992,7 +1082,7 @@ void fy_emit_write_auto_style_scalar(struct fy_emitter *emit, struct fy_node *fy
 }
 
 static enum fy_node_style
-fy_emit_scalar_style(struct fy_emitter *emit, struct fy_node *fyn,
+fy_emit_scalar_style(struct fy_emitter *emit, struct fy_token *fyt,
 		     int flags, const char *value, size_t len,
 		     enum fy_node_style style)
 {
@@ -1086,19 +1176,18 @@ fy_emit_scalar_style(struct fy_emitter *emit, struct fy_node *fyn,
 
 out:
 	if (style == FYNS_ANY)
-		style = (fy_token_text_analyze(fyn->scalar) & FYTTAF_DIRECT_OUTPUT) ?
+		style = (fy_token_text_analyze(fyt) & FYTTAF_DIRECT_OUTPUT) ?
 				FYNS_PLAIN : FYNS_DOUBLE_QUOTED;
 
 	return style;
 }
 
-void fy_emit_scalar(struct fy_emitter *emit, struct fy_node *fyn, int flags, int indent)
+static void fy_emit_token_scalar(struct fy_emitter *emit, struct fy_token *fyt,
+				 enum fy_node_style style, int flags, int indent)
 {
-	enum fy_node_style style;
 	const char *value = NULL;
 	size_t len = 0;
 
-	style = fyn ? fyn->style : FYNS_ANY;
 	assert(style != FYNS_FLOW && style != FYNS_BLOCK);
 
 	indent = fy_emit_increase_indent(emit, flags, indent);
@@ -1106,10 +1195,10 @@ void fy_emit_scalar(struct fy_emitter *emit, struct fy_node *fyn, int flags, int
 	if (!fy_emit_whitespace(emit))
 		fy_emit_write_ws(emit);
 
-	if (fyn && fyn->scalar)
-		value = fy_token_get_text(fyn->scalar, &len);
+	if (fyt)
+		value = fy_token_get_text(fyt, &len);
 
-	style = fy_emit_scalar_style(emit, fyn, flags, value, len, style);
+	style = fy_emit_scalar_style(emit, fyt, flags, value, len, style);
 
 	switch (style) {
 	case FYNS_ALIAS:
@@ -1135,6 +1224,12 @@ void fy_emit_scalar(struct fy_emitter *emit, struct fy_node *fyn, int flags, int
 	}
 }
 
+void fy_emit_scalar(struct fy_emitter *emit, struct fy_node *fyn, int flags, int indent)
+{
+	fy_emit_token_scalar(emit, fyn ? fyn->scalar : NULL,
+			     fyn ? fyn->style : FYNS_ANY, flags, indent);
+}
+
 void fy_emit_sequence(struct fy_emitter *emit, struct fy_node *fyn, int flags, int indent)
 {
 	struct fy_node *fyni, *fynin;
@@ -1215,8 +1310,9 @@ void fy_emit_sequence(struct fy_emitter *emit, struct fy_node *fyn, int flags, i
 void fy_emit_mapping(struct fy_emitter *emit, struct fy_node *fyn, int flags, int indent)
 {
 	struct fy_node_pair *fynp, *fynpn, **fynpp = NULL;
+	struct fy_node *fyn_key;
 	int aflags;
-	bool flow = false, json = false, oneline = false, empty;
+	bool flow = false, json = false, oneline = false, empty, merge;
 	int old_indent = indent, tmp_indent, i;
 
 	oneline = fy_emit_is_oneline(emit);
@@ -1272,18 +1368,22 @@ void fy_emit_mapping(struct fy_emitter *emit, struct fy_node *fyn, int flags, in
 
 		if (fynp->key) {
 			flags = DDNF_MAP;
-			switch (fynp->key->type) {
+			/* an expanded alias key is output as its target */
+			fyn_key = fy_emit_alias_target(emit, fynp->key);
+			if (!fyn_key)
+				fyn_key = fynp->key;
+			switch (fyn_key->type) {
 			case FYNT_SCALAR:
-				aflags = fy_token_text_analyze(fynp->key->scalar);
+				aflags = fy_token_text_analyze(fyn_key->scalar);
 				if (aflags & FYTTAF_CAN_BE_SIMPLE_KEY)
 					flags |= DDNF_SIMPLE | DDNF_SIMPLE_SCALAR_KEY;
 				break;
 			case FYNT_SEQUENCE:
-				if (fy_node_list_empty(&fynp->key->sequence))
+				if (fy_node_list_empty(&fyn_key->sequence))
 					flags |= DDNF_SIMPLE;
 				break;
 			case FYNT_MAPPING:
-				if (fy_node_pair_list_empty(&fynp->key->mapping))
+				if (fy_node_pair_list_empty(&fyn_key->mapping))
 					flags |= DDNF_SIMPLE;
 				break;
 			}
@@ -1295,7 +1395,7 @@ void fy_emit_mapping(struct fy_emitter *emit, struct fy_node *fyn, int flags, in
 			fy_emit_node_internal(emit, fynp->key, flags, indent);
 
 			/* if the key is an alias, always output an extra whitespace */
-			if (fynp->key->type == FYNT_SCALAR && fynp->key->style == FYNS_ALIAS)
+			if (fyn_key->type == FYNT_SCALAR && fyn_key->style == FYNS_ALIAS)
 				fy_emit_write_ws(emit);
 
 			flags &= ~DDNF_MAP;
@@ -1315,8 +1415,14 @@ void fy_emit_mapping(struct fy_emitter *emit, struct fy_node *fyn, int flags, in
 
 		flags = DDNF_MAP;
 
-		if (fynp->value)
+		if (fynp->value) {
+			merge = fy_emit_is_merge_key(fynp->key);
+			if (merge)
+				emit->merge_value++;
 			fy_emit_node_internal(emit, fynp->value, flags, indent);
+			if (merge)
+				emit->merge_value--;
+		}
 
 		if ((flow || json) && fynpn)
 			fy_emit_write_indicator(emit, di_comma, flags, indent, fyewt_indicator);
@@ -1339,10 +1445,9 @@ void fy_emit_mapping(struct fy_emitter *emit, struct fy_node *fyn, int flags, in
 	}
 }
 
-int fy_emit_document_start(struct fy_emitter *emit, struct fy_document *fyd)
+static void fy_emit_common_document_start(struct fy_emitter *emit,
+					  struct fy_document_state *fyds)
 {
-	struct fy_document_state *fyds;
-	struct fy_node *root;
 	struct fy_token *fyt_chk;
 	const char *td_handle, *td_prefix;
 	size_t td_handle_size, td_prefix_size;
@@ -1351,17 +1456,8 @@ int fy_emit_document_start(struct fy_emitter *emit, struct fy_document *fyd)
 	enum fy_emitter_cfg_flags td_flags = flags & FYECF_TAG_DIR(FYECF_TAG_DIR_MASK);
 	enum fy_emitter_cfg_flags dsm_flags = flags & FYECF_DOC_START_MARK(FYECF_DOC_START_MARK_MASK);
 	bool vd, td, dsm;
-	bool root_tag_or_anchor __attribute__((__unused__));
 	bool had_non_default_tag = false;
 
-	if (!emit || !fyd || emit->fyd || !fyd->fyds)
-		return -1;
-
-	root = fy_document_root(fyd);
-
-	emit->fyd = fyd;
-	fyds = fyd->fyds;
-
 	vd = (vd_flags == FYECF_VERSION_DIR_AUTO && fyds->version_explicit) ||
 	      vd_flags == FYECF_VERSION_DIR_ON;
 	td = (td_flags == FYECF_TAG_DIR_AUTO && fyds->tags_explicit) ||
@@ -1411,9 +1507,6 @@ int fy_emit_document_start(struct fy_emitter *emit, struct fy_document *fyd)
 		}
 	}
 
-	/* NOTE we can force tags and anchors on the --- line */
-	root_tag_or_anchor = (root && (root->tag || fy_document_lookup_anchor_by_node(fyd, root)));
-
 	/* always output document start indicator:
 	 * - was explicit
 	 * - document has tags
@@ -1433,30 +1526,58 @@ int fy_emit_document_start(struct fy_emitter *emit, struct fy_document *fyd)
 		emit->flags |= FYEF_HAD_DOCUMENT_START;
 	} else
 		emit->flags &= ~FYEF_HAD_DOCUMENT_START;
+}
+
+int fy_emit_document_start(struct fy_emitter *emit, struct fy_document *fyd)
+{
+	struct fy_node *root;
+	bool root_tag_or_anchor __attribute__((__unused__));
+
+	if (!emit || !fyd || emit->fyd || !fyd->fyds)
+		return -1;
+
+	root = fy_document_root(fyd);
+
+	/* repeated subtrees are found before anything is output */
+	if ((emit->cfg->flags & FYECF_AUTO_ANCHORS) &&
+	    !(emit->cfg->flags & FYECF_EXPAND_ALIASES) && !fy_emit_is_json_mode(emit)) {
+		emit->anchors = fy_emit_anchors_create(fyd, emit->cfg->auto_anchor_min,
+						       !!(emit->cfg->flags & FYECF_SORT_KEYS));
+		if (!emit->anchors)
+			return -1;
+	}
+
+	emit->fyd = fyd;
+
+	/* NOTE we can force tags and anchors on the --- line */
+	root_tag_or_anchor = (root && (root->tag || fy_document_lookup_anchor_by_node(fyd, root)));
+
+	fy_emit_common_document_start(emit, fyd->fyds);
 
 	return 0;
 }
 
-int fy_emit_document_end(struct fy_emitter *emit)
+static void fy_emit_flush(struct fy_emitter *emit)
+{
+	if (!(emit->cfg->flags & FYECF_FLUSH_DOCUMENT))
+		return;
+
+	if (emit->cfg->output(emit, fyewt_flush, "", 0, emit->cfg->userdata))
+		emit->output_error = true;
+}
+
+static void fy_emit_common_document_end(struct fy_emitter *emit, bool end_implicit)
 {
-	struct fy_document *fyd;
-	const struct fy_document_state *fyds;
 	enum fy_emitter_cfg_flags flags = emit->cfg->flags;
 	enum fy_emitter_cfg_flags dem_flags = flags & FYECF_DOC_END_MARK(FYECF_DOC_END_MARK_MASK);
 	bool dem;
 
-	if (!emit || !emit->fyd || !emit->fyd->fyds)
-		return -1;
-
-	fyd = emit->fyd;
-	fyds = fyd->fyds;
-
 	if (emit->column != 0) {
 		fy_emit_putc(emit, fyewt_linebreak, '\n');
 		emit->flags = FYEF_WHITESPACE | FYEF_INDENTATION;
 	}
 
-	dem = (dem_flags == FYECF_DOC_END_MARK_AUTO && !fyds->end_implicit) ||
+	dem = (dem_flags == FYECF_DOC_END_MARK_AUTO && !end_implicit) ||
 	       dem_flags == FYECF_DOC_END_MARK_ON;
 	if (!fy_emit_is_json_mode(emit) && dem) {
 		fy_emit_puts(emit, fyewt_document_indicator, "...");
@@ -1466,6 +1587,19 @@ int fy_emit_document_end(struct fy_emitter *emit)
 	} else
 		emit->flags &= ~FYEF_HAD_DOCUMENT_END;
 
+	fy_emit_flush(emit);
+}
+
+int fy_emit_document_end(struct fy_emitter *emit)
+{
+	if (!emit || !emit->fyd || !emit->fyd->fyds)
+		return -1;
+
+	fy_emit_common_document_end(emit, emit->fyd->fyds->end_implicit);
+
+	fy_emit_anchors_destroy(emit->anchors);
+	emit->anchors = NULL;
+
 	/* stop our association with the document */
 	emit->fyd = NULL;
 
@@ -1490,6 +1624,8 @@ int fy_emit_explicit_document_end(struct fy_emitter *emit)
 	} else
 		emit->flags &= ~FYEF_HAD_DOCUMENT_END;
 
+	fy_emit_flush(emit);
+
 	return 0;
 }
 
@@ -1506,7 +1642,11 @@ void fy_emit_setup(struct fy_emitter *emit, const struct fy_emitter_cfg *cfg)
 
 void fy_emit_cleanup(struct fy_emitter *emit)
 {
-	/* nothing */
+	fy_token_unref(emit->pending_anchor);
+	fy_token_unref(emit->pending_tag);
+	free(emit->frames);
+	fy_emit_anchors_destroy(emit->anchors);
+	free(emit->expanding);
 }
 
 int fy_emit_node(struct fy_emitter *emit, struct fy_node *fyn)
@@ -1552,6 +1692,316 @@ int fy_emit_document(struct fy_emitter *emit, struct fy_document *fyd)
 	return rc;
 }
 
+/*
+ * Event output mirrors fy_emit_sequence() and fy_emit_mapping(), with the
+ * loop state kept in a frame per open collection. Since the next item is
+ * not known in advance, the flow separator is written before an item
+ * instead of after the previous one.
+ */
+static int fy_emit_event_node_prolog(struct fy_emitter *emit, enum fy_node_type type,
+				     struct fy_token *fyt, bool empty, bool alias,
+				     int *flagsp, int *indentp)
+{
+	struct fy_emit_event_frame *fr;
+	bool flow_or_json, oneline;
+	int flags, aflags;
+
+	/* the root */
+	if (!emit->frame_count) {
+		*flagsp = DDNF_ROOT;
+		*indentp = -1;
+		return 0;
+	}
+
+	fr = &emit->frames[emit->frame_count - 1];
+	oneline = fy_emit_is_oneline(emit);
+	flow_or_json = fr->flow || fy_emit_is_json_mode(emit);
+
+	if (fr->type == FYNT_MAPPING && !fr->key) {
+		*flagsp = DDNF_MAP;
+		*indentp = fr->indent;
+		return 0;
+	}
+
+	if (!fr->first && flow_or_json)
+		fy_emit_write_indicator(emit, di_comma, fr->flags, fr->indent, fyewt_indicator);
+	fr->first = false;
+
+	if (!oneline)
+		fy_emit_write_indent(emit, fr->indent);
+
+	if (fr->type == FYNT_SEQUENCE) {
+		flags = fr->flags | DDNF_SEQ;
+		if (!flow_or_json)
+			fy_emit_write_indicator(emit, di_dash, flags, fr->indent, fyewt_indicator);
+	} else {
+		flags = DDNF_MAP;
+		switch (type) {
+		case FYNT_SCALAR:
+			aflags = fy_token_text_analyze(fyt);
+			if (aflags & FYTTAF_CAN_BE_SIMPLE_KEY)
+				flags |= DDNF_SIMPLE | DDNF_SIMPLE_SCALAR_KEY;
+			break;
+		case FYNT_SEQUENCE:
+		case FYNT_MAPPING:
+			if (empty)
+				flags |= DDNF_SIMPLE;
+			break;
+		}
+
+		/* complex? */
+		if (!(flags & DDNF_SIMPLE))
+			fy_emit_write_indicator(emit, di_question_mark, flags, fr->indent, fyewt_indicator);
+
+		fr->key_flags = flags;
+		fr->alias_key = alias;
+	}
+
+	*flagsp = flags;
+	*indentp = fr->indent;
+	return 0;
+}
+
+static void fy_emit_event_node_done(struct fy_emitter *emit)
+{
+	struct fy_emit_event_frame *fr;
+
+	if (!emit->frame_count)
+		return;
+
+	fr = &emit->frames[emit->frame_count - 1];
+	if (fr->type != FYNT_MAPPING)
+		return;
+
+	if (fr->key) {
+		/* if the key is an alias, always output an extra whitespace */
+		if (fr->alias_key)
+			fy_emit_write_ws(emit);
+
+		fy_emit_write_indicator(emit, di_colon, fr->key_flags & ~DDNF_MAP,
+					fr->indent, fyewt_indicator);
+	}
+	fr->key = !fr->key;
+}
+
+static int fy_emit_event_collection_start(struct fy_emitter *emit, bool empty)
+{
+	struct fy_emit_event_frame *fr;
+	enum fy_node_type type;
+	const char *anchor = NULL;
+	size_t anchor_len = 0;
+	bool flow = false, json, oneline;
+	int flags, indent, old_indent, alloc;
+
+	type = emit->pending_type == FYET_SEQUENCE_START ? FYNT_SEQUENCE : FYNT_MAPPING;
+
+	if (emit->frame_count >= emit->frame_alloc) {
+		alloc = emit->frame_alloc ? emit->frame_alloc * 2 : 16;
+		fr = realloc(emit->frames, alloc * sizeof(*fr));
+		if (!fr)
+			return -1;
+		emit->frames = fr;
+		emit->frame_alloc = alloc;
+	}
+
+	fy_emit_event_node_prolog(emit, type, NULL, empty, false, &flags, &indent);
+
+	if (emit->pending_anchor)
+		anchor = fy_token_get_text(emit->pending_anchor, &anchor_len);
+	fy_emit_common_node_preamble(emit, anchor, anchor_len, emit->pending_tag, flags, indent);
+
+	oneline = fy_emit_is_oneline(emit);
+	json = fy_emit_is_json_mode(emit);
+	old_indent = indent;
+
+	if (!json) {
+		if (fy_emit_is_flow_mode(emit))
+			flow = true;
+		else if (fy_emit_is_block_mode(emit))
+			flow = false;
+		else
+			flow = emit->flow_level || emit->pending_flow || empty;
+
+		if (flow) {
+			if (!emit->flow_level) {
+				indent = fy_emit_increase_indent(emit, flags, indent);
+				old_indent = indent;
+			}
+
+			flags = (flags | DDNF_FLOW) | (flags & ~DDNF_INDENTLESS);
+			fy_emit_write_indicator(emit,
+					type == FYNT_SEQUENCE ? di_left_bracket : di_left_brace,
+					flags, indent, fyewt_indicator);
+		} else if (type == FYNT_SEQUENCE)
+			flags = (flags & ~DDNF_FLOW) | ((flags & DDNF_MAP) ? DDNF_INDENTLESS : 0);
+		else
+			flags &= ~(DDNF_FLOW | DDNF_INDENTLESS);
+	} else {
+		flags = (flags | DDNF_FLOW) | (flags & ~DDNF_INDENTLESS);
+		fy_emit_write_indicator(emit,
+				type == FYNT_SEQUENCE ? di_left_bracket : di_left_brace,
+				flags, indent, fyewt_indicator);
+	}
+
+	if (!oneline && (type == FYNT_SEQUENCE || !empty))
+		indent = fy_emit_increase_indent(emit, flags, indent);
+
+	fr = &emit->frames[emit->frame_count++];
+	memset(fr, 0, sizeof(*fr));
+	fr->type = type;
+	fr->flags = flags & ~DDNF_ROOT;
+	fr->indent = indent;
+	fr->old_indent = old_indent;
+	fr->flow = flow;
+	fr->empty = empty;
+	fr->first = true;
+	fr->key = true;
+
+	return 0;
+}
+
+static int fy_emit_event_collection_end(struct fy_emitter *emit, enum fy_node_type type)
+{
+	struct fy_emit_event_frame *fr;
+
+	if (!emit->frame_count)
+		return -1;
+
+	fr = &emit->frames[emit->frame_count - 1];
+	if (fr->type != type || (type == FYNT_MAPPING && !fr->key))
+		return -1;
+
+	if (fr->flow || fy_emit_is_json_mode(emit)) {
+		if (!fy_emit_is_oneline(emit) && !fr->empty)
+			fy_emit_write_indent(emit, fr->old_indent);
+		fy_emit_write_indicator(emit,
+				type == FYNT_SEQUENCE ? di_right_bracket : di_right_brace,
+				fr->flags, fr->old_indent, fyewt_indicator);
+	}
+
+	emit->frame_count--;
+
+	fy_emit_event_node_done(emit);
+
+	return 0;
+}
+
+static int fy_emit_event_scalar(struct fy_emitter *emit, struct fy_event *fye)
+{
+	struct fy_token *fyt, *fyt_anchor, *fyt_tag;
+	enum fy_node_style style;
+	const char *anchor = NULL;
+	size_t anchor_len = 0;
+	bool alias;
+	int flags, indent;
+
+	alias = fye->type == FYET_ALIAS;
+	if (!alias) {
+		fyt = fye->scalar.value;
+		fyt_anchor = fye->scalar.anchor;
+		fyt_tag = fye->scalar.tag;
+		style = fyt ? fy_node_style_from_scalar_style(fyt->scalar.style) : FYNS_PLAIN;
+	} else {
+		fyt = fye->alias.anchor;
+		fyt_anchor = NULL;
+		fyt_tag = NULL;
+		style = FYNS_ALIAS;
+	}
+
+	fy_emit_event_node_prolog(emit, FYNT_SCALAR, fyt, false, alias, &flags, &indent);
+
+	if (fyt_anchor)
+		anchor = fy_token_get_text(fyt_anchor, &anchor_len);
+	fy_emit_common_node_preamble(emit, anchor, anchor_len, fyt_tag, flags, indent);
+
+	fy_emit_token_scalar(emit, fyt, style, flags, indent);
+
+	fy_emit_event_node_done(emit);
+
+	return 0;
+}
+
+static void fy_emit_event_clear_pending(struct fy_emitter *emit)
+{
+	fy_token_unref(emit->pending_anchor);
+	emit->pending_anchor = NULL;
+	fy_token_unref(emit->pending_tag);
+	emit->pending_tag = NULL;
+	emit->pending_type = FYET_NONE;
+}
+
+int fy_emit_event(struct fy_emitter *emit, struct fy_event *fye)
+{
+	struct fy_token *fyt;
+	bool empty;
+	int rc = 0;
+
+	if (!emit || !fye)
+		return -1;
+
+	if (emit->pending_type != FYET_NONE) {
+		empty = (emit->pending_type == FYET_SEQUENCE_START && fye->type == FYET_SEQUENCE_END) ||
+			(emit->pending_type == FYET_MAPPING_START && fye->type == FYET_MAPPING_END);
+		rc = fy_emit_event_collection_start(emit, empty);
+		fy_emit_event_clear_pending(emit);
+		if (rc)
+			return rc;
+	}
+
+	switch (fye->type) {
+	case FYET_NONE:
+	case FYET_STREAM_START:
+	case FYET_STREAM_END:
+		break;
+
+	case FYET_DOCUMENT_START:
+		if (emit->fyd || emit->frame_count || !fye->document_start.document_state)
+			return -1;
+		fy_emit_common_document_start(emit, fye->document_start.document_state);
+		break;
+
+	case FYET_DOCUMENT_END:
+		if (emit->frame_count)
+			return -1;
+		fy_emit_common_document_end(emit, fye->document_end.implicit);
+		break;
+
+	case FYET_SEQUENCE_START:
+	case FYET_MAPPING_START:
+		emit->pending_type = fye->type;
+		if (fye->type == FYET_SEQUENCE_START) {
+			emit->pending_anchor = fy_token_ref(fye->sequence_start.anchor);
+			emit->pending_tag = fy_token_ref(fye->sequence_start.tag);
+			fyt = fye->sequence_start.sequence_start;
+			emit->pending_flow = fyt && fyt->type == FYTT_FLOW_SEQUENCE_START;
+		} else {
+			emit->pending_anchor = fy_token_ref(fye->mapping_start.anchor);
+			emit->pending_tag = fy_token_ref(fye->mapping_start.tag);
+			fyt = fye->mapping_start.mapping_start;
+			emit->pending_flow = fyt && fyt->type == FYTT_FLOW_MAPPING_START;
+		}
+		break;
+
+	case FYET_SEQUENCE_END:
+		rc = fy_emit_event_collection_end(emit, FYNT_SEQUENCE);
+		break;
+
+	case FYET_MAPPING_END:
+		rc = fy_emit_event_collection_end(emit, FYNT_MAPPING);
+		break;
+
+	case FYET_SCALAR:
+	case FYET_ALIAS:
+		rc = fy_emit_event_scalar(emit, fye);
+		break;
+	}
+
+	if (rc)
+		return rc;
+
+	return emit->output_error ? -1 : 0;
+}
+
 const struct fy_emitter_cfg *fy_emitter_get_cfg(struct fy_emitter *emit)
 {
 	if (!emit)
@@ -1630,10 +2080,19 @@ static int do_buffer_output(struct fy_emitter *emit, enum fy_emitter_write_type
 	return len;
 }
 
-static int fy_emit_str_internal(struct fy_document *fyd,
-				enum fy_emitter_cfg_flags flags,
-				struct fy_node *fyn, char **bufp, int *sizep,
-				bool grow)
+static int fy_emit_str_document(struct fy_emitter *emit, void *arg)
+{
+	return fy_emit_document(emit, arg);
+}
+
+static int fy_emit_str_node(struct fy_emitter *emit, void *arg)
+{
+	return fy_emit_node(emit, arg);
+}
+
+int fy_emit_str_internal(enum fy_emitter_cfg_flags flags,
+			 int (*body)(struct fy_emitter *emit, void *arg), void *arg,
+			 char **bufp, int *sizep, bool grow)
 {
 	struct fy_emitter emit_state, *emit = &emit_state;
 	struct fy_emitter_cfg emit_cfg;
@@ -1651,7 +2110,7 @@ static int fy_emit_str_internal(struct fy_document *fyd,
 	state.grow = grow;
 
 	fy_emit_setup(emit, &emit_cfg);
-	rc = fyd ? fy_emit_document(emit, fyd) : fy_emit_node(emit, fyn);
+	rc = body(emit, arg);
 	fy_emit_cleanup(emit);
 
 	if (rc)
@@ -1691,7 +2150,7 @@ int fy_emit_document_to_buffer(struct fy_document *fyd, enum fy_emitter_cfg_flag
 {
 	int rc;
 
-	rc = fy_emit_str_internal(fyd, flags, NULL, &buf, &size, false);
+	rc = fy_emit_str_internal(flags, fy_emit_str_document, fyd, &buf, &size, false);
 	if (rc != 0)
 		return -1;
 	return size;
@@ -1702,7 +2161,7 @@ char *fy_emit_document_to_string(struct fy_document *fyd, enum fy_emitter_cfg_fl
 	char *buf = NULL;
 	int rc, size = 0;
 
-	rc = fy_emit_str_internal(fyd, flags, NULL, &buf, &size, true);
+	rc = fy_emit_str_internal(flags, fy_emit_str_document, fyd, &buf, &size, true);
 	if (rc != 0)
 		return NULL;
 	return buf;
@@ -1712,6 +2171,9 @@ static int do_file_output(struct fy_emitter *emit, enum fy_emitter_write_type ty
 {
 	FILE *fp = userdata;
 
+	if (type == fyewt_flush)
+		return fflush(fp) ? -1 : 0;
+
 	return fwrite(str, 1, len, fp);
 }
 
@@ -1759,7 +2221,7 @@ int fy_emit_node_to_buffer(struct fy_node *fyn, enum fy_emitter_cfg_flags flags,
 {
 	int rc;
 
-	rc = fy_emit_str_internal(NULL, flags, fyn, &buf, &size, false);
+	rc = fy_emit_str_internal(flags, fy_emit_str_node, fyn, &buf, &size, false);
 	if (rc != 0)
 		return -1;
 	return size;
@@ -1770,7 +2232,7 @@ char *fy_emit_node_to_string(struct fy_node *fyn, enum fy_emitter_cfg_flags flag
 	char *buf = NULL;
 	int rc, size = 0;
 
-	rc = fy_emit_str_internal(NULL, flags, fyn, &buf, &size, true);
+	rc = fy_emit_str_internal(flags, fy_emit_str_node, fyn, &buf, &size, true);
 	if (rc != 0)
 		return NULL;
 	return buf;
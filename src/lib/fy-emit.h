@@ -25,6 +25,84 @@
 #define FYEF_HAD_DOCUMENT_END	0x0010
 
 struct fy_document;
+struct fy_token;
+struct fy_node;
+
+/* the smallest subtree (in nodes) replaced by an alias, by default */
+#define FY_EMIT_AUTO_ANCHOR_MIN_DEFAULT	4
+
+struct fy_emit_anchor_entry {
+	struct fy_node *fyn;
+	uint32_t node_hash;		/* of the node pointer */
+	uint32_t hash;			/* of the contents */
+	int node_next;			/* next entry of the node bucket */
+	int next;			/* next class of the contents bucket */
+	int parent;			/* the entry of the parent, -1 for none */
+	int rep;			/* the first entry with the same contents */
+	unsigned int size;		/* nodes in the subtree */
+	int source;			/* representative; first output with an anchor to refer to */
+	int id;				/* generated anchor, 0 for none */
+	bool no_alias : 1;		/* never output as an alias */
+	bool anchored : 1;		/* holds a document anchor, or is above one */
+	bool has_anchor : 1;		/* holds a document anchor itself */
+	bool alias : 1;			/* output as an alias to the source */
+	bool referenced : 1;		/* a source some alias refers to */
+};
+
+/*
+ * Every node of the document is classified by its contents, bottom up;
+ * two nodes are in the same class when their type, tag and scalar value
+ * (or the classes of their children, in order) are the same. The nodes
+ * are then walked in output order: the first member of a class that can
+ * hold an anchor is the source, and the members after it that can be
+ * aliases are. A source with a document anchor keeps it, otherwise it
+ * gets a generated one, but only when some alias refers to it; the
+ * contents of an alias are not output, so they refer to nothing.
+ */
+struct fy_emit_anchors {
+	struct fy_document *fyd;
+	unsigned int min_size;
+	int last_id;
+	struct fy_emit_anchor_entry *entries;
+	int count;
+	int alloc;
+	int *node_buckets;
+	int *buckets;
+	unsigned int bucket_count;
+};
+
+enum fy_emit_anchor_action {
+	fyeaa_none,
+	fyeaa_anchor,			/* output with the generated anchor */
+	fyeaa_alias,			/* output as an alias */
+};
+
+struct fy_emit_anchors *fy_emit_anchors_create(struct fy_document *fyd, unsigned int min_size,
+					       bool sort_keys);
+void fy_emit_anchors_destroy(struct fy_emit_anchors *fyea);
+/* the anchor or alias name is in @buf when generated, in the document otherwise */
+enum fy_emit_anchor_action fy_emit_anchors_get(struct fy_emit_anchors *fyea, struct fy_node *fyn,
+					       char *buf, size_t bufsz,
+					       const char **namep, size_t *lenp);
+
+/* the output of @body into a buffer, grown (and allocated) when @grow */
+int fy_emit_str_internal(enum fy_emitter_cfg_flags flags,
+			 int (*body)(struct fy_emitter *emit, void *arg), void *arg,
+			 char **bufp, int *sizep, bool grow);
+
+/* an open collection while emitting events */
+struct fy_emit_event_frame {
+	enum fy_node_type type;
+	int flags;			/* flags of the items */
+	int indent;			/* indent of the items */
+	int old_indent;
+	int key_flags;			/* flags the current key was emitted with */
+	bool flow : 1;
+	bool empty : 1;
+	bool first : 1;			/* no item emitted yet */
+	bool key : 1;			/* mapping; the next node is a key */
+	bool alias_key : 1;		/* mapping; the current key is an alias */
+};
 
 struct fy_emitter {
 	int line;
@@ -35,6 +113,21 @@ struct fy_emitter {
 	/* current document */
 	const struct fy_emitter_cfg *cfg;
 	struct fy_document *fyd;
+	/* event output */
+	struct fy_emit_event_frame *frames;
+	int frame_count;
+	int frame_alloc;
+	/* a collection start waits for the next event to tell if it's empty */
+	enum fy_event_type pending_type;
+	struct fy_token *pending_anchor;
+	struct fy_token *pending_tag;
+	bool pending_flow;
+	/* document output */
+	struct fy_emit_anchors *anchors;	/* FYECF_AUTO_ANCHORS */
+	struct fy_node **expanding;		/* FYECF_EXPAND_ALIASES; targets being output */
+	int expanding_count;
+	int expanding_alloc;
+	int merge_value;			/* in the value of a merge key */
 };
 
 static inline bool fy_emit_whitespace(struct fy_emitter *emit)
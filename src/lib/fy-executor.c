@@ -0,0 +1,449 @@
+/*
+ * fy-executor.c - work stealing task pool
+ *
+ * Copyright (c) 2019 Pantelis Antoniou <pantelis.antoniou@konsulko.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <libfyaml.h>
+
+#include "fy-executor.h"
+
+/* the worker the current thread is, if any */
+static __thread struct fy_executor_worker *fy_executor_current;
+
+static int fy_executor_queue_setup(struct fy_executor_queue *fyxq)
+{
+	memset(fyxq, 0, sizeof(*fyxq));
+	fyxq->tasks = malloc(sizeof(*fyxq->tasks) * FY_EXECUTOR_QUEUE_MIN);
+	if (!fyxq->tasks)
+		return -1;
+	fyxq->size = FY_EXECUTOR_QUEUE_MIN;
+	pthread_mutex_init(&fyxq->lock, NULL);
+	return 0;
+}
+
+static void fy_executor_queue_cleanup(struct fy_executor_queue *fyxq)
+{
+	pthread_mutex_destroy(&fyxq->lock);
+	free(fyxq->tasks);
+}
+
+static int fy_executor_queue_push(struct fy_executor_queue *fyxq,
+				  const struct fy_executor_task *task)
+{
+	struct fy_executor_task *tasks;
+	unsigned int i, size;
+
+	pthread_mutex_lock(&fyxq->lock);
+
+	if (fyxq->count >= fyxq->size) {
+		size = fyxq->size * 2;
+		tasks = malloc(sizeof(*tasks) * size);
+		if (!tasks) {
+			pthread_mutex_unlock(&fyxq->lock);
+			return -1;
+		}
+		/* unwrap the ring */
+		for (i = 0; i < fyxq->count; i++)
+			tasks[i] = fyxq->tasks[(fyxq->head + i) % fyxq->size];
+		free(fyxq->tasks);
+		fyxq->tasks = tasks;
+		fyxq->head = 0;
+		fyxq->size = size;
+	}
+
+	fyxq->tasks[(fyxq->head + fyxq->count) % fyxq->size] = *task;
+	fyxq->count++;
+
+	pthread_mutex_unlock(&fyxq->lock);
+
+	return 0;
+}
+
+/* the newest task for the owner, the oldest for thieves */
+static bool fy_executor_queue_pop(struct fy_executor_queue *fyxq, bool newest,
+				  struct fy_executor_task *task)
+{
+	bool found;
+
+	pthread_mutex_lock(&fyxq->lock);
+
+	found = fyxq->count > 0;
+	if (found) {
+		if (newest) {
+			*task = fyxq->tasks[(fyxq->head + fyxq->count - 1) % fyxq->size];
+		} else {
+			*task = fyxq->tasks[fyxq->head];
+			fyxq->head = (fyxq->head + 1) % fyxq->size;
+		}
+		fyxq->count--;
+	}
+
+	pthread_mutex_unlock(&fyxq->lock);
+
+	return found;
+}
+
+static bool fy_executor_get_task(struct fy_executor *fyx, struct fy_executor_task *task)
+{
+	struct fy_executor_worker *fyxw = fy_executor_current;
+	unsigned int i, start;
+
+	if (!atomic_load(&fyx->pending))
+		return false;
+
+	if (fyxw && fyxw->fyx != fyx)
+		fyxw = NULL;
+
+	if (fyxw && fy_executor_queue_pop(&fyxw->queue, true, task))
+		goto found;
+
+	if (fy_executor_queue_pop(&fyx->shared, false, task))
+		goto found;
+
+	/* steal, starting from the next worker */
+	start = fyxw ? fyxw->index + 1 : 0;
+	for (i = 0; i < fyx->num_workers; i++) {
+		if (fy_executor_queue_pop(&fyx->workers[(start + i) % fyx->num_workers].queue,
+					  false, task))
+			goto found;
+	}
+
+	return false;
+
+found:
+	atomic_fetch_sub(&fyx->pending, 1);
+	return true;
+}
+
+static void fy_executor_task_run(const struct fy_executor_task *task)
+{
+	struct fy_executor_group *fyxg = task->group;
+	struct fy_executor *fyx;
+
+	task->fn(task->arg);
+
+	if (!fyxg)
+		return;
+
+	/* the group is gone as soon as the last one is done */
+	fyx = fyxg->fyx;
+	if (atomic_fetch_sub(&fyxg->left, 1) != 1)
+		return;
+
+	/* the last one of the group wakes up the waiter */
+	pthread_mutex_lock(&fyx->lock);
+	pthread_cond_broadcast(&fyx->done);
+	pthread_mutex_unlock(&fyx->lock);
+}
+
+static void fy_executor_group_put(struct fy_executor_group *fyxg)
+{
+	if (atomic_fetch_sub(&fyxg->refs, 1) == 1)
+		free(fyxg);
+}
+
+/* run the task unless someone already did */
+static bool fy_executor_task_claim_run(struct fy_executor_task *task)
+{
+	if (atomic_exchange(&task->claimed, true))
+		return false;
+	fy_executor_task_run(task);
+	return true;
+}
+
+static void fy_executor_external_trampoline(void *arg)
+{
+	struct fy_executor_task *task = arg;
+	struct fy_executor_group *fyxg = task->group;
+
+	fy_executor_task_claim_run(task);
+	fy_executor_group_put(fyxg);
+}
+
+static int fy_executor_push(struct fy_executor *fyx, const struct fy_executor_task *task)
+{
+	struct fy_executor_worker *fyxw = fy_executor_current;
+	struct fy_executor_queue *fyxq;
+	int rc;
+
+	if (fyx->cfg.submit) {
+		/* a group task is kept by the waiter until it's done */
+		if (task->group)
+			return fyx->cfg.submit(fyx->cfg.pool,
+					fy_executor_external_trampoline, (void *)task);
+		return fyx->cfg.submit(fyx->cfg.pool, task->fn, task->arg);
+	}
+
+	fyxq = fyxw && fyxw->fyx == fyx ? &fyxw->queue : &fyx->shared;
+	rc = fy_executor_queue_push(fyxq, task);
+	if (rc)
+		return rc;
+
+	atomic_fetch_add(&fyx->pending, 1);
+
+	/* under the lock, so that a worker going to sleep does not miss it */
+	pthread_mutex_lock(&fyx->lock);
+	pthread_cond_signal(&fyx->work);
+	pthread_mutex_unlock(&fyx->lock);
+
+	return 0;
+}
+
+static void *fy_executor_worker_thread(void *arg)
+{
+	struct fy_executor_worker *fyxw = arg;
+	struct fy_executor *fyx = fyxw->fyx;
+	struct fy_executor_task task;
+
+	fy_executor_current = fyxw;
+
+	for (;;) {
+		if (fy_executor_get_task(fyx, &task)) {
+			fy_executor_task_run(&task);
+			continue;
+		}
+
+		pthread_mutex_lock(&fyx->lock);
+		while (!fyx->stop && !atomic_load(&fyx->pending))
+			pthread_cond_wait(&fyx->work, &fyx->lock);
+		/* the queued tasks are run before stopping */
+		if (fyx->stop && !atomic_load(&fyx->pending)) {
+			pthread_mutex_unlock(&fyx->lock);
+			break;
+		}
+		pthread_mutex_unlock(&fyx->lock);
+	}
+
+	fy_executor_current = NULL;
+
+	return NULL;
+}
+
+static void fy_executor_stop_workers(struct fy_executor *fyx, unsigned int count)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&fyx->lock);
+	fyx->stop = true;
+	pthread_cond_broadcast(&fyx->work);
+	pthread_mutex_unlock(&fyx->lock);
+
+	for (i = 0; i < count; i++)
+		pthread_join(fyx->workers[i].thread, NULL);
+}
+
+struct fy_executor *fy_executor_create(const struct fy_executor_cfg *cfg)
+{
+	struct fy_executor *fyx;
+	struct fy_executor_worker *fyxw;
+	unsigned int i, started;
+	long ncpus;
+	int rc;
+
+	fyx = malloc(sizeof(*fyx));
+	if (!fyx)
+		return NULL;
+	memset(fyx, 0, sizeof(*fyx));
+
+	if (cfg)
+		fyx->cfg = *cfg;
+
+	pthread_mutex_init(&fyx->lock, NULL);
+	pthread_cond_init(&fyx->work, NULL);
+	pthread_cond_init(&fyx->done, NULL);
+	atomic_init(&fyx->pending, 0);
+
+	rc = fy_executor_queue_setup(&fyx->shared);
+	if (rc)
+		goto err_out;
+
+	/* no workers of our own when an external executor is plugged in */
+	if (fyx->cfg.submit)
+		return fyx;
+
+	fyx->num_workers = fyx->cfg.num_threads;
+	if (!fyx->num_workers) {
+		ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+		fyx->num_workers = ncpus > 0 ? (unsigned int)ncpus : 1;
+	}
+
+	fyx->workers = malloc(sizeof(*fyx->workers) * fyx->num_workers);
+	if (!fyx->workers)
+		goto err_out;
+	memset(fyx->workers, 0, sizeof(*fyx->workers) * fyx->num_workers);
+
+	for (i = 0; i < fyx->num_workers; i++) {
+		fyxw = &fyx->workers[i];
+		fyxw->fyx = fyx;
+		fyxw->index = i;
+		rc = fy_executor_queue_setup(&fyxw->queue);
+		if (rc) {
+			fyx->stop = true;	/* no threads to stop yet */
+			goto err_out;
+		}
+	}
+
+	for (started = 0; started < fyx->num_workers; started++) {
+		fyxw = &fyx->workers[started];
+		rc = pthread_create(&fyxw->thread, NULL, fy_executor_worker_thread, fyxw);
+		if (rc)
+			goto err_stop;
+	}
+
+	return fyx;
+
+err_stop:
+	fy_executor_stop_workers(fyx, started);
+err_out:
+	fy_executor_destroy(fyx);
+	return NULL;
+}
+
+void fy_executor_destroy(struct fy_executor *fyx)
+{
+	unsigned int i;
+
+	if (!fyx)
+		return;
+
+	if (fyx->workers && !fyx->stop)
+		fy_executor_stop_workers(fyx, fyx->num_workers);
+
+	if (fyx->workers) {
+		for (i = 0; i < fyx->num_workers; i++) {
+			if (fyx->workers[i].queue.tasks)
+				fy_executor_queue_cleanup(&fyx->workers[i].queue);
+		}
+		free(fyx->workers);
+	}
+
+	if (fyx->shared.tasks)
+		fy_executor_queue_cleanup(&fyx->shared);
+
+	pthread_cond_destroy(&fyx->done);
+	pthread_cond_destroy(&fyx->work);
+	pthread_mutex_destroy(&fyx->lock);
+	free(fyx);
+}
+
+const struct fy_executor_cfg *fy_executor_get_cfg(struct fy_executor *fyx)
+{
+	if (!fyx)
+		return NULL;
+	return &fyx->cfg;
+}
+
+unsigned int fy_executor_num_threads(struct fy_executor *fyx)
+{
+	if (!fyx)
+		return 0;
+
+	/* an external executor's size is not known */
+	if (fyx->cfg.submit)
+		return fyx->cfg.num_threads ? fyx->cfg.num_threads : 1;
+
+	return fyx->num_workers;
+}
+
+int fy_executor_submit(struct fy_executor *fyx, void (*fn)(void *arg), void *arg)
+{
+	struct fy_executor_task task;
+
+	if (!fyx || !fn)
+		return -1;
+
+	task.fn = fn;
+	task.arg = arg;
+	task.group = NULL;
+
+	return fy_executor_push(fyx, &task);
+}
+
+int fy_executor_run(struct fy_executor *fyx, void (*fn)(void *arg),
+		    void * const *args, unsigned int count)
+{
+	struct fy_executor_group *fyxg;
+	struct fy_executor_task *tasks, task;
+	unsigned int i, submitted;
+
+	if (!fyx || !fn || (count && !args))
+		return -1;
+
+	if (!count)
+		return 0;
+
+	/* a single task is just a call */
+	if (count == 1) {
+		fn(args[0]);
+		return 0;
+	}
+
+	fyxg = malloc(sizeof(*fyxg) + sizeof(*fyxg->tasks) * count);
+	if (!fyxg)
+		return -1;
+
+	fyxg->fyx = fyx;
+	atomic_init(&fyxg->left, count);
+	atomic_init(&fyxg->refs, 1);
+	tasks = fyxg->tasks;
+
+	for (i = 0; i < count; i++) {
+		tasks[i].fn = fn;
+		tasks[i].arg = args[i];
+		tasks[i].group = fyxg;
+		atomic_init(&tasks[i].claimed, false);
+	}
+
+	/* the first one is run by the caller, after handing out the rest */
+	for (submitted = 1; submitted < count; submitted++) {
+		/* an external call keeps the group alive */
+		if (fyx->cfg.submit)
+			atomic_fetch_add(&fyxg->refs, 1);
+		if (fy_executor_push(fyx, &tasks[submitted])) {
+			if (fyx->cfg.submit)
+				atomic_fetch_sub(&fyxg->refs, 1);
+			break;
+		}
+	}
+
+	/* what could not be handed out is run here */
+	for (i = submitted; i < count; i++)
+		fy_executor_task_run(&tasks[i]);
+
+	fy_executor_task_run(&tasks[0]);
+
+	if (fyx->cfg.submit) {
+		/*
+		 * The external executor may have no thread to spare, for
+		 * instance when this is one of its tasks and the others
+		 * are waiting too; whatever has not started yet is run here.
+		 */
+		for (i = 1; i < submitted; i++)
+			fy_executor_task_claim_run(&tasks[i]);
+	} else {
+		/* help with whatever is queued while the group is not done */
+		while (atomic_load(&fyxg->left) && fy_executor_get_task(fyx, &task))
+			fy_executor_task_run(&task);
+	}
+
+	/* the rest is being run by others */
+	pthread_mutex_lock(&fyx->lock);
+	while (atomic_load(&fyxg->left))
+		pthread_cond_wait(&fyx->done, &fyx->lock);
+	pthread_mutex_unlock(&fyx->lock);
+
+	fy_executor_group_put(fyxg);
+
+	return 0;
+}
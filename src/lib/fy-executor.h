@@ -0,0 +1,83 @@
+/*
+ * fy-executor.h - work stealing task pool internal header file
+ *
+ * Copyright (c) 2019 Pantelis Antoniou <pantelis.antoniou@konsulko.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef FY_EXECUTOR_H
+#define FY_EXECUTOR_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include <libfyaml.h>
+
+/* initial size of a task queue */
+#define FY_EXECUTOR_QUEUE_MIN	64
+
+struct fy_executor_group;
+
+struct fy_executor_task {
+	void (*fn)(void *arg);
+	void *arg;
+	struct fy_executor_group *group;	/* NULL when not waited for */
+	atomic_bool claimed;			/* external: started by someone */
+};
+
+/*
+ * The tasks of a single fy_executor_run(). An external executor may
+ * call a task long after the waiter ran it itself and returned, so the
+ * group (and the tasks with it) is freed by whoever drops the last
+ * reference: the waiter, or the last of the external calls.
+ */
+struct fy_executor_group {
+	struct fy_executor *fyx;
+	atomic_uint left;
+	atomic_uint refs;
+	struct fy_executor_task tasks[];
+};
+
+/* a ring of tasks; the owner works on the tail, thieves on the head */
+struct fy_executor_queue {
+	pthread_mutex_t lock;
+	struct fy_executor_task *tasks;
+	unsigned int head;
+	unsigned int count;
+	unsigned int size;
+};
+
+struct fy_executor_worker {
+	struct fy_executor *fyx;
+	pthread_t thread;
+	unsigned int index;
+	struct fy_executor_queue queue;
+};
+
+/*
+ * Every worker has its own queue, where the tasks it submits go and
+ * which it drains in LIFO order. Tasks submitted from other threads go
+ * to the shared queue. An idle worker steals the oldest tasks, first
+ * from the shared queue then from the other workers.
+ *
+ * With an external executor all tasks are handed to its submit method
+ * instead, and nothing is queued here.
+ */
+struct fy_executor {
+	struct fy_executor_cfg cfg;
+	pthread_mutex_t lock;
+	pthread_cond_t work;		/* idle workers wait on this */
+	pthread_cond_t done;		/* fy_executor_run() waits on this */
+	atomic_uint pending;		/* queued, not yet picked up */
+	bool stop;
+	unsigned int num_workers;
+	struct fy_executor_worker *workers;
+	struct fy_executor_queue shared;
+};
+
+#endif
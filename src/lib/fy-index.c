@@ -0,0 +1,1145 @@
+/*
+ * fy-index.c - document value indexes
+ *
+ * Copyright (c) 2019 Pantelis Antoniou <pantelis.antoniou@konsulko.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <libfyaml.h>
+
+#include "fy-parse.h"
+#include "fy-doc.h"
+#include "fy-utils.h"
+#include "fy-index.h"
+#include "fy-ypath.h"
+
+void fy_text_hash_init(struct fy_text_hash *fyth)
+{
+	memset(fyth, 0, sizeof(*fyth));
+}
+
+void fy_text_hash_cleanup(struct fy_text_hash *fyth)
+{
+	free(fyth->entries);
+	free(fyth->buckets);
+	free(fyth->tails);
+	fy_text_hash_init(fyth);
+}
+
+void fy_text_hash_reset(struct fy_text_hash *fyth)
+{
+	fyth->count = 0;
+	fyth->removed = 0;
+	fyth->free_slot = 0;
+	if (fyth->bucket_count) {
+		memset(fyth->buckets, 0xff, fyth->bucket_count * sizeof(*fyth->buckets));
+		memset(fyth->tails, 0xff, fyth->bucket_count * sizeof(*fyth->tails));
+	}
+}
+
+/* append to the end of its bucket, which keeps equal texts in order */
+static void fy_text_hash_link(struct fy_text_hash *fyth, int i)
+{
+	struct fy_text_hash_entry *fythe = &fyth->entries[i];
+	unsigned int b;
+
+	b = fythe->hash & (fyth->bucket_count - 1);
+	fythe->next = -1;
+	fythe->prev = fyth->tails[b];
+	if (fythe->prev >= 0)
+		fyth->entries[fythe->prev].next = i;
+	else
+		fyth->buckets[b] = i;
+	fyth->tails[b] = i;
+}
+
+static int fy_text_hash_grow(struct fy_text_hash *fyth)
+{
+	struct fy_text_hash_entry *entries;
+	unsigned int bucket_count, old_bucket_count, b;
+	int *buckets, *old_buckets, *tails, alloc, i;
+
+	alloc = fyth->alloc ? fyth->alloc * 2 : 16;
+	entries = realloc(fyth->entries, alloc * sizeof(*entries));
+	if (!entries)
+		return -1;
+	fyth->entries = entries;
+	fyth->alloc = alloc;
+
+	/* keep the load factor under one half */
+	bucket_count = fyth->bucket_count ? fyth->bucket_count : 16;
+	while (bucket_count < (unsigned int)alloc * 2)
+		bucket_count <<= 1;
+
+	if (bucket_count == fyth->bucket_count)
+		return 0;
+
+	buckets = malloc(bucket_count * sizeof(*buckets));
+	tails = malloc(bucket_count * sizeof(*tails));
+	if (!buckets || !tails) {
+		free(buckets);
+		free(tails);
+		return -1;
+	}
+	memset(buckets, 0xff, bucket_count * sizeof(*buckets));
+	memset(tails, 0xff, bucket_count * sizeof(*tails));
+
+	old_buckets = fyth->buckets;
+	old_bucket_count = fyth->bucket_count;
+	free(fyth->tails);
+	fyth->buckets = buckets;
+	fyth->tails = tails;
+	fyth->bucket_count = bucket_count;
+
+	/* rechain following the old chains, so that their order is kept */
+	for (b = 0; b < old_bucket_count; b++) {
+		for (i = old_buckets[b]; i >= 0; ) {
+			int next = entries[i].next;
+
+			fy_text_hash_link(fyth, i);
+			i = next;
+		}
+	}
+
+	free(old_buckets);
+
+	return 0;
+}
+
+int fy_text_hash_add(struct fy_text_hash *fyth, const char *text, size_t len, void *data)
+{
+	struct fy_text_hash_entry *fythe;
+	int i;
+
+	if (!data)
+		return -1;
+
+	/* the slots of removed entries are reused, the others stay put */
+	if (fyth->free_slot) {
+		i = fyth->free_slot - 1;
+		fyth->free_slot = fyth->entries[i].next;
+		fyth->removed--;
+	} else {
+		if (fyth->count >= fyth->alloc && fy_text_hash_grow(fyth))
+			return -1;
+		i = fyth->count++;
+	}
+
+	fythe = &fyth->entries[i];
+	fythe->hash = fy_hash_bytes(FY_HASH_INIT, text, len);
+	fythe->text = text;
+	fythe->len = len;
+	fythe->data = data;
+
+	fy_text_hash_link(fyth, i);
+
+	return i;
+}
+
+void fy_text_hash_remove_slot(struct fy_text_hash *fyth, int i)
+{
+	struct fy_text_hash_entry *fythe;
+	unsigned int b;
+
+	if (i < 0 || i >= fyth->count || !fyth->entries[i].data)
+		return;
+
+	fythe = &fyth->entries[i];
+	b = fythe->hash & (fyth->bucket_count - 1);
+	if (fythe->prev >= 0)
+		fyth->entries[fythe->prev].next = fythe->next;
+	else
+		fyth->buckets[b] = fythe->next;
+	if (fythe->next >= 0)
+		fyth->entries[fythe->next].prev = fythe->prev;
+	else
+		fyth->tails[b] = fythe->prev;
+
+	fythe->data = NULL;
+	fythe->text = NULL;
+	fythe->next = fyth->free_slot;
+	fyth->free_slot = i + 1;
+	fyth->removed++;
+}
+
+int fy_text_hash_remove(struct fy_text_hash *fyth, const char *text, size_t len, void *data)
+{
+	uint32_t hash;
+	int i;
+
+	if (!fyth->bucket_count)
+		return -1;
+
+	hash = fy_hash_bytes(FY_HASH_INIT, text, len);
+	for (i = fyth->buckets[hash & (fyth->bucket_count - 1)]; i >= 0;
+			i = fyth->entries[i].next) {
+		if (fyth->entries[i].data == data) {
+			fy_text_hash_remove_slot(fyth, i);
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+void *fy_text_hash_iterate(struct fy_text_hash *fyth, const char *text, size_t len, int *iterp)
+{
+	struct fy_text_hash_entry *fythe;
+	uint32_t hash;
+	int i;
+
+	if (!fyth->bucket_count || !text)
+		return NULL;
+
+	hash = fy_hash_bytes(FY_HASH_INIT, text, len);
+
+	if (!*iterp)
+		i = fyth->buckets[hash & (fyth->bucket_count - 1)];
+	else if (*iterp > 0 && *iterp <= fyth->count)
+		i = fyth->entries[*iterp - 1].next;
+	else
+		return NULL;
+
+	for (; i >= 0; i = fythe->next) {
+		fythe = &fyth->entries[i];
+		if (fythe->hash == hash && fythe->len == len && !memcmp(fythe->text, text, len)) {
+			*iterp = i + 1;
+			return fythe->data;
+		}
+	}
+
+	return NULL;
+}
+
+void *fy_text_hash_lookup(struct fy_text_hash *fyth, const char *text, size_t len)
+{
+	int iter = 0;
+
+	return fy_text_hash_iterate(fyth, text, len, &iter);
+}
+
+static int fy_document_index_add(struct fy_document_index *fydi,
+				 struct fy_node *fyn, struct fy_node *fyn_value)
+{
+	struct fy_document_index_entry *fydie;
+	const char *text;
+	size_t len;
+
+	/* only scalar values are indexed */
+	text = fy_ypath_node_text(fyn_value, &len);
+	if (!text)
+		return 0;
+
+	fydie = fy_tpool_alloc(&fydi->entry_pool);
+	if (!fydie)
+		return -1;
+	fydie->fyn = fyn;
+	fydie->fyn_value = fyn_value;
+
+	fydie->value_slot = fy_text_hash_add(&fydi->values, text, len, fydie);
+	if (fydie->value_slot < 0)
+		goto err_out;
+
+	/* keyed by the address, kept in the entry */
+	fydie->node_slot = fy_text_hash_add(&fydi->nodes, (const char *)&fydie->fyn_value,
+					    sizeof(fydie->fyn_value), fydie);
+	if (fydie->node_slot < 0) {
+		fy_text_hash_remove_slot(&fydi->values, fydie->value_slot);
+		goto err_out;
+	}
+
+	return 0;
+
+err_out:
+	fy_tpool_free(&fydi->entry_pool, fydie);
+	return -1;
+}
+
+/* drop the entries with the scalar as the value */
+static void fy_document_index_drop(struct fy_document_index *fydi, struct fy_node *fyn_value)
+{
+	struct fy_document_index_entry *fydie;
+
+	while ((fydie = fy_text_hash_lookup(&fydi->nodes, (const char *)&fyn_value,
+					    sizeof(fyn_value))) != NULL) {
+		fy_text_hash_remove_slot(&fydi->values, fydie->value_slot);
+		fy_text_hash_remove_slot(&fydi->nodes, fydie->node_slot);
+		fy_tpool_free(&fydi->entry_pool, fydie);
+	}
+}
+
+static void fy_document_index_drop_tree(struct fy_document_index *fydi, struct fy_node *fyn)
+{
+	struct fy_node *fyni;
+	struct fy_node_pair *fynp;
+
+	if (!fyn)
+		return;
+
+	switch (fyn->type) {
+	case FYNT_SCALAR:
+		fy_document_index_drop(fydi, fyn);
+		break;
+	case FYNT_SEQUENCE:
+		for (fyni = fy_node_list_head(&fyn->sequence); fyni;
+		     fyni = fy_node_next(&fyn->sequence, fyni))
+			fy_document_index_drop_tree(fydi, fyni);
+		break;
+	case FYNT_MAPPING:
+		for (fynp = fy_node_pair_list_head(&fyn->mapping); fynp;
+		     fynp = fy_node_pair_next(&fyn->mapping, fynp)) {
+			fy_document_index_drop_tree(fydi, fynp->key);
+			fy_document_index_drop_tree(fydi, fynp->value);
+		}
+		break;
+	}
+}
+
+/*
+ * The nodes the key path starts from, that reached a node with the same
+ * states. Starts merging on the way down are joined in a tree of unions,
+ * so that a descendant step (//) is evaluated in a single walk instead
+ * of a walk from every collection above.
+ */
+struct fy_index_starts {
+	struct fy_node *fyn;		/* a start, NULL for a union */
+	struct fy_index_starts *left;
+	struct fy_index_starts *right;
+	int order;			/* of the start in the walk */
+};
+
+struct fy_index_group {
+	uint64_t states;
+	struct fy_index_starts *starts;
+};
+
+struct fy_index_match {
+	int order;			/* of the start */
+	int seq;			/* of the match */
+	struct fy_node *fyn;
+	struct fy_node *fyn_value;
+};
+
+struct fy_index_walk {
+	struct fy_document_index *fydi;
+	unsigned int since;		/* for an update, the generation of the last */
+	bool update;
+	bool clear;			/* no other index needs the reindex marks */
+	struct fy_talloc_list tallocs;
+	struct fy_tpool starts_pool;
+	struct fy_index_match *matches;
+	int match_count;
+	int match_alloc;
+	int order;
+	bool error;
+};
+
+static struct fy_index_starts *
+fy_index_starts_create(struct fy_index_walk *w, struct fy_node *fyn,
+		       struct fy_index_starts *left, struct fy_index_starts *right)
+{
+	struct fy_index_starts *starts;
+
+	starts = fy_tpool_alloc(&w->starts_pool);
+	if (!starts) {
+		w->error = true;
+		return NULL;
+	}
+	starts->fyn = fyn;
+	starts->left = left;
+	starts->right = right;
+	starts->order = fyn ? w->order++ : 0;
+	return starts;
+}
+
+/* add to the groups, joining the starts of a group with the same states */
+static void fy_index_group_add(struct fy_index_walk *w, struct fy_index_group *g, int *np,
+			       uint64_t states, struct fy_index_starts *starts)
+{
+	int i;
+
+	for (i = 0; i < *np; i++) {
+		if (g[i].states == states) {
+			g[i].starts = fy_index_starts_create(w, NULL, g[i].starts, starts);
+			return;
+		}
+	}
+	g[*np].states = states;
+	g[*np].starts = starts;
+	(*np)++;
+}
+
+static void fy_index_collect(struct fy_index_walk *w, struct fy_index_starts *starts,
+			     struct fy_node *fyn_value)
+{
+	struct fy_index_match *fyim;
+	int alloc;
+
+	if (!starts || w->error)
+		return;
+
+	if (!starts->fyn) {
+		fy_index_collect(w, starts->left, fyn_value);
+		fy_index_collect(w, starts->right, fyn_value);
+		return;
+	}
+
+	if (w->match_count >= w->match_alloc) {
+		alloc = w->match_alloc ? w->match_alloc * 2 : 64;
+		fyim = realloc(w->matches, alloc * sizeof(*fyim));
+		if (!fyim) {
+			w->error = true;
+			return;
+		}
+		w->matches = fyim;
+		w->match_alloc = alloc;
+	}
+
+	fyim = &w->matches[w->match_count];
+	fyim->order = starts->order;
+	fyim->seq = w->match_count++;
+	fyim->fyn = starts->fyn;
+	fyim->fyn_value = fyn_value;
+}
+
+/* the groups of a child, given those of its parent */
+static int fy_index_transition(struct fy_index_walk *w, const struct fy_index_group *g, int n,
+			       struct fy_index_group *cg, const char *key, size_t key_len,
+			       int index, int count, struct fy_node *fyn)
+{
+	uint64_t next;
+	int i, cn;
+
+	for (i = cn = 0; i < n; i++) {
+		next = fy_ypath_transition(w->fydi->ypath, g[i].states, key, key_len,
+					   index, count, fyn, NULL);
+		if (next)
+			fy_index_group_add(w, cg, &cn, next, g[i].starts);
+	}
+	return cn;
+}
+
+static bool fy_index_walk_changed(struct fy_index_walk *w, struct fy_node *fyn)
+{
+	return fyn->changed > w->since || fyn->reindex;
+}
+
+/*
+ * Visit a node reached with the given groups. With @full set the node
+ * is indexed anew, otherwise only the changed children are visited.
+ */
+static void fy_index_walk_node(struct fy_index_walk *w, struct fy_node *fyn,
+			       const struct fy_index_group *groups, int n,
+			       bool full, bool is_key)
+{
+	struct fy_document_index *fydi = w->fydi;
+	const struct fy_ypath *ypath = fydi->ypath;
+	struct fy_index_group g[n + 1], cg[n + 1];
+	struct fy_index_starts *starts;
+	struct fy_node *fyni;
+	struct fy_node_pair *fynp;
+	const char *key;
+	size_t key_len;
+	uint64_t all;
+	int i, cn, index, count;
+
+	if (w->error)
+		return;
+
+	if (fyn->reindex) {
+		full = true;
+		if (w->clear)
+			fyn->reindex = false;
+	}
+
+	if (n)
+		memcpy(g, groups, n * sizeof(*g));
+
+	if (fyn->type == FYNT_SCALAR) {
+		if (!full)
+			return;
+		if (w->update)
+			fy_document_index_drop(fydi, fyn);
+		for (i = 0; i < n; i++) {
+			if (g[i].states & FY_YPATH_BIT(ypath->count))
+				fy_index_collect(w, g[i].starts, fyn);
+		}
+		return;
+	}
+
+	/* every collection (but a key) is a start */
+	if (!is_key) {
+		starts = fy_index_starts_create(w, fyn, NULL, NULL);
+		if (!starts)
+			return;
+		fy_index_group_add(w, g, &n, FY_YPATH_BIT(0), starts);
+	}
+
+	all = 0;
+	for (i = 0; i < n; i++)
+		all |= g[i].states;
+
+	switch (fyn->type) {
+	case FYNT_SEQUENCE:
+		count = fy_ypath_states_need_count(ypath, all) ?
+				fy_node_sequence_item_count(fyn) : -1;
+		index = 0;
+		for (fyni = fy_node_list_head(&fyn->sequence); fyni && !w->error;
+		     fyni = fy_node_next(&fyn->sequence, fyni), index++) {
+			if (!full && !fy_index_walk_changed(w, fyni))
+				continue;
+			cn = fy_index_transition(w, g, n, cg, NULL, 0, index, count, fyni);
+			fy_index_walk_node(w, fyni, cg, cn, full, false);
+		}
+		break;
+
+	case FYNT_MAPPING:
+		for (fynp = fy_node_pair_list_head(&fyn->mapping); fynp && !w->error;
+		     fynp = fy_node_pair_next(&fyn->mapping, fynp)) {
+			/* the collections in a key start afresh */
+			if (full && fynp->key && fynp->key->type != FYNT_SCALAR) {
+				fydi->keyed = true;
+				fy_index_walk_node(w, fynp->key, NULL, 0, true, true);
+			}
+			if (!fynp->value || (!full && !fy_index_walk_changed(w, fynp->value)))
+				continue;
+			key = fy_ypath_node_text(fynp->key, &key_len);
+			cn = fy_index_transition(w, g, n, cg, key, key_len, -1, -1, fynp->value);
+			fy_index_walk_node(w, fynp->value, cg, cn, full, false);
+		}
+		break;
+
+	default:
+		break;
+	}
+}
+
+static int fy_index_match_cmp(const void *a, const void *b)
+{
+	const struct fy_index_match *fyim1 = a, *fyim2 = b;
+
+	if (fyim1->order != fyim2->order)
+		return fyim1->order < fyim2->order ? -1 : 1;
+	return fyim1->seq - fyim2->seq;
+}
+
+/* index the tree (or, for an update, its changed parts) in one walk */
+static int fy_document_index_walk(struct fy_document_index *fydi, bool update)
+{
+	struct fy_document *fyd = fydi->fyd;
+	struct fy_document_index *fydit;
+	struct fy_index_walk w;
+	int i, rc = 0;
+
+	memset(&w, 0, sizeof(w));
+	w.fydi = fydi;
+	w.update = update;
+	w.since = update ? fydi->generation : 0;
+	fy_talloc_list_init(&w.tallocs);
+	fy_tpool_init(&w.starts_pool, &w.tallocs, sizeof(struct fy_index_starts));
+
+	/* the marks stay for another index that is still to follow them */
+	w.clear = true;
+	for (fydit = fy_document_index_list_head(&fyd->indexes); fydit;
+	     fydit = fy_document_index_next(&fyd->indexes, fydit)) {
+		if (fydit != fydi && fydit->valid &&
+		    fydit->generation != fyd->generation &&
+		    fydit->generation >= fyd->rebuild_generation)
+			w.clear = false;
+	}
+
+	if (fyd->root && (!update || fy_index_walk_changed(&w, fyd->root)))
+		fy_index_walk_node(&w, fyd->root, NULL, 0, !update, false);
+
+	/* in the order of the starts, then of the matches */
+	if (!w.error && w.match_count) {
+		qsort(w.matches, w.match_count, sizeof(*w.matches), fy_index_match_cmp);
+		for (i = 0; i < w.match_count; i++) {
+			rc = fy_document_index_add(fydi, w.matches[i].fyn, w.matches[i].fyn_value);
+			if (rc)
+				break;
+		}
+	}
+
+	free(w.matches);
+	fy_tfree_all(&w.tallocs);
+
+	return w.error || rc ? -1 : 0;
+}
+
+static void fy_document_index_reset(struct fy_document_index *fydi)
+{
+	fy_text_hash_reset(&fydi->values);
+	fy_text_hash_reset(&fydi->nodes);
+	fy_tfree_all(&fydi->tallocs);
+	fy_tpool_init(&fydi->entry_pool, &fydi->tallocs, sizeof(struct fy_document_index_entry));
+}
+
+/* bring the index up to date with the document */
+static int fy_document_index_update(struct fy_document_index *fydi)
+{
+	struct fy_document *fyd = fydi->fyd;
+	bool update;
+
+	if (fydi->valid && fydi->generation == fyd->generation)
+		return 0;
+
+	update = fydi->valid && fydi->generation >= fyd->rebuild_generation;
+	fydi->valid = false;
+
+	if (!update) {
+		fy_document_index_reset(fydi);
+		fydi->keyed = false;
+	}
+
+	if (fy_document_index_walk(fydi, update))
+		return -1;
+
+	fydi->generation = fyd->generation;
+	fydi->valid = true;
+
+	return 0;
+}
+
+/* whether the index follows the changes made since its last update */
+static bool fy_document_index_tracking(struct fy_document_index *fydi)
+{
+	return fydi->valid && fydi->generation >= fydi->fyd->rebuild_generation;
+}
+
+void fy_node_modified(struct fy_node *fyn_parent, struct fy_node *fyn)
+{
+	struct fy_document *fyd;
+	struct fy_document_index *fydi;
+	struct fy_node *fyni, *fyn_top = NULL;
+	unsigned int generation;
+	bool keyed = false;
+
+	if (!fyn_parent || !fyn_parent->fyd)
+		return;
+
+	fyd = fyn_parent->fyd;
+	generation = ++fyd->generation;
+
+	if (fy_document_index_list_empty(&fyd->indexes))
+		return;
+
+	if (fyn) {
+		fyn->changed = generation;
+		fyn->reindex = true;
+	}
+
+	for (fydi = fy_document_index_list_head(&fyd->indexes); fydi;
+	     fydi = fy_document_index_next(&fyd->indexes, fydi)) {
+		/* the siblings may match differently now */
+		if (fydi->positional)
+			fyn_parent->reindex = true;
+		keyed |= fydi->keyed;
+	}
+
+	for (fyni = fyn_parent; fyni; fyni = fy_node_parent(fyni)) {
+		fyni->changed = generation;
+		fyn_top = fyni;
+	}
+
+	/*
+	 * Out of the tree it's no concern, unless in a key (which can't be
+	 * told apart) with collections in keys indexed; those are found by
+	 * a full build only.
+	 */
+	if (fyn_top != fyd->root && keyed)
+		fyd->rebuild_generation = generation;
+}
+
+void fy_node_detached(struct fy_node *fyn)
+{
+	struct fy_document *fyd;
+	struct fy_document_index *fydi;
+
+	if (!fyn || !fyn->fyd)
+		return;
+
+	fyd = fyn->fyd;
+	for (fydi = fy_document_index_list_head(&fyd->indexes); fydi;
+	     fydi = fy_document_index_next(&fyd->indexes, fydi)) {
+		/* one that is to be built again doesn't look at its entries */
+		if (fy_document_index_tracking(fydi))
+			fy_document_index_drop_tree(fydi, fyn);
+	}
+}
+
+struct fy_document_index *fy_document_build_index(struct fy_document *fyd, const char *key_path)
+{
+	struct fy_document_index *fydi;
+	int rc;
+
+	if (!fyd || !key_path)
+		return NULL;
+
+	fydi = malloc(sizeof(*fydi));
+	if (!fydi)
+		return NULL;
+	memset(fydi, 0, sizeof(*fydi));
+	fydi->fyd = fyd;
+	fy_talloc_list_init(&fydi->tallocs);
+	fy_tpool_init(&fydi->entry_pool, &fydi->tallocs, sizeof(struct fy_document_index_entry));
+
+	fydi->ypath = fy_ypath_compile(key_path);
+	if (!fydi->ypath)
+		goto err_out;
+	fydi->positional = fy_ypath_is_positional(fydi->ypath);
+
+	rc = fy_document_index_update(fydi);
+	if (rc)
+		goto err_out;
+
+	fy_document_index_list_add_tail(&fyd->indexes, fydi);
+
+	return fydi;
+
+err_out:
+	fy_ypath_destroy(fydi->ypath);
+	fy_text_hash_cleanup(&fydi->values);
+	fy_text_hash_cleanup(&fydi->nodes);
+	fy_tfree_all(&fydi->tallocs);
+	free(fydi);
+	return NULL;
+}
+
+static void fy_document_index_free(struct fy_document_index *fydi)
+{
+	fy_ypath_destroy(fydi->ypath);
+	fy_text_hash_cleanup(&fydi->values);
+	fy_text_hash_cleanup(&fydi->nodes);
+	fy_tfree_all(&fydi->tallocs);
+	free(fydi);
+}
+
+void fy_document_index_destroy(struct fy_document_index *fydi)
+{
+	if (!fydi)
+		return;
+
+	fy_document_index_list_del(&fydi->fyd->indexes, fydi);
+	fy_document_index_free(fydi);
+}
+
+static void fy_ordered_index_free(struct fy_ordered_index *fyoi)
+{
+	free(fyoi->entries);
+	free(fyoi);
+}
+
+void fy_document_destroy_indexes(struct fy_document *fyd)
+{
+	struct fy_document_index *fydi;
+	struct fy_ordered_index *fyoi;
+
+	while ((fydi = fy_document_index_list_pop(&fyd->indexes)) != NULL)
+		fy_document_index_free(fydi);
+	while ((fyoi = fy_ordered_index_list_pop(&fyd->ordered_indexes)) != NULL)
+		fy_ordered_index_free(fyoi);
+	if (fyd->ordered_maps) {
+		fy_text_hash_cleanup(fyd->ordered_maps);
+		free(fyd->ordered_maps);
+		fyd->ordered_maps = NULL;
+	}
+}
+
+void fy_document_index_invalidate(struct fy_document_index *fydi)
+{
+	if (fydi)
+		fydi->valid = false;
+}
+
+struct fy_node *fy_document_index_iterate(struct fy_document_index *fydi,
+					  const char *value, size_t len, void **prevp)
+{
+	struct fy_document_index_entry *fydie;
+	int iter;
+
+	if (!fydi || !value || !prevp)
+		return NULL;
+
+	if (len == (size_t)-1)
+		len = strlen(value);
+
+	/* catch up with any change since the last use */
+	if (!*prevp && fy_document_index_update(fydi))
+		return NULL;
+
+	iter = (int)(uintptr_t)*prevp;
+	fydie = fy_text_hash_iterate(&fydi->values, value, len, &iter);
+	if (!fydie)
+		return NULL;
+
+	*prevp = (void *)(uintptr_t)iter;
+	return fydie->fyn;
+}
+
+struct fy_node *fy_document_index_lookup(struct fy_document_index *fydi,
+					 const char *value, size_t len)
+{
+	void *iter = NULL;
+
+	return fy_document_index_iterate(fydi, value, len, &iter);
+}
+
+static int fy_ordered_index_key_cmp(const char *key1, size_t len1,
+				    const char *key2, size_t len2)
+{
+	int ret;
+
+	ret = memcmp(key1, key2, len1 < len2 ? len1 : len2);
+	if (ret)
+		return ret;
+	return len1 < len2 ? -1 : len1 > len2 ? 1 : 0;
+}
+
+static int fy_ordered_index_entry_cmp(const void *a, const void *b)
+{
+	const struct fy_ordered_index_entry *fyoie1 = a, *fyoie2 = b;
+	int ret;
+
+	ret = fy_ordered_index_key_cmp(fyoie1->key, fyoie1->len,
+				       fyoie2->key, fyoie2->len);
+	if (ret)
+		return ret;
+
+	/* keep the mapping order for equal keys */
+	return fyoie1->pos - fyoie2->pos;
+}
+
+/* the key a pair is ordered by, false for one that isn't indexed */
+static bool fy_ordered_index_pair_key(struct fy_node_pair *fynp,
+				      const char **keyp, size_t *lenp)
+{
+	const char *key;
+
+	/* only scalar keys are ordered */
+	if (!fynp->key || !fy_node_is_scalar(fynp->key) ||
+	    fy_node_get_style(fynp->key) == FYNS_ALIAS)
+		return false;
+
+	key = fy_node_get_scalar(fynp->key, lenp);
+	if (!key) {
+		key = "";
+		*lenp = 0;
+	}
+	*keyp = key;
+	return true;
+}
+
+static int fy_ordered_index_grow(struct fy_ordered_index *fyoi)
+{
+	struct fy_ordered_index_entry *entries;
+	int alloc;
+
+	alloc = fyoi->alloc ? fyoi->alloc * 2 : 16;
+	entries = realloc(fyoi->entries, alloc * sizeof(*entries));
+	if (!entries)
+		return -1;
+	fyoi->entries = entries;
+	fyoi->alloc = alloc;
+	return 0;
+}
+
+static int fy_ordered_index_rebuild(struct fy_ordered_index *fyoi)
+{
+	struct fy_node *fyn_map = fyoi->fyn_map;
+	struct fy_ordered_index_entry *fyoie;
+	struct fy_node_pair *fynp;
+	const char *key;
+	size_t len;
+
+	fyoi->valid = false;
+	fyoi->count = 0;
+
+	for (fynp = fy_node_pair_list_head(&fyn_map->mapping); fynp;
+	     fynp = fy_node_pair_next(&fyn_map->mapping, fynp)) {
+
+		if (!fy_ordered_index_pair_key(fynp, &key, &len))
+			continue;
+
+		if (fyoi->count >= fyoi->alloc && fy_ordered_index_grow(fyoi))
+			return -1;
+
+		fyoie = &fyoi->entries[fyoi->count++];
+		fyoie->key = key;
+		fyoie->len = len;
+		fyoie->fynp = fynp;
+		fyoie->pos = fyoi->count - 1;
+	}
+
+	qsort(fyoi->entries, fyoi->count, sizeof(*fyoi->entries),
+	      fy_ordered_index_entry_cmp);
+
+	fyoi->valid = true;
+
+	return 0;
+}
+
+static struct fy_ordered_index *fy_ordered_index_find(struct fy_node *fyn)
+{
+	struct fy_document *fyd = fyn->fyd;
+
+	if (!fyd->ordered_maps)
+		return NULL;
+
+	return fy_text_hash_lookup(fyd->ordered_maps, (const char *)&fyn, sizeof(fyn));
+}
+
+/* whether the index follows the changes made since it was last used */
+static bool fy_ordered_index_tracking(struct fy_ordered_index *fyoi)
+{
+	return fyoi->valid && fyoi->generation >= fyoi->fyn_map->fyd->rebuild_generation;
+}
+
+static struct fy_ordered_index *fy_ordered_index_get(struct fy_node *fyn)
+{
+	struct fy_document *fyd;
+	struct fy_ordered_index *fyoi;
+
+	if (!fyn || fyn->type != FYNT_MAPPING || !fyn->fyd)
+		return NULL;
+
+	fyd = fyn->fyd;
+	fyoi = fy_ordered_index_find(fyn);
+	if (!fyoi) {
+		if (!fyd->ordered_maps) {
+			fyd->ordered_maps = malloc(sizeof(*fyd->ordered_maps));
+			if (!fyd->ordered_maps)
+				return NULL;
+			fy_text_hash_init(fyd->ordered_maps);
+		}
+
+		fyoi = malloc(sizeof(*fyoi));
+		if (!fyoi)
+			return NULL;
+		memset(fyoi, 0, sizeof(*fyoi));
+		fyoi->fyn_map = fyn;
+		fyoi->map_slot = fy_text_hash_add(fyd->ordered_maps,
+						  (const char *)&fyoi->fyn_map,
+						  sizeof(fyoi->fyn_map), fyoi);
+		if (fyoi->map_slot < 0) {
+			free(fyoi);
+			return NULL;
+		}
+		fy_ordered_index_list_add_tail(&fyd->ordered_indexes, fyoi);
+	}
+
+	if (!fy_ordered_index_tracking(fyoi) && fy_ordered_index_rebuild(fyoi))
+		return NULL;
+
+	/* an iteration ends on any change after this */
+	fyoi->generation = fyd->generation;
+
+	return fyoi;
+}
+
+int fy_node_mapping_create_ordered_index(struct fy_node *fyn)
+{
+	return fy_ordered_index_get(fyn) ? 0 : -1;
+}
+
+void fy_node_mapping_destroy_ordered_index(struct fy_node *fyn)
+{
+	struct fy_ordered_index *fyoi;
+
+	if (!fyn || fyn->type != FYNT_MAPPING || !fyn->fyd)
+		return;
+
+	fyoi = fy_ordered_index_find(fyn);
+	if (!fyoi)
+		return;
+
+	fy_text_hash_remove_slot(fyn->fyd->ordered_maps, fyoi->map_slot);
+	fy_ordered_index_list_del(&fyn->fyd->ordered_indexes, fyoi);
+	fy_ordered_index_free(fyoi);
+}
+
+/* the first entry with a key not less (or, @after, greater) than the given one */
+static int fy_ordered_index_bound(struct fy_ordered_index *fyoi,
+				  const char *key, size_t len, bool after)
+{
+	struct fy_ordered_index_entry *fyoie;
+	int lo, hi, mid, ret;
+
+	lo = 0;
+	hi = fyoi->count;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		fyoie = &fyoi->entries[mid];
+		ret = fy_ordered_index_key_cmp(fyoie->key, fyoie->len, key, len);
+		if (ret < 0 || (after && !ret))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* the index of the mapping of a pair, when it follows the changes */
+static struct fy_ordered_index *fy_ordered_index_of_pair(struct fy_node_pair *fynp)
+{
+	struct fy_node *fyn_map;
+	struct fy_ordered_index *fyoi;
+
+	if (!fynp || !fynp->fyd ||
+	    fy_ordered_index_list_empty(&fynp->fyd->ordered_indexes))
+		return NULL;
+
+	fyn_map = fy_node_pair_parent(fynp);
+	if (!fyn_map || fyn_map->type != FYNT_MAPPING)
+		return NULL;
+
+	fyoi = fy_ordered_index_find(fyn_map);
+	if (!fyoi || !fy_ordered_index_tracking(fyoi))
+		return NULL;
+
+	return fyoi;
+}
+
+void fy_node_pair_added(struct fy_node_pair *fynp)
+{
+	struct fy_ordered_index *fyoi;
+	struct fy_ordered_index_entry *fyoie;
+	struct fy_node *fyn_map;
+	const char *key;
+	size_t len;
+	int i;
+
+	fyoi = fy_ordered_index_of_pair(fynp);
+	if (!fyoi || !fy_ordered_index_pair_key(fynp, &key, &len))
+		return;
+
+	fyn_map = fyoi->fyn_map;
+	i = fy_ordered_index_bound(fyoi, key, len, false);
+
+	/* among equal keys the mapping order is only known at its ends */
+	if (i < fyoi->count &&
+	    !fy_ordered_index_key_cmp(fyoi->entries[i].key, fyoi->entries[i].len, key, len)) {
+		if (fynp == fy_node_pair_list_tail(&fyn_map->mapping))
+			i = fy_ordered_index_bound(fyoi, key, len, true);
+		else if (fynp != fy_node_pair_list_head(&fyn_map->mapping))
+			goto err_out;
+	}
+
+	if (fyoi->count >= fyoi->alloc && fy_ordered_index_grow(fyoi))
+		goto err_out;
+
+	memmove(&fyoi->entries[i + 1], &fyoi->entries[i],
+		(fyoi->count - i) * sizeof(*fyoi->entries));
+	fyoie = &fyoi->entries[i];
+	fyoie->key = key;
+	fyoie->len = len;
+	fyoie->fynp = fynp;
+	fyoie->pos = i;
+	fyoi->count++;
+
+	return;
+
+err_out:
+	/* built again on the next use */
+	fyoi->valid = false;
+}
+
+void fy_node_pair_removed(struct fy_node_pair *fynp)
+{
+	struct fy_ordered_index *fyoi;
+	struct fy_ordered_index_entry *fyoie;
+	const char *key;
+	size_t len;
+	int i;
+
+	fyoi = fy_ordered_index_of_pair(fynp);
+	if (!fyoi || !fy_ordered_index_pair_key(fynp, &key, &len))
+		return;
+
+	for (i = fy_ordered_index_bound(fyoi, key, len, false); i < fyoi->count; i++) {
+		fyoie = &fyoi->entries[i];
+		if (fyoie->fynp == fynp) {
+			memmove(fyoie, fyoie + 1, (fyoi->count - i - 1) * sizeof(*fyoie));
+			fyoi->count--;
+			break;
+		}
+		if (fy_ordered_index_key_cmp(fyoie->key, fyoie->len, key, len))
+			break;
+	}
+}
+
+/*
+ * Iterate from @first (or the start), while the key is less than @last,
+ * or while the key has the @first prefix when @prefix is set.
+ * The iterator holds the position of the next entry plus one.
+ */
+static struct fy_node_pair *
+fy_ordered_index_iterate(struct fy_node *fyn, const char *first, size_t first_len,
+			 const char *last, size_t last_len, bool prefix, void **prevp)
+{
+	struct fy_ordered_index *fyoi;
+	struct fy_ordered_index_entry *fyoie;
+	int i;
+
+	if (!prevp)
+		return NULL;
+
+	if (first && first_len == (size_t)-1)
+		first_len = strlen(first);
+	if (last && last_len == (size_t)-1)
+		last_len = strlen(last);
+
+	if (!*prevp) {
+		fyoi = fy_ordered_index_get(fyn);
+		if (!fyoi)
+			return NULL;
+		i = first ? fy_ordered_index_bound(fyoi, first, first_len, false) : 0;
+	} else {
+		/* the mapping changed while iterating */
+		fyoi = fy_ordered_index_find(fyn);
+		if (!fyoi || !fyoi->valid || fyoi->generation != fyn->fyd->generation)
+			return NULL;
+		i = (int)((uintptr_t)*prevp - 1);
+	}
+
+	if (i < 0 || i >= fyoi->count)
+		return NULL;
+
+	fyoie = &fyoi->entries[i];
+	if (prefix) {
+		if (fyoie->len < first_len || memcmp(fyoie->key, first, first_len))
+			return NULL;
+	} else if (last) {
+		if (fy_ordered_index_key_cmp(fyoie->key, fyoie->len, last, last_len) >= 0)
+			return NULL;
+	}
+
+	*prevp = (void *)(uintptr_t)(i + 2);
+	return fyoie->fynp;
+}
+
+struct fy_node_pair *fy_node_mapping_lookup_prefix(struct fy_node *fyn,
+						   const char *prefix, size_t len,
+						   void **prevp)
+{
+	if (!prefix)
+		return NULL;
+
+	return fy_ordered_index_iterate(fyn, prefix, len, NULL, 0, true, prevp);
+}
+
+struct fy_node_pair *fy_node_mapping_range_iterate(struct fy_node *fyn,
+						   const char *first, size_t first_len,
+						   const char *last, size_t last_len,
+						   void **prevp)
+{
+	return fy_ordered_index_iterate(fyn, first, first_len, last, last_len, false, prevp);
+}
@@ -0,0 +1,119 @@
+/*
+ * fy-index.h - document value indexes internal header file
+ *
+ * Copyright (c) 2019 Pantelis Antoniou <pantelis.antoniou@konsulko.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef FY_INDEX_H
+#define FY_INDEX_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <libfyaml.h>
+
+#include "fy-list.h"
+#include "fy-typelist.h"
+#include "fy-talloc.h"
+
+struct fy_text_hash_entry {
+	uint32_t hash;
+	int next;			/* next entry of the bucket, -1 for none */
+	int prev;			/* previous one, -1 for the first */
+	const char *text;		/* owned by its token */
+	size_t len;
+	void *data;			/* NULL once removed */
+};
+
+/*
+ * Texts (of scalars, not copied) hashed to the objects they belong to.
+ * The entries are chained per bucket in the order they were added, so
+ * that equal texts are found in that order. An entry keeps its slot
+ * until removed, and the slots of removed entries are reused.
+ */
+struct fy_text_hash {
+	struct fy_text_hash_entry *entries;
+	int count;			/* slots used so far */
+	int alloc;
+	int removed;			/* of them, free */
+	int free_slot;			/* plus one, 0 for none */
+	int *buckets;
+	int *tails;			/* last entry of each bucket */
+	unsigned int bucket_count;	/* power of two */
+};
+
+void fy_text_hash_init(struct fy_text_hash *fyth);
+void fy_text_hash_cleanup(struct fy_text_hash *fyth);
+void fy_text_hash_reset(struct fy_text_hash *fyth);
+/* returns the slot of the entry, or -1 on error */
+int fy_text_hash_add(struct fy_text_hash *fyth, const char *text, size_t len, void *data);
+void fy_text_hash_remove_slot(struct fy_text_hash *fyth, int slot);
+int fy_text_hash_remove(struct fy_text_hash *fyth, const char *text, size_t len, void *data);
+/* @iterp starts at 0 */
+void *fy_text_hash_iterate(struct fy_text_hash *fyth, const char *text, size_t len, int *iterp);
+void *fy_text_hash_lookup(struct fy_text_hash *fyth, const char *text, size_t len);
+
+struct fy_document_index_entry {
+	struct fy_node *fyn;		/* the node the key path starts from */
+	struct fy_node *fyn_value;	/* the scalar found there */
+	int value_slot;			/* of the entry in values */
+	int node_slot;			/* and in nodes */
+};
+
+/*
+ * The values found by the key path, each mapped to the node the key
+ * path starts from, in document order as of the last full build; the
+ * entries added by an update follow. The document tells what changed
+ * since the last update by the generation stamps of its nodes, so an
+ * update only visits the changed parts of the tree, while the entries
+ * of nodes leaving the tree are dropped right away. A change the index
+ * can't follow makes the next update a full build.
+ */
+struct fy_document_index {
+	struct list_head node;
+	struct fy_document *fyd;
+	struct fy_ypath *ypath;		/* the compiled key path */
+	bool positional;		/* matches depend on the siblings */
+	bool keyed;			/* collections in keys were indexed */
+	unsigned int generation;	/* of the document when last updated */
+	bool valid;
+	struct fy_text_hash values;	/* scalar text to entries */
+	struct fy_text_hash nodes;	/* scalar node (its address) to entries */
+	struct fy_talloc_list tallocs;
+	struct fy_tpool entry_pool;
+};
+FY_TYPE_DECL_LIST(document_index);
+
+struct fy_ordered_index_entry {
+	const char *key;		/* the key text, owned by its token */
+	size_t len;
+	struct fy_node_pair *fynp;
+	int pos;			/* position in the mapping, for a build */
+};
+
+/*
+ * The scalar keys of a mapping sorted bytewise (pairs with equal keys
+ * stay in mapping order). The pairs added to or removed from the
+ * mapping are put in or taken out of it right away; like the value
+ * indexes, a change it can't follow makes the next use a full build.
+ */
+struct fy_ordered_index {
+	struct list_head node;
+	struct fy_node *fyn_map;
+	int map_slot;			/* in the ordered maps of the document */
+	unsigned int generation;	/* of the document when last used */
+	bool valid;
+	struct fy_ordered_index_entry *entries;
+	int count;
+	int alloc;
+};
+FY_TYPE_DECL_LIST(ordered_index);
+
+void fy_document_destroy_indexes(struct fy_document *fyd);
+
+#endif
@@ -0,0 +1,1090 @@
+/*
+ * fy-overlay.c - layered document overlay methods
+ *
+ * Copyright (c) 2019 Pantelis Antoniou <pantelis.antoniou@konsulko.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <limits.h>
+#include <alloca.h>
+
+#include <libfyaml.h>
+
+#include "fy-parse.h"
+#include "fy-doc.h"
+#include "fy-overlay.h"
+#include "fy-emit.h"
+
+#include "fy-utils.h"
+
+/* a node looked up this many times gets all of its entries merged */
+#define FY_OVERLAY_LAZY_LOOKUPS	8
+
+static inline struct fy_node *fy_overlay_node_top(struct fy_overlay_node *fyon)
+{
+	if (fyon->nlayers <= 0)
+		return NULL;
+
+	/* the layers over a sequence are patches of its items */
+	if (fy_node_is_sequence(fyon->layers[0]))
+		return fyon->layers[0];
+
+	return fyon->layers[fyon->nlayers - 1];
+}
+
+static struct fy_overlay_node *
+fy_overlay_node_alloc(struct fy_overlay *fyo, struct fy_node *key, uint32_t key_hash)
+{
+	struct fy_overlay_node *fyon;
+
+	fyon = malloc(sizeof(*fyon));
+	if (!fyon)
+		return NULL;
+	memset(fyon, 0, sizeof(*fyon));
+
+	fyon->fyo = fyo;
+	fyon->key = key;
+	fyon->key_hash = key_hash;
+	fy_overlay_node_list_add_tail(&fyo->nodes, fyon);
+
+	return fyon;
+}
+
+static void fy_overlay_node_free(struct fy_overlay_node *fyon)
+{
+	free(fyon->layers);
+	free(fyon->children);
+	free(fyon->hash);
+	free(fyon);
+}
+
+static bool fy_overlay_node_is_cut(struct fy_overlay *fyo, struct fy_node *fyn)
+{
+	int i;
+
+	if (!fyo->cuts)
+		return false;
+
+	for (i = 0; i < fyo->count; i++)
+		if (fyo->cuts[i] == fyn)
+			return true;
+	return false;
+}
+
+static bool fy_overlay_node_is_patch(struct fy_overlay *fyo, struct fy_node *fyn)
+{
+	int i;
+
+	for (i = 0; i < fyo->npatches; i++)
+		if (fyo->patches[i] == fyn)
+			return true;
+	return false;
+}
+
+static int fy_overlay_node_add_layer(struct fy_overlay_node *fyon, struct fy_node *fyn)
+{
+	struct fy_node *fyn_top, **layers;
+	bool merge;
+
+	/* mappings merge, as do patches over a sequence; anything else hides what's below it */
+	fyn_top = fy_overlay_node_top(fyon);
+	if (fy_node_is_sequence(fyn_top))
+		merge = fy_node_is_mapping(fyn) && fy_overlay_node_is_patch(fyon->fyo, fyn);
+	else
+		merge = fy_node_is_mapping(fyn) && fy_node_is_mapping(fyn_top) &&
+			!fy_overlay_node_is_cut(fyon->fyo, fyn);
+	if (!merge)
+		fyon->nlayers = 0;
+
+	layers = realloc(fyon->layers, (fyon->nlayers + 1) * sizeof(*layers));
+	if (!layers)
+		return -1;
+	fyon->layers = layers;
+	fyon->layers[fyon->nlayers++] = fyn;
+
+	return 0;
+}
+
+/* add a resolved child to the index of a node that's not expanded yet */
+static int fy_overlay_node_hash_add(struct fy_overlay_node *fyon, struct fy_overlay_node *fyonc)
+{
+	struct fy_overlay_node **hash, *fyoni;
+	unsigned int size, mask, i, pos;
+
+	size = fyon->hash ? fyon->hash_mask + 1 : 0;
+	if ((unsigned int)(fyon->nhashed + 1) * 2 > size) {
+		size = size ? size * 2 : 8;
+		mask = size - 1;
+		hash = calloc(size, sizeof(*hash));
+		if (!hash)
+			return -1;
+		for (i = 0; fyon->hash && i <= fyon->hash_mask; i++) {
+			fyoni = fyon->hash[i];
+			if (!fyoni)
+				continue;
+			for (pos = fyoni->key_hash & mask; hash[pos]; pos = (pos + 1) & mask)
+				;
+			hash[pos] = fyoni;
+		}
+		free(fyon->hash);
+		fyon->hash = hash;
+		fyon->hash_mask = mask;
+	}
+
+	for (pos = fyonc->key_hash & fyon->hash_mask; fyon->hash[pos];
+			pos = (pos + 1) & fyon->hash_mask)
+		;
+	fyon->hash[pos] = fyonc;
+	fyon->nhashed++;
+
+	return 0;
+}
+
+/* the items of a sequence are indexed by position */
+static struct fy_overlay_node *
+fy_overlay_hash_find_item(struct fy_overlay_node **hash, unsigned int mask, int index)
+{
+	struct fy_overlay_node *fyonc;
+	unsigned int pos;
+
+	if (!hash)
+		return NULL;
+
+	for (pos = (uint32_t)index & mask; (fyonc = hash[pos]) != NULL; pos = (pos + 1) & mask) {
+		if (fyonc->key_hash == (uint32_t)index)
+			break;
+	}
+	return fyonc;
+}
+
+static struct fy_overlay_node *
+fy_overlay_hash_find_key(struct fy_overlay_node **hash, unsigned int mask,
+			 uint32_t key_hash, struct fy_node *key)
+{
+	struct fy_overlay_node *fyonc;
+	unsigned int pos;
+
+	if (!hash)
+		return NULL;
+
+	for (pos = key_hash & mask; (fyonc = hash[pos]) != NULL; pos = (pos + 1) & mask) {
+		if (fyonc->key_hash == key_hash && fy_node_compare(fyonc->key, key))
+			break;
+	}
+	return fyonc;
+}
+
+/* the index a patch entry applies to, or -1 */
+static int fy_overlay_patch_index(struct fy_node *fyn_key)
+{
+	const char *text;
+	size_t len;
+	int index;
+
+	if (!fyn_key || fyn_key->type != FYNT_SCALAR)
+		return -1;
+
+	text = fy_token_get_text(fyn_key->scalar, &len);
+	if (!text || !len)
+		return -1;
+
+	for (index = 0; len > 0; text++, len--) {
+		if (!isdigit(*text) || index > (INT_MAX - 9) / 10)
+			return -1;
+		index = index * 10 + (*text - '0');
+	}
+
+	return index;
+}
+
+/* a sequence item with the patches of the layers above applied */
+static struct fy_overlay_node *
+fy_overlay_node_item_resolve(struct fy_overlay_node *fyon, struct fy_node *fyni, int index)
+{
+	struct fy_overlay_node *fyonc;
+	struct fy_node_pair *fynp;
+	struct fy_node *fyn;
+	int i;
+
+	fyonc = fy_overlay_node_alloc(fyon->fyo, NULL, (uint32_t)index);
+	if (!fyonc)
+		return NULL;
+
+	if (fy_overlay_node_add_layer(fyonc, fyni))
+		goto err_out;
+
+	for (i = 1; i < fyon->nlayers; i++) {
+		fyn = fyon->layers[i];
+		for (fynp = fy_node_pair_list_head(&fyn->mapping); fynp;
+				fynp = fy_node_pair_next(&fyn->mapping, fynp)) {
+			if (fy_overlay_patch_index(fynp->key) != index)
+				continue;
+			if (fy_overlay_node_add_layer(fyonc, fynp->value))
+				goto err_out;
+		}
+	}
+
+	fyonc->merged = true;
+	return fyonc;
+
+err_out:
+	fy_overlay_node_free(fy_overlay_node_list_pop_tail(&fyon->fyo->nodes));
+	return NULL;
+}
+
+static int fy_overlay_node_expand_sequence(struct fy_overlay_node *fyon, struct fy_node *fyn,
+					   struct fy_overlay_node **cache, unsigned int cache_mask)
+{
+	struct fy_overlay_node *fyonc;
+	struct fy_node *fyni;
+	int count;
+
+	count = fy_node_sequence_item_count(fyn);
+	if (!count)
+		return 0;
+
+	fyon->children = malloc(count * sizeof(*fyon->children));
+	if (!fyon->children)
+		return -1;
+
+	for (fyni = fy_node_list_head(&fyn->sequence); fyni; fyni = fy_node_next(&fyn->sequence, fyni)) {
+		fyonc = fy_overlay_hash_find_item(cache, cache_mask, fyon->nchildren);
+		if (!fyonc)
+			fyonc = fy_overlay_node_item_resolve(fyon, fyni, fyon->nchildren);
+		if (!fyonc)
+			return -1;
+		fyon->children[fyon->nchildren++] = fyonc;
+	}
+
+	return 0;
+}
+
+static int fy_overlay_node_expand_mapping(struct fy_overlay_node *fyon,
+					  struct fy_overlay_node **cache, unsigned int cache_mask)
+{
+	struct fy_overlay_node *fyonc;
+	struct fy_node_pair *fynp;
+	struct fy_node *fyn;
+	unsigned int size, pos;
+	uint32_t hash;
+	int i, total;
+
+	/* upper bound of the merged entries */
+	total = 0;
+	for (i = 0; i < fyon->nlayers; i++)
+		total += fy_node_mapping_item_count(fyon->layers[i]);
+	if (!total)
+		return 0;
+
+	for (size = 8; size < (unsigned int)total * 2; size <<= 1)
+		;
+
+	fyon->children = malloc(total * sizeof(*fyon->children));
+	fyon->hash = calloc(size, sizeof(*fyon->hash));
+	if (!fyon->children || !fyon->hash)
+		return -1;
+	fyon->hash_mask = size - 1;
+
+	for (i = 0; i < fyon->nlayers; i++) {
+		fyn = fyon->layers[i];
+		for (fynp = fy_node_pair_list_head(&fyn->mapping); fynp;
+				fynp = fy_node_pair_next(&fyn->mapping, fynp)) {
+
+			hash = fy_node_hash(fynp->key);
+			for (pos = hash & fyon->hash_mask; (fyonc = fyon->hash[pos]) != NULL;
+					pos = (pos + 1) & fyon->hash_mask) {
+				if (fyonc->key_hash == hash && fy_node_compare(fyonc->key, fynp->key))
+					break;
+			}
+
+			if (!fyonc) {
+				/* entries resolved earlier have all their layers */
+				fyonc = fy_overlay_hash_find_key(cache, cache_mask, hash, fynp->key);
+				if (!fyonc)
+					fyonc = fy_overlay_node_alloc(fyon->fyo, fynp->key, hash);
+				if (!fyonc)
+					return -1;
+				fyon->hash[pos] = fyonc;
+				fyon->children[fyon->nchildren++] = fyonc;
+			} else if (!fyonc->merged)
+				fyonc->key = fynp->key;
+
+			if (!fyonc->merged && fy_overlay_node_add_layer(fyonc, fynp->value))
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* undo a failed expansion, freeing the children created after fyon_last */
+static void fy_overlay_node_expand_rollback(struct fy_overlay_node *fyon,
+					    struct fy_overlay_node *fyon_last)
+{
+	struct fy_overlay *fyo = fyon->fyo;
+
+	while (fy_overlay_node_list_tail(&fyo->nodes) != fyon_last)
+		fy_overlay_node_free(fy_overlay_node_list_pop_tail(&fyo->nodes));
+
+	free(fyon->children);
+	fyon->children = NULL;
+	fyon->nchildren = 0;
+	free(fyon->hash);
+	fyon->hash = NULL;
+	fyon->hash_mask = 0;
+}
+
+static int fy_overlay_node_expand(struct fy_overlay_node *fyon)
+{
+	struct fy_overlay_node *fyon_last, **cache;
+	unsigned int cache_mask;
+	struct fy_node *fyn;
+	int i, rc;
+
+	if (fyon->expanded)
+		return 0;
+
+	/* the children are added at the tail of the list of nodes */
+	fyon_last = fy_overlay_node_list_tail(&fyon->fyo->nodes);
+
+	/* the children resolved one by one so far are reused */
+	cache = fyon->hash;
+	cache_mask = fyon->hash_mask;
+	fyon->hash = NULL;
+	fyon->hash_mask = 0;
+
+	fyn = fy_overlay_node_top(fyon);
+	switch (fy_node_get_type(fyn)) {
+	case FYNT_SEQUENCE:
+		rc = fy_overlay_node_expand_sequence(fyon, fyn, cache, cache_mask);
+		break;
+	case FYNT_MAPPING:
+		rc = fy_overlay_node_expand_mapping(fyon, cache, cache_mask);
+		break;
+	default:
+		rc = 0;
+		break;
+	}
+
+	/* so that trying again starts afresh */
+	if (rc) {
+		fy_overlay_node_expand_rollback(fyon, fyon_last);
+		fyon->hash = cache;
+		fyon->hash_mask = cache_mask;
+		return rc;
+	}
+
+	free(cache);
+	fyon->nhashed = 0;
+	for (i = 0; i < fyon->nchildren; i++)
+		fyon->children[i]->merged = true;
+
+	fyon->expanded = true;
+	return 0;
+}
+
+/* keys that are certain to be a plain scalar with identical text */
+static bool fy_overlay_key_is_plain(const char *key)
+{
+	const char *s;
+
+	if (!isalnum(*key) && *key != '_')
+		return false;
+	for (s = key; *s; s++) {
+		if (!isalnum(*s) && !strchr("_-.", *s))
+			return false;
+	}
+	return true;
+}
+
+static bool fy_overlay_key_text_match(struct fy_node *fyn_key, const char *text, size_t len)
+{
+	const char *t;
+	size_t l;
+
+	if (!fyn_key)
+		return len == 0;
+
+	if (fyn_key->type != FYNT_SCALAR)
+		return false;
+
+	t = fy_token_get_text(fyn_key->scalar, &l);
+	if (!t)
+		return len == 0;
+
+	return l == len && !memcmp(t, text, len);
+}
+
+static bool fy_overlay_key_match(struct fy_node *fyn_key, const char *text, size_t len,
+				 struct fy_node *fyn_key_match)
+{
+	return fyn_key_match ? fy_node_compare(fyn_key, fyn_key_match) :
+			       fy_overlay_key_text_match(fyn_key, text, len);
+}
+
+/* merge a single entry by looking it up in every layer, without expanding */
+static struct fy_overlay_node *
+fy_overlay_node_entry_resolve(struct fy_overlay_node *fyon, const char *text, size_t len,
+			      struct fy_node *fyn_key, uint32_t hash)
+{
+	struct fy_overlay_node *fyonc = NULL;
+	struct fy_node_pair *fynp;
+	struct fy_node *fyn;
+	int i;
+
+	for (i = 0; i < fyon->nlayers; i++) {
+		fyn = fyon->layers[i];
+		for (fynp = fy_node_pair_list_head(&fyn->mapping); fynp;
+				fynp = fy_node_pair_next(&fyn->mapping, fynp)) {
+			if (fy_overlay_key_match(fynp->key, text, len, fyn_key))
+				break;
+		}
+		if (!fynp)
+			continue;
+
+		if (!fyonc) {
+			fyonc = fy_overlay_node_alloc(fyon->fyo, fynp->key, hash);
+			if (!fyonc)
+				return NULL;
+		} else
+			fyonc->key = fynp->key;
+
+		if (fy_overlay_node_add_layer(fyonc, fynp->value))
+			goto err_out;
+	}
+
+	if (!fyonc)
+		return NULL;
+
+	if (fy_overlay_node_hash_add(fyon, fyonc))
+		goto err_out;
+
+	fyonc->merged = true;
+	return fyonc;
+
+err_out:
+	fy_overlay_node_free(fy_overlay_node_list_pop_tail(&fyon->fyo->nodes));
+	return NULL;
+}
+
+struct fy_overlay *fy_overlay_create_internal(struct fy_document * const *fyds,
+					      struct fy_node * const *cuts,
+					      struct fy_node * const *patches, int npatches,
+					      int count)
+{
+	struct fy_overlay *fyo;
+	int i;
+
+	if (!fyds || count <= 0 || npatches < 0 || (npatches && !patches))
+		return NULL;
+
+	for (i = 0; i < count; i++)
+		if (!fyds[i])
+			return NULL;
+
+	fyo = malloc(sizeof(*fyo));
+	if (!fyo)
+		return NULL;
+	memset(fyo, 0, sizeof(*fyo));
+	fy_overlay_node_list_init(&fyo->nodes);
+
+	fyo->fyds = malloc(count * sizeof(*fyo->fyds));
+	if (!fyo->fyds)
+		goto err_out;
+	memcpy(fyo->fyds, fyds, count * sizeof(*fyo->fyds));
+	fyo->count = count;
+
+	if (cuts) {
+		fyo->cuts = malloc(count * sizeof(*fyo->cuts));
+		if (!fyo->cuts)
+			goto err_out;
+		memcpy(fyo->cuts, cuts, count * sizeof(*fyo->cuts));
+	}
+
+	if (npatches) {
+		fyo->patches = malloc(npatches * sizeof(*fyo->patches));
+		if (!fyo->patches)
+			goto err_out;
+		memcpy(fyo->patches, patches, npatches * sizeof(*fyo->patches));
+		fyo->npatches = npatches;
+	}
+
+	fyo->root = fy_overlay_node_alloc(fyo, NULL, 0);
+	if (!fyo->root)
+		goto err_out;
+
+	for (i = 0; i < count; i++) {
+		if (fy_overlay_node_add_layer(fyo->root, fy_document_root(fyds[i])))
+			goto err_out;
+	}
+
+	return fyo;
+
+err_out:
+	fy_overlay_destroy(fyo);
+	return NULL;
+}
+
+struct fy_overlay *fy_overlay_create(struct fy_document * const *fyds, int count)
+{
+	return fy_overlay_create_internal(fyds, NULL, NULL, 0, count);
+}
+
+void fy_overlay_destroy(struct fy_overlay *fyo)
+{
+	struct fy_overlay_node *fyon;
+
+	if (!fyo)
+		return;
+
+	while ((fyon = fy_overlay_node_list_pop(&fyo->nodes)) != NULL)
+		fy_overlay_node_free(fyon);
+
+	free(fyo->patches);
+	free(fyo->cuts);
+	free(fyo->fyds);
+	free(fyo);
+}
+
+struct fy_overlay_node *fy_overlay_root(struct fy_overlay *fyo)
+{
+	return fyo ? fyo->root : NULL;
+}
+
+enum fy_node_type fy_overlay_node_get_type(struct fy_overlay_node *fyon)
+{
+	return fy_node_get_type(fyon ? fy_overlay_node_top(fyon) : NULL);
+}
+
+struct fy_node *fy_overlay_node_get_node(struct fy_overlay_node *fyon)
+{
+	return fyon ? fy_overlay_node_top(fyon) : NULL;
+}
+
+struct fy_node *fy_overlay_node_get_key(struct fy_overlay_node *fyon)
+{
+	return fyon ? fyon->key : NULL;
+}
+
+int fy_overlay_node_item_count(struct fy_overlay_node *fyon)
+{
+	enum fy_node_type type;
+
+	type = fy_overlay_node_get_type(fyon);
+	if (!fyon || type == FYNT_SCALAR)
+		return -1;
+
+	/* patches don't change the length of a sequence */
+	if (type == FYNT_SEQUENCE)
+		return fy_node_sequence_item_count(fy_overlay_node_top(fyon));
+
+	if (fy_overlay_node_expand(fyon))
+		return -1;
+
+	return fyon->nchildren;
+}
+
+struct fy_overlay_node *fy_overlay_node_iterate(struct fy_overlay_node *fyon, void **prevp)
+{
+	struct fy_overlay_node **fyonp;
+
+	if (!fyon || !prevp || fy_overlay_node_expand(fyon) || !fyon->nchildren)
+		return NULL;
+
+	fyonp = *prevp;
+	fyonp = fyonp ? fyonp + 1 : fyon->children;
+	if (fyonp >= fyon->children + fyon->nchildren)
+		return NULL;
+
+	*prevp = fyonp;
+	return *fyonp;
+}
+
+struct fy_overlay_node *
+fy_overlay_node_mapping_lookup_by_string(struct fy_overlay_node *fyon, const char *key)
+{
+	struct fy_document *fyd = NULL;
+	struct fy_overlay_node *fyonc;
+	struct fy_node *fyn_key = NULL;
+	size_t len = 0;
+	uint32_t hash;
+	unsigned int pos;
+
+	if (!fyon || !key || fy_overlay_node_get_type(fyon) != FYNT_MAPPING)
+		return NULL;
+
+	if (!fyon->expanded && fyon->lookups >= FY_OVERLAY_LAZY_LOOKUPS &&
+	    fy_overlay_node_expand(fyon))
+		return NULL;
+
+	/* avoid parsing the common case of simple plain keys */
+	if (fy_overlay_key_is_plain(key)) {
+		len = strlen(key);
+		hash = fy_hash_bytes(FY_HASH_INIT, key, len);
+	} else {
+		fyd = fy_document_build_from_string(NULL, key);
+		if (!fyd)
+			return NULL;
+		fyn_key = fy_document_root(fyd);
+		hash = fy_node_hash(fyn_key);
+	}
+
+	fyonc = NULL;
+	for (pos = hash & fyon->hash_mask; fyon->hash && (fyonc = fyon->hash[pos]) != NULL;
+			pos = (pos + 1) & fyon->hash_mask) {
+		if (fyonc->key_hash == hash && fy_overlay_key_match(fyonc->key, key, len, fyn_key))
+			break;
+	}
+
+	/* not expanded yet, look for this entry only */
+	if (!fyonc && !fyon->expanded) {
+		fyon->lookups++;
+		fyonc = fy_overlay_node_entry_resolve(fyon, key, len, fyn_key, hash);
+	}
+
+	fy_document_destroy(fyd);
+
+	return fyonc;
+}
+
+struct fy_overlay_node *
+fy_overlay_node_sequence_get_by_index(struct fy_overlay_node *fyon, int index)
+{
+	struct fy_overlay_node *fyonc;
+	struct fy_node *fyn, *fyni;
+
+	if (!fyon || fy_overlay_node_get_type(fyon) != FYNT_SEQUENCE)
+		return NULL;
+
+	if (!fyon->expanded && fyon->lookups >= FY_OVERLAY_LAZY_LOOKUPS &&
+	    fy_overlay_node_expand(fyon))
+		return NULL;
+
+	if (fyon->expanded) {
+		if (index < 0)
+			index += fyon->nchildren;
+		if (index < 0 || index >= fyon->nchildren)
+			return NULL;
+
+		return fyon->children[index];
+	}
+
+	fyn = fy_overlay_node_top(fyon);
+	if (index < 0)
+		index += fy_node_sequence_item_count(fyn);
+	if (index < 0)
+		return NULL;
+
+	fyonc = fy_overlay_hash_find_item(fyon->hash, fyon->hash_mask, index);
+	if (fyonc)
+		return fyonc;
+
+	fyni = fy_node_sequence_get_by_index(fyn, index);
+	if (!fyni)
+		return NULL;
+
+	fyon->lookups++;
+	fyonc = fy_overlay_node_item_resolve(fyon, fyni, index);
+	if (fyonc && fy_overlay_node_hash_add(fyon, fyonc)) {
+		fy_overlay_node_free(fy_overlay_node_list_pop_tail(&fyon->fyo->nodes));
+		return NULL;
+	}
+
+	return fyonc;
+}
+
+struct fy_overlay_node *fy_overlay_node_by_path(struct fy_overlay_node *fyon, const char *path)
+{
+	char *keybuf;
+	int idx;
+
+	if (!path)
+		return NULL;
+
+	keybuf = alloca(strlen(path) + 1);
+	while (fyon) {
+		/* skip all prefixed / */
+		while (*path == '/')
+			path++;
+
+		if (!*path)
+			break;
+
+		switch (fy_overlay_node_get_type(fyon)) {
+		case FYNT_SEQUENCE:
+			path = fy_path_parse_seq_index(path, &idx);
+			if (!path)
+				return NULL;
+			fyon = fy_overlay_node_sequence_get_by_index(fyon, idx);
+			break;
+
+		case FYNT_MAPPING:
+			path = fy_path_parse_map_key(path, keybuf);
+			if (!path)
+				return NULL;
+			fyon = fy_overlay_node_mapping_lookup_by_string(fyon, keybuf);
+			break;
+
+		default:
+			/* scalar can't match (it has no key) */
+			return NULL;
+		}
+	}
+
+	return fyon;
+}
+
+static int fy_overlay_node_flatten(struct fy_document *fyd, struct fy_overlay_node *fyon,
+				   struct fy_node **fynp)
+{
+	struct fy_node *fyn_top, *fyn, *fyn_value;
+	struct fy_node_pair *fynpt;
+	int i, rc;
+
+	*fynp = NULL;
+
+	fyn_top = fy_overlay_node_top(fyon);
+	if (!fyn_top)
+		return 0;
+
+	/* not merged, copy as is */
+	if (!fy_node_is_mapping(fyn_top) && fyon->nlayers <= 1) {
+		*fynp = fy_node_copy(fyd, fyn_top);
+		return *fynp ? 0 : -1;
+	}
+
+	rc = fy_overlay_node_expand(fyon);
+	if (rc)
+		return rc;
+
+	fyn = fy_node_is_sequence(fyn_top) ? fy_node_create_sequence(fyd) :
+					     fy_node_create_mapping(fyd);
+	if (!fyn)
+		return -1;
+	fyn->style = fyn_top->style;
+	fyn->tag = fy_token_ref(fyn_top->tag);
+
+	for (i = 0; fyn->type == FYNT_SEQUENCE && i < fyon->nchildren; i++) {
+		rc = fy_overlay_node_flatten(fyd, fyon->children[i], &fyn_value);
+		if (rc)
+			goto err_out;
+		fy_node_list_add_tail(&fyn->sequence, fyn_value);
+		fy_node_set_parent(fyn_value, fyn);
+	}
+
+	for (i = 0; fyn->type == FYNT_MAPPING && i < fyon->nchildren; i++) {
+		fynpt = fy_node_pair_alloc(fyd);
+		if (!fynpt)
+			goto err_out;
+
+		fy_node_pair_list_add_tail(&fyn->mapping, fynpt);
+		fy_node_pair_set_parent(fynpt, fyn);
+
+		fy_node_pair_link_key(fynpt, fy_node_copy(fyd, fyon->children[i]->key));
+		if (!fynpt->key && fyon->children[i]->key)
+			goto err_out;
+
+		rc = fy_overlay_node_flatten(fyd, fyon->children[i], &fyn_value);
+		if (rc)
+			goto err_out;
+		fynpt->value = fyn_value;
+		if (fyn_value)
+			fy_node_set_parent(fyn_value, fyn);
+	}
+
+	*fynp = fyn;
+	return 0;
+
+err_out:
+	fy_node_free(fyn);
+	return -1;
+}
+
+struct fy_document *fy_overlay_flatten(struct fy_overlay *fyo)
+{
+	struct fy_document *fyd;
+	struct fy_node *fyn;
+	int i, rc;
+
+	if (!fyo)
+		return NULL;
+
+	fyd = fy_document_create(NULL);
+	if (!fyd)
+		return NULL;
+
+	/* the tags of all the layers must be available */
+	for (i = 0; i < fyo->count; i++) {
+		rc = fy_document_state_merge(fyd, fyo->fyds[i]);
+		if (rc)
+			goto err_out;
+	}
+
+	rc = fy_overlay_node_flatten(fyd, fyo->root, &fyn);
+	if (rc)
+		goto err_out;
+
+	fy_document_set_root(fyd, fyn);
+
+	return fyd;
+
+err_out:
+	fy_document_destroy(fyd);
+	return NULL;
+}
+
+/* a collection start, in the style of @fyn */
+static int fy_overlay_emit_start(struct fy_emitter *emit, struct fy_node *fyn,
+				 struct fy_token *fyt_anchor)
+{
+	struct fy_event fye;
+	int rc;
+
+	memset(&fye, 0, sizeof(fye));
+	if (fyn->type == FYNT_SEQUENCE) {
+		fye.type = FYET_SEQUENCE_START;
+		fye.sequence_start.anchor = fyt_anchor;
+		fye.sequence_start.tag = fyn->tag;
+		fye.sequence_start.sequence_start = fyn->sequence_start;
+	} else {
+		fye.type = FYET_MAPPING_START;
+		fye.mapping_start.anchor = fyt_anchor;
+		fye.mapping_start.tag = fyn->tag;
+		fye.mapping_start.mapping_start = fyn->mapping_start;
+	}
+
+	rc = fy_emit_event(emit, &fye);
+	if (rc)
+		return rc;
+
+	/* created nodes have no start token to tell */
+	if (fyn->style == FYNS_FLOW)
+		emit->pending_flow = true;
+
+	return 0;
+}
+
+static int fy_overlay_emit_end(struct fy_emitter *emit, enum fy_node_type type)
+{
+	struct fy_event fye;
+
+	memset(&fye, 0, sizeof(fye));
+	fye.type = type == FYNT_SEQUENCE ? FYET_SEQUENCE_END : FYET_MAPPING_END;
+
+	return fy_emit_event(emit, &fye);
+}
+
+/* a node of one of the layers, output as is */
+static int fy_overlay_emit_node(struct fy_emitter *emit, struct fy_node *fyn)
+{
+	struct fy_event fye;
+	struct fy_anchor *fya;
+	struct fy_token *fyt_anchor;
+	struct fy_node *fyni;
+	struct fy_node_pair *fynp, **fynpp = NULL;
+	int i, rc;
+
+	memset(&fye, 0, sizeof(fye));
+
+	/* an empty key or value */
+	if (!fyn) {
+		fye.type = FYET_SCALAR;
+		return fy_emit_event(emit, &fye);
+	}
+
+	fya = fy_document_lookup_anchor_by_node(fyn->fyd, fyn);
+	fyt_anchor = fya ? fya->anchor : NULL;
+
+	if (fyn->type == FYNT_SCALAR) {
+		if (fyn->style == FYNS_ALIAS) {
+			fye.type = FYET_ALIAS;
+			fye.alias.anchor = fyn->scalar;
+		} else {
+			fye.type = FYET_SCALAR;
+			fye.scalar.anchor = fyt_anchor;
+			fye.scalar.tag = fyn->tag;
+			fye.scalar.value = fyn->scalar;
+		}
+		return fy_emit_event(emit, &fye);
+	}
+
+	rc = fy_overlay_emit_start(emit, fyn, fyt_anchor);
+	if (rc)
+		return rc;
+
+	if (fyn->type == FYNT_SEQUENCE) {
+		for (fyni = fy_node_list_head(&fyn->sequence); fyni;
+		     fyni = fy_node_next(&fyn->sequence, fyni)) {
+			rc = fy_overlay_emit_node(emit, fyni);
+			if (rc)
+				return rc;
+		}
+		return fy_overlay_emit_end(emit, FYNT_SEQUENCE);
+	}
+
+	if (emit->cfg->flags & FYECF_SORT_KEYS) {
+		fynpp = fy_node_mapping_sort_array(fyn, NULL, NULL, NULL);
+		if (!fynpp)
+			return -1;
+	}
+
+	for (i = 0, fynp = fynpp ? fynpp[0] : fy_node_pair_list_head(&fyn->mapping); fynp;
+	     fynp = fynpp ? fynpp[++i] : fy_node_pair_next(&fyn->mapping, fynp)) {
+		rc = fy_overlay_emit_node(emit, fynp->key);
+		if (!rc)
+			rc = fy_overlay_emit_node(emit, fynp->value);
+		if (rc)
+			break;
+	}
+
+	fy_node_mapping_sort_release_array(fyn, fynpp);
+
+	return rc ? rc : fy_overlay_emit_end(emit, FYNT_MAPPING);
+}
+
+/* the slots of the children, so that equal keys keep their order */
+static int fy_overlay_emit_cmp_keys(const void *a, const void *b)
+{
+	struct fy_overlay_node **fyonpa = *(struct fy_overlay_node ** const *)a;
+	struct fy_overlay_node **fyonpb = *(struct fy_overlay_node ** const *)b;
+	int rc;
+
+	rc = fy_node_mapping_key_cmp((*fyonpa)->key, (*fyonpb)->key);
+	if (rc)
+		return rc;
+
+	return fyonpa > fyonpb ? 1 : (fyonpa < fyonpb ? -1 : 0);
+}
+
+/* walks the merged view the way fy_overlay_node_flatten() copies it */
+static int fy_overlay_emit_overlay_node(struct fy_emitter *emit, struct fy_overlay_node *fyon)
+{
+	struct fy_overlay_node **fyonp, ***fyonpp = NULL;
+	struct fy_node *fyn_top;
+	int i, rc;
+
+	fyn_top = fy_overlay_node_top(fyon);
+	if (!fyn_top)
+		return fy_overlay_emit_node(emit, NULL);
+
+	/* not merged, output as is */
+	if (!fy_node_is_mapping(fyn_top) && fyon->nlayers <= 1)
+		return fy_overlay_emit_node(emit, fyn_top);
+
+	rc = fy_overlay_node_expand(fyon);
+	if (rc)
+		return rc;
+
+	/* the anchors of the layers are not carried over */
+	rc = fy_overlay_emit_start(emit, fyn_top, NULL);
+	if (rc)
+		return rc;
+
+	if (fy_node_is_sequence(fyn_top)) {
+		for (i = 0; i < fyon->nchildren; i++) {
+			rc = fy_overlay_emit_overlay_node(emit, fyon->children[i]);
+			if (rc)
+				return rc;
+		}
+		return fy_overlay_emit_end(emit, FYNT_SEQUENCE);
+	}
+
+	if ((emit->cfg->flags & FYECF_SORT_KEYS) && fyon->nchildren > 1) {
+		fyonpp = malloc(fyon->nchildren * sizeof(*fyonpp));
+		if (!fyonpp)
+			return -1;
+		for (i = 0; i < fyon->nchildren; i++)
+			fyonpp[i] = &fyon->children[i];
+		qsort(fyonpp, fyon->nchildren, sizeof(*fyonpp), fy_overlay_emit_cmp_keys);
+	}
+
+	for (i = 0; i < fyon->nchildren; i++) {
+		fyonp = fyonpp ? fyonpp[i] : &fyon->children[i];
+		rc = fy_overlay_emit_node(emit, (*fyonp)->key);
+		if (!rc)
+			rc = fy_overlay_emit_overlay_node(emit, *fyonp);
+		if (rc)
+			break;
+	}
+
+	free(fyonpp);
+
+	return rc ? rc : fy_overlay_emit_end(emit, FYNT_MAPPING);
+}
+
+struct fy_overlay_emit_ctx {
+	struct fy_overlay *fyo;
+	struct fy_document_state *fyds;
+};
+
+static int fy_overlay_emit_body(struct fy_emitter *emit, void *arg)
+{
+	struct fy_overlay_emit_ctx *ctx = arg;
+	struct fy_event fye;
+	int rc;
+
+	memset(&fye, 0, sizeof(fye));
+	fye.type = FYET_DOCUMENT_START;
+	fye.document_start.document_state = ctx->fyds;
+	fye.document_start.implicit = ctx->fyds->start_implicit;
+	rc = fy_emit_event(emit, &fye);
+	if (rc)
+		return rc;
+
+	if (fy_overlay_node_top(ctx->fyo->root)) {
+		rc = fy_overlay_emit_overlay_node(emit, ctx->fyo->root);
+		if (rc)
+			return rc;
+	}
+
+	memset(&fye, 0, sizeof(fye));
+	fye.type = FYET_DOCUMENT_END;
+	fye.document_end.implicit = ctx->fyds->end_implicit;
+
+	return fy_emit_event(emit, &fye);
+}
+
+char *fy_emit_overlay_to_string(struct fy_overlay *fyo, enum fy_emitter_cfg_flags flags)
+{
+	struct fy_overlay_emit_ctx ctx;
+	struct fy_document *fyd;
+	char *buf = NULL;
+	int i, rc, size = 0;
+
+	if (!fyo)
+		return NULL;
+
+	/* only for the directives, the nodes are output from the layers */
+	fyd = fy_document_create(NULL);
+	if (!fyd)
+		return NULL;
+
+	for (i = 0; i < fyo->count; i++) {
+		rc = fy_document_state_merge(fyd, fyo->fyds[i]);
+		if (rc)
+			goto err_out;
+	}
+
+	ctx.fyo = fyo;
+	ctx.fyds = fyd->fyds;
+	rc = fy_emit_str_internal(flags, fy_overlay_emit_body, &ctx, &buf, &size, true);
+	if (rc)
+		goto err_out;
+
+	fy_document_destroy(fyd);
+
+	return buf;
+
+err_out:
+	fy_document_destroy(fyd);
+	return NULL;
+}
@@ -0,0 +1,57 @@
+/*
+ * fy-overlay.h - layered document overlay internal header file
+ *
+ * Copyright (c) 2019 Pantelis Antoniou <pantelis.antoniou@konsulko.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef FY_OVERLAY_H
+#define FY_OVERLAY_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <libfyaml.h>
+
+#include "fy-list.h"
+#include "fy-typelist.h"
+
+FY_TYPE_FWD_DECL_LIST(overlay_node);
+struct fy_overlay_node {
+	struct list_head node;		/* on the overlay's list of nodes */
+	struct fy_overlay *fyo;
+	struct fy_node *key;		/* key when a mapping entry */
+	uint32_t key_hash;		/* or the index of a sequence item */
+	struct fy_node **layers;	/* underlying nodes, lowest priority first */
+	int nlayers;
+	bool expanded : 1;
+	bool merged : 1;		/* all the layers are in */
+	int lookups;			/* resolved one by one before expanding */
+	struct fy_overlay_node **children;	/* merged entries or sequence items */
+	int nchildren;
+	struct fy_overlay_node **hash;	/* open addressing index of the children */
+	unsigned int hash_mask;
+	int nhashed;			/* resolved children, until expanded */
+};
+FY_TYPE_DECL_LIST(overlay_node);
+
+struct fy_overlay {
+	struct fy_document **fyds;
+	int count;
+	struct fy_node **cuts;		/* mappings that replace instead of merging */
+	struct fy_node **patches;	/* mappings of index keys over a sequence */
+	int npatches;
+	struct fy_overlay_node_list nodes;
+	struct fy_overlay_node *root;
+};
+
+struct fy_overlay *fy_overlay_create_internal(struct fy_document * const *fyds,
+					      struct fy_node * const *cuts,
+					      struct fy_node * const *patches, int npatches,
+					      int count);
+
+#endif
@@ -0,0 +1,466 @@
+/*
+ * fy-parse-ahead.c - parsing ahead on a separate thread
+ *
+ * Copyright (c) 2019 Pantelis Antoniou <pantelis.antoniou@konsulko.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include <libfyaml.h>
+
+#include "fy-parse.h"
+#include "fy-parse-ahead.h"
+#include "fy-executor.h"
+
+/* the parse ahead the current thread is producing for, if any */
+static __thread struct fy_parse_ahead *fy_parse_ahead_current;
+
+static void fy_eventp_list_move_tail(struct fy_eventp_list *to, struct fy_eventp_list *from)
+{
+	list_splice_tail_init(&from->_lh, &to->_lh);
+}
+
+static bool fy_parse_ahead_is_producer(struct fy_parse_ahead *fypa)
+{
+	return fy_parse_ahead_current == fypa;
+}
+
+/* the input buffers must not move under the consumer */
+static bool fy_parse_ahead_input_ok(struct fy_parser *fyp, struct fy_input *fyi)
+{
+	switch (fyi->cfg.type) {
+	case fyit_memory:
+		return true;
+	case fyit_file:
+		if (fyi->state == FYIS_PARSE_IN_PROGRESS)
+			return fyi->file.addr != NULL;
+		return !(fyp->cfg.flags & FYPCF_DISABLE_MMAP_OPT);
+	default:
+		break;
+	}
+	return false;
+}
+
+/* the CPUs this thread may run on, as restricted by affinity or cpusets */
+static int fy_parse_ahead_cpus(void)
+{
+#if defined(__linux__) && defined(CPU_COUNT)
+	cpu_set_t set;
+
+	if (!sched_getaffinity(0, sizeof(set), &set))
+		return CPU_COUNT(&set);
+#endif
+	return (int)sysconf(_SC_NPROCESSORS_ONLN);
+}
+
+static bool fy_parse_ahead_possible(struct fy_parser *fyp)
+{
+	struct fy_input *fyi;
+	unsigned int flags = fyp->cfg.flags;
+
+	if (fyp->stream_error || fyp->state == FYPS_END ||
+	    !fy_eventp_list_empty(&fyp->queued_events))
+		return false;
+
+	/* debugging output is not synchronized */
+	if ((flags & FYPCF_DEBUG_ALL) && FYPCF_GET_DEBUG_LEVEL(flags) < FYET_ERROR)
+		return false;
+
+	if (fyp->current_input && !fy_parse_ahead_input_ok(fyp, fyp->current_input))
+		return false;
+
+	for (fyi = fy_input_list_head(&fyp->queued_inputs); fyi;
+			fyi = fy_input_next(&fyp->queued_inputs, fyi)) {
+		if (!fy_parse_ahead_input_ok(fyp, fyi))
+			return false;
+	}
+
+	return true;
+}
+
+static void fy_parse_ahead_destroy(struct fy_parse_ahead *fypa)
+{
+	pthread_cond_destroy(&fypa->consumed);
+	pthread_cond_destroy(&fypa->produced);
+	pthread_mutex_destroy(&fypa->lock);
+	free(fypa);
+}
+
+/* under the lock; true when the last one out is to free it */
+static bool fy_parse_ahead_release(struct fy_parse_ahead *fypa)
+{
+	fypa->state = FYPAS_IDLE;
+	pthread_cond_broadcast(&fypa->produced);
+	return --fypa->pending == 0 && fypa->dead;
+}
+
+/*
+ * Hand over the batch; true when the task is to return, in which
+ * case the parser is given up and fypa may already be gone.
+ */
+static bool fy_parse_ahead_publish(struct fy_parse_ahead *fypa, bool done,
+				   bool pause, bool from_task)
+{
+	struct fy_parser *fyp = fypa->fyp;
+	bool leave, free_it = false;
+
+	pthread_mutex_lock(&fypa->lock);
+
+	fy_eventp_list_move_tail(&fypa->ready, &fypa->batch);
+	fypa->ready_count += fypa->batch_count;
+	fypa->batch_count = 0;
+	fypa->done = done;
+
+	/* the consumed events are ours to recycle again */
+	fy_eventp_list_move_tail(&fyp->recycled_eventp, &fypa->returned);
+
+	pthread_cond_signal(&fypa->produced);
+
+	if (from_task && (done || fypa->stop)) {
+		leave = true;
+	} else if (from_task && fypa->fyx &&
+		   (fypa->ready_count >= FY_PARSE_AHEAD_MAX || pause)) {
+		/* give the worker back instead of waiting on the consumer */
+		fypa->paused = pause;
+		leave = true;
+	} else {
+		/* when pausing, wait until the consumer took everything and waits */
+		while (!fypa->stop &&
+		       (fypa->ready_count >= FY_PARSE_AHEAD_MAX ||
+			(pause && !(fypa->idle && !fypa->ready_count))))
+			pthread_cond_wait(&fypa->consumed, &fypa->lock);
+		leave = from_task && fypa->stop;
+	}
+
+	if (leave)
+		free_it = fy_parse_ahead_release(fypa);
+
+	pthread_mutex_unlock(&fypa->lock);
+
+	if (free_it)
+		fy_parse_ahead_destroy(fypa);
+
+	return leave;
+}
+
+static void fy_parse_ahead_task(void *arg)
+{
+	struct fy_parse_ahead *fypa = arg;
+	struct fy_parser *fyp;
+	struct fy_eventp *fyep;
+	bool stream_end, free_it;
+
+	/* on an executor it may start late, after being cancelled or stopped */
+	pthread_mutex_lock(&fypa->lock);
+	if (fypa->state != FYPAS_QUEUED || fypa->stop) {
+		free_it = --fypa->pending == 0 && fypa->dead;
+		pthread_mutex_unlock(&fypa->lock);
+		if (free_it)
+			fy_parse_ahead_destroy(fypa);
+		return;
+	}
+	fypa->state = FYPAS_RUNNING;
+	pthread_mutex_unlock(&fypa->lock);
+
+	fyp = fypa->fyp;
+	fy_parse_ahead_current = fypa;
+
+	for (;;) {
+		fyep = fy_parse_next_event(fyp);
+		stream_end = false;
+		if (fyep) {
+			fy_eventp_list_add_tail(&fypa->batch, fyep);
+			fypa->batch_count++;
+
+			/* the consumer looks at the parser state after a stream end */
+			stream_end = fyep->e.type == FYET_STREAM_END;
+
+			if (fypa->batch_count < FY_PARSE_AHEAD_BATCH &&
+			    fyep->e.type != FYET_DOCUMENT_END && !stream_end)
+				continue;
+		}
+
+		if (fy_parse_ahead_publish(fypa, !fyep, stream_end, true))
+			break;
+	}
+
+	fy_parse_ahead_current = NULL;
+}
+
+static void *fy_parse_ahead_thread(void *arg)
+{
+	fy_parse_ahead_task(arg);
+	return NULL;
+}
+
+/* under the lock; true when the task is to be submitted */
+static bool fy_parse_ahead_request(struct fy_parse_ahead *fypa)
+{
+	if (!fypa->fyx || fypa->stop || fypa->done || fypa->paused ||
+	    fypa->state != FYPAS_IDLE)
+		return false;
+
+	fypa->state = FYPAS_QUEUED;
+
+	/* an invocation that did not start yet picks it up */
+	if (fypa->pending)
+		return false;
+
+	fypa->pending++;
+	return true;
+}
+
+static void fy_parse_ahead_submit(struct fy_parse_ahead *fypa)
+{
+	if (!fy_executor_submit(fypa->fyx, fy_parse_ahead_task, fypa))
+		return;
+
+	/* the consumer keeps on parsing by itself */
+	pthread_mutex_lock(&fypa->lock);
+	fypa->pending--;
+	if (fypa->state == FYPAS_QUEUED)
+		fypa->state = FYPAS_IDLE;
+	pthread_mutex_unlock(&fypa->lock);
+}
+
+/* the consumer parses a batch while the task is idle; true at a stream end */
+static bool fy_parse_ahead_self(struct fy_parse_ahead *fypa)
+{
+	struct fy_parser *fyp = fypa->fyp;
+	struct fy_eventp *fyep;
+	int count;
+
+	/* recycling is direct, and errors need no synchronization */
+	fypa->self_parse = true;
+	fy_parse_ahead_current = fypa;
+
+	for (count = 0; count < FY_PARSE_AHEAD_BATCH; count++) {
+		fyep = fy_parse_next_event(fyp);
+		if (!fyep)
+			break;
+		fy_eventp_list_add_tail(&fypa->taken, fyep);
+		if (fyep->e.type == FYET_DOCUMENT_END ||
+		    fyep->e.type == FYET_STREAM_END)
+			break;
+	}
+
+	fy_parse_ahead_current = NULL;
+	fypa->self_parse = false;
+
+	pthread_mutex_lock(&fypa->lock);
+	if (!fyep)
+		fypa->done = true;
+	pthread_mutex_unlock(&fypa->lock);
+
+	return fyep && fyep->e.type == FYET_STREAM_END;
+}
+
+/*
+ * On a single CPU the two sides only take turns, and the hand off costs
+ * more than it saves (a 15MB file loads about 25% slower). An executor
+ * is taken as is, the caller has sized it.
+ */
+bool fy_parse_ahead_worthwhile(struct fy_parser *fyp)
+{
+	return fyp && (fyp->cfg.executor || fy_parse_ahead_cpus() > 1);
+}
+
+int fy_parse_ahead_start(struct fy_parser *fyp)
+{
+	struct fy_parse_ahead *fypa;
+	struct fy_executor *fyx;
+	int rc;
+
+	if (!fyp || fyp->ahead || !(fyp->cfg.flags & FYPCF_PARSE_AHEAD) ||
+	    !fy_parse_ahead_possible(fyp))
+		return 0;
+
+	fypa = malloc(sizeof(*fypa));
+	if (!fypa)
+		return -1;
+	memset(fypa, 0, sizeof(*fypa));
+
+	fypa->fyp = fyp;
+	pthread_mutex_init(&fypa->lock, NULL);
+	pthread_cond_init(&fypa->produced, NULL);
+	pthread_cond_init(&fypa->consumed, NULL);
+	fy_eventp_list_init(&fypa->ready);
+	fy_eventp_list_init(&fypa->returned);
+	fy_eventp_list_init(&fypa->batch);
+	fy_eventp_list_init(&fypa->taken);
+	fy_eventp_list_init(&fypa->freed);
+	fypa->state = FYPAS_QUEUED;
+	fypa->pending = 1;
+
+	/* from now on the parser state belongs to the task */
+	fyp->ahead = fypa;
+
+	/* on the executor if any, the task never blocks one of its workers */
+	fyx = fyp->cfg.executor;
+	if (fyx) {
+		fypa->fyx = fyx;
+		rc = fy_executor_submit(fyx, fy_parse_ahead_task, fypa);
+	} else
+		rc = pthread_create(&fypa->thread, NULL, fy_parse_ahead_thread, fypa);
+	if (rc) {
+		fyp->ahead = NULL;
+		fy_parse_ahead_destroy(fypa);
+		return -1;
+	}
+
+	return 0;
+}
+
+void fy_parse_ahead_stop(struct fy_parser *fyp)
+{
+	struct fy_parse_ahead *fypa;
+	bool free_it;
+
+	if (!fyp || !fyp->ahead)
+		return;
+
+	fypa = fyp->ahead;
+
+	pthread_mutex_lock(&fypa->lock);
+	fypa->stop = true;
+	/* a task that did not start yet never will */
+	if (fypa->state == FYPAS_QUEUED)
+		fypa->state = FYPAS_IDLE;
+	pthread_cond_broadcast(&fypa->consumed);
+	while (fypa->state == FYPAS_RUNNING)
+		pthread_cond_wait(&fypa->produced, &fypa->lock);
+	pthread_mutex_unlock(&fypa->lock);
+
+	if (!fypa->fyx)
+		pthread_join(fypa->thread, NULL);
+
+	fyp->ahead = NULL;
+
+	/* the events not consumed yet are picked up in order */
+	fy_eventp_list_move_tail(&fyp->queued_events, &fypa->taken);
+	fy_eventp_list_move_tail(&fyp->queued_events, &fypa->ready);
+	fy_eventp_list_move_tail(&fyp->queued_events, &fypa->batch);
+
+	fy_eventp_list_move_tail(&fyp->recycled_eventp, &fypa->freed);
+	fy_eventp_list_move_tail(&fyp->recycled_eventp, &fypa->returned);
+
+	/* an invocation still queued on the executor frees it */
+	pthread_mutex_lock(&fypa->lock);
+	fypa->dead = true;
+	free_it = !fypa->pending;
+	pthread_mutex_unlock(&fypa->lock);
+
+	if (free_it)
+		fy_parse_ahead_destroy(fypa);
+}
+
+struct fy_eventp *fy_parse_ahead_next(struct fy_parser *fyp)
+{
+	struct fy_parse_ahead *fypa = fyp->ahead;
+	struct fy_eventp *fyep;
+	bool self, finished, submit;
+
+	fyep = fy_eventp_list_pop(&fypa->taken);
+	if (fyep)
+		return fyep;
+
+	pthread_mutex_lock(&fypa->lock);
+
+	fy_eventp_list_move_tail(&fypa->returned, &fypa->freed);
+
+	self = false;
+	while (fy_eventp_list_empty(&fypa->ready) && !fypa->done) {
+		/* the task is not running, and need not be waited for */
+		if (fypa->state == FYPAS_IDLE ||
+		    (fypa->state == FYPAS_QUEUED && fypa->fyx)) {
+			fypa->state = FYPAS_IDLE;
+			self = true;
+			break;
+		}
+		fypa->idle = true;
+		pthread_cond_signal(&fypa->consumed);
+		pthread_cond_wait(&fypa->produced, &fypa->lock);
+	}
+	fypa->idle = false;
+
+	if (self) {
+		pthread_mutex_unlock(&fypa->lock);
+		self = fy_parse_ahead_self(fypa);
+		pthread_mutex_lock(&fypa->lock);
+		fypa->paused = self;
+	} else {
+		fy_eventp_list_move_tail(&fypa->taken, &fypa->ready);
+		fypa->ready_count = 0;
+		pthread_cond_signal(&fypa->consumed);
+	}
+
+	finished = fypa->done && fy_eventp_list_empty(&fypa->taken);
+
+	/* the queue is drained, let the task refill it */
+	submit = !finished && fy_parse_ahead_request(fypa);
+
+	pthread_mutex_unlock(&fypa->lock);
+
+	if (submit)
+		fy_parse_ahead_submit(fypa);
+
+	/* the thread is done; carry on without it */
+	if (finished) {
+		fy_parse_ahead_stop(fyp);
+		return fy_parse_private(fyp);
+	}
+
+	return fy_eventp_list_pop(&fypa->taken);
+}
+
+bool fy_parse_ahead_recycle(struct fy_parser *fyp, struct fy_eventp *fyep)
+{
+	struct fy_parse_ahead *fypa = fyp->ahead;
+
+	/* the thread recycles directly */
+	if (!fypa || fy_parse_ahead_is_producer(fypa))
+		return false;
+
+	fy_eventp_list_add_tail(&fypa->freed, fyep);
+	return true;
+}
+
+void fy_parse_ahead_sync_slow_path(struct fy_parser *fyp)
+{
+	struct fy_parse_ahead *fypa = fyp->ahead;
+
+	/* the consumer parsing by itself has nothing outstanding */
+	if (fypa->self_parse)
+		return;
+
+	/* the consumer takes the parser back */
+	if (!fy_parse_ahead_is_producer(fypa)) {
+		fy_parse_ahead_stop(fyp);
+		return;
+	}
+
+	/* the thread waits until the consumer caught up and waits */
+	(void)fy_parse_ahead_publish(fypa, false, true, false);
+}
+
+void fy_parse_ahead_lock(struct fy_parser *fyp)
+{
+	if (fyp && fyp->ahead)
+		pthread_mutex_lock(&fyp->ahead->lock);
+}
+
+void fy_parse_ahead_unlock(struct fy_parser *fyp)
+{
+	if (fyp && fyp->ahead)
+		pthread_mutex_unlock(&fyp->ahead->lock);
+}
@@ -0,0 +1,77 @@
+/*
+ * fy-parse-ahead.h - parsing ahead on a separate thread internal header file
+ *
+ * Copyright (c) 2019 Pantelis Antoniou <pantelis.antoniou@konsulko.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef FY_PARSE_AHEAD_H
+#define FY_PARSE_AHEAD_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdbool.h>
+#include <pthread.h>
+
+#include <libfyaml.h>
+
+#include "fy-parse.h"
+
+/* events handed over at once, and the most waiting to be taken */
+#define FY_PARSE_AHEAD_BATCH	64
+#define FY_PARSE_AHEAD_MAX	(FY_PARSE_AHEAD_BATCH * 16)
+
+enum fy_parse_ahead_state {
+	FYPAS_IDLE,			/* the parser is the consumer's */
+	FYPAS_QUEUED,			/* the task is asked to run */
+	FYPAS_RUNNING,			/* the task owns the parser */
+};
+
+/*
+ * The parsing thread scans and parses into a batch of events, which
+ * is handed over to the consuming thread (the one building documents)
+ * under the lock. The consumed events travel back the same way to be
+ * recycled by the parsing thread.
+ *
+ * The parser state is owned by the parsing thread while it runs; when
+ * anything else needs it (an error report, a buffer reallocation, or
+ * a call that is not about building documents), the two threads are
+ * synchronized by fy_parse_ahead_sync().
+ *
+ * On an executor the task never waits for the consumer; it returns
+ * the worker when the queue is full (or at a stream end), and is
+ * submitted again when the consumer drained it. If the task did not
+ * get to run by the time the consumer runs out of events, the
+ * consumer cancels it and parses the next batch itself, so that
+ * parsers outnumbering the workers never wait on each other.
+ */
+struct fy_parse_ahead {
+	struct fy_parser *fyp;
+	struct fy_executor *fyx;	/* NULL when on a thread of its own */
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t produced;	/* the consumer waits on this */
+	pthread_cond_t consumed;	/* the parsing thread waits on this */
+	/* under the lock */
+	enum fy_parse_ahead_state state;
+	unsigned int pending;		/* task invocations not returned yet */
+	struct fy_eventp_list ready;	/* handed over, not yet taken */
+	int ready_count;
+	struct fy_eventp_list returned;	/* consumed, to be recycled */
+	bool stop : 1;			/* consumer wants the parser back */
+	bool done : 1;			/* no more events */
+	bool idle : 1;			/* consumer waits for events */
+	bool paused : 1;		/* not to run past a stream end */
+	bool dead : 1;			/* stopped, freed by the last task */
+	/* parsing thread only */
+	struct fy_eventp_list batch;
+	int batch_count;
+	/* consumer only */
+	struct fy_eventp_list taken;
+	struct fy_eventp_list freed;
+	bool self_parse;		/* parsing a batch itself */
+};
+
+#endif
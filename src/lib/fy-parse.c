@@ -21,12 +21,15 @@
 #include <errno.h>
 #include <stdarg.h>
 #include <limits.h>
+#include <time.h>
+#include <poll.h>
 
 #include <libfyaml.h>
 
 #include "fy-parse.h"
 
 #include "fy-utils.h"
+#include "fy-spill.h"
 
 
 const char *fy_library_version(void)
@@ -503,6 +506,23 @@ static const struct fy_parse_cfg default_parse_cfg = {
 	.flags = FYPCF_DEBUG_LEVEL_INFO | FYPCF_DEBUG_DIAG_TYPE | FYPCF_COLOR_AUTO | FYPCF_DEBUG_ALL,
 };
 
+static uint64_t fy_parse_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void fy_parse_budget_reset(struct fy_parser *fyp)
+{
+	fyp->budget_exceeded = false;
+	fyp->budget_event_count = 0;
+	fyp->budget_start_pos = fyp->current_pos;
+	fyp->budget_deadline_ns = fyp->cfg.budget_ms ?
+		fy_parse_now_ns() + (uint64_t)fyp->cfg.budget_ms * 1000000 : 0;
+}
+
 int fy_parse_setup(struct fy_parser *fyp, const struct fy_parse_cfg *cfg)
 {
 	int rc;
@@ -512,6 +532,7 @@ int fy_parse_setup(struct fy_parser *fyp, const struct fy_parse_cfg *cfg)
 	fyp->cfg = cfg ? *cfg : default_parse_cfg;
 
 	fy_talloc_list_init(&fyp->tallocs);
+	fy_talloc_list_init(&fyp->type_tallocs);
 
 	fy_indent_list_init(&fyp->indent_stack);
 	fy_indent_list_init(&fyp->recycled_indent);
@@ -533,6 +554,7 @@ int fy_parse_setup(struct fy_parser *fyp, const struct fy_parse_cfg *cfg)
 	fy_parse_state_log_list_init(&fyp->recycled_parse_state_log);
 
 	fy_eventp_list_init(&fyp->recycled_eventp);
+	fy_eventp_list_init(&fyp->queued_events);
 
 	fy_flow_list_init(&fyp->flow_stack);
 	fyp->flow = FYFT_NONE;
@@ -543,12 +565,20 @@ int fy_parse_setup(struct fy_parser *fyp, const struct fy_parse_cfg *cfg)
 	fyp->pending_complex_key_column = -1;
 	fyp->last_block_mapping_key_line = -1;
 
+	fy_parse_budget_reset(fyp);
+
 	fyp->suppress_recycling = !!(fyp->cfg.flags & FYPCF_DISABLE_RECYCLING) ||
 		                  getenv("FY_VALGRIND");
 
 	if (fyp->suppress_recycling)
 		fy_notice(fyp, "Suppressing recycling");
 
+	if (fyp->cfg.flags & FYPCF_SPILL) {
+		fyp->spill = fy_spill_create(fyp->cfg.spill_dir);
+		fy_error_check(fyp, fyp->spill, err_out,
+				"fy_spill_create() failed");
+	}
+
 	fyp->current_document_state = NULL;
 	rc = fy_reset_document_state(fyp);
 	fy_error_check(fyp, !rc, err_out_rc,
@@ -556,7 +586,11 @@ int fy_parse_setup(struct fy_parser *fyp, const struct fy_parse_cfg *cfg)
 
 	return 0;
 
+err_out:
+	rc = -1;
 err_out_rc:
+	fy_spill_unref(fyp->spill);
+	fyp->spill = NULL;
 	return rc;
 }
 
@@ -564,6 +598,9 @@ void fy_parse_cleanup(struct fy_parser *fyp)
 {
 	struct fy_input *fyi, *fyin;
 
+	fy_parse_ahead_stop(fyp);
+	fy_parse_document_load_abort(fyp);
+
 	if (fyp->errfp)
 		fclose(fyp->errfp);
 
@@ -576,6 +613,7 @@ void fy_parse_cleanup(struct fy_parser *fyp)
 
 	fy_parse_parse_state_log_list_recycle_all(fyp, &fyp->state_stack);
 	fy_parse_flow_list_recycle_all(fyp, &fyp->flow_stack);
+	fy_parse_eventp_list_recycle_all(fyp, &fyp->queued_events);
 
 	fy_token_unref(fyp->stream_end_token);
 
@@ -584,11 +622,17 @@ void fy_parse_cleanup(struct fy_parser *fyp)
 
 	for (fyi = fy_input_list_head(&fyp->queued_inputs); fyi; fyi = fyin) {
 		fyin = fy_input_next(&fyp->queued_inputs, fyi);
+		/* tokens may keep the input alive after we're gone */
+		fy_input_list_del(&fyp->queued_inputs, fyi);
+		fyi->on_list = NULL;
 		fy_input_unref(fyi);
 	}
 
 	for (fyi = fy_input_list_head(&fyp->parsed_inputs); fyi; fyi = fyin) {
 		fyin = fy_input_next(&fyp->parsed_inputs, fyi);
+		/* tokens may keep the input alive after we're gone */
+		fy_input_list_del(&fyp->parsed_inputs, fyi);
+		fyi->on_list = NULL;
 		fy_input_unref(fyi);
 	}
 
@@ -606,7 +650,12 @@ void fy_parse_cleanup(struct fy_parser *fyp)
 	// fy_parse_document_state_vacuum(fyp);
 
 	/* and release all the remaining tracked memory */
+	fy_tfree_all(&fyp->type_tallocs);
 	fy_tfree_all(&fyp->tallocs);
+
+	/* the tokens still alive keep it */
+	fy_spill_unref(fyp->spill);
+	fyp->spill = NULL;
 }
 
 /* open a file for reading respecting the search path */
@@ -680,7 +729,7 @@ struct fy_input *fy_input_alloc(void)
 	memset(fyi, 0, sizeof(*fyi));
 
 	fyi->state = FYIS_NONE;
-	fyi->refs = 1;
+	atomic_init(&fyi->refs, 1);
 
 	/* fy_notice(NULL, "%s: %p #%d", __func__, fyi, fyi->refs); */
 
@@ -692,11 +741,14 @@ void fy_input_free(struct fy_input *fyi)
 	if (!fyi)
 		return;
 
-	assert(fyi->refs == 1);
+	/* the last reference was dropped by fy_input_unref() */
+	assert(!fyi->refs);
 
 	/* fy_notice(NULL, "%s: %p #%d", __func__, fyi, fyi->refs); */
 	if (fyi->on_list) {
+		fy_parse_ahead_lock(fyi->fyp);
 		fy_input_list_del(fyi->on_list, fyi);
+		fy_parse_ahead_unlock(fyi->fyp);
 		fyi->on_list = NULL;
 	}
 
@@ -711,6 +763,9 @@ void fy_input_free(struct fy_input *fyi)
 		break;
 	}
 
+	if (fyi->cfg.type == fyit_memory && fyi->cfg.memory.owned)
+		free((void *)fyi->cfg.memory.data);
+
 	free(fyi);
 }
 
@@ -722,7 +777,7 @@ struct fy_input *fy_input_ref(struct fy_input *fyi)
 
 	assert(fyi->refs + 1 > 0);
 
-	fyi->refs++;
+	atomic_fetch_add(&fyi->refs, 1);
 
 	/* fy_notice(NULL, "%s: %p #%d", __func__, fyi, fyi->refs); */
 
@@ -738,10 +793,8 @@ void fy_input_unref(struct fy_input *fyi)
 
 	/* fy_notice(NULL, "%s: %p #%d", __func__, fyi, fyi->refs); */
 
-	if (fyi->refs == 1)
+	if (atomic_fetch_sub(&fyi->refs, 1) == 1)
 		fy_input_free(fyi);
-	else
-		fyi->refs--;
 }
 
 struct fy_input *fy_parse_input_alloc(struct fy_parser *fyp)
@@ -920,6 +973,8 @@ int fy_parse_input_done(struct fy_parser *fyp)
 	case fyit_stream:
 		fy_error_check(fyp, fyp, err_out,
 				"no parser associated with input");
+		/* the buffer moves, nothing may be looking at it */
+		fy_parse_ahead_sync(fyp);
 		/* chop extra buffer */
 		buf = realloc(fyi->buffer, fyp->current_input_pos);
 		fy_error_check(fyp, buf || !fyp->current_input_pos, err_out,
@@ -936,8 +991,11 @@ int fy_parse_input_done(struct fy_parser *fyp)
 	fy_scan_debug(fyp, "moving current input to parsed inputs");
 
 	fyi->state = FYIS_PARSED;
+	fyi->fyp = fyp;
 	fyi->on_list = &fyp->parsed_inputs;
+	fy_parse_ahead_lock(fyp);
 	fy_input_list_add_tail(fyi->on_list, fyi);
+	fy_parse_ahead_unlock(fyp);
 
 	fyp->current_input = NULL;
 
@@ -999,8 +1057,11 @@ struct fy_input *fy_parse_input_from_data(struct fy_parser *fyp,
 	handle->fyi = fyi;
 
 	fyi->state = FYIS_PARSED;
+	fyi->fyp = fyp;
 	fyi->on_list = &fyp->parsed_inputs;
+	fy_parse_ahead_lock(fyp);
 	fy_input_list_add_tail(fyi->on_list, fyi);
+	fy_parse_ahead_unlock(fyp);
 
 	return fyi;
 
@@ -1009,6 +1070,73 @@ err_out:
 	return NULL;
 }
 
+/* like fy_parse_input_from_data() but the input takes ownership of data, even on error */
+struct fy_input *fy_parse_input_from_malloc_data(struct fy_parser *fyp,
+		char *data, size_t size, struct fy_atom *handle,
+		bool simple)
+{
+	struct fy_input *fyi;
+
+	fyi = fy_parse_input_from_data(fyp, data, size, handle, simple);
+	if (!fyi) {
+		free(data);
+		return NULL;
+	}
+	fyi->cfg.memory.owned = true;
+
+	return fyi;
+}
+
+static bool fy_input_low_latency(struct fy_parser *fyp, struct fy_input *fyi)
+{
+	return fyi->cfg.type == fyit_stream &&
+	       (fyp->cfg.flags & FYPCF_STREAM_LOW_LATENCY) &&
+	       fileno(fyi->fp) >= 0;
+}
+
+static bool fy_input_stream_ended(struct fy_parser *fyp, struct fy_input *fyi)
+{
+	if (fy_input_low_latency(fyp, fyi))
+		return fyi->stream.eof || fyi->stream.error;
+
+	return feof(fyi->fp) || ferror(fyi->fp);
+}
+
+/* read whatever is available, but at least a byte; 0 at EOF or on error */
+static size_t fy_input_stream_read(struct fy_input *fyi, void *buf, size_t count)
+{
+	struct pollfd pfd;
+	ssize_t ret;
+	int fd;
+
+	fd = fileno(fyi->fp);
+	for (;;) {
+		ret = read(fd, buf, count);
+		if (ret > 0)
+			return (size_t)ret;
+
+		if (!ret) {
+			fyi->stream.eof = true;
+			return 0;
+		}
+
+		if (errno == EINTR)
+			continue;
+
+		/* non blocking, wait until there's something to read */
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			pfd.fd = fd;
+			pfd.events = POLLIN;
+			pfd.revents = 0;
+			if (poll(&pfd, 1, -1) >= 0 || errno == EINTR)
+				continue;
+		}
+
+		fyi->stream.error = true;
+		return 0;
+	}
+}
+
 const void *fy_parse_input_try_pull(struct fy_parser *fyp, struct fy_input *fyi,
 				    size_t pull, size_t *leftp)
 {
@@ -1056,7 +1184,7 @@ const void *fy_parse_input_try_pull(struct fy_parser *fyp, struct fy_input *fyi,
 			break;
 
 		/* no more */
-		if (feof(fyi->fp) || ferror(fyi->fp)) {
+		if (fy_input_stream_ended(fyp, fyi)) {
 			if (!left) {
 				fy_scan_debug(fyp, "input exhausted (EOF)");
 				p = NULL;
@@ -1071,14 +1199,17 @@ const void *fy_parse_input_try_pull(struct fy_parser *fyp, struct fy_input *fyi,
 
 		fy_scan_debug(fyp, "input: space=%zu missing=%zu", space, missing);
 
-		if (missing > 0) {
+		/* grow only when the free space can't hold it */
+		if (fyi->allocated - fyi->read < missing) {
 
 			/* align size to chunk */
-			size = fyi->allocated + missing + fyi->chunk - 1;
+			size = fyi->read + missing + fyi->chunk - 1;
 			size = size - size % fyi->chunk;
 
 			fy_scan_debug(fyp, "input buffer missing %zu bytes (pull=%zu)",
 					missing, pull);
+			/* the buffer moves, nothing may be looking at it */
+			fy_parse_ahead_sync(fyp);
 			buf = realloc(fyi->buffer, size);
 			fy_error_check(fyp, buf, err_out,
 					"realloc() failed");
@@ -1099,7 +1230,11 @@ const void *fy_parse_input_try_pull(struct fy_parser *fyp, struct fy_input *fyi,
 
 			fy_scan_debug(fyp, "performing read request of %zu", nreadreq);
 
-			nread = fread(fyi->buffer + fyi->read, 1, nreadreq, fyi->fp);
+			/* fread() would wait until all of it is read */
+			if (fy_input_low_latency(fyp, fyi))
+				nread = fy_input_stream_read(fyi, fyi->buffer + fyi->read, nreadreq);
+			else
+				nread = fread(fyi->buffer + fyi->read, 1, nreadreq, fyi->fp);
 
 			fy_scan_debug(fyp, "read returned %zu", nread);
 
@@ -1176,6 +1311,8 @@ int fy_parse_input_reset(struct fy_parser *fyp)
 {
 	struct fy_input *fyi, *fyin;
 
+	fy_parse_ahead_stop(fyp);
+
 	/* must not be in the middle of something */
 	if (fyp->state != FYPS_NONE && fyp->state != FYPS_END) {
 		fy_scan_debug(fyp, "parser cannot be reset at state '%s'",
@@ -1189,7 +1326,10 @@ int fy_parse_input_reset(struct fy_parser *fyp)
 		fy_input_unref(fyi);
 	}
 
+	fy_parse_document_load_abort(fyp);
 	fy_parse_parse_state_log_list_recycle_all(fyp, &fyp->state_stack);
+	fy_parse_eventp_list_recycle_all(fyp, &fyp->queued_events);
+	fyp->slice_mark_valid = false;
 
 	fyp->stream_end_produced = false;
 	fyp->stream_start_produced = false;
@@ -1198,6 +1338,8 @@ int fy_parse_input_reset(struct fy_parser *fyp)
 	fyp->pending_complex_key_column = -1;
 	fyp->last_block_mapping_key_line = -1;
 
+	fy_parse_budget_reset(fyp);
+
 	return 0;
 }
 
@@ -1239,6 +1381,7 @@ int fy_parse_input_append(struct fy_parser *fyp, const struct fy_input_cfg *fyic
 	}
 
 	fyi->state = FYIS_QUEUED;
+	fyi->fyp = fyp;
 	fyi->on_list = &fyp->queued_inputs;
 	fy_input_list_add_tail(fyi->on_list, fyi);
 
@@ -3217,6 +3360,8 @@ int fy_scan_block_scalar_indent(struct fy_parser *fyp, int indent)
 {
 	int c, max_indent = 0, min_indent;
 	struct fy_error_ctx ec;
+	const char *s, *e, *p;
+	size_t left;
 
 	/* minimum indent is 0 for zero indent scalars */
 	min_indent = fyp->document_first_content_token ? 0 : 1;
@@ -3224,7 +3369,20 @@ int fy_scan_block_scalar_indent(struct fy_parser *fyp, int indent)
 	/* scan over the indentation spaces */
 	/* we don't format content for display */
 	for (;;) {
-		/* skip over indentation */
+		/* skip over indentation in bulk, what's in the buffer */
+		s = fy_ptr(fyp, &left);
+		if (s) {
+			if (indent && (fyp->column >= indent ||
+				       (size_t)(indent - fyp->column) < left))
+				left = fyp->column < indent ? indent - fyp->column : 0;
+			e = s + left;
+			for (p = s; p < e && *p == ' '; p++)
+				;
+			if (p > s)
+				fy_advance_ascii(fyp, p - s);
+		}
+
+		/* and the remainder (if any) one by one */
 		while ((c = fy_parse_peek(fyp)) == ' ' &&
 			(!indent || fyp->column < indent))
 			fy_advance(fyp, c);
@@ -3268,6 +3426,8 @@ int fy_fetch_block_scalar(struct fy_parser *fyp, bool is_literal, int c)
 	bool doc_end_detected, empty;
 	struct fy_error_ctx ec;
 	struct fy_token *fyt;
+	const char *s;
+	size_t run;
 
 	fy_error_check(fyp, c == '|' || c == '>', err_out,
 			"bad start of block scalar ('%s')",
@@ -3368,6 +3528,18 @@ int fy_fetch_block_scalar(struct fy_parser *fyp, bool is_literal, int c)
 				doc_end_detected = true;
 				break;
 			}
+
+			/* fast path; bulk advance over printable ascii */
+			run = fy_parse_ascii_print_run(fyp);
+			if (run > 0) {
+				if (empty) {
+					s = fy_ptr(fyp, NULL);
+					empty = !fy_find_non_space(s, run);
+				}
+				fy_advance_ascii(fyp, run);
+				continue;
+			}
+
 			if (!fy_is_space(c))
 				empty = false;
 			fy_advance(fyp, c);
@@ -3454,6 +3626,8 @@ int fy_fetch_flow_scalar(struct fy_parser *fyp, int c)
 	struct fy_error_ctx ec;
 	struct fy_mark mark;
 	struct fy_token *fyt;
+	const void *p;
+	size_t left, run;
 
 	is_single = c == '\'';
 	end_c = c;
@@ -3502,6 +3676,16 @@ int fy_fetch_flow_scalar(struct fy_parser *fyp, int c)
 					err_wrongly_indented);
 			}
 
+			/* fast path; bulk advance over a run without quotes,
+			 * escapes, linebreaks or non-ascii; no storage change */
+			p = fy_ptr(fyp, &left);
+			run = p ? fy_ascii_print_run_until(p, left, end_c,
+					is_single ? '\'' : '\\') : 0;
+			if (run > 0) {
+				fy_advance_ascii(fyp, run);
+				continue;
+			}
+
 			/* escaped single quote? */
 			if (is_single && c == '\'' && fy_parse_peek_at(fyp, 1) == '\'') {
 				fy_advance_by(fyp, 2);
@@ -4318,6 +4502,10 @@ fy_parse_node(struct fy_parser *fyp, struct fy_token *fyt, struct fy_eventp *fye
 				fyt_td, err_undefined_tag_prefix);
 	}
 
+	/* resolve the tag once, repeated tags share the result */
+	if (tag)
+		fy_document_state_intern_tag(fyds, tag);
+
 	if ((fyp->state == FYPS_BLOCK_NODE_OR_INDENTLESS_SEQUENCE ||
 	fyp->state == FYPS_BLOCK_MAPPING_VALUE ||
 	fyp->state == FYPS_BLOCK_MAPPING_FIRST_KEY)
@@ -5157,11 +5345,80 @@ const char *fy_event_type_txt[] = {
 	[FYET_ALIAS]		= "=ALI",
 };
 
+static int fy_parse_budget_check(struct fy_parser *fyp, struct fy_eventp *fyep)
+{
+	struct fy_token *fyt;
+	struct fy_error_ctx ec;
+
+	/* the trailing events might not have a token nor an input */
+	fyt = fy_document_event_get_token(&fyep->e);
+	if (!fyt && !fyp->current_input)
+		fyt = fyp->stream_end_token;
+
+	if (fyp->cfg.budget_events)
+		FY_ERROR_CHECK(fyp, fyt, &ec, FYEM_PARSE,
+				++fyp->budget_event_count <= fyp->cfg.budget_events,
+				err_event_budget);
+
+	if (fyp->cfg.budget_bytes)
+		FY_ERROR_CHECK(fyp, fyt, &ec, FYEM_PARSE,
+				fyp->current_pos - fyp->budget_start_pos <= fyp->cfg.budget_bytes,
+				err_byte_budget);
+
+	if (fyp->budget_deadline_ns)
+		FY_ERROR_CHECK(fyp, fyt, &ec, FYEM_PARSE,
+				fy_parse_now_ns() <= fyp->budget_deadline_ns,
+				err_deadline);
+
+	return 0;
+
+err_out:
+	fyp->budget_exceeded = true;
+	return -1;
+
+err_event_budget:
+	fy_error_report(fyp, &ec, "parse event budget exceeded");
+	goto err_out;
+
+err_byte_budget:
+	fy_error_report(fyp, &ec, "parse byte budget exceeded");
+	goto err_out;
+
+err_deadline:
+	fy_error_report(fyp, &ec, "parse deadline exceeded");
+	goto err_out;
+}
+
+struct fy_eventp *fy_parse_next_event(struct fy_parser *fyp)
+{
+	struct fy_eventp *fyep;
+	int rc;
+
+	fyep = fy_parse_internal(fyp);
+	if (!fyep)
+		return NULL;
+
+	rc = fy_parse_budget_check(fyp, fyep);
+	if (rc) {
+		fy_parse_eventp_recycle(fyp, fyep);
+		return NULL;
+	}
+
+	return fyep;
+}
+
 struct fy_eventp *fy_parse_private(struct fy_parser *fyp)
 {
 	struct fy_eventp *fyep = NULL;
 
-	fyep = fy_parse_internal(fyp);
+	/* parsed ahead by a thread or a slice? */
+	if (fyp->ahead)
+		fyep = fy_parse_ahead_next(fyp);
+	else {
+		fyep = fy_eventp_list_pop(&fyp->queued_events);
+		if (!fyep)
+			fyep = fy_parse_next_event(fyp);
+	}
 	fy_parse_debug(fyp, "> %s", fyep ? fy_event_type_txt[fyep->e.type] : "NULL");
 
 	return fyep;
@@ -5169,12 +5426,20 @@ struct fy_eventp *fy_parse_private(struct fy_parser *fyp)
 
 void *fy_parse_alloc(struct fy_parser *fyp, size_t size)
 {
-	return fy_talloc(&fyp->tallocs, size);
+	void *data;
+
+	fy_parse_ahead_lock(fyp);
+	data = fy_talloc(&fyp->tallocs, size);
+	fy_parse_ahead_unlock(fyp);
+
+	return data;
 }
 
 void fy_parse_free(struct fy_parser *fyp, void *data)
 {
+	fy_parse_ahead_lock(fyp);
 	fy_tfree(&fyp->tallocs, data);
+	fy_parse_ahead_unlock(fyp);
 }
 
 char *fy_parse_strdup(struct fy_parser *fyp, const char *str)
@@ -5293,6 +5558,39 @@ err_out_rc:
 	return -1;
 }
 
+/* like fy_parser_set_string() but the input takes ownership of str, even on error */
+int fy_parser_set_malloc_string(struct fy_parser *fyp, char *str, size_t len)
+{
+	struct fy_input_cfg *fyic;
+	int rc;
+
+	if (!fyp || !str)
+		goto err_out;
+
+	fyic = fy_parse_alloc(fyp, sizeof(*fyic));
+	fy_error_check(fyp, fyic, err_out,
+			"fy_parse_alloc() failed");
+	memset(fyic, 0, sizeof(*fyic));
+
+	fyic->type = fyit_memory;
+	fyic->memory.data = str;
+	fyic->memory.size = len;
+	fyic->memory.owned = true;
+
+	rc = fy_parse_input_reset(fyp);
+	fy_error_check(fyp, !rc, err_out,
+			"fy_input_parse_reset() failed");
+
+	rc = fy_parse_input_append(fyp, fyic);
+	fy_error_check(fyp, !rc, err_out,
+			"fy_parse_input_append() failed");
+
+	return 0;
+err_out:
+	free(str);
+	return -1;
+}
+
 int fy_parser_set_input_fp(struct fy_parser *fyp, const char *name, FILE *fp)
 {
 	struct fy_input_cfg *fyic;
@@ -5348,6 +5646,9 @@ struct fy_event *fy_parser_parse(struct fy_parser *fyp)
 	if (!fyp)
 		return NULL;
 
+	/* the events are handed out, no parsing ahead */
+	fy_parse_ahead_stop(fyp);
+
 	fyep = fy_parse_private(fyp);
 	if (!fyep)
 		return NULL;
@@ -5379,6 +5680,65 @@ bool fy_parser_get_stream_error(struct fy_parser *fyp)
 	return fyp->stream_error;
 }
 
+bool fy_parser_budget_exceeded(struct fy_parser *fyp)
+{
+	if (!fyp)
+		return false;
+
+	return fyp->budget_exceeded;
+}
+
+void fy_parse_set_slice_mark(struct fy_parser *fyp, struct fy_event *fye)
+{
+	const struct fy_mark *fym;
+
+	fym = fy_token_end_mark(fy_document_event_get_token(fye));
+	if (!fym)
+		return;
+
+	fyp->slice_mark = *fym;
+	fyp->slice_mark_valid = true;
+}
+
+int fy_parser_parse_slice(struct fy_parser *fyp, int max_events)
+{
+	struct fy_eventp *fyep;
+	int queued, count;
+
+	if (!fyp || max_events <= 0)
+		return -1;
+
+	fy_parse_ahead_stop(fyp);
+
+	/* the events not consumed yet count against the slice */
+	queued = 0;
+	for (fyep = fy_eventp_list_head(&fyp->queued_events);
+	     fyep && queued < max_events;
+	     fyep = fy_eventp_next(&fyp->queued_events, fyep))
+		queued++;
+
+	for (count = 0; queued + count < max_events; count++) {
+		fyep = fy_parse_next_event(fyp);
+		if (!fyep)
+			break;
+		fy_parse_set_slice_mark(fyp, &fyep->e);
+		fy_eventp_list_add_tail(&fyp->queued_events, fyep);
+	}
+
+	if (fyp->stream_error)
+		return -1;
+
+	return count;
+}
+
+const struct fy_mark *fy_parser_get_slice_mark(struct fy_parser *fyp)
+{
+	if (!fyp || !fyp->slice_mark_valid)
+		return NULL;
+
+	return &fyp->slice_mark;
+}
+
 bool fy_document_event_is_implicit(const struct fy_event *fye)
 {
 	if (fye->type == FYET_DOCUMENT_START)
@@ -5440,20 +5800,23 @@ void fy_error_vreport(struct fy_parser *fyp, struct fy_error_ctx *fyec, const ch
 	int ww, cc;
 	FILE *fp;
 
+	/* reported in order, when everything before it is consumed */
+	fy_parse_ahead_sync(fyp);
+
 	fyi = fyec->fyi;
 	assert(fyi);
+
+	if (fyp && fyp->cfg.diag) {
+		fy_diag_vreport_send(fyp, FYET_ERROR, fyec->module,
+				     &fyec->start_mark, &fyec->end_mark,
+				     fyi, fmt, ap);
+		goto out;
+	}
+
 	fp = fy_parser_get_error_fp(fyp);
 	do_color = fy_parser_is_colorized(fyp);
 
-	if (fyi->cfg.type == fyit_file) {
-		name = fyi->cfg.file.filename;
-	} else if (fyi->cfg.type == fyit_stream) {
-		if (fyi->cfg.stream.fp == stdin)
-			name = "<stdin>";
-		else
-			name = fyi->cfg.stream.name;
-	} else
-		name = NULL;
+	name = fy_input_get_name(fyi);
 
 	if (do_color)
 		fprintf(fp, "\x1b[37;1m");	/* white */
@@ -5510,7 +5873,7 @@ void fy_error_vreport(struct fy_parser *fyp, struct fy_error_ctx *fyec, const ch
 	if (do_color)
 		fprintf(fp, "\x1b[0m");	/* reset */
 	fprintf(fp, "\n");
-
+out:
 	if (fyp && !fyp->stream_error)
 		fyp->stream_error = true;
 }
@@ -15,6 +15,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdatomic.h>
 
 #include <libfyaml.h>
 
@@ -33,6 +34,8 @@
 
 struct fy_parser;
 struct fy_input;
+struct fy_parse_ahead;
+struct fy_document_load;
 
 enum fy_flow_type {
 	FYFT_NONE,
@@ -92,6 +95,7 @@ struct fy_input_cfg {
 		struct {
 			const void *data;
 			size_t size;
+			bool owned;	/* the data is freed with the input */
 		} memory;
 		struct {
 		} callback;
@@ -113,13 +117,14 @@ struct fy_input {
 	struct list_head node;
 	enum fy_input_state state;
 	struct fy_input_list *on_list;
+	struct fy_parser *fyp;		/* owner of the list */
 	struct fy_input_cfg cfg;
 	void *buffer;		/* when the file can't be mmaped */
 	size_t allocated;
 	size_t read;
 	size_t chunk;
 	FILE *fp;
-	int refs;
+	atomic_int refs;
 	union {
 		struct {
 			int fd;			/* fd for file and stream */
@@ -127,6 +132,8 @@ struct fy_input {
 			size_t length;
 		} file;
 		struct {
+			bool eof;		/* low latency reads only */
+			bool error;
 		} stream;
 	};
 };
@@ -186,6 +193,21 @@ static inline size_t fy_input_size(const struct fy_input *fyi)
 	return size;
 }
 
+static inline const char *fy_input_get_name(const struct fy_input *fyi)
+{
+	switch (fyi->cfg.type) {
+	case fyit_file:
+		return fyi->cfg.file.filename;
+	case fyit_stream:
+		if (fyi->cfg.stream.fp == stdin)
+			return "<stdin>";
+		return fyi->cfg.stream.name;
+	default:
+		break;
+	}
+	return NULL;
+}
+
 struct fy_input *fy_input_alloc(void);
 void fy_input_free(struct fy_input *fyi);
 struct fy_input *fy_input_ref(struct fy_input *fyi);
@@ -199,6 +221,10 @@ static inline enum fy_input_state fy_input_get_state(struct fy_input *fyi)
 struct fy_input *fy_parse_input_from_data(struct fy_parser *fyp,
 		const char *data, size_t size, struct fy_atom *handle,
 		bool simple);
+struct fy_input *fy_parse_input_from_malloc_data(struct fy_parser *fyp,
+		char *data, size_t size, struct fy_atom *handle,
+		bool simple);
+int fy_parser_set_malloc_string(struct fy_parser *fyp, char *str, size_t len);
 const void *fy_parse_input_try_pull(struct fy_parser *fyp, struct fy_input *fyi,
 				    size_t pull, size_t *leftp);
 
@@ -300,6 +326,7 @@ struct fy_parser {
 	struct fy_parse_cfg cfg;
 
 	struct fy_talloc_list tallocs;
+	struct fy_talloc_list type_tallocs;	/* of the recycled types */
 
 	struct fy_input_list queued_inputs;	/* all the inputs queued */
 	struct fy_input_list parsed_inputs;
@@ -318,12 +345,14 @@ struct fy_parser {
 	bool stream_start_produced : 1;
 	bool stream_end_produced : 1;
 	bool simple_key_allowed : 1;
-	bool stream_error : 1;
 	bool generated_block_map : 1;
 	bool document_has_content : 1;
 	bool document_first_content_token : 1;
 	bool bare_document_only : 1;		/* no document start indicators allowed, no directives */
 	bool external_document_state : 1;	/* no not generate a document state, use one provided */
+	/* set while parsing ahead, read by the consumer at any time */
+	atomic_bool stream_error;
+	atomic_bool budget_exceeded;
 	int flow_level;
 	int pending_complex_key_column;
 	struct fy_mark pending_complex_key_mark;
@@ -363,6 +392,25 @@ struct fy_parser {
 	struct fy_input_list recycled_input;
 	struct fy_parse_state_log_list recycled_parse_state_log;
 	struct fy_eventp_list recycled_eventp;
+
+	/* events parsed ahead by fy_parser_parse_slice() */
+	struct fy_eventp_list queued_events;
+
+	/* the document of fy_parse_load_document_slice() and where slicing stopped */
+	struct fy_document_load *doc_load;
+	struct fy_mark slice_mark;
+	bool slice_mark_valid;
+
+	/* parsing ahead on a separate thread */
+	struct fy_parse_ahead *ahead;
+
+	/* where the tokens live, for FYPCF_SPILL */
+	struct fy_spill *spill;
+
+	/* parse budget accounting */
+	size_t budget_event_count;
+	size_t budget_start_pos;
+	uint64_t budget_deadline_ns;
 	struct fy_flow_list recycled_flow;
 	struct fy_document_state_list recycled_document_state;
 
@@ -560,6 +608,25 @@ static inline void fy_advance(struct fy_parser *fyp, int c)
 		fyp->column++;
 }
 
+/* advance over octets known to be non-linebreak ascii (one column each) */
+static inline void fy_advance_ascii(struct fy_parser *fyp, size_t count)
+{
+	fy_advance_octets(fyp, count);
+	fyp->column += count;
+}
+
+/* length of the run of printable ascii available at the current point */
+static inline size_t fy_parse_ascii_print_run(struct fy_parser *fyp)
+{
+	const void *p;
+	size_t left;
+
+	p = fy_ptr(fyp, &left);
+	if (!p)
+		return 0;
+	return fy_ascii_print_run(p, left);
+}
+
 static inline int fy_parse_get(struct fy_parser *fyp)
 {
 	int value;
@@ -591,7 +658,25 @@ static inline bool fy_strcmp(struct fy_parser *fyp, const char *str)
 	return fy_strncmp(fyp, str, strlen(str));
 }
 
+struct fy_eventp *fy_parse_next_event(struct fy_parser *fyp);
 struct fy_eventp *fy_parse_private(struct fy_parser *fyp);
+void fy_parse_set_slice_mark(struct fy_parser *fyp, struct fy_event *fye);
+
+bool fy_parse_ahead_worthwhile(struct fy_parser *fyp);
+int fy_parse_ahead_start(struct fy_parser *fyp);
+void fy_parse_ahead_stop(struct fy_parser *fyp);
+struct fy_eventp *fy_parse_ahead_next(struct fy_parser *fyp);
+bool fy_parse_ahead_recycle(struct fy_parser *fyp, struct fy_eventp *fyep);
+void fy_parse_ahead_sync_slow_path(struct fy_parser *fyp);
+void fy_parse_ahead_lock(struct fy_parser *fyp);
+void fy_parse_ahead_unlock(struct fy_parser *fyp);
+
+/* get exclusive access to the parser state while parsing ahead */
+static inline void fy_parse_ahead_sync(struct fy_parser *fyp)
+{
+	if (fyp && fyp->ahead)
+		fy_parse_ahead_sync_slow_path(fyp);
+}
 
 void *fy_parse_alloc(struct fy_parser *fyp, size_t size);
 void fy_parse_free(struct fy_parser *fyp, void *data);
@@ -603,6 +688,7 @@ extern const char *fy_event_type_txt[];
 	do { \
 		struct fy_parser *__fyp = (_fyp); \
 		if (!(_cond)) { \
+			fy_parse_ahead_sync(__fyp); \
 			if (!_fyp || !__fyp->stream_error) {\
 				if (__fyp) \
 					__fyp->stream_error = true; \
@@ -632,6 +718,7 @@ struct fy_error_ctx {
 			struct fy_token *__fyt = (_fyt); \
 			const struct fy_mark *_start_mark, *_end_mark; \
 			\
+			fy_parse_ahead_sync(__fyp); \
 			memset(__ctx, 0, sizeof(*__ctx)); \
 			__ctx->file = __FILE__; \
 			__ctx->line = __LINE__; \
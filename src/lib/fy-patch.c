@@ -0,0 +1,1071 @@
+/*
+ * fy-patch.c - JSON patch (RFC 6902) and merge patch (RFC 7386)
+ *
+ * Copyright (c) 2019 Pantelis Antoniou <pantelis.antoniou@konsulko.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <alloca.h>
+
+#include <libfyaml.h>
+
+#include "fy-parse.h"
+#include "fy-doc.h"
+#include "fy-utils.h"
+#include "fy-patch.h"
+
+/* the text of a scalar, NULL for anything else (including aliases) */
+static const char *fy_patch_node_text(struct fy_node *fyn, size_t *lenp)
+{
+	const char *text;
+
+	if (!fyn || fyn->type != FYNT_SCALAR || fyn->style == FYNS_ALIAS)
+		return NULL;
+
+	text = fy_node_get_scalar(fyn, lenp);
+	if (!text) {
+		*lenp = 0;
+		text = "";
+	}
+	return text;
+}
+
+static bool fy_patch_node_is_null(struct fy_node *fyn)
+{
+	const char *text;
+	size_t len;
+
+	if (!fyn)
+		return true;
+
+	if (fyn->style != FYNS_PLAIN)
+		return false;
+
+	text = fy_patch_node_text(fyn, &len);
+	if (!text)
+		return false;
+
+	return !len ||
+	       (len == 1 && text[0] == '~') ||
+	       (len == 4 && (!memcmp(text, "null", 4) || !memcmp(text, "Null", 4) ||
+			     !memcmp(text, "NULL", 4)));
+}
+
+/* a copy in the document, null for nothing */
+static struct fy_node *fy_patch_copy(struct fy_document *fyd, struct fy_node *fyn)
+{
+	if (!fyn)
+		return fy_node_create_scalar(fyd, "null", 4);
+	return fy_node_copy(fyd, fyn);
+}
+
+/* a scalar with a private copy of the text, which lives as long as the document */
+static struct fy_node *
+fy_patch_create_scalar(struct fy_document *fyd, const char *text, size_t len)
+{
+	char *buf;
+
+	buf = fy_talloc(&fyd->tallocs, len + 1);
+	if (!buf)
+		return NULL;
+	memcpy(buf, text, len);
+	buf[len] = '\0';
+
+	return fy_node_create_scalar(fyd, buf, len);
+}
+
+static void fy_key_index_release(struct fy_key_index *ki)
+{
+	fy_text_hash_cleanup(&ki->keys);
+	ki->fyn_map = NULL;
+}
+
+static int fy_key_index_add(struct fy_key_index *ki, struct fy_node_pair *fynp)
+{
+	const char *key;
+	size_t len;
+
+	/* complex keys are never looked up */
+	key = fy_patch_node_text(fynp->key, &len);
+	if (!key)
+		return 0;
+
+	return fy_text_hash_add(&ki->keys, key, len, fynp) < 0 ? -1 : 0;
+}
+
+static int fy_key_index_build(struct fy_key_index *ki, struct fy_node *fyn_map)
+{
+	struct fy_node_pair *fynp;
+
+	fy_text_hash_init(&ki->keys);
+	ki->fyn_map = fyn_map;
+
+	for (fynp = fy_node_pair_list_head(&fyn_map->mapping); fynp;
+	     fynp = fy_node_pair_next(&fyn_map->mapping, fynp)) {
+		if (fy_key_index_add(ki, fynp))
+			return -1;
+	}
+
+	return 0;
+}
+
+static struct fy_node_pair *
+fy_key_index_lookup(struct fy_key_index *ki, const char *key, size_t len)
+{
+	return fy_text_hash_lookup(&ki->keys, key, len);
+}
+
+static void fy_key_index_remove(struct fy_key_index *ki, struct fy_node_pair *fynp)
+{
+	const char *key;
+	size_t len;
+
+	key = fy_patch_node_text(fynp->key, &len);
+	if (key)
+		fy_text_hash_remove(&ki->keys, key, len, fynp);
+}
+
+/* look up a key, using the index when there is one */
+static struct fy_node_pair *
+fy_patch_mapping_lookup(struct fy_key_index *ki, struct fy_node *fyn_map,
+			const char *key, size_t len)
+{
+	struct fy_node_pair *fynp;
+	const char *text;
+	size_t tlen;
+
+	if (ki && ki->fyn_map)
+		return fy_key_index_lookup(ki, key, len);
+
+	for (fynp = fy_node_pair_list_head(&fyn_map->mapping); fynp;
+	     fynp = fy_node_pair_next(&fyn_map->mapping, fynp)) {
+		text = fy_patch_node_text(fynp->key, &tlen);
+		if (text && tlen == len && !memcmp(text, key, len))
+			return fynp;
+	}
+	return NULL;
+}
+
+/* the key is known not to be present, so there's no duplicate check */
+static int
+fy_patch_mapping_add(struct fy_key_index *ki, struct fy_node *fyn_map,
+		     struct fy_node *fyn_key, struct fy_node *fyn_value)
+{
+	struct fy_node_pair *fynp;
+
+	fynp = fy_node_pair_alloc(fyn_map->fyd);
+	if (!fynp)
+		return -1;
+
+	fy_node_pair_link_key(fynp, fyn_key);
+	fynp->value = fyn_value;
+	fy_node_pair_set_parent(fynp, fyn_map);
+	if (fyn_key)
+		fy_node_set_parent(fyn_key, NULL);
+	if (fyn_value)
+		fy_node_set_parent(fyn_value, fyn_map);
+
+	fy_node_pair_list_add_tail(&fyn_map->mapping, fynp);
+	fy_node_pair_added(fynp);
+	fy_node_modified(fyn_map, fyn_value);
+	if (fyn_key && fyn_key->type != FYNT_SCALAR)
+		fy_node_modified(fyn_map, fyn_map);
+
+	/* an index that can't keep up is dropped */
+	if (ki && ki->fyn_map && fy_key_index_add(ki, fynp))
+		fy_key_index_release(ki);
+
+	return 0;
+}
+
+static void
+fy_patch_mapping_del(struct fy_key_index *ki, struct fy_node *fyn_map,
+		     struct fy_node_pair *fynp)
+{
+	if (ki && ki->fyn_map)
+		fy_key_index_remove(ki, fynp);
+
+	fy_node_detached(fynp->key);
+	fy_node_detached(fynp->value);
+	fy_node_pair_removed(fynp);
+	fy_node_pair_list_del(&fyn_map->mapping, fynp);
+	fy_node_modified(fyn_map, NULL);
+
+	if (fynp->value)
+		fy_node_set_parent(fynp->value, NULL);
+	fy_node_pair_set_parent(fynp, NULL);
+}
+
+static struct fy_key_index *fy_patch_cache_get(struct fy_patch_ctx *ctx, struct fy_node *fyn_map)
+{
+	int i;
+
+	for (i = 0; i < FY_PATCH_CACHE_SIZE; i++) {
+		if (ctx->cache[i].fyn_map == fyn_map)
+			return &ctx->cache[i];
+	}
+	return NULL;
+}
+
+static void fy_patch_cache_clear(struct fy_patch_ctx *ctx)
+{
+	int i;
+
+	for (i = 0; i < FY_PATCH_CACHE_SIZE; i++)
+		fy_key_index_release(&ctx->cache[i]);
+}
+
+/* a key lookup which indexes the big mappings it goes through */
+static struct fy_node_pair *
+fy_patch_lookup(struct fy_patch_ctx *ctx, struct fy_node *fyn_map, const char *key, size_t len)
+{
+	struct fy_key_index *ki;
+	struct fy_node_pair *fynp, *fynp_found = NULL;
+	const char *text;
+	size_t tlen;
+	int count = 0;
+
+	ki = fy_patch_cache_get(ctx, fyn_map);
+	if (ki)
+		return fy_key_index_lookup(ki, key, len);
+
+	for (fynp = fy_node_pair_list_head(&fyn_map->mapping); fynp;
+	     fynp = fy_node_pair_next(&fyn_map->mapping, fynp), count++) {
+		if (fynp_found)
+			continue;
+		text = fy_patch_node_text(fynp->key, &tlen);
+		if (text && tlen == len && !memcmp(text, key, len))
+			fynp_found = fynp;
+	}
+
+	if (count >= FY_KEY_INDEX_MIN) {
+		ki = &ctx->cache[ctx->cache_next++ % FY_PATCH_CACHE_SIZE];
+		fy_key_index_release(ki);
+		if (fy_key_index_build(ki, fyn_map))
+			fy_key_index_release(ki);
+	}
+
+	return fynp_found;
+}
+
+/* freeing a collection might free indexed mappings too */
+static void fy_patch_free_node(struct fy_patch_ctx *ctx, struct fy_node *fyn)
+{
+	if (fyn && fyn->type != FYNT_SCALAR)
+		fy_patch_cache_clear(ctx);
+	fy_node_free(fyn);
+}
+
+struct fy_patch_loc {
+	struct fy_node *fyn_parent;	/* NULL for the root */
+	struct fy_node_pair *fynp;	/* mapping parent: the pair, if present */
+	struct fy_node *fyn;		/* the node, if present */
+	bool exists;
+	const char *key;		/* the last reference token */
+	size_t key_len;
+	int index;			/* sequence parent: the index, -1 for "-" */
+};
+
+/* decode the reference token at s (right after a '/') into buf */
+static const char *fy_patch_pointer_token(const char *s, const char *e, char *buf, size_t *lenp)
+{
+	char *d = buf;
+
+	while (s < e && *s != '/') {
+		if (*s != '~') {
+			*d++ = *s++;
+			continue;
+		}
+		if (s + 1 >= e || (s[1] != '0' && s[1] != '1'))
+			return NULL;
+		*d++ = s[1] == '0' ? '~' : '/';
+		s += 2;
+	}
+	*lenp = d - buf;
+	return s;
+}
+
+static bool fy_patch_parse_index(const char *s, size_t len, int *idxp)
+{
+	long v = 0;
+	size_t i;
+
+	/* no signs, no leading zeroes */
+	if (!len || len > 10 || (s[0] == '0' && len > 1))
+		return false;
+	for (i = 0; i < len; i++) {
+		if (s[i] < '0' || s[i] > '9')
+			return false;
+		v = v * 10 + (s[i] - '0');
+	}
+	if (v > INT_MAX)
+		return false;
+	*idxp = (int)v;
+	return true;
+}
+
+/* resolve a JSON pointer; buf holds the last reference token and must fit the pointer */
+static int
+fy_patch_locate(struct fy_patch_ctx *ctx, const char *ptr, size_t len, char *buf,
+		struct fy_patch_loc *loc)
+{
+	struct fy_node *fyn;
+	const char *s, *e;
+	int idx;
+
+	memset(loc, 0, sizeof(*loc));
+	loc->index = -1;
+
+	fyn = ctx->fyd->root;
+	s = ptr;
+	e = ptr + len;
+
+	if (s < e && *s != '/')
+		return -1;
+
+	loc->exists = fyn != NULL;
+	while (s < e) {
+		/* only the last reference token may be missing */
+		if (!fyn || !loc->exists)
+			return -1;
+
+		s = fy_patch_pointer_token(s + 1, e, buf, &loc->key_len);
+		if (!s)
+			return -1;
+		loc->key = buf;
+		loc->fyn_parent = fyn;
+		loc->fynp = NULL;
+		loc->index = -1;
+
+		switch (fyn->type) {
+		case FYNT_MAPPING:
+			loc->fynp = fy_patch_lookup(ctx, fyn, buf, loc->key_len);
+			loc->exists = loc->fynp != NULL;
+			fyn = loc->fynp ? loc->fynp->value : NULL;
+			break;
+
+		case FYNT_SEQUENCE:
+			if (loc->key_len == 1 && buf[0] == '-') {
+				loc->exists = false;
+				fyn = NULL;
+				break;
+			}
+			if (!fy_patch_parse_index(buf, loc->key_len, &idx))
+				return -1;
+			loc->index = idx;
+			fyn = fy_node_sequence_get_by_index(loc->fyn_parent, idx);
+			loc->exists = fyn != NULL;
+			break;
+
+		default:
+			return -1;
+		}
+	}
+	loc->fyn = fyn;
+
+	return 0;
+}
+
+/* put a node at a location, replacing what is there when allowed */
+static int fy_patch_put(struct fy_patch_ctx *ctx, struct fy_patch_loc *loc,
+			struct fy_node *fyn, bool replace)
+{
+	struct fy_document *fyd = ctx->fyd;
+	struct fy_node *fyn_parent = loc->fyn_parent, *fyn_old, *fyn_key;
+	int rc;
+
+	if (replace && !loc->exists)
+		return -1;
+
+	if (!fyn_parent) {
+		fy_patch_cache_clear(ctx);
+		return fy_document_replace_root(fyd, fyn);
+	}
+
+	if (fyn_parent->type == FYNT_MAPPING) {
+		/* adding an existing member replaces it */
+		if (loc->fynp) {
+			fyn_old = loc->fynp->value;
+			fy_node_detached(fyn_old);
+			loc->fynp->value = fyn;
+			fy_node_set_parent(fyn, fyn_parent);
+			fy_node_modified(fyn_parent, fyn);
+			fy_patch_free_node(ctx, fyn_old);
+			return 0;
+		}
+
+		fyn_key = fy_patch_create_scalar(fyd, loc->key, loc->key_len);
+		if (!fyn_key)
+			return -1;
+
+		rc = fy_patch_mapping_add(fy_patch_cache_get(ctx, fyn_parent),
+					  fyn_parent, fyn_key, fyn);
+		if (rc)
+			fy_node_free(fyn_key);
+		return rc;
+	}
+
+	if (loc->fyn) {
+		fy_node_list_insert_before(&fyn_parent->sequence, loc->fyn, fyn);
+		if (replace) {
+			fy_node_detached(loc->fyn);
+			fy_node_list_del(&fyn_parent->sequence, loc->fyn);
+			fy_patch_free_node(ctx, loc->fyn);
+		}
+	} else if (loc->index < 0 || loc->index == fy_node_sequence_item_count(fyn_parent)) {
+		fy_node_list_add_tail(&fyn_parent->sequence, fyn);
+	} else
+		return -1;
+
+	fy_node_set_parent(fyn, fyn_parent);
+	fy_node_modified(fyn_parent, fyn);
+
+	return 0;
+}
+
+/* take the node at a location out of the tree */
+static int fy_patch_detach(struct fy_patch_ctx *ctx, struct fy_patch_loc *loc,
+			   struct fy_node **fynp)
+{
+	struct fy_node *fyn_parent = loc->fyn_parent, *fyn;
+	struct fy_node_pair *fynpp;
+
+	/* the root itself can't be removed */
+	if (!fyn_parent || !loc->exists)
+		return -1;
+
+	if (fyn_parent->type == FYNT_MAPPING) {
+		fynpp = loc->fynp;
+		fy_patch_mapping_del(fy_patch_cache_get(ctx, fyn_parent), fyn_parent, fynpp);
+		fyn = fynpp->value;
+		fynpp->value = NULL;
+		fy_node_pair_free(fynpp);
+	} else {
+		fyn = loc->fyn;
+		fy_node_detached(fyn);
+		fy_node_list_del(&fyn_parent->sequence, fyn);
+		fy_node_set_parent(fyn, NULL);
+		fy_node_modified(fyn_parent, NULL);
+	}
+
+	*fynp = fyn;
+	return 0;
+}
+
+/*
+ * Take the node at a location out of the tree for a move, keeping the
+ * pair of a mapping and the place of the node, so that a move that
+ * fails can put it back.
+ */
+static int fy_patch_unlink(struct fy_patch_ctx *ctx, struct fy_patch_loc *loc,
+			   struct fy_node **fynp, void **prevp)
+{
+	struct fy_node *fyn_parent = loc->fyn_parent, *fyn;
+	struct fy_node_pair *fynpp;
+
+	if (!fyn_parent || !loc->exists)
+		return -1;
+
+	if (fyn_parent->type == FYNT_MAPPING) {
+		fynpp = loc->fynp;
+		*prevp = fy_node_pair_prev(&fyn_parent->mapping, fynpp);
+		fy_patch_mapping_del(fy_patch_cache_get(ctx, fyn_parent), fyn_parent, fynpp);
+		fyn = fynpp->value;
+		fynpp->value = NULL;
+	} else {
+		fyn = loc->fyn;
+		*prevp = fy_node_prev(&fyn_parent->sequence, fyn);
+		fy_node_detached(fyn);
+		fy_node_list_del(&fyn_parent->sequence, fyn);
+		fy_node_set_parent(fyn, NULL);
+		fy_node_modified(fyn_parent, NULL);
+	}
+
+	*fynp = fyn;
+	return 0;
+}
+
+/* put an unlinked node back where it was */
+static void fy_patch_relink(struct fy_patch_ctx *ctx, struct fy_patch_loc *loc,
+			    struct fy_node *fyn, void *prev)
+{
+	struct fy_node *fyn_parent = loc->fyn_parent;
+	struct fy_key_index *ki;
+
+	if (fyn_parent->type == FYNT_MAPPING) {
+		loc->fynp->value = fyn;
+		if (prev)
+			fy_node_pair_list_insert_after(&fyn_parent->mapping, prev, loc->fynp);
+		else
+			fy_node_pair_list_add(&fyn_parent->mapping, loc->fynp);
+		fy_node_pair_set_parent(loc->fynp, fyn_parent);
+		fy_node_pair_added(loc->fynp);
+		ki = fy_patch_cache_get(ctx, fyn_parent);
+		if (ki && fy_key_index_add(ki, loc->fynp))
+			fy_key_index_release(ki);
+	} else {
+		if (prev)
+			fy_node_list_insert_after(&fyn_parent->sequence, prev, fyn);
+		else
+			fy_node_list_add(&fyn_parent->sequence, fyn);
+	}
+	if (fyn)
+		fy_node_set_parent(fyn, fyn_parent);
+	fy_node_modified(fyn_parent, fyn);
+	if (fyn_parent->type == FYNT_MAPPING && loc->fynp->key &&
+	    loc->fynp->key->type != FYNT_SCALAR)
+		fy_node_modified(fyn_parent, fyn_parent);
+}
+
+/* a member of a patch operation */
+static struct fy_node *
+fy_patch_op_member(struct fy_node *fyn_op, const char *name, bool *presentp)
+{
+	struct fy_node_pair *fynp;
+
+	fynp = fy_patch_mapping_lookup(NULL, fyn_op, name, strlen(name));
+	if (presentp)
+		*presentp = fynp != NULL;
+	return fynp ? fynp->value : NULL;
+}
+
+static int fy_patch_apply_op(struct fy_patch_ctx *ctx, struct fy_node *fyn_op)
+{
+	struct fy_document *fyd = ctx->fyd;
+	struct fy_patch_loc loc, loc_from;
+	struct fy_node *fyn_value, *fyn = NULL, *fyn_moved;
+	const char *op, *path, *from = NULL;
+	size_t op_len, path_len, from_len = 0;
+	char *buf, *buf_from = NULL;
+	void *prev;
+	bool has_value;
+	int rc;
+
+	if (!fy_node_is_mapping(fyn_op))
+		return -1;
+
+	op = fy_patch_node_text(fy_patch_op_member(fyn_op, "op", NULL), &op_len);
+	path = fy_patch_node_text(fy_patch_op_member(fyn_op, "path", NULL), &path_len);
+	if (!op || !path)
+		return -1;
+	buf = alloca(path_len + 1);
+
+	fyn_value = fy_patch_op_member(fyn_op, "value", &has_value);
+
+	if ((op_len == 4 && !memcmp(op, "move", 4)) ||
+	    (op_len == 4 && !memcmp(op, "copy", 4))) {
+		from = fy_patch_node_text(fy_patch_op_member(fyn_op, "from", NULL), &from_len);
+		if (!from)
+			return -1;
+		buf_from = alloca(from_len + 1);
+	}
+
+	if (op_len == 3 && !memcmp(op, "add", 3)) {
+		if (!has_value)
+			return -1;
+		rc = fy_patch_locate(ctx, path, path_len, buf, &loc);
+		if (rc)
+			return rc;
+		fyn = fy_patch_copy(fyd, fyn_value);
+		if (!fyn)
+			return -1;
+		rc = fy_patch_put(ctx, &loc, fyn, false);
+
+	} else if (op_len == 6 && !memcmp(op, "remove", 6)) {
+		rc = fy_patch_locate(ctx, path, path_len, buf, &loc);
+		if (!rc)
+			rc = fy_patch_detach(ctx, &loc, &fyn);
+		if (!rc)
+			fy_patch_free_node(ctx, fyn);
+		return rc;
+
+	} else if (op_len == 7 && !memcmp(op, "replace", 7)) {
+		if (!has_value)
+			return -1;
+		rc = fy_patch_locate(ctx, path, path_len, buf, &loc);
+		if (rc)
+			return rc;
+		fyn = fy_patch_copy(fyd, fyn_value);
+		if (!fyn)
+			return -1;
+		rc = fy_patch_put(ctx, &loc, fyn, true);
+
+	} else if (op_len == 4 && !memcmp(op, "move", 4)) {
+		/* a location can't be moved into one of its children */
+		if (from_len < path_len && !memcmp(path, from, from_len) && path[from_len] == '/')
+			return -1;
+
+		/* the source must exist, even when moved onto itself */
+		rc = fy_patch_locate(ctx, from, from_len, buf_from, &loc_from);
+		if (rc || !loc_from.exists)
+			return -1;
+		if (from_len == path_len && !memcmp(path, from, from_len))
+			return 0;
+		if (!loc_from.fyn_parent)
+			return -1;
+
+		/* the destination must be there before anything is taken out */
+		rc = fy_patch_locate(ctx, path, path_len, buf, &loc);
+		if (rc)
+			return rc;
+
+		/* the node itself is moved, nothing is copied */
+		fyn_moved = NULL;
+		rc = fy_patch_unlink(ctx, &loc_from, &fyn_moved, &prev);
+		if (rc)
+			return rc;
+		fyn = fyn_moved ? fyn_moved : fy_patch_copy(fyd, NULL);
+
+		/* the destination is located again, the source's siblings moved */
+		rc = fyn ? fy_patch_locate(ctx, path, path_len, buf, &loc) : -1;
+		if (!rc)
+			rc = fy_patch_put(ctx, &loc, fyn, false);
+		if (rc) {
+			/* a failed move leaves the source as it was */
+			if (fyn != fyn_moved)
+				fy_node_free(fyn);
+			fy_patch_relink(ctx, &loc_from, fyn_moved, prev);
+			return rc;
+		}
+		if (loc_from.fyn_parent->type == FYNT_MAPPING)
+			fy_node_pair_free(loc_from.fynp);
+		return 0;
+
+	} else if (op_len == 4 && !memcmp(op, "copy", 4)) {
+		rc = fy_patch_locate(ctx, from, from_len, buf_from, &loc_from);
+		if (rc || !loc_from.exists)
+			return -1;
+		fyn = fy_patch_copy(fyd, loc_from.fyn);
+		if (!fyn)
+			return -1;
+		rc = fy_patch_locate(ctx, path, path_len, buf, &loc);
+		if (!rc)
+			rc = fy_patch_put(ctx, &loc, fyn, false);
+
+	} else if (op_len == 4 && !memcmp(op, "test", 4)) {
+		if (!has_value)
+			return -1;
+		rc = fy_patch_locate(ctx, path, path_len, buf, &loc);
+		if (rc || !loc.exists)
+			return -1;
+		return fy_node_compare(loc.fyn, fyn_value) ? 0 : -1;
+
+	} else
+		return -1;
+
+	/* the node was not placed */
+	if (rc)
+		fy_patch_free_node(ctx, fyn);
+
+	return rc;
+}
+
+int fy_document_apply_json_patch(struct fy_document *fyd, struct fy_node *fyn_patch)
+{
+	struct fy_patch_ctx ctx;
+	struct fy_node *fyn_op;
+	void *iter = NULL;
+	int rc = 0;
+
+	if (!fyd || !fy_node_is_sequence(fyn_patch))
+		return -1;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.fyd = fyd;
+
+	while ((fyn_op = fy_node_sequence_iterate(fyn_patch, &iter)) != NULL) {
+		rc = fy_patch_apply_op(&ctx, fyn_op);
+		if (rc)
+			break;
+	}
+
+	fy_patch_cache_clear(&ctx);
+
+	return rc;
+}
+
+/* returns the merged node, which is fyn itself if it was merged in place */
+static struct fy_node *
+fy_merge_patch(struct fy_document *fyd, struct fy_node *fyn, struct fy_node *fyn_patch)
+{
+	struct fy_key_index ki;
+	struct fy_node *fyn_target, *fyn_new, *fyn_old, *fyn_key;
+	struct fy_node_pair *fynp, *fynp_patch;
+	const char *key;
+	size_t len;
+	int count = 0, rc;
+
+	if (!fy_node_is_mapping(fyn_patch))
+		return fy_patch_copy(fyd, fyn_patch);
+
+	fyn_target = fy_node_is_mapping(fyn) ? fyn : fy_node_create_mapping(fyd);
+	if (!fyn_target)
+		return NULL;
+
+	memset(&ki, 0, sizeof(ki));
+	for (fynp = fy_node_pair_list_head(&fyn_target->mapping); fynp;
+	     fynp = fy_node_pair_next(&fyn_target->mapping, fynp))
+		count++;
+	if (count >= FY_KEY_INDEX_MIN && fy_key_index_build(&ki, fyn_target))
+		fy_key_index_release(&ki);
+
+	for (fynp_patch = fy_node_pair_list_head(&fyn_patch->mapping); fynp_patch;
+	     fynp_patch = fy_node_pair_next(&fyn_patch->mapping, fynp_patch)) {
+
+		key = fy_patch_node_text(fynp_patch->key, &len);
+		if (!key)
+			goto err_out;
+
+		fynp = fy_patch_mapping_lookup(&ki, fyn_target, key, len);
+
+		/* null removes */
+		if (fy_patch_node_is_null(fynp_patch->value)) {
+			if (fynp) {
+				fy_patch_mapping_del(&ki, fyn_target, fynp);
+				fy_node_pair_free(fynp);
+			}
+			continue;
+		}
+
+		if (fynp) {
+			fyn_old = fynp->value;
+			fyn_new = fy_merge_patch(fyd, fyn_old, fynp_patch->value);
+			if (!fyn_new)
+				goto err_out;
+			if (fyn_new != fyn_old) {
+				fy_node_detached(fyn_old);
+				fynp->value = fyn_new;
+				fy_node_set_parent(fyn_new, fyn_target);
+				fy_node_modified(fyn_target, fyn_new);
+				fy_node_free(fyn_old);
+			}
+			continue;
+		}
+
+		/* merging into nothing drops the nulls of the patch */
+		fyn_new = fy_merge_patch(fyd, NULL, fynp_patch->value);
+		if (!fyn_new)
+			goto err_out;
+		fyn_key = fy_node_copy(fyd, fynp_patch->key);
+		rc = fyn_key ? fy_patch_mapping_add(&ki, fyn_target, fyn_key, fyn_new) : -1;
+		if (rc) {
+			fy_node_free(fyn_key);
+			fy_node_free(fyn_new);
+			goto err_out;
+		}
+	}
+
+	fy_key_index_release(&ki);
+	return fyn_target;
+
+err_out:
+	fy_key_index_release(&ki);
+	if (fyn_target != fyn)
+		fy_node_free(fyn_target);
+	return NULL;
+}
+
+/* put fyn_new in the place of fyn_old, which is freed */
+static int fy_patch_replace_node(struct fy_document *fyd, struct fy_node *fyn_old,
+				 struct fy_node *fyn_new)
+{
+	struct fy_node *fyn_parent = fy_node_parent(fyn_old);
+	struct fy_node_pair *fynp;
+
+	if (!fyn_parent) {
+		if (fyd->root != fyn_old)
+			return -1;
+		return fy_document_replace_root(fyd, fyn_new);
+	}
+
+	if (fyn_parent->type == FYNT_MAPPING) {
+		for (fynp = fy_node_pair_list_head(&fyn_parent->mapping); fynp;
+		     fynp = fy_node_pair_next(&fyn_parent->mapping, fynp)) {
+			if (fynp->value == fyn_old)
+				break;
+		}
+		if (!fynp)
+			return -1;
+		fy_node_detached(fyn_old);
+		fynp->value = fyn_new;
+	} else {
+		fy_node_detached(fyn_old);
+		fy_node_list_insert_before(&fyn_parent->sequence, fyn_old, fyn_new);
+		fy_node_list_del(&fyn_parent->sequence, fyn_old);
+	}
+	fy_node_set_parent(fyn_new, fyn_parent);
+	fy_node_modified(fyn_parent, fyn_new);
+	fy_node_free(fyn_old);
+
+	return 0;
+}
+
+struct fy_node *fy_node_apply_merge_patch(struct fy_node *fyn, struct fy_node *fyn_patch)
+{
+	struct fy_document *fyd;
+	struct fy_node *fyn_new;
+
+	if (!fyn || !fyn_patch)
+		return NULL;
+
+	fyd = fyn->fyd;
+
+	fyn_new = fy_merge_patch(fyd, fyn, fyn_patch);
+	if (!fyn_new || fyn_new == fyn)
+		return fyn_new;
+
+	if (fy_patch_replace_node(fyd, fyn, fyn_new)) {
+		fy_node_free(fyn_new);
+		return NULL;
+	}
+
+	return fyn_new;
+}
+
+struct fy_patch_diff {
+	struct fy_document *fyd;	/* the patch */
+	struct fy_node *fyn_ops;
+	char *path;			/* the JSON pointer of the current node */
+	size_t len;
+	size_t alloc;
+};
+
+static int fy_diff_path_reserve(struct fy_patch_diff *d, size_t len)
+{
+	char *path;
+	size_t alloc;
+
+	if (d->len + len + 1 <= d->alloc)
+		return 0;
+
+	alloc = (d->len + len + 1) * 2;
+	path = realloc(d->path, alloc);
+	if (!path)
+		return -1;
+	d->path = path;
+	d->alloc = alloc;
+	return 0;
+}
+
+static int fy_diff_path_push(struct fy_patch_diff *d, const char *key, size_t len)
+{
+	size_t i;
+
+	/* worst case every character is escaped */
+	if (fy_diff_path_reserve(d, len * 2 + 1))
+		return -1;
+
+	d->path[d->len++] = '/';
+	for (i = 0; i < len; i++) {
+		if (key[i] == '~' || key[i] == '/') {
+			d->path[d->len++] = '~';
+			d->path[d->len++] = key[i] == '~' ? '0' : '1';
+		} else
+			d->path[d->len++] = key[i];
+	}
+	return 0;
+}
+
+static int fy_diff_path_push_index(struct fy_patch_diff *d, int idx)
+{
+	char buf[16];
+
+	snprintf(buf, sizeof(buf), "%d", idx);
+	return fy_diff_path_push(d, buf, strlen(buf));
+}
+
+static int fy_diff_op_member(struct fy_patch_diff *d, struct fy_node *fyn_op,
+			     const char *name, struct fy_node *fyn_value)
+{
+	struct fy_node *fyn_key;
+	int rc;
+
+	fyn_key = fy_node_create_scalar(d->fyd, name, strlen(name));
+	if (!fyn_key || !fyn_value) {
+		fy_node_free(fyn_key);
+		fy_node_free(fyn_value);
+		return -1;
+	}
+
+	rc = fy_patch_mapping_add(NULL, fyn_op, fyn_key, fyn_value);
+	if (rc) {
+		fy_node_free(fyn_key);
+		fy_node_free(fyn_value);
+	}
+	return rc;
+}
+
+static int fy_diff_op(struct fy_patch_diff *d, const char *op, struct fy_node *fyn_value,
+		      bool has_value)
+{
+	struct fy_node *fyn_op;
+	int rc;
+
+	fyn_op = fy_node_create_mapping(d->fyd);
+	if (!fyn_op)
+		return -1;
+
+	rc = fy_diff_op_member(d, fyn_op, "op", fy_node_create_scalar(d->fyd, op, strlen(op)));
+	if (!rc)
+		rc = fy_diff_op_member(d, fyn_op, "path",
+				       fy_patch_create_scalar(d->fyd, d->path, d->len));
+	if (!rc && has_value)
+		rc = fy_diff_op_member(d, fyn_op, "value", fy_patch_copy(d->fyd, fyn_value));
+	if (!rc)
+		rc = fy_node_sequence_append(d->fyn_ops, fyn_op);
+	if (rc)
+		fy_node_free(fyn_op);
+	return rc;
+}
+
+static bool fy_diff_keys_are_scalars(struct fy_node *fyn_map)
+{
+	struct fy_node_pair *fynp;
+	size_t len;
+
+	for (fynp = fy_node_pair_list_head(&fyn_map->mapping); fynp;
+	     fynp = fy_node_pair_next(&fyn_map->mapping, fynp)) {
+		if (!fy_patch_node_text(fynp->key, &len))
+			return false;
+	}
+	return true;
+}
+
+static int fy_diff_node(struct fy_patch_diff *d, struct fy_node *fyn_a, struct fy_node *fyn_b);
+
+static int fy_diff_mapping(struct fy_patch_diff *d, struct fy_node *fyn_a, struct fy_node *fyn_b)
+{
+	struct fy_key_index ki_a, ki_b;
+	struct fy_node_pair *fynp, *fynp_other;
+	const char *key;
+	size_t len, saved_len = d->len;
+	int rc = 0;
+
+	memset(&ki_a, 0, sizeof(ki_a));
+	memset(&ki_b, 0, sizeof(ki_b));
+	/* an index that can't be built just means scanning */
+	if (fy_key_index_build(&ki_a, fyn_a))
+		fy_key_index_release(&ki_a);
+	if (fy_key_index_build(&ki_b, fyn_b))
+		fy_key_index_release(&ki_b);
+
+	/* removed or changed */
+	for (fynp = fy_node_pair_list_head(&fyn_a->mapping); fynp && !rc;
+	     fynp = fy_node_pair_next(&fyn_a->mapping, fynp)) {
+		key = fy_patch_node_text(fynp->key, &len);
+		fynp_other = fy_patch_mapping_lookup(&ki_b, fyn_b, key, len);
+		rc = fy_diff_path_push(d, key, len);
+		if (!rc)
+			rc = fynp_other ? fy_diff_node(d, fynp->value, fynp_other->value) :
+					  fy_diff_op(d, "remove", NULL, false);
+		d->len = saved_len;
+	}
+
+	/* added */
+	for (fynp = fy_node_pair_list_head(&fyn_b->mapping); fynp && !rc;
+	     fynp = fy_node_pair_next(&fyn_b->mapping, fynp)) {
+		key = fy_patch_node_text(fynp->key, &len);
+		if (fy_patch_mapping_lookup(&ki_a, fyn_a, key, len))
+			continue;
+		rc = fy_diff_path_push(d, key, len);
+		if (!rc)
+			rc = fy_diff_op(d, "add", fynp->value, true);
+		d->len = saved_len;
+	}
+
+	fy_key_index_release(&ki_a);
+	fy_key_index_release(&ki_b);
+
+	return rc;
+}
+
+static int fy_diff_sequence(struct fy_patch_diff *d, struct fy_node *fyn_a, struct fy_node *fyn_b)
+{
+	struct fy_node *fyni_a, *fyni_b;
+	size_t saved_len = d->len;
+	int idx, count_a, rc = 0;
+
+	/* the common part item by item */
+	fyni_a = fy_node_list_head(&fyn_a->sequence);
+	fyni_b = fy_node_list_head(&fyn_b->sequence);
+	for (idx = 0; fyni_a && fyni_b && !rc; idx++) {
+		rc = fy_diff_path_push_index(d, idx);
+		if (!rc)
+			rc = fy_diff_node(d, fyni_a, fyni_b);
+		d->len = saved_len;
+		fyni_a = fy_node_next(&fyn_a->sequence, fyni_a);
+		fyni_b = fy_node_next(&fyn_b->sequence, fyni_b);
+	}
+
+	/* extra items are removed from the end, so the indexes stay valid */
+	for (count_a = idx; fyni_a; fyni_a = fy_node_next(&fyn_a->sequence, fyni_a))
+		count_a++;
+	while (count_a > idx && !rc) {
+		rc = fy_diff_path_push_index(d, --count_a);
+		if (!rc)
+			rc = fy_diff_op(d, "remove", NULL, false);
+		d->len = saved_len;
+	}
+
+	for (; fyni_b && !rc; fyni_b = fy_node_next(&fyn_b->sequence, fyni_b)) {
+		rc = fy_diff_path_push(d, "-", 1);
+		if (!rc)
+			rc = fy_diff_op(d, "add", fyni_b, true);
+		d->len = saved_len;
+	}
+
+	return rc;
+}
+
+static int fy_diff_node(struct fy_patch_diff *d, struct fy_node *fyn_a, struct fy_node *fyn_b)
+{
+	if (fy_node_is_mapping(fyn_a) && fy_node_is_mapping(fyn_b) &&
+	    fy_diff_keys_are_scalars(fyn_a) && fy_diff_keys_are_scalars(fyn_b))
+		return fy_diff_mapping(d, fyn_a, fyn_b);
+
+	if (fy_node_is_sequence(fyn_a) && fy_node_is_sequence(fyn_b))
+		return fy_diff_sequence(d, fyn_a, fyn_b);
+
+	if (fy_node_compare(fyn_a, fyn_b))
+		return 0;
+
+	return fy_diff_op(d, "replace", fyn_b, true);
+}
+
+struct fy_document *fy_node_diff_json_patch(struct fy_node *fyn_from, struct fy_node *fyn_to)
+{
+	struct fy_patch_diff d;
+	int rc;
+
+	memset(&d, 0, sizeof(d));
+
+	d.fyd = fy_document_create(NULL);
+	if (!d.fyd)
+		return NULL;
+
+	d.fyn_ops = fy_node_create_sequence(d.fyd);
+	if (!d.fyn_ops || fy_document_replace_root(d.fyd, d.fyn_ops))
+		goto err_out;
+
+	rc = fy_diff_path_reserve(&d, 0);
+	if (!rc)
+		rc = fy_diff_node(&d, fyn_from, fyn_to);
+	if (rc)
+		goto err_out;
+
+	free(d.path);
+	return d.fyd;
+
+err_out:
+	free(d.path);
+	fy_document_destroy(d.fyd);
+	return NULL;
+}
@@ -0,0 +1,40 @@
+/*
+ * fy-patch.h - JSON patch and merge patch internal header file
+ *
+ * Copyright (c) 2019 Pantelis Antoniou <pantelis.antoniou@konsulko.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef FY_PATCH_H
+#define FY_PATCH_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <libfyaml.h>
+
+#include "fy-index.h"
+
+/* mappings smaller than this are simply scanned */
+#define FY_KEY_INDEX_MIN	16
+
+/* number of mapping key indexes kept while applying a JSON patch */
+#define FY_PATCH_CACHE_SIZE	8
+
+/* a transient index of the (scalar) keys of a mapping */
+struct fy_key_index {
+	struct fy_node *fyn_map;	/* NULL when not built */
+	struct fy_text_hash keys;	/* to the pairs */
+};
+
+struct fy_patch_ctx {
+	struct fy_document *fyd;
+	struct fy_key_index cache[FY_PATCH_CACHE_SIZE];
+	unsigned int cache_next;	/* round robin replacement */
+};
+
+#endif
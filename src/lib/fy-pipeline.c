@@ -0,0 +1,273 @@
+/*
+ * fy-pipeline.c - event transformation pipelines
+ *
+ * Copyright (c) 2019 Pantelis Antoniou <pantelis.antoniou@konsulko.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <libfyaml.h>
+
+#include "fy-parse.h"
+#include "fy-emit.h"
+#include "fy-pipeline.h"
+
+struct fy_pipeline *fy_pipeline_create(struct fy_parser *fyp, struct fy_emitter *emit)
+{
+	struct fy_pipeline *fypl;
+
+	if (!fyp)
+		return NULL;
+
+	fypl = malloc(sizeof(*fypl));
+	if (!fypl)
+		return NULL;
+	memset(fypl, 0, sizeof(*fypl));
+
+	fypl->fyp = fyp;
+	fypl->emit = emit;
+	fy_pipeline_stage_list_init(&fypl->stages);
+
+	return fypl;
+}
+
+void fy_pipeline_destroy(struct fy_pipeline *fypl)
+{
+	struct fy_pipeline_stage *stage;
+
+	if (!fypl)
+		return;
+
+	while ((stage = fy_pipeline_stage_list_pop(&fypl->stages)) != NULL) {
+		free(stage->levels);
+		free(stage);
+	}
+	free(fypl);
+}
+
+struct fy_pipeline_stage *
+fy_pipeline_add_stage(struct fy_pipeline *fypl, fy_pipeline_stage_fn fn, void *user)
+{
+	struct fy_pipeline_stage *stage;
+
+	if (!fypl || !fn)
+		return NULL;
+
+	stage = malloc(sizeof(*stage));
+	if (!stage)
+		return NULL;
+	memset(stage, 0, sizeof(*stage));
+
+	stage->fypl = fypl;
+	stage->fn = fn;
+	stage->user = user;
+	stage->skip_depth = -1;
+
+	fy_pipeline_stage_list_add_tail(&fypl->stages, stage);
+
+	return stage;
+}
+
+static int fy_pipeline_stage_process(struct fy_pipeline_stage *stage, struct fy_event *fye)
+{
+	uint8_t *lvl, *levels;
+	bool node_start, collection_start, collection_end, deliver;
+	int alloc, rc = 0;
+
+	collection_start = fye->type == FYET_SEQUENCE_START ||
+			   fye->type == FYET_MAPPING_START;
+	collection_end = fye->type == FYET_SEQUENCE_END ||
+			 fye->type == FYET_MAPPING_END;
+	node_start = collection_start || fye->type == FYET_SCALAR ||
+		     fye->type == FYET_ALIAS;
+
+	if (collection_end && stage->depth > 0)
+		stage->depth--;
+
+	/* keys and values alternate in a mapping */
+	stage->is_key = false;
+	lvl = stage->depth > 0 ? &stage->levels[stage->depth - 1] : NULL;
+	if (node_start && lvl && (*lvl & FYPLL_MAPPING)) {
+		stage->is_key = !!(*lvl & FYPLL_KEY);
+		*lvl ^= FYPLL_KEY;
+	}
+
+	deliver = stage->skip_depth < 0;
+	if (deliver && node_start && stage->skip_nodes > 0) {
+		stage->skip_nodes--;
+		if (collection_start)
+			stage->skip_depth = stage->depth;
+		deliver = false;
+	}
+
+	if (deliver) {
+		stage->fye = fye;
+		rc = stage->fn(stage, fye, stage->user);
+		stage->fye = NULL;
+	}
+
+	if (collection_start) {
+		if (stage->depth >= stage->alloc) {
+			alloc = stage->alloc ? stage->alloc * 2 : 16;
+			levels = realloc(stage->levels, alloc * sizeof(*levels));
+			if (!levels)
+				return -1;
+			stage->levels = levels;
+			stage->alloc = alloc;
+		}
+		stage->levels[stage->depth++] =
+			fye->type == FYET_MAPPING_START ? (FYPLL_MAPPING | FYPLL_KEY) : 0;
+	} else if (collection_end && stage->skip_depth == stage->depth)
+		stage->skip_depth = -1;
+
+	return rc;
+}
+
+static int fy_pipeline_deliver(struct fy_pipeline *fypl, struct fy_pipeline_stage *stage,
+			       struct fy_event *fye)
+{
+	if (stage)
+		return fy_pipeline_stage_process(stage, fye);
+
+	/* past the last stage */
+	return fypl->emit ? fy_emit_event(fypl->emit, fye) : 0;
+}
+
+int fy_pipeline_process(struct fy_pipeline *fypl, struct fy_event *fye)
+{
+	if (!fypl || !fye)
+		return -1;
+
+	return fy_pipeline_deliver(fypl, fy_pipeline_stage_list_head(&fypl->stages), fye);
+}
+
+int fy_pipeline_run(struct fy_pipeline *fypl)
+{
+	struct fy_event *fye;
+	int rc = 0;
+
+	if (!fypl)
+		return -1;
+
+	while ((fye = fy_parser_parse(fypl->fyp)) != NULL) {
+		rc = fy_pipeline_process(fypl, fye);
+		fy_parser_event_free(fypl->fyp, fye);
+		if (rc)
+			return rc;
+	}
+
+	return fy_parser_get_stream_error(fypl->fyp) ? -1 : 0;
+}
+
+int fy_pipeline_stage_forward(struct fy_pipeline_stage *stage, struct fy_event *fye)
+{
+	if (!stage || !fye)
+		return -1;
+
+	return fy_pipeline_deliver(stage->fypl,
+			fy_pipeline_stage_next(&stage->fypl->stages, stage), fye);
+}
+
+int fy_pipeline_stage_inject_scalar(struct fy_pipeline_stage *stage, const char *text,
+				    size_t len, enum fy_scalar_style style)
+{
+	struct fy_parser *fyp;
+	struct fy_input *fyi;
+	struct fy_atom handle;
+	struct fy_token *fyt;
+	struct fy_event fye;
+	int rc;
+
+	if (!stage || !text)
+		return -1;
+
+	fyp = stage->fypl->fyp;
+
+	if (len == (size_t)-1)
+		len = strlen(text);
+
+	/* the text is only referenced; it is valid until we return */
+	fyi = fy_parse_input_from_data(fyp, text, len, &handle, false);
+	fy_error_check(fyp, fyi, err_out,
+			"fy_parse_input_from_data() failed");
+
+	if (style == FYSS_ANY || (style == FYSS_PLAIN && handle.style != FYAS_PLAIN))
+		style = handle.style == FYAS_PLAIN ? FYSS_PLAIN : FYSS_DOUBLE_QUOTED;
+
+	fyt = fy_token_create(fyp, FYTT_SCALAR, &handle, style);
+	fy_error_check(fyp, fyt, err_out_input,
+			"fy_token_create() failed");
+
+	memset(&fye, 0, sizeof(fye));
+	fye.type = FYET_SCALAR;
+	fye.scalar.value = fyt;
+	fye.scalar.tag_implicit = true;
+
+	rc = fy_pipeline_stage_forward(stage, &fye);
+
+	/* drop both the token and the input, so memory stays constant */
+	fy_token_unref(fyt);
+	fy_input_unref(fyi);
+
+	return rc;
+
+err_out_input:
+	fy_input_unref(fyi);
+err_out:
+	return -1;
+}
+
+int fy_pipeline_stage_inject(struct fy_pipeline_stage *stage, enum fy_event_type type)
+{
+	struct fy_event fye;
+
+	if (!stage)
+		return -1;
+
+	switch (type) {
+	case FYET_SEQUENCE_START:
+	case FYET_SEQUENCE_END:
+	case FYET_MAPPING_START:
+	case FYET_MAPPING_END:
+		break;
+	default:
+		return -1;
+	}
+
+	memset(&fye, 0, sizeof(fye));
+	fye.type = type;
+
+	return fy_pipeline_stage_forward(stage, &fye);
+}
+
+void fy_pipeline_stage_skip(struct fy_pipeline_stage *stage)
+{
+	if (!stage || !stage->fye)
+		return;
+
+	/* drop the rest of the collection */
+	if (stage->fye->type == FYET_SEQUENCE_START ||
+	    stage->fye->type == FYET_MAPPING_START)
+		stage->skip_depth = stage->depth;
+
+	/* and the value of a key */
+	if (stage->is_key)
+		stage->skip_nodes++;
+}
+
+int fy_pipeline_stage_depth(struct fy_pipeline_stage *stage)
+{
+	return stage ? stage->depth : -1;
+}
+
+bool fy_pipeline_stage_is_key(struct fy_pipeline_stage *stage)
+{
+	return stage && stage->is_key;
+}
@@ -0,0 +1,51 @@
+/*
+ * fy-pipeline.h - event pipeline internal header file
+ *
+ * Copyright (c) 2019 Pantelis Antoniou <pantelis.antoniou@konsulko.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef FY_PIPELINE_H
+#define FY_PIPELINE_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <libfyaml.h>
+
+#include "fy-list.h"
+#include "fy-typelist.h"
+
+/* state of an open collection of the input of a stage */
+#define FYPLL_MAPPING	0x01
+#define FYPLL_KEY	0x02	/* the next node is a key */
+
+FY_TYPE_FWD_DECL_LIST(pipeline_stage);
+struct fy_pipeline_stage {
+	struct list_head node;
+	struct fy_pipeline *fypl;
+	fy_pipeline_stage_fn fn;
+	void *user;
+	struct fy_event *fye;		/* the event being processed */
+	bool is_key;			/* it starts a mapping key */
+	/* the structure of the input seen so far */
+	uint8_t *levels;
+	int depth;
+	int alloc;
+	/* dropping events until the collection at this depth ends, or -1 */
+	int skip_depth;
+	int skip_nodes;			/* count of following nodes to drop */
+};
+FY_TYPE_DECL_LIST(pipeline_stage);
+
+struct fy_pipeline {
+	struct fy_parser *fyp;
+	struct fy_emitter *emit;
+	struct fy_pipeline_stage_list stages;
+};
+
+#endif
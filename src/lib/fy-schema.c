@@ -0,0 +1,938 @@
+/*
+ * fy-schema.c - compiled schema validation
+ *
+ * Copyright (c) 2019 Pantelis Antoniou <pantelis.antoniou@konsulko.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <math.h>
+#include <errno.h>
+#include <ctype.h>
+
+#include <libfyaml.h>
+
+#include "fy-parse.h"
+#include "fy-utf8.h"
+#include "fy-schema.h"
+
+static const struct {
+	const char *name;
+	unsigned int type;
+} fy_schema_type_names[] = {
+	{ "null",	FYSCT_NULL },
+	{ "boolean",	FYSCT_BOOLEAN },
+	{ "integer",	FYSCT_INTEGER },
+	{ "number",	FYSCT_NUMBER },
+	{ "string",	FYSCT_STRING },
+	{ "array",	FYSCT_ARRAY },
+	{ "object",	FYSCT_OBJECT },
+};
+
+#define FY_SCHEMA_TYPE_COUNT \
+	(sizeof(fy_schema_type_names) / sizeof(fy_schema_type_names[0]))
+
+static int fy_schema_str_set(struct fy_schema_str *str, const char *text, size_t len)
+{
+	str->text = malloc(len + 1);
+	if (!str->text)
+		return -1;
+	memcpy(str->text, text, len);
+	str->text[len] = '\0';
+	str->len = len;
+	return 0;
+}
+
+static int fy_schema_str_cmp(const char *text1, size_t len1, const char *text2, size_t len2)
+{
+	int ret;
+
+	ret = memcmp(text1, text2, len1 < len2 ? len1 : len2);
+	if (ret)
+		return ret;
+	return len1 < len2 ? -1 : len1 > len2 ? 1 : 0;
+}
+
+static int fy_schema_prop_cmp(const void *a, const void *b)
+{
+	const struct fy_schema_prop *p1 = a, *p2 = b;
+
+	return fy_schema_str_cmp(p1->key.text, p1->key.len, p2->key.text, p2->key.len);
+}
+
+static struct fy_schema_prop *
+fy_schema_state_lookup(struct fy_schema_state *st, const char *key, size_t len)
+{
+	int lo, hi, mid, ret;
+
+	lo = 0;
+	hi = st->prop_count - 1;
+	while (lo <= hi) {
+		mid = lo + (hi - lo) / 2;
+		ret = fy_schema_str_cmp(st->props[mid].key.text, st->props[mid].key.len, key, len);
+		if (!ret)
+			return &st->props[mid];
+		if (ret < 0)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+	return NULL;
+}
+
+static bool fy_schema_parse_number(const char *text, double *dp)
+{
+	char *end;
+
+	if (!text || !*text)
+		return false;
+	errno = 0;
+	*dp = strtod(text, &end);
+	return !*end && !errno;
+}
+
+static bool fy_schema_parse_count(const char *text, long *lp)
+{
+	char *end;
+
+	if (!text || !*text)
+		return false;
+	errno = 0;
+	*lp = strtol(text, &end, 10);
+	return !*end && !errno && *lp >= 0;
+}
+
+static const char *fy_schema_node_text0(struct fy_node *fyn)
+{
+	return fy_node_is_scalar(fyn) ? fy_node_get_scalar0(fyn) : NULL;
+}
+
+static int fy_schema_compile_node(struct fy_schema *fysc, struct fy_node *fyn);
+
+static int fy_schema_compile_types(struct fy_schema_state *st, struct fy_node *fyn)
+{
+	struct fy_node *fyni;
+	void *iter = NULL;
+	const char *text;
+	unsigned int i;
+
+	if (fy_node_is_sequence(fyn))
+		fyni = fy_node_sequence_iterate(fyn, &iter);
+	else
+		fyni = fyn;
+
+	while (fyni) {
+		text = fy_schema_node_text0(fyni);
+		if (!text)
+			return -1;
+		for (i = 0; i < FY_SCHEMA_TYPE_COUNT; i++) {
+			if (!strcmp(text, fy_schema_type_names[i].name))
+				break;
+		}
+		if (i >= FY_SCHEMA_TYPE_COUNT)
+			return -1;
+		st->types |= fy_schema_type_names[i].type;
+
+		fyni = fy_node_is_sequence(fyn) ? fy_node_sequence_iterate(fyn, &iter) : NULL;
+	}
+
+	return 0;
+}
+
+static int fy_schema_compile_enum(struct fy_schema_state *st, struct fy_node *fyn)
+{
+	struct fy_node *fyni;
+	void *iter = NULL;
+	const char *text;
+	size_t len;
+	int count;
+
+	if (!fy_node_is_sequence(fyn))
+		return -1;
+
+	count = fy_node_sequence_item_count(fyn);
+	st->enums = malloc(count * sizeof(*st->enums) + 1);
+	if (!st->enums)
+		return -1;
+
+	while ((fyni = fy_node_sequence_iterate(fyn, &iter)) != NULL) {
+		if (!fy_node_is_scalar(fyni))
+			return -1;
+		text = fy_node_get_scalar(fyni, &len);
+		if (!text) {
+			text = "";
+			len = 0;
+		}
+		if (fy_schema_str_set(&st->enums[st->enum_count], text, len))
+			return -1;
+		st->enum_count++;
+	}
+
+	return 0;
+}
+
+static int fy_schema_compile_properties(struct fy_schema *fysc, int idx, struct fy_node *fyn)
+{
+	struct fy_schema_state *st;
+	struct fy_schema_prop *prop;
+	struct fy_node_pair *fynp;
+	void *iter = NULL;
+	const char *key;
+	size_t len;
+	int count, state;
+
+	if (!fy_node_is_mapping(fyn))
+		return -1;
+
+	count = fy_node_mapping_item_count(fyn);
+	st = &fysc->states[idx];
+	st->props = malloc(count * sizeof(*st->props) + 1);
+	if (!st->props)
+		return -1;
+
+	while ((fynp = fy_node_mapping_iterate(fyn, &iter)) != NULL) {
+		if (!fy_node_is_scalar(fy_node_pair_key(fynp)))
+			return -1;
+		key = fy_node_get_scalar(fy_node_pair_key(fynp), &len);
+		if (!key) {
+			key = "";
+			len = 0;
+		}
+
+		state = fy_schema_compile_node(fysc, fy_node_pair_value(fynp));
+		if (state < 0)
+			return -1;
+
+		/* the states may have moved */
+		st = &fysc->states[idx];
+		prop = &st->props[st->prop_count];
+		if (fy_schema_str_set(&prop->key, key, len))
+			return -1;
+		prop->state = state;
+		prop->required = -1;
+		st->prop_count++;
+	}
+
+	qsort(st->props, st->prop_count, sizeof(*st->props), fy_schema_prop_cmp);
+
+	return 0;
+}
+
+static int fy_schema_compile_required(struct fy_schema *fysc, int idx, struct fy_node *fyn)
+{
+	struct fy_schema_state *st = &fysc->states[idx];
+	struct fy_schema_prop *prop, *props;
+	struct fy_node *fyni;
+	void *iter = NULL;
+	const char *key;
+	size_t len;
+
+	if (!fy_node_is_sequence(fyn))
+		return -1;
+
+	while ((fyni = fy_node_sequence_iterate(fyn, &iter)) != NULL) {
+		if (!fy_node_is_scalar(fyni))
+			return -1;
+		key = fy_node_get_scalar(fyni, &len);
+		if (!key) {
+			key = "";
+			len = 0;
+		}
+
+		prop = fy_schema_state_lookup(st, key, len);
+		if (!prop) {
+			/* a required key without a schema; other keys apply */
+			props = realloc(st->props, (st->prop_count + 1) * sizeof(*props));
+			if (!props)
+				return -1;
+			st->props = props;
+			prop = &st->props[st->prop_count];
+			if (fy_schema_str_set(&prop->key, key, len))
+				return -1;
+			prop->state = st->additional;
+			prop->required = -1;
+			st->prop_count++;
+			qsort(st->props, st->prop_count, sizeof(*st->props), fy_schema_prop_cmp);
+			prop = fy_schema_state_lookup(st, key, len);
+		}
+		if (prop->required < 0)
+			prop->required = st->required_count++;
+	}
+
+	return 0;
+}
+
+static int fy_schema_compile_node(struct fy_schema *fysc, struct fy_node *fyn)
+{
+	struct fy_schema_state *st, *states;
+	struct fy_node_pair *fynp;
+	struct fy_node *fyn_key, *fyn_value, *fyn_required = NULL;
+	void *iter = NULL;
+	const char *key, *text;
+	int idx, alloc, rc, state;
+
+	if (!fy_node_is_mapping(fyn))
+		return -1;
+
+	if (fysc->count >= fysc->alloc) {
+		alloc = fysc->alloc ? fysc->alloc * 2 : 16;
+		states = realloc(fysc->states, alloc * sizeof(*states));
+		if (!states)
+			return -1;
+		fysc->states = states;
+		fysc->alloc = alloc;
+	}
+
+	idx = fysc->count++;
+	st = &fysc->states[idx];
+	memset(st, 0, sizeof(*st));
+	st->min_length = st->max_length = -1;
+	st->min_items = st->max_items = -1;
+	st->additional = FY_SCHEMA_ANY;
+	st->items = FY_SCHEMA_ANY;
+
+	while ((fynp = fy_node_mapping_iterate(fyn, &iter)) != NULL) {
+		fyn_key = fy_node_pair_key(fynp);
+		fyn_value = fy_node_pair_value(fynp);
+		key = fy_schema_node_text0(fyn_key);
+		if (!key || !fyn_value)
+			return -1;
+		text = fy_schema_node_text0(fyn_value);
+
+		/* the states may have moved */
+		st = &fysc->states[idx];
+		rc = 0;
+
+		if (!strcmp(key, "type"))
+			rc = fy_schema_compile_types(st, fyn_value);
+		else if (!strcmp(key, "enum"))
+			rc = fy_schema_compile_enum(st, fyn_value);
+		else if (!strcmp(key, "minimum"))
+			rc = -!(st->has_minimum = fy_schema_parse_number(text, &st->minimum));
+		else if (!strcmp(key, "maximum"))
+			rc = -!(st->has_maximum = fy_schema_parse_number(text, &st->maximum));
+		else if (!strcmp(key, "exclusiveMinimum") || !strcmp(key, "exclusiveMaximum")) {
+			bool min = !strcmp(key, "exclusiveMinimum");
+
+			/* either the bound itself or a flag for the inclusive one */
+			if (text && (!strcmp(text, "true") || !strcmp(text, "false"))) {
+				if (min)
+					st->exclusive_minimum = !strcmp(text, "true");
+				else
+					st->exclusive_maximum = !strcmp(text, "true");
+			} else if (min) {
+				rc = -!(st->has_minimum = fy_schema_parse_number(text, &st->minimum));
+				st->exclusive_minimum = true;
+			} else {
+				rc = -!(st->has_maximum = fy_schema_parse_number(text, &st->maximum));
+				st->exclusive_maximum = true;
+			}
+		} else if (!strcmp(key, "minLength"))
+			rc = -!fy_schema_parse_count(text, &st->min_length);
+		else if (!strcmp(key, "maxLength"))
+			rc = -!fy_schema_parse_count(text, &st->max_length);
+		else if (!strcmp(key, "minItems"))
+			rc = -!fy_schema_parse_count(text, &st->min_items);
+		else if (!strcmp(key, "maxItems"))
+			rc = -!fy_schema_parse_count(text, &st->max_items);
+		else if (!strcmp(key, "pattern")) {
+			if (!text || st->has_pattern ||
+			    regcomp(&st->pattern, text, REG_EXTENDED | REG_NOSUB))
+				return -1;
+			st->has_pattern = true;
+		} else if (!strcmp(key, "properties"))
+			rc = fy_schema_compile_properties(fysc, idx, fyn_value);
+		else if (!strcmp(key, "required"))
+			fyn_required = fyn_value;
+		else if (!strcmp(key, "additionalProperties")) {
+			if (text && !strcmp(text, "true"))
+				state = FY_SCHEMA_ANY;
+			else if (text && !strcmp(text, "false"))
+				state = FY_SCHEMA_NONE;
+			else if ((state = fy_schema_compile_node(fysc, fyn_value)) < 0)
+				return -1;
+			fysc->states[idx].additional = state;
+		} else if (!strcmp(key, "items")) {
+			if ((state = fy_schema_compile_node(fysc, fyn_value)) < 0)
+				return -1;
+			fysc->states[idx].items = state;
+		}
+		/* anything else (title, description, default...) is ignored */
+
+		if (rc)
+			return -1;
+	}
+
+	/* after the properties and the schema of other keys are known */
+	if (fyn_required && fy_schema_compile_required(fysc, idx, fyn_required))
+		return -1;
+
+	return idx;
+}
+
+void fy_schema_destroy(struct fy_schema *fysc)
+{
+	struct fy_schema_state *st;
+	int i, j;
+
+	if (!fysc)
+		return;
+
+	for (i = 0; i < fysc->count; i++) {
+		st = &fysc->states[i];
+		for (j = 0; j < st->enum_count; j++)
+			free(st->enums[j].text);
+		free(st->enums);
+		for (j = 0; j < st->prop_count; j++)
+			free(st->props[j].key.text);
+		free(st->props);
+		if (st->has_pattern)
+			regfree(&st->pattern);
+	}
+	free(fysc->states);
+	free(fysc);
+}
+
+struct fy_schema *fy_schema_compile(struct fy_node *fyn)
+{
+	struct fy_schema *fysc;
+
+	if (!fyn)
+		return NULL;
+
+	fysc = malloc(sizeof(*fysc));
+	if (!fysc)
+		return NULL;
+	memset(fysc, 0, sizeof(*fysc));
+
+	/* the root schema is state 0 */
+	if (fy_schema_compile_node(fysc, fyn) < 0) {
+		fy_schema_destroy(fysc);
+		return NULL;
+	}
+
+	return fysc;
+}
+
+struct fy_schema_validator *
+fy_schema_validator_create(struct fy_schema *fysc, struct fy_parser *fyp)
+{
+	struct fy_schema_validator *fysv;
+
+	if (!fysc || !fyp)
+		return NULL;
+
+	fysv = malloc(sizeof(*fysv));
+	if (!fysv)
+		return NULL;
+	memset(fysv, 0, sizeof(*fysv));
+	fysv->fysc = fysc;
+	fysv->fyp = fyp;
+
+	return fysv;
+}
+
+static void fy_schema_validator_reset(struct fy_schema_validator *fysv)
+{
+	while (fysv->frame_count > 0)
+		fy_token_unref(fysv->frames[--fysv->frame_count].fyt_start);
+	fysv->bits_used = 0;
+	fysv->skip_depth = 0;
+}
+
+void fy_schema_validator_destroy(struct fy_schema_validator *fysv)
+{
+	if (!fysv)
+		return;
+
+	fy_schema_validator_reset(fysv);
+	free(fysv->frames);
+	free(fysv->bits);
+	free(fysv);
+}
+
+static int fy_schema_report(struct fy_schema_validator *fysv, struct fy_token *fyt,
+			    const char *fmt, ...)
+		__attribute__((format(printf, 3, 4)));
+
+static int fy_schema_report(struct fy_schema_validator *fysv, struct fy_token *fyt,
+			    const char *fmt, ...)
+{
+	struct fy_parser *fyp = fysv->fyp;
+	struct fy_error_ctx ec;
+	va_list ap;
+
+	memset(&ec, 0, sizeof(ec));
+	ec.file = __FILE__;
+	ec.line = __LINE__;
+	ec.func = __func__;
+	ec.module = FYEM_DOC;
+	if (fyt && fy_token_start_mark(fyt)) {
+		ec.start_mark = *fy_token_start_mark(fyt);
+		ec.end_mark = *fy_token_end_mark(fyt);
+		ec.fyi = fy_token_get_input(fyt);
+	} else {
+		fy_get_mark(fyp, &ec.start_mark);
+		ec.end_mark = ec.start_mark;
+		ec.fyi = fyp->current_input;
+	}
+
+	if (ec.fyi) {
+		va_start(ap, fmt);
+		fy_error_vreport(fyp, &ec, fmt, ap);
+		va_end(ap);
+	}
+
+	fysv->failed = true;
+	return -1;
+}
+
+static unsigned int fy_schema_scalar_type(struct fy_event *fye, const char *text, size_t len)
+{
+	const char *tag, *s, *e;
+	size_t tag_len;
+	bool digits;
+
+	if (fye->scalar.tag) {
+		tag = fy_token_get_text(fye->scalar.tag, &tag_len);
+		if (tag && tag_len > 18 && !memcmp(tag, "tag:yaml.org,2002:", 18)) {
+			tag += 18;
+			tag_len -= 18;
+			if (tag_len == 4 && !memcmp(tag, "null", 4))
+				return FYSCT_NULL;
+			if (tag_len == 4 && !memcmp(tag, "bool", 4))
+				return FYSCT_BOOLEAN;
+			if (tag_len == 3 && !memcmp(tag, "int", 3))
+				return FYSCT_INTEGER;
+			if (tag_len == 5 && !memcmp(tag, "float", 5))
+				return FYSCT_NUMBER;
+		}
+		return FYSCT_STRING;
+	}
+
+	if (fye->scalar.value && fye->scalar.value->scalar.style != FYSS_PLAIN)
+		return FYSCT_STRING;
+
+	/* the YAML 1.2 core schema */
+	if (!len || (len == 1 && *text == '~') ||
+	    (len == 4 && (!memcmp(text, "null", 4) || !memcmp(text, "Null", 4) ||
+			  !memcmp(text, "NULL", 4))))
+		return FYSCT_NULL;
+
+	if ((len == 4 && (!memcmp(text, "true", 4) || !memcmp(text, "True", 4) ||
+			  !memcmp(text, "TRUE", 4))) ||
+	    (len == 5 && (!memcmp(text, "false", 5) || !memcmp(text, "False", 5) ||
+			  !memcmp(text, "FALSE", 5))))
+		return FYSCT_BOOLEAN;
+
+	s = text;
+	e = text + len;
+
+	if (len > 2 && s[0] == '0' && s[1] == 'x') {
+		for (s += 2; s < e && isxdigit((unsigned char)*s); s++)
+			;
+		return s == e ? FYSCT_INTEGER : FYSCT_STRING;
+	}
+
+	if (len > 2 && s[0] == '0' && s[1] == 'o') {
+		for (s += 2; s < e && *s >= '0' && *s <= '7'; s++)
+			;
+		return s == e ? FYSCT_INTEGER : FYSCT_STRING;
+	}
+
+	if (s < e && (*s == '+' || *s == '-'))
+		s++;
+
+	if (e - s == 4 && *s == '.' && (!memcmp(s, ".inf", 4) || !memcmp(s, ".Inf", 4) ||
+					!memcmp(s, ".INF", 4)))
+		return FYSCT_NUMBER;
+	if (len == 4 && (!memcmp(text, ".nan", 4) || !memcmp(text, ".NaN", 4) ||
+			 !memcmp(text, ".NAN", 4)))
+		return FYSCT_NUMBER;
+
+	digits = false;
+	while (s < e && *s >= '0' && *s <= '9') {
+		s++;
+		digits = true;
+	}
+	if (s == e)
+		return digits ? FYSCT_INTEGER : FYSCT_STRING;
+
+	if (*s == '.') {
+		s++;
+		while (s < e && *s >= '0' && *s <= '9') {
+			s++;
+			digits = true;
+		}
+	}
+	if (!digits)
+		return FYSCT_STRING;
+	if (s < e && (*s == 'e' || *s == 'E')) {
+		s++;
+		if (s < e && (*s == '+' || *s == '-'))
+			s++;
+		if (s >= e || *s < '0' || *s > '9')
+			return FYSCT_STRING;
+		while (s < e && *s >= '0' && *s <= '9')
+			s++;
+	}
+
+	return s == e ? FYSCT_NUMBER : FYSCT_STRING;
+}
+
+static bool fy_schema_scalar_number(const char *text, double *dp)
+{
+	const char *s = text;
+	char *end;
+	bool neg;
+
+	neg = *s == '-';
+	if (*s == '+' || *s == '-')
+		s++;
+
+	if (!strcasecmp(s, ".inf")) {
+		*dp = neg ? -INFINITY : INFINITY;
+		return true;
+	}
+	if (!strcasecmp(s, ".nan")) {
+		*dp = NAN;
+		return true;
+	}
+
+	errno = 0;
+	if (s == text && s[0] == '0' && s[1] == 'x')
+		*dp = (double)strtoull(s + 2, &end, 16);
+	else if (s == text && s[0] == '0' && s[1] == 'o')
+		*dp = (double)strtoull(s + 2, &end, 8);
+	else
+		*dp = strtod(text, &end);
+
+	return !*end && !errno;
+}
+
+static const char *fy_schema_types_txt(unsigned int types, char *buf, size_t size)
+{
+	unsigned int i;
+	size_t len = 0;
+
+	buf[0] = '\0';
+	for (i = 0; i < FY_SCHEMA_TYPE_COUNT && len < size; i++) {
+		if (!(types & fy_schema_type_names[i].type))
+			continue;
+		len += snprintf(buf + len, size - len, "%s%s",
+				len ? " or " : "", fy_schema_type_names[i].name);
+	}
+	return buf;
+}
+
+static int fy_schema_check_scalar(struct fy_schema_validator *fysv, struct fy_schema_state *st,
+				  struct fy_event *fye, unsigned int type)
+{
+	struct fy_token *fyt = fye->scalar.value;
+	const char *text, *text0;
+	size_t len;
+	long count;
+	double d;
+	int i;
+
+	text = fyt ? fy_token_get_text(fyt, &len) : NULL;
+	if (!text) {
+		text = "";
+		len = 0;
+	}
+
+	if (st->enum_count) {
+		for (i = 0; i < st->enum_count; i++) {
+			if (!fy_schema_str_cmp(st->enums[i].text, st->enums[i].len, text, len))
+				break;
+		}
+		if (i >= st->enum_count)
+			return fy_schema_report(fysv, fyt, "value '%.*s' is not one of the allowed values",
+						(int)len, text);
+	}
+
+	if ((type & (FYSCT_INTEGER | FYSCT_NUMBER)) && (st->has_minimum || st->has_maximum)) {
+		text0 = fyt ? fy_token_get_text0(fyt) : NULL;
+		if (!text0 || !fy_schema_scalar_number(text0, &d))
+			return fy_schema_report(fysv, fyt, "invalid number '%.*s'", (int)len, text);
+
+		if (st->has_minimum &&
+		    (st->exclusive_minimum ? !(d > st->minimum) : !(d >= st->minimum)))
+			return fy_schema_report(fysv, fyt, "value %.*s is less than %s%g",
+						(int)len, text,
+						st->exclusive_minimum ? "or equal to " : "",
+						st->minimum);
+		if (st->has_maximum &&
+		    (st->exclusive_maximum ? !(d < st->maximum) : !(d <= st->maximum)))
+			return fy_schema_report(fysv, fyt, "value %.*s is greater than %s%g",
+						(int)len, text,
+						st->exclusive_maximum ? "or equal to " : "",
+						st->maximum);
+	}
+
+	if (!(type & FYSCT_STRING))
+		return 0;
+
+	if (st->min_length >= 0 || st->max_length >= 0) {
+		count = fy_utf8_count(text, len);
+		if (st->min_length >= 0 && count < st->min_length)
+			return fy_schema_report(fysv, fyt, "string is shorter than %ld characters",
+						st->min_length);
+		if (st->max_length >= 0 && count > st->max_length)
+			return fy_schema_report(fysv, fyt, "string is longer than %ld characters",
+						st->max_length);
+	}
+
+	if (st->has_pattern) {
+		text0 = fyt ? fy_token_get_text0(fyt) : "";
+		if (!text0 || regexec(&st->pattern, text0, 0, NULL, 0))
+			return fy_schema_report(fysv, fyt, "string '%.*s' does not match the pattern",
+						(int)len, text);
+	}
+
+	return 0;
+}
+
+static int fy_schema_push(struct fy_schema_validator *fysv, int state,
+			  struct fy_event *fye)
+{
+	struct fy_schema_state *st = &fysv->fysc->states[state];
+	struct fy_schema_frame *f, *frames;
+	uint64_t *bits;
+	int alloc, words;
+
+	if (fysv->frame_count >= fysv->frame_alloc) {
+		alloc = fysv->frame_alloc ? fysv->frame_alloc * 2 : 16;
+		frames = realloc(fysv->frames, alloc * sizeof(*frames));
+		if (!frames)
+			return -1;
+		fysv->frames = frames;
+		fysv->frame_alloc = alloc;
+	}
+
+	f = &fysv->frames[fysv->frame_count];
+	memset(f, 0, sizeof(*f));
+	f->state = state;
+	f->mapping = fye->type == FYET_MAPPING_START;
+	f->key_next = true;
+	f->bits = fysv->bits_used;
+
+	/* a bitmap of the required keys seen in this mapping */
+	words = f->mapping ? (st->required_count + 63) / 64 : 0;
+	if (fysv->bits_used + words > fysv->bits_alloc) {
+		alloc = fysv->bits_alloc ? fysv->bits_alloc * 2 : 16;
+		while (alloc < fysv->bits_used + words)
+			alloc *= 2;
+		bits = realloc(fysv->bits, alloc * sizeof(*bits));
+		if (!bits)
+			return -1;
+		fysv->bits = bits;
+		fysv->bits_alloc = alloc;
+	}
+	memset(fysv->bits + fysv->bits_used, 0, words * sizeof(*bits));
+	fysv->bits_used += words;
+
+	f->fyt_start = fy_token_ref(fy_document_event_get_token(fye));
+	fysv->frame_count++;
+
+	return 0;
+}
+
+static int fy_schema_pop(struct fy_schema_validator *fysv)
+{
+	struct fy_schema_frame *f;
+	struct fy_schema_state *st;
+	struct fy_schema_prop *prop;
+	int i, rc = 0;
+
+	if (fysv->frame_count <= 0)
+		return 0;
+
+	f = &fysv->frames[fysv->frame_count - 1];
+	st = &fysv->fysc->states[f->state];
+
+	if (!f->mapping) {
+		if (st->min_items >= 0 && f->count < st->min_items)
+			rc = fy_schema_report(fysv, f->fyt_start,
+					"sequence has fewer than %ld items",
+					st->min_items);
+	} else if (st->required_count) {
+		for (i = 0, prop = st->props; i < st->prop_count; i++, prop++) {
+			if (prop->required < 0 ||
+			    (fysv->bits[f->bits + prop->required / 64] &
+			     ((uint64_t)1 << (prop->required % 64))))
+				continue;
+			rc = fy_schema_report(fysv, f->fyt_start,
+					"missing required key '%s'", prop->key.text);
+			break;
+		}
+	}
+
+	fysv->bits_used = f->bits;
+	fy_token_unref(f->fyt_start);
+	fysv->frame_count--;
+
+	return rc;
+}
+
+static int fy_schema_key(struct fy_schema_validator *fysv, struct fy_schema_frame *f,
+			 struct fy_event *fye)
+{
+	struct fy_schema_state *st = &fysv->fysc->states[f->state];
+	struct fy_schema_prop *prop;
+	const char *key;
+	size_t len;
+
+	f->key_next = false;
+	f->count++;
+
+	if (fye->type != FYET_SCALAR) {
+		/* complex keys are not checked, and neither are their values */
+		if (fye->type != FYET_ALIAS)
+			fysv->skip_depth = 1;
+		f->value_state = FY_SCHEMA_ANY;
+		return 0;
+	}
+
+	key = fye->scalar.value ? fy_token_get_text(fye->scalar.value, &len) : NULL;
+	if (!key) {
+		key = "";
+		len = 0;
+	}
+
+	prop = fy_schema_state_lookup(st, key, len);
+	if (prop && prop->required >= 0)
+		fysv->bits[f->bits + prop->required / 64] |= (uint64_t)1 << (prop->required % 64);
+
+	f->value_state = prop ? prop->state : st->additional;
+	if (f->value_state == FY_SCHEMA_NONE)
+		return fy_schema_report(fysv, fye->scalar.value, "unexpected key '%.*s'",
+					(int)len, key);
+
+	return 0;
+}
+
+int fy_schema_validator_process(struct fy_schema_validator *fysv, struct fy_event *fye)
+{
+	struct fy_schema_state *st;
+	struct fy_schema_frame *f;
+	unsigned int type;
+	const char *text;
+	size_t len;
+	int state;
+	char buf[80];
+
+	if (!fysv || !fye || fysv->failed)
+		return -1;
+
+	switch (fye->type) {
+	case FYET_DOCUMENT_START:
+	case FYET_DOCUMENT_END:
+		fy_schema_validator_reset(fysv);
+		return 0;
+
+	case FYET_SEQUENCE_END:
+	case FYET_MAPPING_END:
+		if (fysv->skip_depth > 0) {
+			fysv->skip_depth--;
+			return 0;
+		}
+		return fy_schema_pop(fysv);
+
+	case FYET_SCALAR:
+	case FYET_ALIAS:
+	case FYET_SEQUENCE_START:
+	case FYET_MAPPING_START:
+		break;
+
+	default:
+		return 0;
+	}
+
+	/* inside a subtree that any schema accepts */
+	if (fysv->skip_depth > 0) {
+		if (fye->type == FYET_SEQUENCE_START || fye->type == FYET_MAPPING_START)
+			fysv->skip_depth++;
+		return 0;
+	}
+
+	if (fysv->frame_count > 0) {
+		f = &fysv->frames[fysv->frame_count - 1];
+		st = &fysv->fysc->states[f->state];
+		if (f->mapping && f->key_next)
+			return fy_schema_key(fysv, f, fye);
+
+		if (f->mapping) {
+			state = f->value_state;
+			f->key_next = true;
+		} else {
+			if (st->max_items >= 0 && f->count >= st->max_items)
+				return fy_schema_report(fysv, fy_document_event_get_token(fye),
+						"sequence has more than %ld items", st->max_items);
+			state = st->items;
+			f->count++;
+		}
+	} else
+		state = 0;
+
+	if (state == FY_SCHEMA_ANY || fye->type == FYET_ALIAS) {
+		if (fye->type == FYET_SEQUENCE_START || fye->type == FYET_MAPPING_START)
+			fysv->skip_depth = 1;
+		return 0;
+	}
+
+	st = &fysv->fysc->states[state];
+
+	if (fye->type == FYET_SCALAR) {
+		text = fye->scalar.value ? fy_token_get_text(fye->scalar.value, &len) : NULL;
+		if (!text) {
+			text = "";
+			len = 0;
+		}
+		type = fy_schema_scalar_type(fye, text, len);
+	} else
+		type = fye->type == FYET_SEQUENCE_START ? FYSCT_ARRAY : FYSCT_OBJECT;
+
+	/* an integer is also a number */
+	if (st->types && !(st->types & type) &&
+	    !(type == FYSCT_INTEGER && (st->types & FYSCT_NUMBER)))
+		return fy_schema_report(fysv, fy_document_event_get_token(fye),
+				"invalid type, expected %s",
+				fy_schema_types_txt(st->types, buf, sizeof(buf)));
+
+	if (fye->type == FYET_SCALAR)
+		return fy_schema_check_scalar(fysv, st, fye, type);
+
+	return fy_schema_push(fysv, state, fye);
+}
+
+int fy_schema_validate_parser(struct fy_schema *fysc, struct fy_parser *fyp)
+{
+	struct fy_schema_validator *fysv;
+	struct fy_event *fye;
+	int rc = 0;
+
+	fysv = fy_schema_validator_create(fysc, fyp);
+	if (!fysv)
+		return -1;
+
+	/* stop at the first invalid event; nothing more is parsed */
+	while (!rc && (fye = fy_parser_parse(fyp)) != NULL) {
+		rc = fy_schema_validator_process(fysv, fye);
+		fy_parser_event_free(fyp, fye);
+	}
+
+	fy_schema_validator_destroy(fysv);
+
+	if (!rc && fy_parser_get_stream_error(fyp))
+		rc = -1;
+
+	return rc;
+}
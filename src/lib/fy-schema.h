@@ -0,0 +1,106 @@
+/*
+ * fy-schema.h - compiled schema validation internal header file
+ *
+ * Copyright (c) 2019 Pantelis Antoniou <pantelis.antoniou@konsulko.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef FY_SCHEMA_H
+#define FY_SCHEMA_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <regex.h>
+
+#include <libfyaml.h>
+
+/* the types of a node, as a mask */
+#define FYSCT_NULL	0x01
+#define FYSCT_BOOLEAN	0x02
+#define FYSCT_INTEGER	0x04
+#define FYSCT_NUMBER	0x08
+#define FYSCT_STRING	0x10
+#define FYSCT_ARRAY	0x20
+#define FYSCT_OBJECT	0x40
+
+/* transitions to no state */
+#define FY_SCHEMA_ANY	-1	/* anything is valid */
+#define FY_SCHEMA_NONE	-2	/* nothing is valid */
+
+struct fy_schema_str {
+	char *text;
+	size_t len;
+};
+
+struct fy_schema_prop {
+	struct fy_schema_str key;
+	int state;			/* the state of the value */
+	int required;			/* bit of the required key, or -1 */
+};
+
+/*
+ * A compiled schema is a set of states, one per (sub)schema; the
+ * transitions to the states of the values of an object and the items
+ * of an array are state indices.
+ */
+struct fy_schema_state {
+	unsigned int types;		/* FYSCT_* mask, 0 for any */
+	/* scalars */
+	struct fy_schema_str *enums;
+	int enum_count;
+	bool has_minimum : 1;
+	bool has_maximum : 1;
+	bool exclusive_minimum : 1;
+	bool exclusive_maximum : 1;
+	bool has_pattern : 1;
+	double minimum;
+	double maximum;
+	long min_length;		/* -1 when not set */
+	long max_length;
+	regex_t pattern;
+	/* objects, the properties are sorted by key */
+	struct fy_schema_prop *props;
+	int prop_count;
+	int required_count;
+	int additional;			/* state of other keys' values */
+	/* arrays */
+	int items;			/* state of the items */
+	long min_items;			/* -1 when not set */
+	long max_items;
+};
+
+struct fy_schema {
+	struct fy_schema_state *states;
+	int count;
+	int alloc;
+};
+
+/* an open collection during validation */
+struct fy_schema_frame {
+	int state;
+	bool mapping : 1;
+	bool key_next : 1;		/* the next node is a key */
+	int value_state;		/* the state of the next value */
+	long count;			/* items or keys seen */
+	int bits;			/* offset of the seen required keys bitmap */
+	struct fy_token *fyt_start;	/* for reporting */
+};
+
+struct fy_schema_validator {
+	struct fy_schema *fysc;
+	struct fy_parser *fyp;
+	bool failed;
+	int skip_depth;			/* depth in a subtree that is not checked */
+	struct fy_schema_frame *frames;
+	int frame_count;
+	int frame_alloc;
+	uint64_t *bits;
+	int bits_used;
+	int bits_alloc;
+};
+
+#endif
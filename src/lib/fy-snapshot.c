@@ -0,0 +1,449 @@
+/*
+ * fy-snapshot.c - persistent document snapshots
+ *
+ * Copyright (c) 2019 Pantelis Antoniou <pantelis.antoniou@konsulko.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <alloca.h>
+#include <sched.h>
+
+#include <libfyaml.h>
+
+#include "fy-parse.h"
+#include "fy-doc.h"
+#include "fy-overlay.h"
+#include "fy-snapshot.h"
+
+static void fy_snapshot_prepare_node(struct fy_node *fyn)
+{
+	struct fy_node *fyni;
+	struct fy_node_pair *fynp;
+	size_t len;
+
+	if (!fyn)
+		return;
+
+	(void)fy_token_get_text(fyn->tag, &len);
+
+	switch (fyn->type) {
+	case FYNT_SCALAR:
+		(void)fy_token_get_text(fyn->scalar, &len);
+		break;
+	case FYNT_SEQUENCE:
+		for (fyni = fy_node_list_head(&fyn->sequence); fyni;
+				fyni = fy_node_next(&fyn->sequence, fyni))
+			fy_snapshot_prepare_node(fyni);
+		break;
+	case FYNT_MAPPING:
+		for (fynp = fy_node_pair_list_head(&fyn->mapping); fynp;
+				fynp = fy_node_pair_next(&fyn->mapping, fynp)) {
+			fy_snapshot_prepare_node(fynp->key);
+			fy_snapshot_prepare_node(fynp->value);
+		}
+		break;
+	}
+}
+
+/*
+ * Readers hash and compare the nodes of a snapshot concurrently, and
+ * the text of a token is cached on first use; do it before anyone
+ * gets to see the document, so that reading never writes.
+ */
+static void fy_snapshot_prepare(struct fy_document *fyd)
+{
+	struct fy_anchor *fya;
+	size_t len;
+
+	fy_snapshot_prepare_node(fy_document_root(fyd));
+
+	for (fya = fy_anchor_list_head(&fyd->anchors); fya;
+			fya = fy_anchor_next(&fyd->anchors, fya))
+		(void)fy_token_get_text(fya->anchor, &len);
+}
+
+static struct fy_snapshot *
+fy_snapshot_alloc(struct fy_snapshot *parent, struct fy_document *fyd, struct fy_node *cut,
+		  struct fy_node * const *patches, int npatches)
+{
+	struct fy_snapshot *fys;
+
+	fys = malloc(sizeof(*fys));
+	if (!fys)
+		return NULL;
+	memset(fys, 0, sizeof(*fys));
+
+	if (npatches) {
+		fys->patches = malloc(npatches * sizeof(*fys->patches));
+		if (!fys->patches) {
+			free(fys);
+			return NULL;
+		}
+		memcpy(fys->patches, patches, npatches * sizeof(*fys->patches));
+		fys->npatches = npatches;
+	}
+
+	fy_snapshot_prepare(fyd);
+
+	atomic_init(&fys->refs, 1);
+	fys->parent = fy_snapshot_ref(parent);
+	fys->fyd = fyd;
+	fys->cut = cut;
+	fys->depth = parent ? parent->depth + 1 : 1;
+
+	return fys;
+}
+
+struct fy_snapshot *fy_snapshot_create(struct fy_document *fyd)
+{
+	if (!fyd)
+		return NULL;
+
+	return fy_snapshot_alloc(NULL, fyd, NULL, NULL, 0);
+}
+
+struct fy_snapshot *fy_snapshot_ref(struct fy_snapshot *fys)
+{
+	if (fys)
+		atomic_fetch_add(&fys->refs, 1);
+	return fys;
+}
+
+void fy_snapshot_unref(struct fy_snapshot *fys)
+{
+	struct fy_snapshot *parent;
+
+	/* iteratively, dropping a layer may drop the ones below it */
+	while (fys && atomic_fetch_sub(&fys->refs, 1) == 1) {
+		parent = fys->parent;
+		fy_document_destroy(fys->fyd);
+		free(fys->patches);
+		free(fys);
+		fys = parent;
+	}
+}
+
+struct fy_overlay *fy_snapshot_overlay(struct fy_snapshot *fys)
+{
+	struct fy_document **fyds;
+	struct fy_node **cuts, **patches = NULL;
+	struct fy_snapshot *fysi;
+	struct fy_overlay *fyo;
+	int i, count, npatches;
+
+	if (!fys)
+		return NULL;
+
+	count = fys->depth;
+	fyds = alloca(count * sizeof(*fyds));
+	cuts = alloca(count * sizeof(*cuts));
+
+	npatches = 0;
+	for (fysi = fys; fysi; fysi = fysi->parent)
+		npatches += fysi->npatches;
+	if (npatches) {
+		patches = malloc(npatches * sizeof(*patches));
+		if (!patches)
+			return NULL;
+	}
+
+	/* the overlay wants the base layer first */
+	npatches = 0;
+	for (fysi = fys, i = count - 1; fysi; fysi = fysi->parent, i--) {
+		assert(i >= 0);
+		fyds[i] = fysi->fyd;
+		cuts[i] = fysi->cut;
+		if (fysi->npatches)
+			memcpy(patches + npatches, fysi->patches, fysi->npatches * sizeof(*patches));
+		npatches += fysi->npatches;
+	}
+
+	/* nothing is merged here, the readers resolve what they look up */
+	fyo = fy_overlay_create_internal(fyds, cuts, patches, npatches, count);
+	free(patches);
+
+	return fyo;
+}
+
+/* the delta node standing in for an overlay node on the update path */
+static struct fy_node *
+fy_snapshot_delta_node(struct fy_document *fyd, struct fy_overlay_node *fyon,
+		       struct fy_node **patches, int *npatchesp)
+{
+	struct fy_node *fyn_top, *fyn;
+
+	/* nothing (or null) there, start a new mapping */
+	fyn_top = fy_overlay_node_get_node(fyon);
+	if (!fyn_top)
+		return fy_node_create_mapping(fyd);
+
+	/* scalars can't be traversed */
+	if (fy_node_is_scalar(fyn_top))
+		return NULL;
+
+	fyn = fy_node_create_mapping(fyd);
+	if (!fyn)
+		return NULL;
+
+	/* a sequence is patched by index, only the item on the path is in the delta */
+	if (fy_node_is_sequence(fyn_top)) {
+		patches[(*npatchesp)++] = fyn;
+		return fyn;
+	}
+
+	fyn->style = fyn_top->style;
+	fyn->tag = fy_token_ref(fyn_top->tag);
+
+	return fyn;
+}
+
+/*
+ * The keys are copied into flattened documents, which outlive the deltas,
+ * so they must hold on to their own text.
+ */
+static struct fy_node *fy_snapshot_key_build(struct fy_document *fyd, const char *text)
+{
+	char *str;
+
+	str = strdup(text);
+	if (!str)
+		return NULL;
+
+	return fy_node_build_from_malloc_string(fyd, str, strlen(str));
+}
+
+struct fy_snapshot *fy_document_update_path(struct fy_snapshot *fys, const char *path,
+					    struct fy_node *fyn)
+{
+	struct fy_overlay *fyo = NULL;
+	struct fy_overlay_node *fyon, *fyonc;
+	struct fy_document *fyd = NULL, *fyd_flat;
+	struct fy_node *fyn_new, *fyn_cur, *fyn_key, *fyn_next, *cut = NULL;
+	struct fy_node **patches = NULL;
+	struct fy_node_pair *fynp;
+	struct fy_snapshot *fys_new;
+	char *keybuf;
+	char idxbuf[16];
+	int idx, rc, npatches = 0;
+
+	if (!fys || !path || !fyn)
+		return NULL;
+
+	fyo = fy_snapshot_overlay(fys);
+	if (!fyo)
+		return NULL;
+
+	fyd = fy_document_create(NULL);
+	if (!fyd)
+		goto err_out;
+
+	rc = fy_document_state_merge(fyd, fyn->fyd);
+	if (rc)
+		goto err_out;
+
+	fyn_new = fy_node_copy(fyd, fyn);
+	if (!fyn_new)
+		goto err_out;
+
+	while (*path == '/')
+		path++;
+
+	/* the new node replaces what's below it, everywhere */
+	cut = fyn_new;
+
+	/* replacing the root */
+	if (!*path) {
+		fy_document_set_root(fyd, fyn_new);
+		goto done;
+	}
+
+	/* at most one patch per path component */
+	patches = alloca((strlen(path) + 1) * sizeof(*patches));
+
+	fyon = fy_overlay_root(fyo);
+	fyn_cur = fy_snapshot_delta_node(fyd, fyon, patches, &npatches);
+	if (!fyn_cur)
+		goto err_free_new;
+	fy_document_set_root(fyd, fyn_cur);
+
+	keybuf = alloca(strlen(path) + 1);
+	for (;;) {
+		if (fy_overlay_node_get_type(fyon) == FYNT_SEQUENCE) {
+			path = fy_path_parse_seq_index(path, &idx);
+			if (!path)
+				goto err_free_new;
+
+			if (idx < 0)
+				idx += fy_overlay_node_item_count(fyon);
+			fyonc = fy_overlay_node_sequence_get_by_index(fyon, idx);
+			if (!fyonc)
+				goto err_free_new;
+
+			snprintf(idxbuf, sizeof(idxbuf), "%d", idx);
+			fyn_key = fy_snapshot_key_build(fyd, idxbuf);
+		} else {
+			path = fy_path_parse_map_key(path, keybuf);
+			if (!path)
+				goto err_free_new;
+
+			fyonc = fy_overlay_node_mapping_lookup_by_string(fyon, keybuf);
+
+			/* keep the key as it is in the lower layers */
+			if (fyonc && fy_overlay_node_get_key(fyonc))
+				fyn_key = fy_node_copy(fyd, fy_overlay_node_get_key(fyonc));
+			else
+				fyn_key = fy_snapshot_key_build(fyd, keybuf);
+		}
+		if (!fyn_key)
+			goto err_free_new;
+
+		fynp = fy_node_pair_alloc(fyd);
+		if (!fynp) {
+			fy_node_free(fyn_key);
+			goto err_free_new;
+		}
+		fy_node_pair_link_key(fynp, fyn_key);
+		fy_node_pair_set_parent(fynp, fyn_cur);
+		fy_node_pair_list_add_tail(&fyn_cur->mapping, fynp);
+
+		while (*path == '/')
+			path++;
+
+		if (!*path) {
+			fynp->value = fyn_new;
+			fy_node_set_parent(fyn_new, fyn_cur);
+			goto done;
+		}
+
+		fyn_next = fy_snapshot_delta_node(fyd, fyonc, patches, &npatches);
+		if (!fyn_next)
+			goto err_free_new;
+		fynp->value = fyn_next;
+		fy_node_set_parent(fyn_next, fyn_cur);
+
+		fyn_cur = fyn_next;
+		fyon = fyonc;
+	}
+
+done:
+	fy_overlay_destroy(fyo);
+	fyo = NULL;
+
+	fys_new = fy_snapshot_alloc(fys, fyd, cut, patches, npatches);
+	if (!fys_new)
+		goto err_out;
+
+	if (fys_new->depth <= FY_SNAPSHOT_MAX_DEPTH)
+		return fys_new;
+
+	/* too many layers, lookups would suffer; start over from a flat base */
+	fyo = fy_snapshot_overlay(fys_new);
+	fyd_flat = fyo ? fy_overlay_flatten(fyo) : NULL;
+	fy_overlay_destroy(fyo);
+	fy_snapshot_unref(fys_new);
+	if (!fyd_flat)
+		return NULL;
+
+	fys_new = fy_snapshot_create(fyd_flat);
+	if (!fys_new)
+		fy_document_destroy(fyd_flat);
+
+	return fys_new;
+
+err_free_new:
+	/* the new node is only linked on success */
+	fy_node_free(fyn_new);
+err_out:
+	fy_document_destroy(fyd);
+	fy_overlay_destroy(fyo);
+	return NULL;
+}
+
+struct fy_snapshot_slot *fy_snapshot_slot_create(struct fy_snapshot *fys)
+{
+	struct fy_snapshot_slot *slot;
+
+	if (!fys)
+		return NULL;
+
+	slot = malloc(sizeof(*slot));
+	if (!slot)
+		return NULL;
+	memset(slot, 0, sizeof(*slot));
+
+	atomic_init(&slot->current, fy_snapshot_ref(fys));
+	atomic_init(&slot->epoch, 0);
+	atomic_init(&slot->readers[0], 0);
+	atomic_init(&slot->readers[1], 0);
+	atomic_flag_clear(&slot->publishing);
+
+	return slot;
+}
+
+void fy_snapshot_slot_destroy(struct fy_snapshot_slot *slot)
+{
+	if (!slot)
+		return;
+
+	fy_snapshot_unref(atomic_load(&slot->current));
+	free(slot);
+}
+
+struct fy_snapshot *fy_snapshot_acquire(struct fy_snapshot_slot *slot)
+{
+	struct fy_snapshot *fys;
+	unsigned int e;
+
+	if (!slot)
+		return NULL;
+
+	/* announce ourselves in the current epoch; the publisher waits for us */
+	e = atomic_load(&slot->epoch) & 1;
+	atomic_fetch_add(&slot->readers[e], 1);
+	fys = fy_snapshot_ref(atomic_load(&slot->current));
+	atomic_fetch_sub(&slot->readers[e], 1);
+
+	return fys;
+}
+
+void fy_snapshot_publish(struct fy_snapshot_slot *slot, struct fy_snapshot *fys)
+{
+	struct fy_snapshot *fys_old;
+	unsigned int e;
+	int i;
+
+	if (!slot || !fys)
+		return;
+
+	fy_snapshot_ref(fys);
+
+	/* publishers are rare, simply serialize them */
+	while (atomic_flag_test_and_set(&slot->publishing))
+		sched_yield();
+
+	fys_old = atomic_exchange(&slot->current, fys);
+
+	/*
+	 * Wait out the readers that might have seen the old snapshot
+	 * without having referenced it yet. Readers that show up after
+	 * a flip use the other counter, so flipping twice guarantees
+	 * the wait terminates and covers readers of both epochs.
+	 */
+	for (i = 0; i < 2; i++) {
+		e = atomic_fetch_xor(&slot->epoch, 1) & 1;
+		while (atomic_load(&slot->readers[e]))
+			sched_yield();
+	}
+
+	atomic_flag_clear(&slot->publishing);
+
+	fy_snapshot_unref(fys_old);
+}
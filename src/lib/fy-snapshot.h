@@ -0,0 +1,47 @@
+/*
+ * fy-snapshot.h - persistent document snapshots internal header file
+ *
+ * Copyright (c) 2019 Pantelis Antoniou <pantelis.antoniou@konsulko.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef FY_SNAPSHOT_H
+#define FY_SNAPSHOT_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdatomic.h>
+
+#include <libfyaml.h>
+
+/* snapshots with more layers than this are flattened on update */
+#define FY_SNAPSHOT_MAX_DEPTH	16
+
+/*
+ * A snapshot is a base document with a chain of delta layers on top.
+ * Each delta holds just the path leading to the updated node, merged
+ * over the layers below it by an overlay. Mappings on the path merge
+ * by key; a sequence is stood in for by a patch, a mapping from the
+ * index of the item on the path to its delta. The cut is the delta
+ * node that replaces (instead of merging with) what's below.
+ */
+struct fy_snapshot {
+	atomic_uint refs;
+	struct fy_snapshot *parent;	/* the layers below, NULL for a base */
+	struct fy_document *fyd;	/* the base document or the delta */
+	struct fy_node *cut;
+	struct fy_node **patches;	/* the sequence patches of the delta */
+	int npatches;
+	int depth;			/* number of layers */
+};
+
+struct fy_snapshot_slot {
+	_Atomic(struct fy_snapshot *) current;
+	atomic_uint epoch;
+	atomic_uint readers[2];
+	atomic_flag publishing;
+};
+
+#endif
@@ -0,0 +1,189 @@
+/*
+ * fy-spill.c - disk backed storage
+ *
+ * Copyright (c) 2019 Pantelis Antoniou <pantelis.antoniou@konsulko.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <alloca.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <libfyaml.h>
+
+#include "fy-spill.h"
+
+#define FY_SPILL_ALIGN	16
+
+struct fy_spill *fy_spill_create(const char *dir)
+{
+	struct fy_spill *spill;
+	char *path;
+	size_t len;
+
+	/* /tmp is often a tmpfs, which would take up the memory we're saving */
+	if (!dir || !*dir)
+		dir = getenv("TMPDIR");
+	if (!dir || !*dir)
+		dir = "/var/tmp";
+
+	spill = malloc(sizeof(*spill));
+	if (!spill)
+		return NULL;
+	memset(spill, 0, sizeof(*spill));
+
+	len = strlen(dir) + sizeof("/libfyaml-spill-XXXXXX");
+	path = alloca(len);
+	snprintf(path, len, "%s/libfyaml-spill-XXXXXX", dir);
+
+	spill->fd = mkstemp(path);
+	if (spill->fd == -1) {
+		free(spill);
+		return NULL;
+	}
+	/* nobody else gets to see it, and it's gone when we're done */
+	unlink(path);
+
+	atomic_init(&spill->refs, 1);
+	pthread_mutex_init(&spill->lock, NULL);
+	spill->region_size = FY_SPILL_REGION_MIN;
+
+	return spill;
+}
+
+struct fy_spill *fy_spill_ref(struct fy_spill *spill)
+{
+	if (!spill)
+		return NULL;
+
+	assert(spill->refs + 1 > 0);
+	atomic_fetch_add(&spill->refs, 1);
+
+	return spill;
+}
+
+void fy_spill_unref(struct fy_spill *spill)
+{
+	unsigned int i;
+
+	if (!spill)
+		return;
+
+	assert(spill->refs > 0);
+
+	if (atomic_fetch_sub(&spill->refs, 1) != 1)
+		return;
+
+	for (i = 0; i < spill->region_count; i++)
+		munmap(spill->regions[i].addr, spill->regions[i].size);
+	free(spill->regions);
+	close(spill->fd);
+	pthread_mutex_destroy(&spill->lock);
+	free(spill);
+}
+
+static int fy_spill_grow(struct fy_spill *spill, size_t size)
+{
+	struct fy_spill_region *regions;
+	size_t page_size, region_size;
+	unsigned int alloc;
+	void *addr;
+
+	if (spill->region_count >= spill->region_alloc) {
+		alloc = spill->region_alloc ? spill->region_alloc * 2 : 16;
+		regions = realloc(spill->regions, sizeof(*regions) * alloc);
+		if (!regions)
+			return -1;
+		spill->regions = regions;
+		spill->region_alloc = alloc;
+	}
+
+	page_size = sysconf(_SC_PAGESIZE);
+	region_size = spill->region_size;
+	if (region_size < size)
+		region_size = (size + page_size - 1) & ~(page_size - 1);
+
+	/* the blocks are reserved now, not at the first write to the page */
+	if (posix_fallocate(spill->fd, spill->file_size, region_size))
+		return -1;
+
+	addr = mmap(NULL, region_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		    spill->fd, spill->file_size);
+	if (addr == MAP_FAILED)
+		return -1;
+
+	spill->regions[spill->region_count].addr = addr;
+	spill->regions[spill->region_count].size = region_size;
+	spill->region_count++;
+	spill->file_size += region_size;
+	spill->mapped += region_size;
+
+	/* what's left of the previous region is lost */
+	spill->cur = addr;
+	spill->left = region_size;
+
+	if (spill->region_size < FY_SPILL_REGION_MAX)
+		spill->region_size <<= 1;
+
+	return 0;
+}
+
+void *fy_spill_alloc(struct fy_spill *spill, size_t size)
+{
+	void *ptr;
+
+	if (!spill || !size)
+		return NULL;
+
+	size = (size + FY_SPILL_ALIGN - 1) & ~(size_t)(FY_SPILL_ALIGN - 1);
+
+	if (spill->left < size && fy_spill_grow(spill, size))
+		return NULL;
+
+	ptr = spill->cur;
+	spill->cur += size;
+	spill->left -= size;
+
+	return ptr;
+}
+
+void *fy_spill_obj_alloc(struct fy_spill *spill, size_t size)
+{
+	void *ptr;
+
+	if (!spill)
+		return NULL;
+
+	pthread_mutex_lock(&spill->lock);
+
+	if (!spill->pool.size) {
+		fy_tpool_init(&spill->pool, NULL, size);
+		spill->pool.spill = spill;
+	}
+	assert(spill->pool.size >= size);
+
+	ptr = fy_tpool_alloc(&spill->pool);
+
+	pthread_mutex_unlock(&spill->lock);
+
+	return ptr;
+}
+
+void fy_spill_obj_free(struct fy_spill *spill, void *ptr)
+{
+	if (!spill || !ptr)
+		return;
+
+	pthread_mutex_lock(&spill->lock);
+	fy_tpool_free(&spill->pool, ptr);
+	pthread_mutex_unlock(&spill->lock);
+}
@@ -0,0 +1,65 @@
+/*
+ * fy-spill.h - disk backed storage internal header file
+ *
+ * Copyright (c) 2019 Pantelis Antoniou <pantelis.antoniou@konsulko.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef FY_SPILL_H
+#define FY_SPILL_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include <libfyaml.h>
+
+#include "fy-talloc.h"
+
+/* the first region mapped, and the most a region grows to */
+#define FY_SPILL_REGION_MIN	(64 << 10)
+#define FY_SPILL_REGION_MAX	(64 << 20)
+
+struct fy_spill_region {
+	void *addr;
+	size_t size;
+};
+
+/*
+ * An unlinked temporary file, grown and mapped a region at a time.
+ * The memory carved out of it is backed by the file instead of swap,
+ * so the kernel is free to write cold pages back and drop them.
+ * Nothing is ever returned to the file; the objects of the pool are
+ * recycled, and everything goes away with the last reference.
+ */
+struct fy_spill {
+	atomic_int refs;
+	pthread_mutex_t lock;
+	int fd;
+	size_t file_size;
+	size_t region_size;		/* of the next region */
+	char *cur;			/* free space of the last region */
+	size_t left;
+	struct fy_spill_region *regions;
+	unsigned int region_count;
+	unsigned int region_alloc;
+	size_t mapped;			/* bytes of all regions */
+	struct fy_tpool pool;		/* objects shared between threads */
+};
+
+struct fy_spill *fy_spill_create(const char *dir);
+struct fy_spill *fy_spill_ref(struct fy_spill *spill);
+void fy_spill_unref(struct fy_spill *spill);
+
+/* not locked; a spill is either used by one thread or through its pool */
+void *fy_spill_alloc(struct fy_spill *spill, size_t size);
+
+/* objects of a single size, may be freed on another thread */
+void *fy_spill_obj_alloc(struct fy_spill *spill, size_t size);
+void fy_spill_obj_free(struct fy_spill *spill, void *ptr);
+
+#endif
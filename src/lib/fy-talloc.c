@@ -16,6 +16,7 @@
 #include <stdlib.h>
 
 #include "fy-talloc.h"
+#include "fy-spill.h"
 
 void *fy_talloc(struct fy_talloc_list *fytal, size_t size)
 {
@@ -113,3 +114,111 @@ int fy_same_tfree(void *ptr)
 	fyta = container_of(ptr, struct fy_talloc, data);
 	return fy_tfree(fyta->list, ptr);
 }
+
+#define FY_TPOOL_MIN_CHUNK	16
+
+void fy_tpool_init(struct fy_tpool *pool, struct fy_talloc_list *fytal, size_t size)
+{
+	memset(pool, 0, sizeof(*pool));
+	pool->fytal = fytal;
+	/* room for the free list link, keep pointer alignment */
+	if (size < sizeof(void *))
+		size = sizeof(void *);
+	pool->size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+	pool->chunk_count = FY_TPOOL_MIN_CHUNK;
+}
+
+void fy_tpool_init_indexed(struct fy_tpool *pool, struct fy_talloc_list *fytal, size_t size)
+{
+	/* the id and then the free list link */
+	if (size < 2 * sizeof(void *))
+		size = 2 * sizeof(void *);
+	fy_tpool_init(pool, fytal, size);
+	pool->indexed = true;
+}
+
+/* where the free list link of an object is */
+static inline void **fy_tpool_link(struct fy_tpool *pool, void *ptr)
+{
+	return pool->indexed ? (void **)ptr + 1 : (void **)ptr;
+}
+
+/* keep track of a new chunk of an indexed pool, numbering its objects */
+static int fy_tpool_add_chunk(struct fy_tpool *pool, char *chunk)
+{
+	char **chunks;
+	unsigned int alloc, i;
+	uint32_t id;
+
+	/* the ids run out after 2^32 - 1 objects */
+	if (pool->chunks_count >= (UINT32_MAX >> FY_TPOOL_CHUNK_SHIFT))
+		return -1;
+
+	if (pool->chunks_count >= pool->chunks_alloc) {
+		alloc = pool->chunks_alloc ? pool->chunks_alloc * 2 : 16;
+		chunks = fy_talloc(pool->fytal, sizeof(*chunks) * alloc);
+		if (!chunks)
+			return -1;
+		if (pool->chunks) {
+			memcpy(chunks, pool->chunks, sizeof(*chunks) * pool->chunks_count);
+			fy_tfree(pool->fytal, pool->chunks);
+		}
+		pool->chunks = chunks;
+		pool->chunks_alloc = alloc;
+	}
+
+	id = (pool->chunks_count << FY_TPOOL_CHUNK_SHIFT) + 1;
+	for (i = 0; i < pool->chunk_count; i++)
+		*(uint32_t *)(chunk + i * pool->size) = id + i;
+	pool->chunks[pool->chunks_count++] = chunk;
+
+	return 0;
+}
+
+void *fy_tpool_alloc(struct fy_tpool *pool)
+{
+	char *chunk;
+	void *ptr;
+	unsigned int i;
+
+	if (!pool->free_list) {
+		/* chunks grow with the pool, small documents stay small */
+		chunk = pool->spill ?
+			fy_spill_alloc(pool->spill, pool->size * pool->chunk_count) :
+			fy_talloc(pool->fytal, pool->size * pool->chunk_count);
+		if (!chunk)
+			return NULL;
+
+		/* chunks are only released with the whole pool */
+		if (pool->indexed && fy_tpool_add_chunk(pool, chunk))
+			return NULL;
+
+		pool->reserved += pool->size * pool->chunk_count;
+
+		for (i = pool->chunk_count; i > 0; i--) {
+			ptr = chunk + (i - 1) * pool->size;
+			*fy_tpool_link(pool, ptr) = pool->free_list;
+			pool->free_list = ptr;
+		}
+
+		if (pool->chunk_count < FY_TPOOL_MAX_CHUNK)
+			pool->chunk_count <<= 1;
+	}
+
+	ptr = pool->free_list;
+	pool->free_list = *fy_tpool_link(pool, ptr);
+	pool->used++;
+
+	return ptr;
+}
+
+void fy_tpool_free(struct fy_tpool *pool, void *ptr)
+{
+	if (!ptr)
+		return;
+
+	assert(pool->used > 0);
+	*fy_tpool_link(pool, ptr) = pool->free_list;
+	pool->free_list = ptr;
+	pool->used--;
+}
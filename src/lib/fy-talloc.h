@@ -41,4 +41,51 @@ int fy_talloc_move(struct fy_talloc_list *to_fytal,
 void *fy_same_talloc(void *ptr, size_t size);
 int fy_same_tfree(void *ptr);
 
+struct fy_spill;
+
+/* objects in the largest chunk; a chunk never holds more */
+#define FY_TPOOL_CHUNK_SHIFT	12
+#define FY_TPOOL_MAX_CHUNK	(1U << FY_TPOOL_CHUNK_SHIFT)
+
+/*
+ * Pool of fixed size objects carved out of tracked chunks.
+ *
+ * The objects of an indexed pool are also known by a 32-bit id, the
+ * chunk number and the slot in it, plus one so that 0 is none. The id
+ * is kept in the first word of the object for as long as it lives, so
+ * the free list of an indexed pool is linked through the second.
+ */
+struct fy_tpool {
+	struct fy_talloc_list *fytal;	/* chunks are freed along with it */
+	struct fy_spill *spill;		/* or come out of it, if set */
+	size_t size;
+	unsigned int chunk_count;	/* objects in the next chunk */
+	void *free_list;
+	size_t used;			/* objects in use */
+	size_t reserved;		/* bytes in chunks */
+	bool indexed;
+	char **chunks;			/* indexed: the chunks, by number */
+	unsigned int chunks_count;
+	unsigned int chunks_alloc;
+};
+
+void fy_tpool_init(struct fy_tpool *pool, struct fy_talloc_list *fytal, size_t size);
+void fy_tpool_init_indexed(struct fy_tpool *pool, struct fy_talloc_list *fytal, size_t size);
+void *fy_tpool_alloc(struct fy_tpool *pool);
+void fy_tpool_free(struct fy_tpool *pool, void *ptr);
+
+/* the id of an object of an indexed pool */
+static inline uint32_t fy_tpool_id(const void *ptr)
+{
+	return ptr ? *(const uint32_t *)ptr : 0;
+}
+
+static inline void *fy_tpool_ptr(const struct fy_tpool *pool, uint32_t id)
+{
+	if (!id--)
+		return NULL;
+	return pool->chunks[id >> FY_TPOOL_CHUNK_SHIFT] +
+	       (size_t)(id & (FY_TPOOL_MAX_CHUNK - 1)) * pool->size;
+}
+
 #endif
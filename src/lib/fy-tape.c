@@ -0,0 +1,907 @@
+/*
+ * fy-tape.c - flat read-only document representation
+ *
+ * Copyright (c) 2019 Pantelis Antoniou <pantelis.antoniou@konsulko.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <alloca.h>
+
+#include <libfyaml.h>
+
+#include "fy-parse.h"
+#include "fy-doc.h"
+#include "fy-tape.h"
+
+#include "fy-utils.h"
+
+/* mappings with fewer pairs than this are searched linearly */
+#define FY_TAPE_INDEX_MIN	8
+
+static struct fy_tape_entry *fy_tape_entry_at(struct fy_tape *fytp, int pos)
+{
+	if (!fytp || pos < 0 || (unsigned int)pos >= fytp->count)
+		return NULL;
+	return &fytp->entries[pos];
+}
+
+static int fy_tape_append(struct fy_tape *fytp, enum fy_tape_entry_type type,
+			  enum fy_node_style style)
+{
+	struct fy_tape_entry *entries, *fyte;
+	unsigned int alloc;
+
+	if (fytp->count >= fytp->alloc) {
+		alloc = fytp->alloc ? fytp->alloc * 2 : 64;
+		entries = realloc(fytp->entries, alloc * sizeof(*entries));
+		if (!entries)
+			return -1;
+		fytp->entries = entries;
+		fytp->alloc = alloc;
+	}
+
+	fyte = &fytp->entries[fytp->count];
+	memset(fyte, 0, sizeof(*fyte));
+	fyte->type = type;
+	fyte->style = style;
+
+	return fytp->count++;
+}
+
+/* where a token starts in the input of the tape */
+static uint32_t fy_tape_token_pos(struct fy_tape *fytp, struct fy_token *fyt)
+{
+	if (!fyt || !fyt->handle.fyi)
+		return 0;
+
+	/* all the spans are in the input of the first token */
+	if (!fytp->fyi)
+		fytp->fyi = fy_input_ref(fyt->handle.fyi);
+
+	if (fyt->handle.fyi != fytp->fyi || fyt->handle.start_mark.input_pos > UINT32_MAX)
+		return 0;
+	return (uint32_t)fyt->handle.start_mark.input_pos;
+}
+
+/* record the text of a token as a span of the input, or copy it if it isn't there */
+static int fy_tape_set_text(struct fy_tape *fytp, int pos, struct fy_token *fyt)
+{
+	struct fy_tape_entry *fyte = &fytp->entries[pos];
+	const char *text, *start;
+	size_t len, size, alloc;
+	char *buf;
+
+	if (!fyt) {
+		fyte->flags |= FYTEF_EMPTY;
+		return 0;
+	}
+
+	fyte->pos = fy_tape_token_pos(fytp, fyt);
+
+	text = fy_token_get_text(fyt, &len);
+	if (!text || !len)
+		return 0;
+
+	if (len > UINT32_MAX)
+		return -1;
+
+	fyte->span.length = (uint32_t)len;
+
+	if (fyt->handle.fyi == fytp->fyi) {
+		start = fy_input_start(fytp->fyi);
+		size = fy_input_size(fytp->fyi);
+		if (text >= start && text + len <= start + size && size <= UINT32_MAX) {
+			fyte->span.offset = (uint32_t)(text - start);
+			return 0;
+		}
+	}
+
+	if (fytp->text_count + len > UINT32_MAX)
+		return -1;
+
+	if (fytp->text_count + len > fytp->text_alloc) {
+		alloc = fytp->text_alloc ? fytp->text_alloc : 256;
+		while (alloc < fytp->text_count + len)
+			alloc *= 2;
+		buf = realloc(fytp->text, alloc);
+		if (!buf)
+			return -1;
+		fytp->text = buf;
+		fytp->text_alloc = alloc;
+	}
+
+	memcpy(fytp->text + fytp->text_count, text, len);
+	fyte->span.offset = (uint32_t)fytp->text_count;
+	fyte->flags |= FYTEF_TEXT;
+	fytp->text_count += len;
+
+	return 0;
+}
+
+static const char *fy_tape_entry_text(struct fy_tape *fytp, struct fy_tape_entry *fyte)
+{
+	if (!fyte->span.length)
+		return "";
+	if (fyte->flags & FYTEF_TEXT)
+		return fytp->text + fyte->span.offset;
+	return (const char *)fy_input_start(fytp->fyi) + fyte->span.offset;
+}
+
+static bool fy_tape_key_match(struct fy_tape *fytp, int item, const char *key, size_t keylen)
+{
+	struct fy_tape_entry *fyte = &fytp->entries[item];
+
+	return fyte->type == FYTE_SCALAR && fyte->span.length == keylen &&
+	       !memcmp(fy_tape_entry_text(fytp, fyte), key, keylen);
+}
+
+static unsigned int fy_tape_index_size(unsigned int count)
+{
+	unsigned int size;
+
+	for (size = 16; size < count * 2; size <<= 1)
+		;
+	return size;
+}
+
+/*
+ * Index the scalar keys of a large mapping by the hash of their text;
+ * the first of any keys with the same text is the one found.
+ */
+static int fy_tape_index_mapping(struct fy_tape *fytp, int pos)
+{
+	struct fy_tape_entry *fyte = &fytp->entries[pos], *fyte_key;
+	const char *text;
+	unsigned int size, mask, p;
+	uint32_t *slots, *keys;
+	size_t alloc;
+	int item;
+
+	if (fyte->coll.count < FY_TAPE_INDEX_MIN)
+		return 0;
+
+	size = fy_tape_index_size(fyte->coll.count);
+	mask = size - 1;
+
+	if (fytp->keys_count + size > UINT32_MAX)
+		return -1;
+
+	if (fytp->keys_count + size > fytp->keys_alloc) {
+		alloc = fytp->keys_alloc ? fytp->keys_alloc : 256;
+		while (alloc < fytp->keys_count + size)
+			alloc *= 2;
+		keys = realloc(fytp->keys, alloc * sizeof(*keys));
+		if (!keys)
+			return -1;
+		fytp->keys = keys;
+		fytp->keys_alloc = alloc;
+	}
+
+	slots = fytp->keys + fytp->keys_count;
+	memset(slots, 0, size * sizeof(*slots));
+
+	for (item = fy_tape_iterate(fytp, pos, -1); item >= 0;
+			item = fy_tape_iterate(fytp, pos, item)) {
+
+		fyte_key = &fytp->entries[item];
+		if (fyte_key->type != FYTE_SCALAR)
+			continue;
+
+		text = fy_tape_entry_text(fytp, fyte_key);
+		for (p = fy_hash_bytes(FY_HASH_INIT, text, fyte_key->span.length) & mask; slots[p];
+				p = (p + 1) & mask) {
+			if (fy_tape_key_match(fytp, slots[p] - 1, text, fyte_key->span.length))
+				break;
+		}
+		if (!slots[p])
+			slots[p] = item + 1;
+	}
+
+	fyte->coll.index = fytp->keys_count + 1;
+	fytp->keys_count += size;
+
+	return 0;
+}
+
+static int fy_tape_set_props(struct fy_tape *fytp, int pos,
+			     struct fy_token *tag, struct fy_token *anchor)
+{
+	struct fy_tape_props *props;
+	unsigned int alloc;
+
+	if (!tag && !anchor)
+		return 0;
+
+	if (fytp->props_count >= fytp->props_alloc) {
+		alloc = fytp->props_alloc ? fytp->props_alloc * 2 : 16;
+		props = realloc(fytp->props, alloc * sizeof(*props));
+		if (!props)
+			return -1;
+		fytp->props = props;
+		fytp->props_alloc = alloc;
+	}
+
+	props = &fytp->props[fytp->props_count++];
+	props->tag = tag;
+	props->anchor = anchor;
+	fytp->entries[pos].props = fytp->props_count;
+
+	return 0;
+}
+
+static struct fy_tape_props *fy_tape_entry_props(struct fy_tape *fytp, struct fy_tape_entry *fyte)
+{
+	return fyte->props ? &fytp->props[fyte->props - 1] : NULL;
+}
+
+void fy_tape_destroy(struct fy_tape *fytp)
+{
+	unsigned int i;
+
+	if (!fytp)
+		return;
+
+	for (i = 0; i < fytp->props_count; i++) {
+		fy_token_unref(fytp->props[i].tag);
+		fy_token_unref(fytp->props[i].anchor);
+	}
+	fy_input_unref(fytp->fyi);
+	fy_document_state_unref(fytp->fyds);
+	free(fytp->keys);
+	free(fytp->text);
+	free(fytp->props);
+	free(fytp->entries);
+	free(fytp);
+}
+
+struct fy_tape *fy_parse_load_tape(struct fy_parser *fyp)
+{
+	struct fy_tape *fytp = NULL;
+	struct fy_eventp *fyep = NULL;
+	struct fy_event *fye;
+	struct fy_token *fyt_value;
+	struct fy_tape_entry *fyte;
+	struct fy_error_ctx ec;
+	unsigned int *stack = NULL, *new_stack, depth = 0, stack_alloc = 0;
+	enum fy_event_type etype;
+	enum fy_tape_entry_type type;
+	enum fy_node_style style;
+	bool done = false;
+	int pos, rc;
+
+	if (!fyp)
+		return NULL;
+
+	/* skip over the stream starts/ends up to the next document */
+	for (;;) {
+		fyep = fy_parse_private(fyp);
+		if (!fyep)
+			return NULL;
+
+		if (fyep->e.type == FYET_STREAM_START) {
+			fy_parse_eventp_recycle(fyp, fyep);
+			continue;
+		}
+
+		if (fyep->e.type == FYET_STREAM_END) {
+			fy_parse_eventp_recycle(fyp, fyep);
+			/* final STREAM_END? */
+			if (fyp->state == FYPS_END)
+				return NULL;
+			continue;
+		}
+		break;
+	}
+
+	fye = &fyep->e;
+
+	FY_ERROR_CHECK(fyp, fy_document_event_get_token(fye), &ec, FYEM_DOC,
+			fye->type == FYET_DOCUMENT_START,
+			err_bad_event);
+
+	fytp = malloc(sizeof(*fytp));
+	fy_error_check(fyp, fytp, err_out,
+			"malloc() failed");
+	memset(fytp, 0, sizeof(*fytp));
+
+	/* keep the document state, the tags need it */
+	fytp->fyds = fye->document_start.document_state;
+	fye->document_start.document_state = NULL;
+
+	fy_parse_eventp_recycle(fyp, fyep);
+	fyep = NULL;
+
+	/* a single pass over the events; the tokens move to the tape */
+	while (!done && (fyep = fy_parse_private(fyp)) != NULL) {
+		fye = &fyep->e;
+		etype = fye->type;
+
+		pos = -1;
+		switch (fye->type) {
+		case FYET_DOCUMENT_END:
+			FY_ERROR_CHECK(fyp, fy_document_event_get_token(fye), &ec, FYEM_DOC,
+					depth == 0, err_bad_event);
+			done = true;
+			break;
+
+		case FYET_SCALAR:
+			fyt_value = fye->scalar.value;
+			style = fyt_value ? fy_node_style_from_scalar_style(fyt_value->scalar.style) :
+					    FYNS_PLAIN;
+			pos = fy_tape_append(fytp, FYTE_SCALAR, style);
+			fy_error_check(fyp, pos >= 0, err_out,
+					"fy_tape_append() failed");
+
+			rc = fy_tape_set_text(fytp, pos, fyt_value);
+			fy_error_check(fyp, !rc, err_out,
+					"fy_tape_set_text() failed");
+
+			rc = fy_tape_set_props(fytp, pos, fye->scalar.tag, fye->scalar.anchor);
+			fy_error_check(fyp, !rc, err_out,
+					"fy_tape_set_props() failed");
+			fye->scalar.tag = NULL;
+			fye->scalar.anchor = NULL;
+			break;
+
+		case FYET_ALIAS:
+			pos = fy_tape_append(fytp, FYTE_ALIAS, FYNS_ALIAS);
+			fy_error_check(fyp, pos >= 0, err_out,
+					"fy_tape_append() failed");
+
+			rc = fy_tape_set_text(fytp, pos, fye->alias.anchor);
+			fy_error_check(fyp, !rc, err_out,
+					"fy_tape_set_text() failed");
+			break;
+
+		case FYET_SEQUENCE_START:
+			style = fye->sequence_start.sequence_start &&
+				fye->sequence_start.sequence_start->type == FYTT_FLOW_SEQUENCE_START ?
+					FYNS_FLOW : FYNS_BLOCK;
+			pos = fy_tape_append(fytp, FYTE_SEQUENCE_START, style);
+			fy_error_check(fyp, pos >= 0, err_out,
+					"fy_tape_append() failed");
+			fytp->entries[pos].pos = fy_tape_token_pos(fytp, fye->sequence_start.sequence_start);
+
+			rc = fy_tape_set_props(fytp, pos, fye->sequence_start.tag,
+					       fye->sequence_start.anchor);
+			fy_error_check(fyp, !rc, err_out,
+					"fy_tape_set_props() failed");
+			fye->sequence_start.tag = NULL;
+			fye->sequence_start.anchor = NULL;
+			break;
+
+		case FYET_MAPPING_START:
+			style = fye->mapping_start.mapping_start &&
+				fye->mapping_start.mapping_start->type == FYTT_FLOW_MAPPING_START ?
+					FYNS_FLOW : FYNS_BLOCK;
+			pos = fy_tape_append(fytp, FYTE_MAPPING_START, style);
+			fy_error_check(fyp, pos >= 0, err_out,
+					"fy_tape_append() failed");
+			fytp->entries[pos].pos = fy_tape_token_pos(fytp, fye->mapping_start.mapping_start);
+
+			rc = fy_tape_set_props(fytp, pos, fye->mapping_start.tag,
+					       fye->mapping_start.anchor);
+			fy_error_check(fyp, !rc, err_out,
+					"fy_tape_set_props() failed");
+			fye->mapping_start.tag = NULL;
+			fye->mapping_start.anchor = NULL;
+			break;
+
+		case FYET_SEQUENCE_END:
+		case FYET_MAPPING_END:
+			type = fye->type == FYET_SEQUENCE_END ? FYTE_SEQUENCE_END : FYTE_MAPPING_END;
+			FY_ERROR_CHECK(fyp, fy_document_event_get_token(fye), &ec, FYEM_DOC,
+					depth > 0 &&
+					fytp->entries[stack[depth - 1]].type == type - 1,
+					err_bad_event);
+
+			rc = fy_tape_append(fytp, type, FYNS_ANY);
+			fy_error_check(fyp, rc >= 0, err_out,
+					"fy_tape_append() failed");
+
+			fyte = &fytp->entries[stack[--depth]];
+			fyte->coll.skip = fytp->count;
+			/* keys and values were counted separately */
+			if (type == FYTE_MAPPING_END) {
+				fyte->coll.count /= 2;
+				rc = fy_tape_index_mapping(fytp, stack[depth]);
+				fy_error_check(fyp, !rc, err_out,
+						"fy_tape_index_mapping() failed");
+			}
+			break;
+
+		default:
+			FY_ERROR_CHECK(fyp, fy_document_event_get_token(fye), &ec, FYEM_DOC,
+					false, err_bad_event);
+			break;
+		}
+
+		fy_parse_eventp_recycle(fyp, fyep);
+		fyep = NULL;
+
+		/* a new node */
+		if (pos < 0)
+			continue;
+
+		if (depth > 0)
+			fytp->entries[stack[depth - 1]].coll.count++;
+
+		if (etype == FYET_SEQUENCE_START || etype == FYET_MAPPING_START) {
+			if (depth >= stack_alloc) {
+				stack_alloc = stack_alloc ? stack_alloc * 2 : 16;
+				new_stack = realloc(stack, stack_alloc * sizeof(*stack));
+				fy_error_check(fyp, new_stack, err_out,
+						"realloc() failed");
+				stack = new_stack;
+			}
+			stack[depth++] = pos;
+		}
+	}
+
+	FY_ERROR_CHECK(fyp, NULL, &ec, FYEM_DOC,
+			done, err_stream_end);
+
+	free(stack);
+
+	return fytp;
+
+err_out:
+	fy_parse_eventp_recycle(fyp, fyep);
+	fy_tape_destroy(fytp);
+	free(stack);
+	return NULL;
+
+err_bad_event:
+	fy_error_report(fyp, &ec, "bad event");
+	goto err_out;
+
+err_stream_end:
+	fy_error_report(fyp, &ec, "premature end of event stream");
+	goto err_out;
+}
+
+static const struct fy_parse_cfg tape_parse_default_cfg = {
+	.search_path = "",
+	.flags = FYPCF_QUIET | FYPCF_DEBUG_LEVEL_WARNING |
+		 FYPCF_DEBUG_DIAG_TYPE | FYPCF_COLOR_NONE,
+};
+
+struct fy_tape *fy_tape_build_from_string(const struct fy_parse_cfg *cfg, const char *str)
+{
+	struct fy_parser *fyp;
+	struct fy_tape *fytp = NULL;
+	int rc;
+
+	if (!str)
+		return NULL;
+
+	if (!cfg)
+		cfg = &tape_parse_default_cfg;
+
+	fyp = fy_parser_create(cfg);
+	if (!fyp)
+		return NULL;
+
+	rc = fy_parser_set_string(fyp, str);
+	if (!rc)
+		fytp = fy_parse_load_tape(fyp);
+
+	/* the tokens keep what they need of the input */
+	fy_parser_destroy(fyp);
+
+	return fytp;
+}
+
+int fy_tape_root(struct fy_tape *fytp)
+{
+	return fytp && fytp->count ? 0 : -1;
+}
+
+enum fy_node_type fy_tape_get_type(struct fy_tape *fytp, int pos)
+{
+	struct fy_tape_entry *fyte;
+
+	fyte = fy_tape_entry_at(fytp, pos);
+	if (!fyte)
+		return FYNT_SCALAR;
+
+	switch (fyte->type) {
+	case FYTE_SEQUENCE_START:
+		return FYNT_SEQUENCE;
+	case FYTE_MAPPING_START:
+		return FYNT_MAPPING;
+	default:
+		break;
+	}
+	return FYNT_SCALAR;
+}
+
+enum fy_node_style fy_tape_get_style(struct fy_tape *fytp, int pos)
+{
+	struct fy_tape_entry *fyte;
+
+	fyte = fy_tape_entry_at(fytp, pos);
+	return fyte ? fyte->style : FYNS_ANY;
+}
+
+const char *fy_tape_get_scalar(struct fy_tape *fytp, int pos, size_t *lenp)
+{
+	struct fy_tape_entry *fyte;
+
+	fyte = fy_tape_entry_at(fytp, pos);
+	if (!fyte || !lenp || (fyte->type != FYTE_SCALAR && fyte->type != FYTE_ALIAS))
+		return NULL;
+
+	*lenp = fyte->span.length;
+	return fy_tape_entry_text(fytp, fyte);
+}
+
+int fy_tape_skip(struct fy_tape *fytp, int pos)
+{
+	struct fy_tape_entry *fyte;
+
+	fyte = fy_tape_entry_at(fytp, pos);
+	if (!fyte)
+		return -1;
+
+	switch (fyte->type) {
+	case FYTE_SCALAR:
+	case FYTE_ALIAS:
+		return pos + 1;
+	case FYTE_SEQUENCE_START:
+	case FYTE_MAPPING_START:
+		return fyte->coll.skip;
+	default:
+		break;
+	}
+	return -1;
+}
+
+int fy_tape_item_count(struct fy_tape *fytp, int pos)
+{
+	struct fy_tape_entry *fyte;
+
+	fyte = fy_tape_entry_at(fytp, pos);
+	if (!fyte || (fyte->type != FYTE_SEQUENCE_START && fyte->type != FYTE_MAPPING_START))
+		return -1;
+
+	return fyte->coll.count;
+}
+
+int fy_tape_iterate(struct fy_tape *fytp, int pos, int prev)
+{
+	struct fy_tape_entry *fyte;
+	int next;
+
+	fyte = fy_tape_entry_at(fytp, pos);
+	if (!fyte || (fyte->type != FYTE_SEQUENCE_START && fyte->type != FYTE_MAPPING_START))
+		return -1;
+
+	if (prev < 0) {
+		next = pos + 1;
+	} else {
+		next = fy_tape_skip(fytp, prev);
+		/* step over the value */
+		if (next >= 0 && fyte->type == FYTE_MAPPING_START)
+			next = fy_tape_skip(fytp, next);
+	}
+
+	/* the end marker (or garbage) */
+	if (next <= pos || (unsigned int)next >= fyte->coll.skip - 1)
+		return -1;
+
+	return next;
+}
+
+int fy_tape_sequence_get_by_index(struct fy_tape *fytp, int pos, int index)
+{
+	struct fy_tape_entry *fyte;
+	int item;
+
+	fyte = fy_tape_entry_at(fytp, pos);
+	if (!fyte || fyte->type != FYTE_SEQUENCE_START)
+		return -1;
+
+	if (index < 0)
+		index += fyte->coll.count;
+	if (index < 0 || (unsigned int)index >= fyte->coll.count)
+		return -1;
+
+	for (item = fy_tape_iterate(fytp, pos, -1); item >= 0 && index > 0;
+			item = fy_tape_iterate(fytp, pos, item))
+		index--;
+
+	return item;
+}
+
+int fy_tape_mapping_lookup_by_string(struct fy_tape *fytp, int pos, const char *key)
+{
+	struct fy_tape_entry *fyte;
+	unsigned int mask, p;
+	uint32_t *slots;
+	size_t keylen;
+	int item;
+
+	fyte = fy_tape_entry_at(fytp, pos);
+	if (!fyte || fyte->type != FYTE_MAPPING_START || !key)
+		return -1;
+
+	keylen = strlen(key);
+
+	if (fyte->coll.index) {
+		slots = fytp->keys + fyte->coll.index - 1;
+		mask = fy_tape_index_size(fyte->coll.count) - 1;
+		for (p = fy_hash_bytes(FY_HASH_INIT, key, keylen) & mask; slots[p]; p = (p + 1) & mask) {
+			if (fy_tape_key_match(fytp, slots[p] - 1, key, keylen))
+				return fy_tape_skip(fytp, slots[p] - 1);
+		}
+		return -1;
+	}
+
+	for (item = fy_tape_iterate(fytp, pos, -1); item >= 0;
+			item = fy_tape_iterate(fytp, pos, item)) {
+		if (fy_tape_key_match(fytp, item, key, keylen))
+			return fy_tape_skip(fytp, item);
+	}
+
+	return -1;
+}
+
+int fy_tape_by_path(struct fy_tape *fytp, int pos, const char *path)
+{
+	char *keybuf;
+	int idx;
+
+	if (!fytp || !path)
+		return -1;
+
+	keybuf = alloca(strlen(path) + 1);
+	while (pos >= 0) {
+		/* skip all prefixed / */
+		while (*path == '/')
+			path++;
+
+		if (!*path)
+			break;
+
+		switch (fy_tape_get_type(fytp, pos)) {
+		case FYNT_SEQUENCE:
+			path = fy_path_parse_seq_index(path, &idx);
+			if (!path)
+				return -1;
+			pos = fy_tape_sequence_get_by_index(fytp, pos, idx);
+			break;
+
+		case FYNT_MAPPING:
+			path = fy_path_parse_map_key(path, keybuf);
+			if (!path)
+				return -1;
+			pos = fy_tape_mapping_lookup_by_string(fytp, pos, keybuf);
+			break;
+
+		default:
+			/* scalar can't match (it has no key) */
+			return -1;
+		}
+	}
+
+	return pos;
+}
+
+/* the state of turning a tape into a document */
+struct fy_tape_load {
+	struct fy_tape *fytp;
+	struct fy_document *fyd;
+	struct fy_mark mark;	/* runs over the input, the entries are in its order */
+};
+
+static void fy_tape_load_mark(struct fy_tape_load *ftl, uint32_t pos, struct fy_mark *fym)
+{
+	struct fy_mark *m = &ftl->mark;
+	const char *s, *e;
+
+	/* the marks are counted up to pos, once */
+	if (ftl->fytp->fyi && pos > m->input_pos && pos <= fy_input_size(ftl->fytp->fyi)) {
+		s = (const char *)fy_input_start(ftl->fytp->fyi) + m->input_pos;
+		for (e = s + (pos - m->input_pos); s < e; s++) {
+			if (*s == '\n') {
+				m->line++;
+				m->column = 0;
+			} else if ((*s & 0xc0) != 0x80)
+				m->column++;
+		}
+		m->input_pos = pos;
+	}
+	*fym = *m;
+}
+
+static struct fy_token *fy_tape_load_token(struct fy_tape_load *ftl, struct fy_tape_entry *fyte)
+{
+	struct fy_tape *fytp = ftl->fytp;
+	struct fy_parser *fyp = ftl->fyd->fyp;
+	bool alias = fyte->type == FYTE_ALIAS;
+	struct fy_atom handle;
+	size_t len;
+	char *buf;
+
+	len = fyte->span.length;
+	if (fyte->flags & FYTEF_TEXT) {
+		/* the tape may go away before the document, which gets its own
+		 * copy; the text is final, so it is output verbatim */
+		buf = malloc(len);
+		if (!buf)
+			return NULL;
+		memcpy(buf, fytp->text + fyte->span.offset, len);
+		if (!fy_parse_input_from_malloc_data(fyp, buf, len, &handle, true))
+			return NULL;
+	} else {
+		memset(&handle, 0, sizeof(handle));
+		fy_tape_load_mark(ftl, fyte->span.offset, &handle.start_mark);
+		fy_tape_load_mark(ftl, fyte->span.offset + fyte->span.length, &handle.end_mark);
+		handle.storage_hint = len;
+		handle.direct_output = true;
+		handle.style = FYAS_PLAIN;
+		handle.chomp = FYAC_STRIP;
+		handle.fyi = fytp->fyi;
+	}
+
+	if (alias)
+		return fy_token_create(fyp, FYTT_ALIAS, &handle);
+
+	return fy_token_create(fyp, FYTT_SCALAR, &handle,
+			       fyte->style >= FYNS_PLAIN && fyte->style <= FYNS_FOLDED ?
+					FYSS_PLAIN + (fyte->style - FYNS_PLAIN) : FYSS_PLAIN);
+}
+
+static int fy_tape_load_node(struct fy_tape_load *ftl, int pos,
+			     struct fy_node *fyn_parent, struct fy_node **fynp)
+{
+	struct fy_tape *fytp = ftl->fytp;
+	struct fy_document *fyd = ftl->fyd;
+	struct fy_parser *fyp = fyd->fyp;
+	struct fy_tape_entry *fyte;
+	struct fy_tape_props *props;
+	struct fy_node *fyn, *fyn_item, *fyn_key;
+	struct fy_node_pair *fynpi;
+	struct fy_error_ctx ec;
+	struct fy_mark key_mark;
+	bool duplicate;
+	int item, rc;
+
+	*fynp = NULL;
+
+	fyte = fy_tape_entry_at(fytp, pos);
+	if (!fyte)
+		return -1;
+
+	fyn = fy_node_alloc(fyd, fy_tape_get_type(fytp, pos));
+	if (!fyn)
+		return -1;
+	fyn->style = fyte->style;
+	fy_node_set_parent(fyn, fyn_parent);
+
+	props = fy_tape_entry_props(fytp, fyte);
+	if (props) {
+		fyn->tag = fy_token_ref(props->tag);
+		if (props->anchor) {
+			rc = fy_parse_document_register_anchor(fyp, fyd, fyn, props->anchor);
+			if (rc)
+				goto err_out;
+		}
+	}
+
+	switch (fyte->type) {
+	case FYTE_SCALAR:
+	case FYTE_ALIAS:
+		/* empty scalars might not have a token */
+		if (fyte->flags & FYTEF_EMPTY)
+			break;
+		fyn->scalar = fy_tape_load_token(ftl, fyte);
+		if (!fyn->scalar)
+			goto err_out;
+		break;
+
+	case FYTE_SEQUENCE_START:
+		for (item = fy_tape_iterate(fytp, pos, -1); item >= 0;
+				item = fy_tape_iterate(fytp, pos, item)) {
+			rc = fy_tape_load_node(ftl, item, fyn, &fyn_item);
+			if (rc)
+				goto err_out;
+			fy_node_list_add_tail(&fyn->sequence, fyn_item);
+		}
+		break;
+
+	case FYTE_MAPPING_START:
+		for (item = fy_tape_iterate(fytp, pos, -1); item >= 0;
+				item = fy_tape_iterate(fytp, pos, item)) {
+			fy_tape_load_mark(ftl, fytp->entries[item].pos, &key_mark);
+
+			/* the parent of the key is always NULL */
+			rc = fy_tape_load_node(ftl, item, NULL, &fyn_key);
+			if (rc)
+				goto err_out;
+
+			/* the same check as when loading a document */
+			duplicate = fy_node_mapping_key_is_duplicate(fyn, fyn_key);
+
+			FY_ERROR_CHECK(fyp, NULL, &ec, FYEM_DOC,
+					!duplicate, err_duplicate_key);
+
+			fynpi = fy_node_pair_alloc(fyd);
+			if (!fynpi) {
+				fy_node_free(fyn_key);
+				goto err_out;
+			}
+			fy_node_pair_set_parent(fynpi, fyn);
+			fy_node_pair_list_add_tail(&fyn->mapping, fynpi);
+			fy_node_pair_link_key(fynpi, fyn_key);
+
+			rc = fy_tape_load_node(ftl, fy_tape_skip(fytp, item), fyn, &fyn_item);
+			if (rc)
+				goto err_out;
+			fynpi->value = fyn_item;
+		}
+		break;
+
+	default:
+		goto err_out;
+	}
+
+	*fynp = fyn;
+	return 0;
+
+err_out:
+	fy_node_free(fyn);
+	return -1;
+
+err_duplicate_key:
+	ec.start_mark = key_mark;
+	ec.end_mark = key_mark;
+	ec.fyi = fytp->fyi;
+	fy_error_report(fyp, &ec, "duplicate key");
+	fy_node_free(fyn_key);
+	goto err_out;
+}
+
+struct fy_document *fy_tape_to_document(struct fy_tape *fytp)
+{
+	struct fy_tape_load ftl;
+	struct fy_document *fyd;
+	struct fy_node *fyn;
+	int rc;
+
+	if (!fytp)
+		return NULL;
+
+	fyd = fy_document_create(NULL);
+	if (!fyd)
+		return NULL;
+
+	/* the document state of the tape */
+	if (fytp->fyds) {
+		fy_document_state_unref(fyd->fyds);
+		fyd->fyds = fy_document_state_ref(fytp->fyds);
+	}
+
+	if (fytp->count) {
+		memset(&ftl, 0, sizeof(ftl));
+		ftl.fytp = fytp;
+		ftl.fyd = fyd;
+		rc = fy_tape_load_node(&ftl, 0, NULL, &fyn);
+		if (rc) {
+			fy_document_destroy(fyd);
+			return NULL;
+		}
+		fyd->root = fyn;
+	}
+
+	return fyd;
+}
@@ -0,0 +1,83 @@
+/*
+ * fy-tape.h - flat read-only document representation header file
+ *
+ * Copyright (c) 2019 Pantelis Antoniou <pantelis.antoniou@konsulko.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef FY_TAPE_H
+#define FY_TAPE_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <libfyaml.h>
+
+enum fy_tape_entry_type {
+	FYTE_SCALAR,
+	FYTE_ALIAS,
+	FYTE_SEQUENCE_START,
+	FYTE_SEQUENCE_END,
+	FYTE_MAPPING_START,
+	FYTE_MAPPING_END,
+};
+
+/* the text of the entry is in the tape's own buffer, not in the input */
+#define FYTEF_TEXT	0x01
+/* an empty scalar without a token */
+#define FYTEF_EMPTY	0x02
+
+/*
+ * Collections are bracketed by start/end entries with their contents
+ * (keys and values alternating for mappings) in between. The start
+ * entry records where the entry following the end one is, so whole
+ * subtrees are skipped without looking at them. Scalars and aliases
+ * are spans of the input; only text that had to be unescaped or
+ * folded is copied to the tape.
+ */
+struct fy_tape_entry {
+	uint8_t type;			/* enum fy_tape_entry_type */
+	int8_t style;			/* enum fy_node_style */
+	uint8_t flags;			/* FYTEF_* */
+	uint32_t props;			/* index in props + 1, 0 for none */
+	uint32_t pos;			/* start in the input */
+	union {
+		struct {
+			uint32_t skip;	/* index past the matching end */
+			uint32_t count;	/* number of items (or pairs) */
+			uint32_t index;	/* key index in keys + 1, 0 for none */
+		} coll;
+		struct {
+			uint32_t offset;	/* in the input, or in text */
+			uint32_t length;
+		} span;
+	};
+};
+
+struct fy_tape_props {
+	struct fy_token *tag;
+	struct fy_token *anchor;
+};
+
+struct fy_tape {
+	struct fy_document_state *fyds;
+	struct fy_input *fyi;		/* the input the spans are in */
+	struct fy_tape_entry *entries;
+	unsigned int count;
+	unsigned int alloc;
+	struct fy_tape_props *props;
+	unsigned int props_count;
+	unsigned int props_alloc;
+	char *text;			/* texts not verbatim in the input */
+	size_t text_count;
+	size_t text_alloc;
+	uint32_t *keys;			/* open addressing indices of large mappings */
+	size_t keys_count;
+	size_t keys_alloc;
+};
+
+#endif
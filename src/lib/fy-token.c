@@ -27,8 +27,49 @@
 #include "fy-utf8.h"
 
 #include "fy-token.h"
+#include "fy-spill.h"
 
-struct fy_token *fy_token_alloc(struct fy_document_state *fyds)
+struct fy_interned_tag *fy_interned_tag_create(const char *text, size_t len, int id)
+{
+	struct fy_interned_tag *fytag;
+
+	fytag = malloc(sizeof(*fytag) + len + 1);
+	if (!fytag)
+		return NULL;
+
+	INIT_LIST_HEAD(&fytag->node);
+	atomic_init(&fytag->refs, 1);
+	fytag->id = id;
+	fytag->len = len;
+	memcpy(fytag->text, text, len);
+	fytag->text[len] = '\0';
+
+	return fytag;
+}
+
+struct fy_interned_tag *fy_interned_tag_ref(struct fy_interned_tag *fytag)
+{
+	if (!fytag)
+		return NULL;
+
+	assert(fytag->refs + 1 > 0);
+	atomic_fetch_add(&fytag->refs, 1);
+
+	return fytag;
+}
+
+void fy_interned_tag_unref(struct fy_interned_tag *fytag)
+{
+	if (!fytag)
+		return;
+
+	assert(fytag->refs > 0);
+
+	if (atomic_fetch_sub(&fytag->refs, 1) == 1)
+		free(fytag);
+}
+
+struct fy_token *fy_token_alloc(struct fy_document_state *fyds, struct fy_spill *spill)
 {
 	struct fy_token *fyt;
 	unsigned int i;
@@ -36,12 +77,15 @@ struct fy_token *fy_token_alloc(struct fy_document_state *fyds)
 	if (!fyds)
 		return NULL;
 
-	fyt = malloc(sizeof(*fyt));
+	fyt = spill ? fy_spill_obj_alloc(spill, sizeof(*fyt)) : malloc(sizeof(*fyt));
 	if (!fyt)
 		return fyt;
 
 	memset(fyt, 0, sizeof(*fyt));
 
+	/* the file stays while there are tokens in it */
+	fyt->spill = fy_spill_ref(spill);
+
 	fyt->type = FYTT_NONE;
 	fyt->analyze_flags = 0;
 	fyt->text_len = 0;
@@ -51,13 +95,15 @@ struct fy_token *fy_token_alloc(struct fy_document_state *fyds)
 	for (i = 0; i < sizeof(fyt->comment)/sizeof(fyt->comment[0]); i++)
 		fyt->comment[i].fyi = NULL;
 
-	fyt->refs = 1;
+	atomic_init(&fyt->refs, 1);
 
 	return fyt;
 }
 
 void fy_token_free(struct fy_token *fyt)
 {
+	struct fy_spill *spill;
+
 	if (!fyt)
 		return;
 
@@ -66,6 +112,7 @@ void fy_token_free(struct fy_token *fyt)
 	switch (fyt->type) {
 	case FYTT_TAG:
 		fy_token_unref(fyt->tag.fyt_td);
+		fy_interned_tag_unref(fyt->tag.interned);
 		break;
 	default:
 		break;
@@ -74,7 +121,16 @@ void fy_token_free(struct fy_token *fyt)
 	if (fyt->text0)
 		free(fyt->text0);
 
-	free(fyt);
+	fy_input_unref(fyt->handle.fyi);
+
+	spill = fyt->spill;
+	if (!spill) {
+		free(fyt);
+		return;
+	}
+
+	fy_spill_obj_free(spill, fyt);
+	fy_spill_unref(spill);
 }
 
 struct fy_token *fy_token_ref(struct fy_token *fyt)
@@ -83,7 +139,7 @@ struct fy_token *fy_token_ref(struct fy_token *fyt)
 	if (!fyt)
 		return NULL;
 	assert(fyt->refs + 1 > 0);
-	fyt->refs++;
+	atomic_fetch_add(&fyt->refs, 1);
 
 	/* fy_notice(NULL, "%s: %p #%d", __func__, fyt, fyt->refs); */
 	
@@ -99,10 +155,8 @@ void fy_token_unref(struct fy_token *fyt)
 
 	/* fy_notice(NULL, "%s: %p #%d", __func__, fyt, fyt->refs); */
 
-	if (fyt->refs == 1)
+	if (atomic_fetch_sub(&fyt->refs, 1) == 1)
 		fy_token_free(fyt);
-	else
-		fyt->refs--;
 }
 
 void fy_token_list_unref_all(struct fy_token_list *fytl)
@@ -126,7 +180,7 @@ struct fy_token *fy_parse_token_alloc(struct fy_parser *fyp)
 	if (!fyp || !fyp->current_document_state)
 		return NULL;
 
-	return fy_token_alloc(fyp->current_document_state);
+	return fy_token_alloc(fyp->current_document_state, fyp->spill);
 }
 
 struct fy_token *fy_document_token_alloc(struct fy_document *fyd)
@@ -134,7 +188,7 @@ struct fy_token *fy_document_token_alloc(struct fy_document *fyd)
 	if (!fyd || !fyd->fyds)
 		return NULL;
 
-	return fy_token_alloc(fyd->fyds);
+	return fy_token_alloc(fyd->fyds, fyd->fyp ? fyd->fyp->spill : NULL);
 }
 
 void fy_parse_token_recycle(struct fy_parser *fyp, struct fy_token *fyt)
@@ -361,6 +415,8 @@ struct fy_token *fy_token_vcreate(struct fy_parser *fyp, enum fy_token_type type
 	fy_error_check(fyp, handle != NULL, err_out,
 			"illegal handle argument");
 	fyt->handle = *handle;
+	/* the token's text lives in the input */
+	fy_input_ref(fyt->handle.fyi);
 
 	switch (fyt->type) {
 	case FYTT_TAG_DIRECTIVE:
@@ -734,38 +790,51 @@ const char *fy_token_get_direct_output(struct fy_token *fyt, size_t *sizep)
 	return fy_atom_data(fya);
 }
 
-static void fy_token_prepare_text(struct fy_token *fyt)
+/*
+ * Format the zero terminated text of the token. Readers of a shared
+ * document may race to do so; the first one in wins and the rest
+ * use its copy.
+ */
+static char *fy_token_prepare_text0(struct fy_token *fyt, size_t *lenp)
 {
+	char *text0, *expected = NULL;
+	const char *direct;
+	size_t len;
 	int ret;
 
 	assert(fyt);
 
-	/* get text length of this token */
-	ret = fy_token_format_text_length(fyt);
-
-	/* no text on this token? */
-	if (ret == -1) {
-		fyt->text_len = 0;
-		fyt->text = fyt->text0 = strdup("");
-		return;
+	/* direct output is the text as it is, formatting may alter it */
+	direct = fy_token_get_direct_output(fyt, &len);
+	if (direct) {
+		text0 = malloc(len + 1);
+		ret = (int)len;
+	} else {
+		/* get text length of this token */
+		ret = fy_token_format_text_length(fyt);
+		text0 = ret >= 0 ? malloc(ret + 1) : NULL;
 	}
 
-	fyt->text0 = malloc(ret + 1);
-	if (!fyt->text0) {
-		fyt->text_len = 0;
-		fyt->text = fyt->text0 = strdup("");
-		return;
+	if (text0) {
+		if (direct)
+			memcpy(text0, direct, len);
+		else
+			fy_token_format_text(fyt, text0, ret + 1);
+		text0[ret] = '\0';
+		*lenp = ret;
+	} else {
+		/* no text on this token (or no memory for it) */
+		text0 = strdup("");
+		*lenp = 0;
 	}
 
-	fyt->text0[0] = '\0';
-
-	fyt->text_len = ret;
-
-	fy_token_format_text(fyt, fyt->text0, ret + 1);
-	fyt->text0[ret] = '\0';
+	if (!atomic_compare_exchange_strong(&fyt->text0, &expected, text0)) {
+		free(text0);
+		text0 = expected;
+		*lenp = strlen(text0);
+	}
 
-	fyt->text_len = ret;
-	fyt->text = fyt->text0;
+	return text0;
 }
 
 const char *fy_token_get_text(struct fy_token *fyt, size_t *lenp)
@@ -782,10 +851,18 @@ const char *fy_token_get_text(struct fy_token *fyt, size_t *lenp)
 		return fyt->text;
 	}
 
+	/* interned tags share the resolved text */
+	if (fyt->type == FYTT_TAG && fyt->tag.interned) {
+		fyt->text = fyt->tag.interned->text;
+		fyt->text_len = fyt->tag.interned->len;
+		*lenp = fyt->text_len;
+		return fyt->text;
+	}
+
 	/* try direct output first */
 	fyt->text = fy_token_get_direct_output(fyt, &fyt->text_len);
 	if (!fyt->text)
-		fy_token_prepare_text(fyt);
+		fyt->text = fy_token_prepare_text0(fyt, &fyt->text_len);
 
 	*lenp = fyt->text_len;
 	return fyt->text;
@@ -793,15 +870,31 @@ const char *fy_token_get_text(struct fy_token *fyt, size_t *lenp)
 
 const char *fy_token_get_text0(struct fy_token *fyt)
 {
+	const char *text0;
+	size_t len;
+
 	/* return empty */
 	if (!fyt)
 		return "";
 
+	/* interned tags are zero terminated too */
+	if (fyt->type == FYTT_TAG && fyt->tag.interned)
+		return fyt->tag.interned->text;
+
 	/* created text is always zero terminated */
-	if (!fyt->text0)
-		fy_token_prepare_text(fyt);
+	text0 = atomic_load(&fyt->text0);
+	if (text0)
+		return text0;
+
+	text0 = fy_token_prepare_text0(fyt, &len);
 
-	return fyt->text0;
+	/* the text of a shared token is already there */
+	if (!fyt->text) {
+		fyt->text_len = len;
+		fyt->text = text0;
+	}
+
+	return text0;
 }
 
 size_t fy_token_get_text_length(struct fy_token *fyt)
@@ -809,8 +902,12 @@ size_t fy_token_get_text_length(struct fy_token *fyt)
 	if (!fyt)
 		return 0;
 
+	/* interned tags share the resolved text */
+	if (fyt->type == FYTT_TAG && fyt->tag.interned)
+		return fyt->tag.interned->len;
+
 	if (!fyt->text)
-		fy_token_prepare_text(fyt);
+		fyt->text = fy_token_prepare_text0(fyt, &fyt->text_len);
 
 	return fyt->text_len;
 }
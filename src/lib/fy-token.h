@@ -16,12 +16,14 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 
 #include <libfyaml.h>
 
 struct fy_parser;
 struct fy_token;
 struct fy_document;
+struct fy_spill;
 
 enum fy_token_type {
 	/* non-content token types */
@@ -75,14 +77,32 @@ enum fy_comment_placement {
 	fycp_max,
 };
 
+/* resolved tag text, shared by all tag tokens resolving to it */
+struct fy_interned_tag {
+	struct list_head node;
+	struct fy_interned_tag *hash_next;	/* in its bucket of the state */
+	uint32_t hash;
+	atomic_int refs;
+	int id;			/* unique in the interning document state */
+	size_t len;
+	char text[];		/* always zero terminated */
+};
+FY_TYPE_FWD_DECL_LIST(interned_tag);
+FY_TYPE_DECL_LIST(interned_tag);
+
+struct fy_interned_tag *fy_interned_tag_create(const char *text, size_t len, int id);
+struct fy_interned_tag *fy_interned_tag_ref(struct fy_interned_tag *fytag);
+void fy_interned_tag_unref(struct fy_interned_tag *fytag);
+
 struct fy_token {
 	struct list_head node;
 	enum fy_token_type type;
-	int refs;		/* when on document, we switch to reference counting */
+	atomic_int refs;	/* when on document, we switch to reference counting */
 	int analyze_flags;	/* cache of the analysis flags */
 	size_t text_len;
 	const char *text;
-	char *text0;		/* this is allocated */
+	_Atomic(char *) text0;	/* this is allocated, once */
+	struct fy_spill *spill;	/* when it lives in one */
 	struct fy_atom handle;
 	struct fy_atom comment[fycp_max];
 	union  {
@@ -98,12 +118,13 @@ struct fy_token {
 			unsigned int handle_length;
 			unsigned int suffix_length;
 			struct fy_token *fyt_td;
+			struct fy_interned_tag *interned;	/* if resolved */
 		} tag;
 	};
 };
 FY_PARSE_TYPE_DECL(token);
 
-struct fy_token *fy_token_alloc(struct fy_document_state *fyds);
+struct fy_token *fy_token_alloc(struct fy_document_state *fyds, struct fy_spill *spill);
 void fy_token_free(struct fy_token *fyt);
 struct fy_token *fy_token_ref(struct fy_token *fyt);
 void fy_token_unref(struct fy_token *fyt);
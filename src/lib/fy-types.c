@@ -93,6 +93,10 @@ void fy_parse_eventp_recycle(struct fy_parser *fyp, struct fy_eventp *fyep)
 		break;
 	}
 
+	/* while parsing ahead, the parsing thread recycles */
+	if (fyp->ahead && fy_parse_ahead_recycle(fyp, fyep))
+		return;
+
 	fy_parse_eventp_recycle_simple(fyp, fyep);
 }
 
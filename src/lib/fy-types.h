@@ -98,12 +98,12 @@ struct __useless_struct_to_allow_semicolon
 struct fy_ ## _type *fy_parse_ ## _type ## _alloc_simple(struct fy_parser *fyp) \
 { \
 	return fy_ ## _type ## _alloc_simple_internal(&fyp->recycled_ ## _type, \
-			&fyp->tallocs); \
+			&fyp->type_tallocs); \
 } \
 \
 void fy_parse_ ## _type ## _vacuum(struct fy_parser *fyp) \
 { \
-	fy_ ## _type ## _vacuum_internal(&fyp->recycled_ ## _type, &fyp->tallocs); \
+	fy_ ## _type ## _vacuum_internal(&fyp->recycled_ ## _type, &fyp->type_tallocs); \
 } \
 \
 void fy_parse_ ## _type ## _list_recycle_all(struct fy_parser *fyp, struct fy_ ## _type ## _list *_l) \
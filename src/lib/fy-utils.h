@@ -14,9 +14,31 @@
 #endif
 
 #include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
 
 #if defined(__APPLE__) && (_POSIX_C_SOURCE < 200809L)
 FILE *open_memstream(char **ptr, size_t *sizeloc);
 #endif
 
+#if defined(__GNUC__)
+#define fy_prefetch(_p)	__builtin_prefetch(_p)
+#else
+#define fy_prefetch(_p)	do { } while (0)
+#endif
+
+#define FY_HASH_INIT	2166136261U
+
+/* FNV-1a, incremental (start with FY_HASH_INIT) */
+static inline uint32_t fy_hash_bytes(uint32_t hash, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+
+	while (len--) {
+		hash ^= *p++;
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
 #endif
@@ -0,0 +1,182 @@
+/*
+ * fy-walk.c - non-recursive node tree walker
+ *
+ * Copyright (c) 2019 Pantelis Antoniou <pantelis.antoniou@konsulko.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <stdlib.h>
+
+#include <libfyaml.h>
+
+#include "fy-parse.h"
+#include "fy-doc.h"
+#include "fy-walk.h"
+
+#include "fy-utils.h"
+
+static struct fy_walk_frame *
+fy_walk_push(struct fy_walk *fyw, struct fy_node *fyn, struct fy_node_pair *fynp, bool is_key)
+{
+	struct fy_walk_frame *frame;
+	int alloc;
+
+	if (fyw->depth >= fyw->alloc) {
+		alloc = fyw->alloc ? fyw->alloc * 2 : 16;
+		frame = realloc(fyw->stack, alloc * sizeof(*frame));
+		if (!frame)
+			return NULL;
+		fyw->stack = frame;
+		fyw->alloc = alloc;
+	}
+
+	frame = &fyw->stack[fyw->depth++];
+	memset(frame, 0, sizeof(*frame));
+	frame->fyn = fyn;
+	frame->fynp = fynp;
+	frame->is_key = is_key;
+
+	switch (fyn->type) {
+	case FYNT_SEQUENCE:
+		frame->next_item = fy_node_list_head(&fyn->sequence);
+		break;
+	case FYNT_MAPPING:
+		frame->next_pair = fy_node_pair_list_head(&fyn->mapping);
+		break;
+	default:
+		break;
+	}
+
+	return frame;
+}
+
+static const struct fy_walk_event *
+fy_walk_emit(struct fy_walk *fyw, struct fy_walk_frame *frame, enum fy_walk_event_type type)
+{
+	struct fy_walk_event *fywe = &fyw->event;
+
+	fywe->type = type;
+	fywe->fyn = frame->fyn;
+	fywe->fynp = frame->fynp;
+	fywe->is_key = frame->is_key;
+	fywe->depth = frame - fyw->stack;
+
+	return fywe;
+}
+
+struct fy_walk *fy_walk_begin(struct fy_node *fyn)
+{
+	struct fy_walk *fyw;
+
+	fyw = malloc(sizeof(*fyw));
+	if (!fyw)
+		return NULL;
+	memset(fyw, 0, sizeof(*fyw));
+
+	if (fyn && !fy_walk_push(fyw, fyn, NULL, false)) {
+		fy_walk_end(fyw);
+		return NULL;
+	}
+
+	return fyw;
+}
+
+void fy_walk_end(struct fy_walk *fyw)
+{
+	if (!fyw)
+		return;
+
+	free(fyw->stack);
+	free(fyw);
+}
+
+const struct fy_walk_event *fy_walk_next(struct fy_walk *fyw)
+{
+	struct fy_walk_frame *frame;
+	struct fy_node_pair *fynp;
+	struct fy_node *fyn_child;
+	bool is_key;
+
+	if (!fyw || !fyw->depth)
+		return NULL;
+
+	frame = &fyw->stack[fyw->depth - 1];
+	if (!frame->entered) {
+		frame->entered = true;
+		return fy_walk_emit(fyw, frame, FYWE_ENTER);
+	}
+
+	/* find the next (non-null) child of the current node */
+	fyn_child = NULL;
+	fynp = NULL;
+	is_key = false;
+	switch (frame->fyn->type) {
+	case FYNT_SEQUENCE:
+		while (!fyn_child && frame->next_item) {
+			fyn_child = frame->next_item;
+			frame->next_item = fy_node_next(&frame->fyn->sequence, fyn_child);
+			/* the next sibling is what we'll want after this subtree */
+			if (frame->next_item)
+				fy_prefetch(frame->next_item);
+		}
+		break;
+
+	case FYNT_MAPPING:
+		while (!fyn_child && frame->next_pair) {
+			fynp = frame->next_pair;
+			if (!frame->on_value) {
+				fyn_child = fynp->key;
+				is_key = true;
+				frame->on_value = true;
+			} else {
+				fyn_child = fynp->value;
+				is_key = false;
+				frame->on_value = false;
+				frame->next_pair = fy_node_pair_next(&frame->fyn->mapping, fynp);
+				if (frame->next_pair)
+					fy_prefetch(frame->next_pair);
+			}
+		}
+		break;
+
+	default:
+		break;
+	}
+
+	if (!fyn_child) {
+		/* the event is filled before the frame is gone */
+		fyw->depth--;
+		return fy_walk_emit(fyw, frame, FYWE_LEAVE);
+	}
+
+	/* the push may move the stack */
+	frame = fy_walk_push(fyw, fyn_child, fynp, is_key);
+	if (!frame)
+		return NULL;
+	frame->entered = true;
+
+	return fy_walk_emit(fyw, frame, FYWE_ENTER);
+}
+
+void fy_walk_skip_subtree(struct fy_walk *fyw)
+{
+	struct fy_walk_frame *frame;
+
+	if (!fyw || !fyw->depth)
+		return;
+
+	frame = &fyw->stack[fyw->depth - 1];
+	if (!frame->entered)
+		return;
+
+	/* no more children means leaving is next */
+	frame->next_item = NULL;
+	frame->next_pair = NULL;
+}
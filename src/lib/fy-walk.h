@@ -0,0 +1,38 @@
+/*
+ * fy-walk.h - non-recursive node tree walker header file
+ *
+ * Copyright (c) 2019 Pantelis Antoniou <pantelis.antoniou@konsulko.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef FY_WALK_H
+#define FY_WALK_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdbool.h>
+
+#include <libfyaml.h>
+
+struct fy_walk_frame {
+	struct fy_node *fyn;
+	struct fy_node_pair *fynp;	/* the pair of the node */
+	bool is_key : 1;
+	bool entered : 1;
+	bool on_value : 1;		/* the key of next_pair is done */
+	union {
+		struct fy_node *next_item;
+		struct fy_node_pair *next_pair;
+	};
+};
+
+struct fy_walk {
+	struct fy_walk_frame *stack;
+	int depth;			/* frames in use */
+	int alloc;
+	struct fy_walk_event event;
+};
+
+#endif
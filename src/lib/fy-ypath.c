@@ -0,0 +1,788 @@
+/*
+ * fy-ypath.c - compiled path queries
+ *
+ * Copyright (c) 2019 Pantelis Antoniou <pantelis.antoniou@konsulko.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <ctype.h>
+
+#include <libfyaml.h>
+
+#include "fy-parse.h"
+#include "fy-doc.h"
+#include "fy-ypath.h"
+
+struct fy_ypath_ctx {
+	struct fy_ypath *ypath;
+	fy_ypath_match_fn cb;
+	void *user;
+	int count;
+	bool stop;
+};
+
+/* streaming state of an open collection */
+struct fy_ypath_frame {
+	uint64_t states;
+	bool mapping;
+	bool want_key;		/* mapping: the next node is a key */
+	bool has_key;		/* mapping: the key of the next value is a scalar */
+	struct fy_token *key;
+	int index;		/* sequence: index of the next item */
+};
+
+void fy_ypath_destroy(struct fy_ypath *ypath)
+{
+	struct fy_ypath_step *step;
+	int i, j;
+
+	if (!ypath)
+		return;
+
+	for (i = 0; i < ypath->count; i++) {
+		step = &ypath->steps[i];
+		free(step->key);
+		for (j = 0; j < step->pred_count; j++) {
+			free(step->preds[j].key);
+			free(step->preds[j].value);
+		}
+		free(step->preds);
+	}
+	free(ypath->steps);
+	free(ypath);
+}
+
+/* a bare string up to one of the stop characters, or a quoted one */
+static const char *
+fy_ypath_parse_string(const char *s, const char *stop, bool empty_ok,
+		      char **strp, size_t *lenp)
+{
+	char *str, *d;
+	size_t len;
+	char q;
+
+	if (*s == '"' || *s == '\'') {
+		q = *s++;
+		str = malloc(strlen(s) + 1);
+		if (!str)
+			return NULL;
+		for (d = str; *s && *s != q; ) {
+			if (*s == '\\' && s[1])
+				s++;
+			*d++ = *s++;
+		}
+		if (*s != q) {
+			free(str);
+			return NULL;
+		}
+		s++;
+		*d = '\0';
+		len = d - str;
+	} else {
+		len = strcspn(s, stop);
+		if (!len && !empty_ok)
+			return NULL;
+		str = strndup(s, len);
+		if (!str)
+			return NULL;
+		s += len;
+	}
+
+	*strp = str;
+	*lenp = len;
+	return s;
+}
+
+static const char *fy_ypath_parse_int(const char *s, bool *hasp, int *valp)
+{
+	char *e;
+	long v;
+
+	*hasp = false;
+	if (!isdigit((unsigned char)*s) && !(*s == '-' && isdigit((unsigned char)s[1])))
+		return s;
+
+	v = strtol(s, &e, 10);
+	if (v < INT_MIN || v > INT_MAX)
+		return NULL;
+	*hasp = true;
+	*valp = (int)v;
+	return e;
+}
+
+/* [n], [start:end] or [*]; s points right after the opening bracket */
+static const char *fy_ypath_parse_range(const char *s, struct fy_ypath_step *step)
+{
+	if (*s == '*') {
+		step->type = FYYST_ANY;
+		s++;
+	} else {
+		s = fy_ypath_parse_int(s, &step->has_start, &step->start);
+		if (!s)
+			return NULL;
+		if (*s == ':') {
+			step->type = FYYST_SLICE;
+			s = fy_ypath_parse_int(s + 1, &step->has_end, &step->end);
+			if (!s)
+				return NULL;
+		} else {
+			if (!step->has_start)
+				return NULL;
+			step->type = FYYST_INDEX;
+		}
+	}
+	return *s == ']' ? s + 1 : NULL;
+}
+
+/* [key=value]; s points right after the opening bracket */
+static const char *fy_ypath_parse_pred(const char *s, struct fy_ypath_step *step)
+{
+	struct fy_ypath_pred *pred, *preds;
+
+	preds = realloc(step->preds, (step->pred_count + 1) * sizeof(*preds));
+	if (!preds)
+		return NULL;
+	step->preds = preds;
+	pred = &preds[step->pred_count];
+	memset(pred, 0, sizeof(*pred));
+	step->pred_count++;
+
+	s = fy_ypath_parse_string(s, "=]", false, &pred->key, &pred->key_len);
+	if (!s || *s != '=')
+		return NULL;
+	s = fy_ypath_parse_string(s + 1, "]", true, &pred->value, &pred->value_len);
+	if (!s || *s != ']')
+		return NULL;
+	return s + 1;
+}
+
+static bool fy_ypath_is_range(const char *s)
+{
+	return *s == '[' &&
+	       (isdigit((unsigned char)s[1]) || s[1] == '-' || s[1] == ':' || s[1] == '*');
+}
+
+struct fy_ypath *fy_ypath_compile(const char *expr)
+{
+	struct fy_ypath *ypath;
+	struct fy_ypath_step *step, *steps;
+	const char *s;
+	bool recursive = false;
+
+	if (!expr)
+		return NULL;
+
+	ypath = malloc(sizeof(*ypath));
+	if (!ypath)
+		return NULL;
+	memset(ypath, 0, sizeof(*ypath));
+
+	s = expr;
+	if (s[0] == '/') {
+		recursive = s[1] == '/';
+		s += recursive ? 2 : 1;
+	}
+
+	while (*s) {
+		if (ypath->count >= FY_YPATH_MAX_STEPS)
+			goto err_out;
+
+		steps = realloc(ypath->steps, (ypath->count + 1) * sizeof(*steps));
+		if (!steps)
+			goto err_out;
+		ypath->steps = steps;
+		step = &steps[ypath->count];
+		memset(step, 0, sizeof(*step));
+		ypath->count++;
+
+		step->recursive = recursive;
+
+		/* the selector; a lone predicate selects anything */
+		if (*s == '*') {
+			step->type = FYYST_ANY;
+			s++;
+		} else if (fy_ypath_is_range(s)) {
+			s = fy_ypath_parse_range(s + 1, step);
+		} else if (*s == '[') {
+			step->type = FYYST_ANY;
+		} else {
+			step->type = FYYST_KEY;
+			s = fy_ypath_parse_string(s, "/[", false, &step->key, &step->key_len);
+		}
+		if (!s)
+			goto err_out;
+
+		while (*s == '[' && !fy_ypath_is_range(s)) {
+			s = fy_ypath_parse_pred(s + 1, step);
+			if (!s)
+				goto err_out;
+		}
+
+		/* key[n] is shorthand for key/[n] */
+		if (fy_ypath_is_range(s)) {
+			recursive = false;
+			continue;
+		}
+
+		if (!*s)
+			break;
+		if (*s != '/')
+			goto err_out;
+		recursive = s[1] == '/';
+		s += recursive ? 2 : 1;
+	}
+
+	return ypath;
+
+err_out:
+	fy_ypath_destroy(ypath);
+	return NULL;
+}
+
+/* negative indexes need the item count of the sequence */
+static bool fy_ypath_step_needs_count(const struct fy_ypath_step *step)
+{
+	switch (step->type) {
+	case FYYST_INDEX:
+		return step->start < 0;
+	case FYYST_SLICE:
+		return (step->has_start && step->start < 0) ||
+		       (step->has_end && step->end < 0);
+	default:
+		break;
+	}
+	return false;
+}
+
+bool fy_ypath_states_need_count(const struct fy_ypath *ypath, uint64_t states)
+{
+	int i;
+
+	for (i = 0; i < ypath->count; i++) {
+		if ((states & FY_YPATH_BIT(i)) && fy_ypath_step_needs_count(&ypath->steps[i]))
+			return true;
+	}
+	return false;
+}
+
+static bool
+fy_ypath_step_selects(const struct fy_ypath_step *step, const char *key, size_t key_len,
+		      int index, int count)
+{
+	int start, end;
+
+	switch (step->type) {
+	case FYYST_ANY:
+		return true;
+
+	case FYYST_KEY:
+		return key && key_len == step->key_len && !memcmp(key, step->key, key_len);
+
+	case FYYST_INDEX:
+		if (index < 0)
+			return false;
+		start = step->start;
+		if (start < 0)
+			start += count;
+		return index == start;
+
+	case FYYST_SLICE:
+		if (index < 0)
+			return false;
+		start = step->has_start ? step->start : 0;
+		if (start < 0)
+			start += count;
+		if (index < start)
+			return false;
+		if (!step->has_end)
+			return true;
+		end = step->end;
+		if (end < 0)
+			end += count;
+		return index < end;
+	}
+	return false;
+}
+
+/* the scalar text of a node, NULL for anything else (including aliases) */
+const char *fy_ypath_node_text(struct fy_node *fyn, size_t *lenp)
+{
+	const char *text;
+
+	if (!fyn || fyn->type != FYNT_SCALAR || fyn->style == FYNS_ALIAS)
+		return NULL;
+
+	text = fy_node_get_scalar(fyn, lenp);
+	if (!text) {
+		*lenp = 0;
+		text = "";
+	}
+	return text;
+}
+
+bool fy_ypath_is_positional(const struct fy_ypath *ypath)
+{
+	const struct fy_ypath_step *step;
+	int i;
+
+	for (i = 0; i < ypath->count; i++) {
+		step = &ypath->steps[i];
+		if (step->type == FYYST_INDEX || step->type == FYYST_SLICE || step->pred_count)
+			return true;
+	}
+	return false;
+}
+
+static bool fy_ypath_preds_hold(const struct fy_ypath_step *step, struct fy_node *fyn)
+{
+	const struct fy_ypath_pred *pred;
+	struct fy_node_pair *fynp;
+	const char *text;
+	size_t len;
+	int i;
+
+	if (!fyn || fyn->type != FYNT_MAPPING)
+		return false;
+
+	for (i = 0; i < step->pred_count; i++) {
+		pred = &step->preds[i];
+		for (fynp = fy_node_pair_list_head(&fyn->mapping); fynp;
+		     fynp = fy_node_pair_next(&fyn->mapping, fynp)) {
+			text = fy_ypath_node_text(fynp->key, &len);
+			if (text && len == pred->key_len && !memcmp(text, pred->key, len))
+				break;
+		}
+		if (!fynp)
+			return false;
+		text = fy_ypath_node_text(fynp->value, &len);
+		if (!text || len != pred->value_len || memcmp(text, pred->value, len))
+			return false;
+	}
+	return true;
+}
+
+/*
+ * The states of a child given the states of its parent. Mapping values
+ * have a key (NULL when not a scalar) and an index of -1. Without the
+ * child node predicates can't be checked; the states are then assumed
+ * to match and *need_nodep is set.
+ */
+uint64_t
+fy_ypath_transition(const struct fy_ypath *ypath, uint64_t states,
+		    const char *key, size_t key_len, int index, int count,
+		    struct fy_node *fyn, bool *need_nodep)
+{
+	const struct fy_ypath_step *step;
+	uint64_t next = 0;
+	int i;
+
+	for (i = 0; i < ypath->count; i++) {
+		if (!(states & FY_YPATH_BIT(i)))
+			continue;
+		step = &ypath->steps[i];
+
+		/* recursive steps keep looking further down */
+		if (step->recursive)
+			next |= FY_YPATH_BIT(i);
+
+		if (!fy_ypath_step_selects(step, key, key_len, index, count))
+			continue;
+
+		if (step->pred_count) {
+			if (!fyn) {
+				*need_nodep = true;
+			} else if (!fy_ypath_preds_hold(step, fyn))
+				continue;
+		}
+		next |= FY_YPATH_BIT(i + 1);
+	}
+	return next;
+}
+
+static int fy_ypath_exec_node(struct fy_ypath_ctx *ctx, struct fy_node *fyn, uint64_t states)
+{
+	struct fy_ypath *ypath = ctx->ypath;
+	struct fy_node *fyni;
+	struct fy_node_pair *fynp;
+	const char *key;
+	size_t key_len = 0;
+	uint64_t next;
+	int index, count, rc;
+
+	if (states & FY_YPATH_BIT(ypath->count)) {
+		ctx->count++;
+		if (ctx->cb && ctx->cb(fyn, ctx->user)) {
+			ctx->stop = true;
+			return 0;
+		}
+		states &= ~FY_YPATH_BIT(ypath->count);
+	}
+
+	if (!states || !fyn)
+		return 0;
+
+	switch (fyn->type) {
+	case FYNT_SEQUENCE:
+		count = fy_ypath_states_need_count(ypath, states) ?
+				fy_node_sequence_item_count(fyn) : -1;
+		index = 0;
+		for (fyni = fy_node_list_head(&fyn->sequence); fyni && !ctx->stop;
+		     fyni = fy_node_next(&fyn->sequence, fyni), index++) {
+			next = fy_ypath_transition(ypath, states, NULL, 0, index, count, fyni, NULL);
+			if (!next)
+				continue;
+			rc = fy_ypath_exec_node(ctx, fyni, next);
+			if (rc)
+				return rc;
+		}
+		break;
+
+	case FYNT_MAPPING:
+		for (fynp = fy_node_pair_list_head(&fyn->mapping); fynp && !ctx->stop;
+		     fynp = fy_node_pair_next(&fyn->mapping, fynp)) {
+			if (!fynp->value)
+				continue;
+			key = fy_ypath_node_text(fynp->key, &key_len);
+			next = fy_ypath_transition(ypath, states, key, key_len, -1, -1,
+						   fynp->value, NULL);
+			if (!next)
+				continue;
+			rc = fy_ypath_exec_node(ctx, fynp->value, next);
+			if (rc)
+				return rc;
+		}
+		break;
+
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+int fy_ypath_exec(struct fy_ypath *ypath, struct fy_node *fyn,
+		  fy_ypath_match_fn cb, void *user)
+{
+	struct fy_ypath_ctx ctx;
+	int rc;
+
+	if (!ypath || !fyn)
+		return -1;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.ypath = ypath;
+	ctx.cb = cb;
+	ctx.user = user;
+
+	rc = fy_ypath_exec_node(&ctx, fyn, FY_YPATH_BIT(0));
+	if (rc)
+		return rc;
+
+	return ctx.count;
+}
+
+/* consume the events of the node starting with fyep */
+static int fy_ypath_skip_node(struct fy_parser *fyp, struct fy_eventp *fyep)
+{
+	int level = 0;
+
+	for (;;) {
+		switch (fyep->e.type) {
+		case FYET_SEQUENCE_START:
+		case FYET_MAPPING_START:
+			level++;
+			break;
+		case FYET_SEQUENCE_END:
+		case FYET_MAPPING_END:
+			level--;
+			break;
+		default:
+			break;
+		}
+		fy_parse_eventp_recycle(fyp, fyep);
+		if (level <= 0)
+			return 0;
+
+		fyep = fy_parse_private(fyp);
+		if (!fyep)
+			return -1;
+	}
+}
+
+/* load the node starting with fyep in a document of its own */
+static struct fy_document *
+fy_ypath_load_node(struct fy_parser *fyp, struct fy_document_state *fyds,
+		   struct fy_eventp *fyep)
+{
+	struct fy_document *fyd;
+	int rc;
+
+	fyd = fy_document_create(NULL);
+	if (!fyd) {
+		fy_parse_eventp_recycle(fyp, fyep);
+		return NULL;
+	}
+
+	/* the tags are resolved against the stream's document state */
+	if (fyds) {
+		fy_document_state_unref(fyd->fyds);
+		fyd->fyds = fy_document_state_ref(fyds);
+	}
+
+	rc = fy_parse_document_load_node(fyp, fyd, fyep, &fyd->root);
+	if (rc) {
+		fy_document_destroy(fyd);
+		return NULL;
+	}
+	fy_resolve_parent_node(fyd, fyd->root, NULL);
+
+	return fyd;
+}
+
+static void fy_ypath_frame_advance(struct fy_ypath_frame *f)
+{
+	if (!f->mapping) {
+		f->index++;
+		return;
+	}
+	fy_token_unref(f->key);
+	f->key = NULL;
+	f->has_key = false;
+	f->want_key = true;
+}
+
+/*
+ * Evaluate the query over the events of one document. Collections are
+ * followed event by event and subtrees no step can match are skipped
+ * without being loaded; only matches, and nodes whose children can't
+ * be selected without seeing all of them (predicates, negative
+ * indexes), are loaded and handed over to the tree evaluator.
+ */
+static int
+fy_ypath_stream_document(struct fy_ypath_ctx *ctx, struct fy_parser *fyp,
+			 struct fy_document_state *fyds)
+{
+	struct fy_ypath *ypath = ctx->ypath;
+	struct fy_ypath_frame *stack = NULL, *new_stack, *f;
+	struct fy_eventp *fyep;
+	struct fy_event *fye;
+	struct fy_document *fyd;
+	struct fy_error_ctx ec;
+	enum fy_event_type type;
+	const char *key;
+	size_t key_len;
+	uint64_t states;
+	bool need_node;
+	int depth = 0, alloc = 0, rc;
+
+	for (;;) {
+		fyep = fy_parse_private(fyp);
+		FY_ERROR_CHECK(fyp, NULL, &ec, FYEM_DOC,
+				fyep, err_stream_end);
+		fye = &fyep->e;
+		type = fye->type;
+
+		f = depth > 0 ? &stack[depth - 1] : NULL;
+
+		if (type == FYET_DOCUMENT_END) {
+			FY_ERROR_CHECK(fyp, fy_document_event_get_token(fye), &ec, FYEM_DOC,
+					!depth, err_bad_event);
+			fy_parse_eventp_recycle(fyp, fyep);
+			break;
+		}
+
+		if (type == FYET_SEQUENCE_END || type == FYET_MAPPING_END) {
+			FY_ERROR_CHECK(fyp, fy_document_event_get_token(fye), &ec, FYEM_DOC,
+					f, err_bad_event);
+			fy_parse_eventp_recycle(fyp, fyep);
+			fy_ypath_frame_advance(f);	/* drops a pending key */
+			if (--depth > 0)
+				fy_ypath_frame_advance(&stack[depth - 1]);
+			continue;
+		}
+
+		FY_ERROR_CHECK(fyp, fy_document_event_get_token(fye), &ec, FYEM_DOC,
+				type == FYET_ALIAS || type == FYET_SCALAR ||
+				type == FYET_SEQUENCE_START || type == FYET_MAPPING_START,
+				err_bad_event);
+
+		/* keys are only needed for their text */
+		if (f && f->mapping && f->want_key) {
+			f->want_key = false;
+			if (type == FYET_SCALAR) {
+				f->key = fye->scalar.value;
+				fye->scalar.value = NULL;
+				f->has_key = true;
+			}
+			rc = fy_ypath_skip_node(fyp, fyep);
+			fy_error_check(fyp, !rc, err_out,
+					"fy_ypath_skip_node() failed");
+			continue;
+		}
+
+		need_node = false;
+		key = NULL;
+		key_len = 0;
+		if (!f) {
+			states = FY_YPATH_BIT(0);
+		} else {
+			if (f->has_key) {
+				key = f->key ? fy_token_get_text(f->key, &key_len) : NULL;
+				if (!key) {
+					key = "";
+					key_len = 0;
+				}
+			}
+			/* negative indexes force a load of the parent, the count is not needed */
+			states = fy_ypath_transition(ypath, f->states, key, key_len,
+						     f->mapping ? -1 : f->index, 0,
+						     NULL, &need_node);
+		}
+
+		if (!states) {
+			rc = fy_ypath_skip_node(fyp, fyep);
+			fy_error_check(fyp, !rc, err_out,
+					"fy_ypath_skip_node() failed");
+			if (f)
+				fy_ypath_frame_advance(f);
+			continue;
+		}
+
+		if (need_node || (states & FY_YPATH_BIT(ypath->count)) ||
+		    (type == FYET_SEQUENCE_START && fy_ypath_states_need_count(ypath, states))) {
+			fyd = fy_ypath_load_node(fyp, fyds, fyep);
+			fy_error_check(fyp, fyd, err_out,
+					"fy_ypath_load_node() failed");
+
+			/* now the predicates can be checked */
+			if (need_node)
+				states = fy_ypath_transition(ypath, f->states, key, key_len,
+							     f->mapping ? -1 : f->index, 0,
+							     fyd->root, NULL);
+
+			rc = fy_ypath_exec_node(ctx, fyd->root, states);
+			fy_document_destroy(fyd);
+			fy_error_check(fyp, !rc, err_out,
+					"fy_ypath_exec_node() failed");
+
+			/* the rest of the stream is left unread */
+			if (ctx->stop)
+				goto out;
+
+			if (f)
+				fy_ypath_frame_advance(f);
+			continue;
+		}
+
+		if (type == FYET_SCALAR || type == FYET_ALIAS) {
+			fy_parse_eventp_recycle(fyp, fyep);
+			if (f)
+				fy_ypath_frame_advance(f);
+			continue;
+		}
+
+		/* follow the collection */
+		if (depth >= alloc) {
+			alloc = alloc ? alloc * 2 : 16;
+			new_stack = realloc(stack, alloc * sizeof(*stack));
+			fy_error_check(fyp, new_stack, err_out_recycle,
+					"realloc() failed");
+			stack = new_stack;
+		}
+		f = &stack[depth++];
+		memset(f, 0, sizeof(*f));
+		f->states = states;
+		f->mapping = type == FYET_MAPPING_START;
+		f->want_key = f->mapping;
+
+		fy_parse_eventp_recycle(fyp, fyep);
+	}
+
+out:
+	while (depth > 0)
+		fy_token_unref(stack[--depth].key);
+	free(stack);
+	return 0;
+
+err_out_recycle:
+	fy_parse_eventp_recycle(fyp, fyep);
+err_out:
+	while (depth > 0)
+		fy_token_unref(stack[--depth].key);
+	free(stack);
+	return -1;
+
+err_bad_event:
+	fy_parse_eventp_recycle(fyp, fyep);
+	fy_error_report(fyp, &ec, "bad event");
+	goto err_out;
+
+err_stream_end:
+	fy_error_report(fyp, &ec, "premature end of event stream");
+	goto err_out;
+}
+
+int fy_ypath_exec_parser(struct fy_ypath *ypath, struct fy_parser *fyp,
+			 fy_ypath_match_fn cb, void *user)
+{
+	struct fy_ypath_ctx ctx;
+	struct fy_eventp *fyep;
+	struct fy_document_state *fyds;
+	struct fy_error_ctx ec;
+	int rc;
+
+	if (!ypath || !fyp)
+		return -1;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.ypath = ypath;
+	ctx.cb = cb;
+	ctx.user = user;
+
+	while (!ctx.stop && (fyep = fy_parse_private(fyp)) != NULL) {
+
+		if (fyep->e.type == FYET_STREAM_START) {
+			fy_parse_eventp_recycle(fyp, fyep);
+			continue;
+		}
+
+		if (fyep->e.type == FYET_STREAM_END) {
+			fy_parse_eventp_recycle(fyp, fyep);
+			/* final STREAM_END? */
+			if (fyp->state == FYPS_END)
+				break;
+			continue;
+		}
+
+		FY_ERROR_CHECK(fyp, fy_document_event_get_token(&fyep->e), &ec, FYEM_DOC,
+				fyep->e.type == FYET_DOCUMENT_START,
+				err_bad_event);
+
+		fyds = fyep->e.document_start.document_state;
+		fyep->e.document_start.document_state = NULL;
+		fy_parse_eventp_recycle(fyp, fyep);
+
+		rc = fy_ypath_stream_document(&ctx, fyp, fyds);
+		fy_document_state_unref(fyds);
+		if (rc)
+			return -1;
+	}
+
+	if (fyp->stream_error)
+		return -1;
+
+	return ctx.count;
+
+err_bad_event:
+	fy_parse_eventp_recycle(fyp, fyep);
+	fy_error_report(fyp, &ec, "bad event");
+	return -1;
+}
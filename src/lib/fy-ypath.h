@@ -0,0 +1,72 @@
+/*
+ * fy-ypath.h - compiled path queries internal header file
+ *
+ * Copyright (c) 2019 Pantelis Antoniou <pantelis.antoniou@konsulko.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef FY_YPATH_H
+#define FY_YPATH_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <libfyaml.h>
+
+/* the match states of a query fit in a 64 bit mask */
+#define FY_YPATH_MAX_STEPS	63
+
+enum fy_ypath_step_type {
+	FYYST_KEY,		/* mapping value with the given key */
+	FYYST_ANY,		/* any mapping value or sequence item */
+	FYYST_INDEX,		/* sequence item by index */
+	FYYST_SLICE,		/* sequence items in [start, end) */
+};
+
+/* [key=value], the node is a mapping with a scalar value for the key */
+struct fy_ypath_pred {
+	char *key;
+	size_t key_len;
+	char *value;
+	size_t value_len;
+};
+
+struct fy_ypath_step {
+	enum fy_ypath_step_type type;
+	bool recursive;			/* preceded by //, selects at any depth */
+	bool has_start;
+	bool has_end;
+	int start;			/* index or slice bounds, negative from the end */
+	int end;
+	char *key;
+	size_t key_len;
+	struct fy_ypath_pred *preds;
+	int pred_count;
+};
+
+/*
+ * Evaluation tracks the set of steps each node has matched so far as a
+ * bit mask; bit i set means the first i steps have been matched. A node
+ * matches the whole query when bit count is set.
+ */
+struct fy_ypath {
+	struct fy_ypath_step *steps;
+	int count;
+};
+
+#define FY_YPATH_BIT(_i)	((uint64_t)1 << (_i))
+
+/* the steps of evaluation, for walks of their own */
+const char *fy_ypath_node_text(struct fy_node *fyn, size_t *lenp);
+bool fy_ypath_states_need_count(const struct fy_ypath *ypath, uint64_t states);
+uint64_t fy_ypath_transition(const struct fy_ypath *ypath, uint64_t states,
+			     const char *key, size_t key_len, int index, int count,
+			     struct fy_node *fyn, bool *need_nodep);
+/* whether a match depends on the siblings of a node (indexes, predicates) */
+bool fy_ypath_is_positional(const struct fy_ypath *ypath);
+
+#endif
@@ -36,12 +36,17 @@
 #define TO_DEFAULT			"/"
 #define FROM_DEFAULT			"/"
 #define TRIM_DEFAULT			"/"
+#define MEMORY_REPORT_DEFAULT		10
 
 #define OPT_DUMP			1000
 #define OPT_TESTSUITE			1001
 #define OPT_FILTER			1002
 #define OPT_JOIN			1003
 #define OPT_TOOL			1004
+#define OPT_STREAMING			1005
+#define OPT_AUTO_ANCHORS		1006
+#define OPT_EXPAND_ALIASES		1007
+#define OPT_MEMORY_REPORT		1008
 
 static struct option lopts[] = {
 	{"include",		required_argument,	0,	'I' },
@@ -62,6 +67,10 @@ static struct option lopts[] = {
 	{"join",		no_argument,		0,	OPT_JOIN },
 	{"to",			required_argument,	0,	'T' },
 	{"from",		required_argument,	0,	'F' },
+	{"streaming",		no_argument,		0,	OPT_STREAMING },
+	{"auto-anchors",	no_argument,		0,	OPT_AUTO_ANCHORS },
+	{"expand-aliases",	no_argument,		0,	OPT_EXPAND_ALIASES },
+	{"memory-report",	optional_argument,	0,	OPT_MEMORY_REPORT },
 	{"quiet",		no_argument,		0,	'q' },
 	{"help",		no_argument,		0,	'h' },
 	{"version",		no_argument,		0,	'v' },
@@ -102,6 +111,16 @@ static void display_usage(FILE *fp, char *progname, int tool_mode)
 	fprintf(fp, "\t--mode, -m <mode>        : Output mode can be one of original, block, flow, flow-oneline, json, json-tp, json-oneline"
 						" (default %s)\n",
 						MODE_DEFAULT);
+	fprintf(fp, "\t--streaming              : Low latency streaming; output each document"
+						" as soon as it's read\n");
+	fprintf(fp, "\t--auto-anchors           : Output repeated subtrees as aliases"
+						" to the first one\n");
+	fprintf(fp, "\t--expand-aliases         : Output aliases as copies of what they"
+						" refer to\n");
+	fprintf(fp, "\t--memory-report[=<n>]    : Instead of the documents, output the memory"
+						" they use and their <n> heaviest subtrees (valid for dump)"
+						" (default %d)\n",
+						MEMORY_REPORT_DEFAULT);
 	fprintf(fp, "\t--quiet, -q              : Quiet operation, do not "
 						"output messages (default %s)\n",
 						QUIET_DEFAULT ? "true" : "false");
@@ -251,6 +270,9 @@ static int do_output(struct fy_emitter *fye, enum fy_emitter_write_type type, co
 	const char *color = NULL;
 	const char *s, *e;
 
+	if (type == fyewt_flush)
+		return fflush(fp) ? -1 : 0;
+
 	s = str;
 	e = str + len;
 	if (du->colorize) {
@@ -327,6 +349,7 @@ static int do_output(struct fy_emitter *fye, enum fy_emitter_write_type type, co
 			color = NULL;
 			break;
 		case fyewt_terminating_zero:
+		case fyewt_flush:
 			color = NULL;
 			break;
 		case fyewt_plain_scalar_key:
@@ -534,6 +557,139 @@ void dump_testsuite_event(struct fy_parser *fyp, struct fy_event *fye, bool colo
 	fputs("\n", stdout);
 }
 
+struct memory_report_entry {
+	struct fy_node *fyn;
+	struct fy_memory_report r;
+};
+
+/* the heaviest subtrees, heaviest first */
+struct memory_report_top {
+	struct memory_report_entry *entries;
+	int count;
+	int max;
+};
+
+static void memory_report_add(struct fy_memory_report *to, const struct fy_memory_report *from)
+{
+	to->nodes += from->nodes;
+	to->pairs += from->pairs;
+	to->tokens += from->tokens;
+	to->text += from->text;
+	to->shared += from->shared;
+	to->input += from->input;
+	to->total += from->total;
+	to->count += from->count;
+}
+
+static void memory_report_top_add(struct memory_report_top *top, struct fy_node *fyn,
+				  const struct fy_memory_report *r)
+{
+	struct memory_report_entry tmp;
+	int i;
+
+	if (top->count >= top->max) {
+		if (r->total <= top->entries[top->count - 1].r.total)
+			return;
+		top->count--;
+	}
+
+	i = top->count++;
+	top->entries[i].fyn = fyn;
+	top->entries[i].r = *r;
+
+	for (; i > 0 && top->entries[i].r.total > top->entries[i - 1].r.total; i--) {
+		tmp = top->entries[i];
+		top->entries[i] = top->entries[i - 1];
+		top->entries[i - 1] = tmp;
+	}
+}
+
+/* bottom up, every node once; keys are counted but not listed */
+static int memory_report_walk(struct fy_node *fyn, struct fy_memory_report *r,
+			      struct memory_report_top *top, bool listed)
+{
+	struct fy_memory_report rc;
+	struct fy_node *fyni;
+	struct fy_node_pair *fynp;
+	void *iter = NULL;
+
+	if (!fyn) {
+		memset(r, 0, sizeof(*r));
+		return 0;
+	}
+
+	if (fy_node_memory_usage_self(fyn, r))
+		return -1;
+
+	switch (fy_node_get_type(fyn)) {
+	case FYNT_SEQUENCE:
+		while ((fyni = fy_node_sequence_iterate(fyn, &iter)) != NULL) {
+			if (memory_report_walk(fyni, &rc, top, true))
+				return -1;
+			memory_report_add(r, &rc);
+		}
+		break;
+	case FYNT_MAPPING:
+		while ((fynp = fy_node_mapping_iterate(fyn, &iter)) != NULL) {
+			if (memory_report_walk(fy_node_pair_key(fynp), &rc, top, false))
+				return -1;
+			memory_report_add(r, &rc);
+			if (memory_report_walk(fy_node_pair_value(fynp), &rc, top, true))
+				return -1;
+			memory_report_add(r, &rc);
+		}
+		break;
+	default:
+		break;
+	}
+
+	if (listed)
+		memory_report_top_add(top, fyn, r);
+
+	return 0;
+}
+
+static void memory_report_print_line(FILE *fp, const struct fy_memory_report *r, const char *path)
+{
+	fprintf(fp, "%10zu %10zu %10zu %10zu %10zu %10zu %10zu %10zu  %s\n",
+			r->total, r->nodes, r->pairs, r->tokens, r->text,
+			r->shared, r->input, r->count, path);
+}
+
+static int memory_report(FILE *fp, struct fy_document *fyd, int idx, int max)
+{
+	struct memory_report_top top;
+	struct fy_memory_report r;
+	char *path;
+	int i, rc;
+
+	memset(&top, 0, sizeof(top));
+	top.max = max;
+	top.entries = malloc(sizeof(*top.entries) * max);
+	if (!top.entries)
+		return -1;
+
+	memset(&r, 0, sizeof(r));
+	rc = memory_report_walk(fy_document_root(fyd), &r, &top, false);
+	if (rc)
+		goto out;
+
+	fprintf(fp, "# document #%d: %zu bytes in %zu nodes\n", idx, r.total, r.count);
+	fprintf(fp, "%10s %10s %10s %10s %10s %10s %10s %10s  %s\n",
+			"total", "nodes", "pairs", "tokens", "text",
+			"shared", "input", "count", "path");
+	memory_report_print_line(fp, &r, "/");
+
+	for (i = 0; i < top.count; i++) {
+		path = fy_node_get_path(top.entries[i].fyn);
+		memory_report_print_line(fp, &top.entries[i].r, path ? path : "/");
+		free(path);
+	}
+out:
+	free(top.entries);
+	return rc;
+}
+
 static int set_parser_input(struct fy_parser *fyp, const char *what,
 		bool default_string)
 {
@@ -582,6 +738,7 @@ int main(int argc, char *argv[])
 	int tool_mode = OPT_TOOL;
 	struct fy_event *fyev;
 	bool join_resolve = RESOLVE_DEFAULT;
+	int memory_report_max = 0;
 
 	fy_valgrind_check(&argc, &argv);
 
@@ -703,6 +860,24 @@ int main(int argc, char *argv[])
 		case 'q':
 			cfg.flags |= FYPCF_QUIET;
 			break;
+		case OPT_STREAMING:
+			cfg.flags |= FYPCF_STREAM_LOW_LATENCY;
+			emit_flags |= FYECF_FLUSH_DOCUMENT;
+			break;
+		case OPT_AUTO_ANCHORS:
+			emit_flags |= FYECF_AUTO_ANCHORS;
+			break;
+		case OPT_EXPAND_ALIASES:
+			emit_flags |= FYECF_EXPAND_ALIASES;
+			break;
+		case OPT_MEMORY_REPORT:
+			memory_report_max = optarg ? atoi(optarg) : MEMORY_REPORT_DEFAULT;
+			if (memory_report_max <= 0) {
+				fprintf(stderr, "bad memory-report option %s\n", optarg);
+				display_usage(stderr, progname, tool_mode);
+				return EXIT_FAILURE;
+			}
+			break;
 		case 'f':
 			file = optarg;
 			break;
@@ -813,7 +988,10 @@ int main(int argc, char *argv[])
 
 			while ((fyd = fy_parse_load_document(fyp)) != NULL) {
 
-				rc = fy_emit_document(fye, fyd);
+				if (memory_report_max)
+					rc = memory_report(stdout, fyd, count, memory_report_max);
+				else
+					rc = fy_emit_document(fye, fyd);
 				if (rc)
 					goto cleanup;
 
@@ -910,24 +1088,22 @@ int main(int argc, char *argv[])
 				fyn_to = fy_node_by_path(fy_document_root(fyd_join), to);
 				if (!fyn_to) {
 					fprintf(stderr, "unable to find to=%s\n", to);
+					fy_parse_document_destroy(fyp, fyd);
 					goto cleanup;
 				}
 
 				fyn_from = fy_node_by_path(fy_document_root(fyd), from);
 				if (!fyn_from) {
 					fprintf(stderr, "unable to find from=%s\n", from);
+					fy_parse_document_destroy(fyp, fyd);
 					goto cleanup;
 				}
 
-				rc = fy_node_insert(fyn_to, fyn_from);
-				if (rc) {
-					fprintf(stderr, "fy_node_insert() failed\n");
-					goto cleanup;
-				}
-
-				rc = fy_document_set_parent(fyd_join, fyd);
+				/* move instead of copying, so the source can go */
+				rc = fy_node_insert_move(fyn_to, fyn_from);
+				fy_parse_document_destroy(fyp, fyd);
 				if (rc) {
-					fprintf(stderr, "fy_document_set_parent() failed\n");
+					fprintf(stderr, "fy_node_insert_move() failed\n");
 					goto cleanup;
 				}
 			}
@@ -0,0 +1,529 @@
+/*
+ * libfyaml-test-complexity.c - libfyaml algorithmic complexity test harness
+ *
+ * Copyright (c) 2019 Pantelis Antoniou <pantelis.antoniou@konsulko.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#include <time.h>
+
+#include <check.h>
+
+#include <libfyaml.h>
+
+/*
+ * Every input family is generated at increasing sizes, each operation
+ * is timed on it and the scaling exponent is fitted on a log-log scale.
+ * An operation fails when the fitted exponent is larger than the declared
+ * one by more than the tolerance, i.e. a linear operation that turns
+ * quadratic is caught, while timing noise is not.
+ *
+ * Wall clock times depend on the machine and its load, so the exponents
+ * are only checked when FY_TEST_COMPLEXITY is set in the environment
+ * (make check-complexity does that); otherwise every operation is still
+ * run (once) at every size.
+ */
+
+#define CX_STEPS	4	/* sizes: base, 2 * base, 4 * base, 8 * base */
+#define CX_REPEAT	3	/* best time of each measurement is used */
+#define CX_TOLERANCE	0.5
+#define CX_MIN_TIME	0.001	/* below this (at the largest size) it's all noise */
+#define CX_ENV		"FY_TEST_COMPLEXITY"
+
+enum cx_op {
+	CXO_SCAN,
+	CXO_LOAD,
+	CXO_LOOKUP,
+	CXO_RESOLVE,
+	CXO_EMIT,
+	CXO_JSON_PATCH,
+	CXO_MERGE_PATCH,
+	CXO_INSERT,
+	CXO_MAX,
+};
+
+static const char *cx_op_names[CXO_MAX] = {
+	[CXO_SCAN]	= "scan",
+	[CXO_LOAD]	= "load",
+	[CXO_LOOKUP]	= "lookup",
+	[CXO_RESOLVE]	= "resolve",
+	[CXO_EMIT]	= "emit",
+	[CXO_JSON_PATCH] = "json-patch",
+	[CXO_MERGE_PATCH] = "merge-patch",
+	[CXO_INSERT]	= "insert",
+};
+
+struct cx_buf {
+	char *data;
+	size_t len;
+	size_t alloc;
+};
+
+static void cx_printf(struct cx_buf *b, const char *fmt, ...)
+		__attribute__((format(printf, 2, 3)));
+
+static void cx_printf(struct cx_buf *b, const char *fmt, ...)
+{
+	va_list ap;
+	int len;
+
+	for (;;) {
+		va_start(ap, fmt);
+		len = vsnprintf(b->data + b->len, b->alloc - b->len, fmt, ap);
+		va_end(ap);
+		ck_assert_int_ge(len, 0);
+
+		if (b->len + len < b->alloc)
+			break;
+
+		b->alloc = (b->alloc + len + 1) * 2;
+		b->data = realloc(b->data, b->alloc);
+		ck_assert_ptr_ne(b->data, NULL);
+	}
+	b->len += len;
+}
+
+static char *cx_gen_mapping(int n)
+{
+	struct cx_buf b = { NULL, 0, 0 };
+	int i;
+
+	for (i = 0; i < n; i++)
+		cx_printf(&b, "k%d: v%d\n", i, i);
+	return b.data;
+}
+
+static char *cx_gen_sequence(int n)
+{
+	struct cx_buf b = { NULL, 0, 0 };
+	int i;
+
+	for (i = 0; i < n; i++)
+		cx_printf(&b, "- v%d\n", i);
+	return b.data;
+}
+
+static char *cx_gen_anchors(int n)
+{
+	struct cx_buf b = { NULL, 0, 0 };
+	int i;
+
+	for (i = 0; i < n; i++)
+		cx_printf(&b, "- &a%d v%d\n- *a%d\n", i, i, i);
+	return b.data;
+}
+
+static char *cx_gen_nested(int n)
+{
+	struct cx_buf b = { NULL, 0, 0 };
+	int i;
+
+	for (i = 0; i < n; i++)
+		cx_printf(&b, "[");
+	cx_printf(&b, "x");
+	for (i = 0; i < n; i++)
+		cx_printf(&b, "]");
+	cx_printf(&b, "\n");
+	return b.data;
+}
+
+static char *cx_gen_long_scalar(int n)
+{
+	struct cx_buf b = { NULL, 0, 0 };
+	int i;
+
+	cx_printf(&b, "key: \"");
+	for (i = 0; i < n; i++)
+		cx_printf(&b, "word%d \\t ", i);
+	cx_printf(&b, "\"\n");
+	return b.data;
+}
+
+/* replace every value */
+static char *cx_gen_mapping_json_patch(int n)
+{
+	struct cx_buf b = { NULL, 0, 0 };
+	int i;
+
+	for (i = 0; i < n; i++)
+		cx_printf(&b, "- { op: replace, path: /k%d, value: w%d }\n", i, i);
+	return b.data;
+}
+
+static char *cx_gen_mapping_merge_patch(int n)
+{
+	struct cx_buf b = { NULL, 0, 0 };
+	int i;
+
+	for (i = 0; i < n; i++)
+		cx_printf(&b, "k%d: w%d\n", i, i);
+	return b.data;
+}
+
+/* append as many items */
+static char *cx_gen_sequence_json_patch(int n)
+{
+	struct cx_buf b = { NULL, 0, 0 };
+	int i;
+
+	for (i = 0; i < n; i++)
+		cx_printf(&b, "- { op: add, path: /-, value: w%d }\n", i);
+	return b.data;
+}
+
+static void cx_lookup_mapping(struct fy_document *fyd, int n)
+{
+	char key[32];
+	int i;
+
+	for (i = 0; i < n; i++) {
+		snprintf(key, sizeof(key), "k%d", i);
+		ck_assert_ptr_ne(fy_node_mapping_lookup_by_string(fy_document_root(fyd), key), NULL);
+	}
+}
+
+static void cx_lookup_sequence(struct fy_document *fyd, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		ck_assert_ptr_ne(fy_node_sequence_get_by_index(fy_document_root(fyd), i), NULL);
+}
+
+static void cx_lookup_anchors(struct fy_document *fyd, int n)
+{
+	char anchor[32];
+	int i;
+
+	for (i = 0; i < n; i++) {
+		snprintf(anchor, sizeof(anchor), "a%d", i);
+		ck_assert_ptr_ne(fy_document_lookup_anchor(fyd, anchor), NULL);
+	}
+}
+
+static void cx_lookup_nested(struct fy_document *fyd, int n)
+{
+	struct cx_buf b = { NULL, 0, 0 };
+	int i;
+
+	for (i = 0; i < n; i++)
+		cx_printf(&b, "/[0]");
+	ck_assert_ptr_ne(fy_node_by_path(fy_document_root(fyd), b.data), NULL);
+	free(b.data);
+}
+
+struct cx_family {
+	const char *name;
+	int base;
+	char *(*gen)(int n);
+	void (*lookup)(struct fy_document *fyd, int n);
+	char *(*gen_json_patch)(int n);
+	char *(*gen_merge_patch)(int n);
+	char *(*gen_insert)(int n);	/* inserted into the root */
+	double order[CXO_MAX];	/* declared exponent, 0 means not applicable */
+};
+
+static const struct cx_family cx_families[] = {
+	{
+		.name	= "wide-mapping",
+		.base	= 500,
+		.gen	= cx_gen_mapping,
+		.lookup	= cx_lookup_mapping,
+		.gen_json_patch = cx_gen_mapping_json_patch,
+		.gen_merge_patch = cx_gen_mapping_merge_patch,
+		.gen_insert = cx_gen_mapping_merge_patch,
+		.order	= {
+			[CXO_SCAN]	= 1,
+			[CXO_LOAD]	= 2,	/* linear duplicate key check */
+			[CXO_LOOKUP]	= 2,	/* linear key search, n lookups */
+			[CXO_RESOLVE]	= 1,
+			[CXO_EMIT]	= 1,
+			[CXO_JSON_PATCH] = 1,	/* hashed keys, n replaces */
+			[CXO_MERGE_PATCH] = 1,
+			[CXO_INSERT]	= 2,	/* linear key search, n updates */
+		},
+	}, {
+		.name	= "long-sequence",
+		.base	= 1000,
+		.gen	= cx_gen_sequence,
+		.lookup	= cx_lookup_sequence,
+		.gen_json_patch = cx_gen_sequence_json_patch,
+		.gen_insert = cx_gen_sequence,
+		.order	= {
+			[CXO_SCAN]	= 1,
+			[CXO_LOAD]	= 1,
+			[CXO_LOOKUP]	= 2,	/* list walk, n lookups */
+			[CXO_RESOLVE]	= 1,
+			[CXO_EMIT]	= 1,
+			[CXO_JSON_PATCH] = 1,	/* n appends */
+			[CXO_INSERT]	= 1,	/* n appends */
+		},
+	}, {
+		.name	= "many-anchors",
+		.base	= 500,
+		.gen	= cx_gen_anchors,
+		.lookup	= cx_lookup_anchors,
+		.order	= {
+			[CXO_SCAN]	= 1,
+			[CXO_LOAD]	= 2,	/* linear duplicate anchor check */
+			[CXO_LOOKUP]	= 2,	/* anchor list walk, n lookups */
+			[CXO_RESOLVE]	= 2,	/* anchor list walk per alias */
+			[CXO_EMIT]	= 2,	/* anchor list walk per node */
+		},
+	}, {
+		.name	= "deep-nesting",
+		.base	= 2000,	/* deep enough for the walks to be timed */
+		.gen	= cx_gen_nested,
+		.lookup	= cx_lookup_nested,
+		.order	= {
+			[CXO_SCAN]	= 1,
+			[CXO_LOAD]	= 1,
+			[CXO_LOOKUP]	= 1,
+			[CXO_RESOLVE]	= 1,
+			[CXO_EMIT]	= 2,	/* indentation, output is quadratic */
+		},
+	}, {
+		.name	= "long-scalar",
+		.base	= 4000,
+		.gen	= cx_gen_long_scalar,
+		.order	= {
+			[CXO_SCAN]	= 1,
+			[CXO_LOAD]	= 1,
+			[CXO_RESOLVE]	= 1,
+			[CXO_EMIT]	= 1,
+		},
+	},
+};
+
+static double cx_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void cx_measure(const struct cx_family *fam, int n, int repeat, double *t)
+{
+	static const struct fy_parse_cfg cfg = { .flags = FYPCF_QUIET };
+	struct fy_parser *fyp;
+	struct fy_event *fye;
+	struct fy_document *fyd, *fyd_json_patch = NULL, *fyd_merge_patch = NULL;
+	struct fy_document *fyd_insert = NULL;
+	char *text, *json_patch = NULL, *merge_patch = NULL, *insert = NULL, *out;
+	double t0, tt[CXO_MAX];
+	int i, j, rc;
+
+	text = fam->gen(n);
+	ck_assert_ptr_ne(text, NULL);
+
+	/* the patches are loaded once, outside of the measurements */
+	if (fam->gen_json_patch) {
+		json_patch = fam->gen_json_patch(n);
+		ck_assert_ptr_ne(json_patch, NULL);
+		fyd_json_patch = fy_document_build_from_string(&cfg, json_patch);
+		ck_assert_ptr_ne(fyd_json_patch, NULL);
+	}
+	if (fam->gen_merge_patch) {
+		merge_patch = fam->gen_merge_patch(n);
+		ck_assert_ptr_ne(merge_patch, NULL);
+		fyd_merge_patch = fy_document_build_from_string(&cfg, merge_patch);
+		ck_assert_ptr_ne(fyd_merge_patch, NULL);
+	}
+	if (fam->gen_insert) {
+		insert = fam->gen_insert(n);
+		ck_assert_ptr_ne(insert, NULL);
+		fyd_insert = fy_document_build_from_string(&cfg, insert);
+		ck_assert_ptr_ne(fyd_insert, NULL);
+	}
+
+	for (j = 0; j < CXO_MAX; j++)
+		t[j] = HUGE_VAL;
+
+	for (i = 0; i < repeat; i++) {
+		memset(tt, 0, sizeof(tt));
+
+		t0 = cx_now();
+		fyp = fy_parser_create(&cfg);
+		ck_assert_ptr_ne(fyp, NULL);
+		rc = fy_parser_set_string(fyp, text);
+		ck_assert_int_eq(rc, 0);
+		while ((fye = fy_parser_parse(fyp)) != NULL)
+			fy_parser_event_free(fyp, fye);
+		ck_assert(!fy_parser_get_stream_error(fyp));
+		fy_parser_destroy(fyp);
+		tt[CXO_SCAN] = cx_now() - t0;
+
+		t0 = cx_now();
+		fyd = fy_document_build_from_string(&cfg, text);
+		tt[CXO_LOAD] = cx_now() - t0;
+		ck_assert_ptr_ne(fyd, NULL);
+
+		if (fam->lookup) {
+			t0 = cx_now();
+			fam->lookup(fyd, n);
+			tt[CXO_LOOKUP] = cx_now() - t0;
+		}
+
+		if (fyd_json_patch) {
+			t0 = cx_now();
+			rc = fy_document_apply_json_patch(fyd, fy_document_root(fyd_json_patch));
+			tt[CXO_JSON_PATCH] = cx_now() - t0;
+			ck_assert_int_eq(rc, 0);
+		}
+
+		if (fyd_merge_patch) {
+			t0 = cx_now();
+			ck_assert_ptr_ne(fy_node_apply_merge_patch(fy_document_root(fyd),
+						fy_document_root(fyd_merge_patch)), NULL);
+			tt[CXO_MERGE_PATCH] = cx_now() - t0;
+		}
+
+		if (fyd_insert) {
+			t0 = cx_now();
+			rc = fy_node_insert(fy_document_root(fyd), fy_document_root(fyd_insert));
+			tt[CXO_INSERT] = cx_now() - t0;
+			ck_assert_int_eq(rc, 0);
+		}
+
+		t0 = cx_now();
+		rc = fy_document_resolve(fyd);
+		tt[CXO_RESOLVE] = cx_now() - t0;
+		ck_assert_int_eq(rc, 0);
+
+		t0 = cx_now();
+		out = fy_emit_document_to_string(fyd, FYECF_DEFAULT);
+		tt[CXO_EMIT] = cx_now() - t0;
+		ck_assert_ptr_ne(out, NULL);
+		free(out);
+
+		fy_document_destroy(fyd);
+
+		for (j = 0; j < CXO_MAX; j++)
+			if (tt[j] < t[j])
+				t[j] = tt[j];
+	}
+
+	fy_document_destroy(fyd_insert);
+	fy_document_destroy(fyd_merge_patch);
+	fy_document_destroy(fyd_json_patch);
+	free(insert);
+	free(merge_patch);
+	free(json_patch);
+	free(text);
+}
+
+/* least squares slope of log(t) over log(n) */
+static double cx_fit_exponent(const int *n, const double *t, int count)
+{
+	double x, y, sx = 0, sy = 0, sxx = 0, sxy = 0;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		x = log((double)n[i]);
+		y = log(t[i] > 1e-9 ? t[i] : 1e-9);
+		sx += x;
+		sy += y;
+		sxx += x * x;
+		sxy += x * y;
+	}
+	return (count * sxy - sx * sy) / (count * sxx - sx * sx);
+}
+
+static void cx_check_family(const struct cx_family *fam)
+{
+	int n[CX_STEPS];
+	double t[CX_STEPS][CXO_MAX], tk[CX_STEPS], exp;
+	const char *env;
+	bool timed;
+	int i, k;
+
+	env = getenv(CX_ENV);
+	timed = env && *env && strcmp(env, "0");
+
+	for (i = 0; i < CX_STEPS; i++) {
+		n[i] = fam->base << i;
+		cx_measure(fam, n[i], timed ? CX_REPEAT : 1, t[i]);
+	}
+
+	if (!timed)
+		return;
+
+	for (k = 0; k < CXO_MAX; k++) {
+		if (fam->order[k] <= 0)
+			continue;
+
+		for (i = 0; i < CX_STEPS; i++)
+			tk[i] = t[i][k];
+		if (tk[CX_STEPS - 1] < CX_MIN_TIME) {
+			fprintf(stderr, "%s/%s: too fast to fit (%.3f ms at n=%d), not checked\n",
+				fam->name, cx_op_names[k], tk[CX_STEPS - 1] * 1e3,
+				n[CX_STEPS - 1]);
+			continue;
+		}
+		exp = cx_fit_exponent(n, tk, CX_STEPS);
+
+		ck_assert_msg(exp <= fam->order[k] + CX_TOLERANCE,
+			      "%s/%s: measured O(n^%.2f), declared O(n^%.0f)",
+			      fam->name, cx_op_names[k], exp, fam->order[k]);
+	}
+}
+
+START_TEST(complexity_wide_mapping)
+{
+	cx_check_family(&cx_families[0]);
+}
+END_TEST
+
+START_TEST(complexity_long_sequence)
+{
+	cx_check_family(&cx_families[1]);
+}
+END_TEST
+
+START_TEST(complexity_many_anchors)
+{
+	cx_check_family(&cx_families[2]);
+}
+END_TEST
+
+START_TEST(complexity_deep_nesting)
+{
+	cx_check_family(&cx_families[3]);
+}
+END_TEST
+
+START_TEST(complexity_long_scalar)
+{
+	cx_check_family(&cx_families[4]);
+}
+END_TEST
+
+TCase *libfyaml_case_complexity(void)
+{
+	TCase *tc;
+
+	tc = tcase_create("complexity");
+
+	/* the largest sizes of the quadratic operations take a while */
+	tcase_set_timeout(tc, 60);
+
+	tcase_add_test(tc, complexity_wide_mapping);
+	tcase_add_test(tc, complexity_long_sequence);
+	tcase_add_test(tc, complexity_many_anchors);
+	tcase_add_test(tc, complexity_deep_nesting);
+	tcase_add_test(tc, complexity_long_scalar);
+
+	return tc;
+}
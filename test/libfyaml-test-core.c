@@ -17,6 +17,7 @@
 #include <getopt.h>
 #include <unistd.h>
 #include <limits.h>
+#include <stdatomic.h>
 
 #include <check.h>
 
@@ -621,56 +622,2633 @@ START_TEST(doc_insert_remove_map)
 }
 END_TEST
 
+START_TEST(doc_insert_foreign)
+{
+	struct fy_document *fyd, *fyd_src;
+	struct fy_node *fyn, *fyn_key, *fyn_cpy;
+	char *output;
+	int ret;
+
+	fyd = fy_document_build_from_string(NULL, "{ seq: [ a ], map: { b: 1 } }");
+	ck_assert_ptr_ne(fyd, NULL);
+	fyd_src = fy_document_build_from_string(NULL, "[ x, { y: z } ]");
+	ck_assert_ptr_ne(fyd_src, NULL);
+
+	fyn = fy_node_by_path(fy_document_root(fyd_src), "/[1]");
+	ck_assert_ptr_ne(fyn, NULL);
+	fyn = fy_node_sequence_remove(fy_document_root(fyd_src), fyn);
+	ck_assert_ptr_ne(fyn, NULL);
+
+	/* nodes of another document are not linked in */
+	ret = fy_node_sequence_append(fy_node_by_path(fy_document_root(fyd), "/seq"), fyn);
+	ck_assert_int_eq(ret, -1);
+	ret = fy_node_sequence_prepend(fy_node_by_path(fy_document_root(fyd), "/seq"), fyn);
+	ck_assert_int_eq(ret, -1);
+
+	fyn_key = fy_node_build_from_string(fyd, "c");
+	ck_assert_ptr_ne(fyn_key, NULL);
+	ret = fy_node_mapping_append(fy_node_by_path(fy_document_root(fyd), "/map"), fyn_key, fyn);
+	ck_assert_int_eq(ret, -1);
+	fy_node_pair_set_value(fy_node_mapping_get_by_index(
+				fy_node_by_path(fy_document_root(fyd), "/map"), 0), fyn);
+	ck_assert_ptr_ne(fy_node_by_path(fy_document_root(fyd), "/map/b"), fyn);
+	fy_document_set_root(fyd, fyn);
+	ck_assert_ptr_ne(fy_document_root(fyd), fyn);
+
+	/* a copy is */
+	fyn_cpy = fy_node_copy(fyd, fyn);
+	ck_assert_ptr_ne(fyn_cpy, NULL);
+	ret = fy_node_mapping_append(fy_node_by_path(fy_document_root(fyd), "/map"), fyn_key, fyn_cpy);
+	ck_assert_int_eq(ret, 0);
+
+	/* and outlives its source */
+	fy_node_free(fyn);
+	fy_document_destroy(fyd_src);
+
+	output = fy_emit_document_to_string(fyd, FYECF_MODE_FLOW_ONELINE | FYECF_WIDTH_INF);
+	ck_assert_ptr_ne(output, NULL);
+	ck_assert_str_eq(output, "{seq: [a], map: {b: 1, c: {y: z}}}\n");
+	free(output);
+
+	fy_document_destroy(fyd);
+}
+END_TEST
+
+/* reverses the mapping, looking the pairs up in it while sorting */
+static int sort_reverse_index(const struct fy_node_pair *fynp_a,
+			      const struct fy_node_pair *fynp_b, void *arg)
+{
+	struct fy_node *fyn_map = arg;
+
+	return fy_node_mapping_get_pair_index(fyn_map, fynp_b) -
+	       fy_node_mapping_get_pair_index(fyn_map, fynp_a);
+}
+
 START_TEST(doc_sort)
 {
 	struct fy_document *fyd;
-	void *fynp;
+	void *fynp;
+	void *iter;
+	int ret, count;
+
+	fyd = fy_document_build_from_string(NULL, "{ a: 5, { z: bar }: 1, z: 7, "
+				      "[ a, b, c] : 3, { a: whee } : 2 , "
+				      "b: 6, [ z ]: 4 }");
+	ck_assert_ptr_ne(fyd, NULL);
+
+	ret = fy_node_sort(fy_document_root(fyd), NULL, NULL);
+	ck_assert_int_eq(ret, 0);
+
+	/* check for correct count value */
+	count = fy_node_mapping_item_count(fy_document_root(fyd));
+	ck_assert_int_eq(count, 7);
+
+	/* forward iterator first */
+	iter = NULL;
+
+	fynp = fy_node_mapping_iterate(fy_document_root(fyd), &iter);
+	ck_assert_ptr_ne(fynp, NULL);
+	ck_assert_str_eq(fy_node_get_scalar0(fy_node_pair_value(fynp)), "1");
+
+	fynp = fy_node_mapping_iterate(fy_document_root(fyd), &iter);
+	ck_assert_ptr_ne(fynp, NULL);
+	ck_assert_str_eq(fy_node_get_scalar0(fy_node_pair_value(fynp)), "2");
+
+	fynp = fy_node_mapping_iterate(fy_document_root(fyd), &iter);
+	ck_assert_ptr_ne(fynp, NULL);
+	ck_assert_str_eq(fy_node_get_scalar0(fy_node_pair_value(fynp)), "3");
+
+	fynp = fy_node_mapping_iterate(fy_document_root(fyd), &iter);
+	ck_assert_ptr_ne(fynp, NULL);
+	ck_assert_str_eq(fy_node_get_scalar0(fy_node_pair_value(fynp)), "4");
+
+	fynp = fy_node_mapping_iterate(fy_document_root(fyd), &iter);
+	ck_assert_ptr_ne(fynp, NULL);
+	ck_assert_str_eq(fy_node_get_scalar0(fy_node_pair_value(fynp)), "5");
+
+	fynp = fy_node_mapping_iterate(fy_document_root(fyd), &iter);
+	ck_assert_ptr_ne(fynp, NULL);
+	ck_assert_str_eq(fy_node_get_scalar0(fy_node_pair_value(fynp)), "6");
+
+	fynp = fy_node_mapping_iterate(fy_document_root(fyd), &iter);
+	ck_assert_ptr_ne(fynp, NULL);
+	ck_assert_str_eq(fy_node_get_scalar0(fy_node_pair_value(fynp)), "7");
+
+	fy_document_destroy(fyd);
+
+	/* the comparison method may look at the mapping */
+	fyd = fy_document_build_from_string(NULL, "{ a: 1, b: 2, c: 3, d: 4, e: 5 }");
+	ck_assert_ptr_ne(fyd, NULL);
+
+	ret = fy_node_sort(fy_document_root(fyd), sort_reverse_index, fy_document_root(fyd));
+	ck_assert_int_eq(ret, 0);
+
+	fynp = fy_node_mapping_get_by_index(fy_document_root(fyd), 0);
+	ck_assert_ptr_ne(fynp, NULL);
+	ck_assert_str_eq(fy_node_get_scalar0(fy_node_pair_value(fynp)), "5");
+	fynp = fy_node_mapping_get_by_index(fy_document_root(fyd), 4);
+	ck_assert_ptr_ne(fynp, NULL);
+	ck_assert_str_eq(fy_node_get_scalar0(fy_node_pair_value(fynp)), "1");
+
+	fy_document_destroy(fyd);
+}
+END_TEST
+
+START_TEST(doc_tags_shared)
+{
+	struct fy_document *fyd;
+	struct fy_node *fyn;
+	const char *tag1, *tag2, *tag3;
+	size_t len1, len2, len3;
+	char *buf, *s;
+	int i;
+
+	fyd = fy_document_build_from_string(NULL,
+			"%TAG !e! tag:example.com,2019:\n"
+			"---\n"
+			"{ a: !e!foo 1, b: !e!foo 2, c: !e!bar 3 }\n");
+	ck_assert_ptr_ne(fyd, NULL);
+
+	tag1 = fy_node_get_tag(fy_node_by_path(fy_document_root(fyd), "/a"), &len1);
+	tag2 = fy_node_get_tag(fy_node_by_path(fy_document_root(fyd), "/b"), &len2);
+	tag3 = fy_node_get_tag(fy_node_by_path(fy_document_root(fyd), "/c"), &len3);
+	ck_assert_ptr_ne(tag1, NULL);
+	ck_assert_ptr_ne(tag3, NULL);
+
+	/* same resolved tag, same storage */
+	ck_assert_ptr_eq(tag1, tag2);
+	ck_assert_int_eq(len1, len2);
+	ck_assert_ptr_ne(tag1, tag3);
+
+	ck_assert_int_eq(len1, strlen("tag:example.com,2019:foo"));
+	ck_assert(!memcmp(tag1, "tag:example.com,2019:foo", len1));
+	ck_assert_int_eq(len3, strlen("tag:example.com,2019:bar"));
+	ck_assert(!memcmp(tag3, "tag:example.com,2019:bar", len3));
+
+	/* and the same id */
+	ck_assert_int_ge(fy_node_get_tag_id(fy_node_by_path(fy_document_root(fyd), "/a")), 0);
+	ck_assert_int_eq(fy_node_get_tag_id(fy_node_by_path(fy_document_root(fyd), "/a")),
+			 fy_node_get_tag_id(fy_node_by_path(fy_document_root(fyd), "/b")));
+	ck_assert_int_ne(fy_node_get_tag_id(fy_node_by_path(fy_document_root(fyd), "/a")),
+			 fy_node_get_tag_id(fy_node_by_path(fy_document_root(fyd), "/c")));
+	ck_assert_int_eq(fy_node_get_tag_id(fy_document_root(fyd)), -1);
+
+	/* a tag set later is interned then, not when its id is asked for */
+	ck_assert_int_eq(fy_node_set_tag(fy_document_root(fyd), "!baz", strlen("!baz")), 0);
+	ck_assert_int_ge(fy_node_get_tag_id(fy_document_root(fyd)), 0);
+	ck_assert_int_ne(fy_node_get_tag_id(fy_document_root(fyd)),
+			 fy_node_get_tag_id(fy_node_by_path(fy_document_root(fyd), "/a")));
+
+	fy_document_destroy(fyd);
+
+	/* more distinct tags than the first table holds, and a long one */
+	buf = malloc(100 * 32 + 2048);
+	ck_assert_ptr_ne(buf, NULL);
+	s = buf;
+	s += sprintf(s, "[ !long%01000d x", 0);
+	for (i = 0; i < 100; i++)
+		s += sprintf(s, ", !t%d a, !t%d b", i, i);
+	s += sprintf(s, " ]\n");
+
+	fyd = fy_document_build_from_string(NULL, buf);
+	ck_assert_ptr_ne(fyd, NULL);
+	fyn = fy_document_root(fyd);
+
+	tag1 = fy_node_get_tag(fy_node_sequence_get_by_index(fyn, 0), &len1);
+	ck_assert_int_eq(len1, strlen("!long") + 1000);
+	for (i = 0; i < 100; i++) {
+		ck_assert_int_eq(fy_node_get_tag_id(fy_node_sequence_get_by_index(fyn, 1 + i * 2)),
+				 fy_node_get_tag_id(fy_node_sequence_get_by_index(fyn, 2 + i * 2)));
+		ck_assert_int_ne(fy_node_get_tag_id(fy_node_sequence_get_by_index(fyn, 1 + i * 2)),
+				 fy_node_get_tag_id(fy_node_sequence_get_by_index(fyn, 0)));
+	}
+
+	fy_document_destroy(fyd);
+	free(buf);
+}
+END_TEST
+
+START_TEST(doc_dedup_scalars)
+{
+	static const char *yaml =
+		"- { name: web, env: [ prod, eu ] }\n"
+		"- { name: web, env: [ prod, us ] }\n"
+		"- { name: 'web', env: [ prod, eu ] }\n";
+	struct fy_parse_cfg cfg;
+	struct fy_document *fyd, *fyd_plain;
+	struct fy_node *fyn;
+	const char *text1, *text2;
+	char *output, *output_plain;
+	size_t len1, len2, scalars, shared, bytes;
+	int rc;
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.flags = FYPCF_QUIET | FYPCF_DEDUP_SCALARS;
+
+	fyd = fy_document_build_from_string(&cfg, yaml);
+	ck_assert_ptr_ne(fyd, NULL);
+
+	fyd_plain = fy_document_build_from_string(NULL, yaml);
+	ck_assert_ptr_ne(fyd_plain, NULL);
+
+	/* name, env and prod twice, web and eu once; 'web' is different */
+	rc = fy_document_get_dedup_stats(fyd, &scalars, &shared, &bytes);
+	ck_assert_int_eq(rc, 0);
+	ck_assert_int_eq(scalars, 15);
+	ck_assert_int_eq(shared, 8);
+	ck_assert_int_eq(bytes, 27);
+
+	rc = fy_document_get_dedup_stats(fyd_plain, &scalars, &shared, NULL);
+	ck_assert_int_eq(rc, 0);
+	ck_assert_int_eq(scalars, 0);
+	ck_assert_int_eq(shared, 0);
+
+	/* the same storage for the same scalar */
+	text1 = fy_node_get_scalar(fy_node_by_path(fy_document_root(fyd), "/[0]/name"), &len1);
+	text2 = fy_node_get_scalar(fy_node_by_path(fy_document_root(fyd), "/[1]/name"), &len2);
+	ck_assert_ptr_ne(text1, NULL);
+	ck_assert_ptr_eq(text1, text2);
+	ck_assert_int_eq(len1, len2);
+	text2 = fy_node_get_scalar(fy_node_by_path(fy_document_root(fyd), "/[2]/name"), &len2);
+	ck_assert_ptr_ne(text1, text2);
+
+	/* and no difference in the output */
+	output = fy_emit_document_to_string(fyd, FYECF_MODE_FLOW_ONELINE | FYECF_WIDTH_INF);
+	output_plain = fy_emit_document_to_string(fyd_plain, FYECF_MODE_FLOW_ONELINE | FYECF_WIDTH_INF);
+	ck_assert_ptr_ne(output, NULL);
+	ck_assert_ptr_ne(output_plain, NULL);
+	ck_assert_str_eq(output, output_plain);
+	free(output_plain);
+	free(output);
+
+	/* changing one of them leaves the others alone */
+	fyn = fy_node_create_scalar(fyd, "db", 2);
+	ck_assert_ptr_ne(fyn, NULL);
+	rc = fy_node_insert(fy_node_by_path(fy_document_root(fyd), "/[1]/name"), fyn);
+	ck_assert_int_eq(rc, 0);
+	fy_node_free(fyn);
+
+	rc = fy_node_set_tag(fy_node_by_path(fy_document_root(fyd), "/[0]/env/[0]"), "!x", 2);
+	ck_assert_int_eq(rc, 0);
+
+	output = fy_emit_document_to_string(fyd, FYECF_MODE_FLOW_ONELINE | FYECF_WIDTH_INF);
+	ck_assert_ptr_ne(output, NULL);
+	ck_assert_str_eq(output,
+			"[{name: web, env: [!x prod, eu]}, {name: 'db', env: [prod, us]}, "
+			"{name: 'web', env: [prod, eu]}]\n");
+	free(output);
+
+	fy_document_destroy(fyd_plain);
+	fy_document_destroy(fyd);
+}
+END_TEST
+
+START_TEST(doc_spill)
+{
+	struct fy_parse_cfg cfg;
+	struct fy_document *fyd, *fyd_plain;
+	struct fy_node *fyn;
+	char *yaml, *output, *output_plain;
+	size_t size, len;
+	int i, rc;
+
+	/* enough of it to take more than a single region of the file */
+	size = 200000;
+	yaml = malloc(size);
+	ck_assert_ptr_ne(yaml, NULL);
+	len = 0;
+	for (i = 5000; i > 0; i--)
+		len += snprintf(yaml + len, size - len, "k%05d: [ v%d, { x: %d } ]\n", i, i, i);
+	ck_assert(len < size);
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.flags = FYPCF_QUIET | FYPCF_SPILL;
+
+	fyd = fy_document_build_from_string(&cfg, yaml);
+	ck_assert_ptr_ne(fyd, NULL);
+
+	fyd_plain = fy_document_build_from_string(NULL, yaml);
+	ck_assert_ptr_ne(fyd_plain, NULL);
+
+	ck_assert_str_eq(fy_node_get_scalar0(fy_node_by_path(fy_document_root(fyd), "/k01234/[1]/x")), "1234");
+
+	/* the same, in and out of order */
+	output = fy_emit_document_to_string(fyd, FYECF_MODE_FLOW_ONELINE | FYECF_WIDTH_INF);
+	output_plain = fy_emit_document_to_string(fyd_plain, FYECF_MODE_FLOW_ONELINE | FYECF_WIDTH_INF);
+	ck_assert_ptr_ne(output, NULL);
+	ck_assert_ptr_ne(output_plain, NULL);
+	ck_assert_str_eq(output, output_plain);
+	free(output_plain);
+	free(output);
+
+	/* a comparison method can't see the mapping it sorts, and is refused */
+	rc = fy_node_sort(fy_document_root(fyd), sort_reverse_index, fy_document_root(fyd));
+	ck_assert_int_eq(rc, -1);
+	ck_assert_str_eq(fy_node_get_scalar0(fy_node_pair_key(fy_node_mapping_get_by_index(fy_document_root(fyd), 0))), "k05000");
+
+	rc = fy_node_sort(fy_document_root(fyd), NULL, NULL);
+	ck_assert_int_eq(rc, 0);
+	rc = fy_node_sort(fy_document_root(fyd_plain), NULL, NULL);
+	ck_assert_int_eq(rc, 0);
+
+	ck_assert_str_eq(fy_node_get_scalar0(fy_node_pair_key(fy_node_mapping_get_by_index(fy_document_root(fyd), 0))), "k00001");
+	ck_assert_str_eq(fy_node_get_scalar0(fy_node_pair_key(fy_node_mapping_get_by_index(fy_document_root(fyd), 4999))), "k05000");
+
+	output = fy_emit_document_to_string(fyd, FYECF_MODE_FLOW_ONELINE | FYECF_WIDTH_INF);
+	output_plain = fy_emit_document_to_string(fyd_plain, FYECF_MODE_FLOW_ONELINE | FYECF_WIDTH_INF);
+	ck_assert_ptr_ne(output, NULL);
+	ck_assert_ptr_ne(output_plain, NULL);
+	ck_assert_str_eq(output, output_plain);
+	free(output_plain);
+	free(output);
+
+	/* created nodes live in the file too */
+	fyn = fy_node_build_from_string(fyd, "{ new: node }");
+	ck_assert_ptr_ne(fyn, NULL);
+	rc = fy_node_mapping_append(fy_document_root(fyd), fy_node_create_scalar(fyd, "k0", 2), fyn);
+	ck_assert_int_eq(rc, 0);
+	ck_assert_str_eq(fy_node_get_scalar0(fy_node_by_path(fy_document_root(fyd), "/k0/new")), "node");
+
+	fy_document_destroy(fyd_plain);
+	fy_document_destroy(fyd);
+	free(yaml);
+}
+END_TEST
+
+START_TEST(doc_memory_usage)
+{
+	static const char *yaml =
+		"a: [ x, y, \"e\\tscaped\" ]\n"
+		"b: { c: x, d: x }\n";
+	struct fy_parse_cfg cfg;
+	struct fy_document *fyd;
+	struct fy_node *fyn_root, *fyn_a, *fyn_b;
+	struct fy_memory_report r, r_self, r_a, r_b, r_key;
+	int rc;
+
+	fyd = fy_document_build_from_string(NULL, yaml);
+	ck_assert_ptr_ne(fyd, NULL);
+
+	fyn_root = fy_document_root(fyd);
+	fyn_a = fy_node_by_path(fyn_root, "/a");
+	fyn_b = fy_node_by_path(fyn_root, "/b");
+
+	rc = fy_node_memory_usage(fyn_root, &r);
+	ck_assert_int_eq(rc, 0);
+	ck_assert_int_eq(r.count, 12);
+	ck_assert(r.nodes > 0 && r.pairs > 0 && r.tokens > 0 && r.input > 0);
+	ck_assert_int_eq(r.shared, 0);
+	ck_assert_int_eq(r.total, r.nodes + r.pairs + r.tokens + r.text);
+
+	/* the whole is the root, its keys and its values */
+	rc = fy_node_memory_usage_self(fyn_root, &r_self);
+	ck_assert_int_eq(rc, 0);
+	ck_assert_int_eq(r_self.count, 1);
+	ck_assert_int_eq(r_self.pairs, r.pairs / 2);
+	fy_node_memory_usage(fyn_a, &r_a);
+	fy_node_memory_usage(fyn_b, &r_b);
+	fy_node_memory_usage(fy_node_pair_key(fy_node_mapping_get_by_index(fyn_root, 0)), &r_key);
+	ck_assert_int_eq(r_a.count, 4);
+	ck_assert_int_eq(r_b.count, 5);
+	ck_assert_int_eq(r.total, r_self.total + r_a.total + r_b.total + 2 * r_key.total);
+
+	/* converting the escaped scalar materializes its text */
+	ck_assert_str_eq(fy_node_get_scalar0(fy_node_by_path(fyn_root, "/a/[2]")), "e\tscaped");
+	fy_node_memory_usage(fyn_a, &r);
+	ck_assert_int_eq(r.text, strlen("e\tscaped") + 1);
+
+	fy_document_destroy(fyd);
+
+	/* the repeated x is shared when deduplicating */
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.flags = FYPCF_QUIET | FYPCF_DEDUP_SCALARS;
+	fyd = fy_document_build_from_string(&cfg, yaml);
+	ck_assert_ptr_ne(fyd, NULL);
+
+	fy_node_memory_usage(fy_document_root(fyd), &r);
+	ck_assert(r.shared > 0);
+	ck_assert(r.tokens < r_a.tokens + r_b.tokens + r_self.tokens + 2 * r_key.tokens);
+
+	rc = fy_node_memory_usage(NULL, &r);
+	ck_assert_int_eq(rc, -1);
+
+	fy_document_destroy(fyd);
+}
+END_TEST
+
+struct diag_capture {
+	int count;
+	enum fy_error_type type;
+	enum fy_error_module module;
+	struct fy_mark start_mark;
+	bool has_input;
+	char msg[256];
+};
+
+static void diag_capture_cb(struct fy_parser *fyp, const struct fy_diag_report *report,
+			    void *userdata)
+{
+	struct diag_capture *dc = userdata;
+
+	/* keep the first report */
+	if (dc->count++)
+		return;
+
+	dc->type = report->type;
+	dc->module = report->module;
+	dc->start_mark = report->start_mark;
+	dc->has_input = report->input != NULL && report->input_size > 0;
+	fy_diag_report_format_message(report, dc->msg, sizeof(dc->msg));
+}
+
+START_TEST(parse_diag_report)
+{
+	struct diag_capture dc;
+	struct fy_parse_cfg cfg;
+	struct fy_document *fyd;
+
+	memset(&dc, 0, sizeof(dc));
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.flags = FYPCF_QUIET;
+	cfg.userdata = &dc;
+	cfg.diag = diag_capture_cb;
+
+	/* missing value separator on the second line */
+	fyd = fy_document_build_from_string(&cfg, "foo: bar\n\"baz\" qux\n");
+	ck_assert_ptr_eq(fyd, NULL);
+
+	ck_assert_int_ne(dc.count, 0);
+	ck_assert_int_eq(dc.type, FYET_ERROR);
+	ck_assert_int_eq(dc.start_mark.line, 1);
+	ck_assert(dc.has_input);
+	ck_assert(dc.msg[0] != '\0');
+
+	/* a duplicate key sharing the first one's token is reported where it is */
+	memset(&dc, 0, sizeof(dc));
+	cfg.flags = FYPCF_QUIET | FYPCF_DEDUP_SCALARS;
+	fyd = fy_document_build_from_string(&cfg, "a: 1\nb: 2\n  \na: 3\n");
+	ck_assert_ptr_eq(fyd, NULL);
+
+	ck_assert_int_ne(dc.count, 0);
+	ck_assert_int_eq(dc.start_mark.line, 3);
+	ck_assert_int_eq(dc.start_mark.column, 0);
+	ck_assert_int_eq(dc.start_mark.input_pos, 13);
+}
+END_TEST
+
+START_TEST(parse_budget_events)
+{
+	struct fy_parse_cfg cfg;
+	struct fy_parser *fyp;
+	struct fy_event *fye;
+	struct fy_document *fyd;
+	int count, rc;
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.flags = FYPCF_QUIET | FYPCF_COLLECT_DIAG;
+	cfg.budget_events = 8;
+
+	fyp = fy_parser_create(&cfg);
+	ck_assert_ptr_ne(fyp, NULL);
+
+	rc = fy_parser_set_string(fyp, "[ 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 ]\n");
+	ck_assert_int_eq(rc, 0);
+
+	/* only the budget events are produced */
+	count = 0;
+	while ((fye = fy_parser_parse(fyp)) != NULL) {
+		count++;
+		fy_parser_event_free(fyp, fye);
+	}
+	ck_assert_int_eq(count, 8);
+	ck_assert(fy_parser_get_stream_error(fyp));
+	ck_assert(fy_parser_budget_exceeded(fyp));
+
+	fy_parser_destroy(fyp);
+
+	/* a document that fits is fine */
+	cfg.budget_events = 16;
+	fyd = fy_document_build_from_string(&cfg, "[ 1, 2, 3 ]\n");
+	ck_assert_ptr_ne(fyd, NULL);
+	fy_document_destroy(fyd);
+
+	/* and one that does not fit in the byte budget is not */
+	cfg.budget_events = 0;
+	cfg.budget_bytes = 16;
+	fyd = fy_document_build_from_string(&cfg, "[ 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 ]\n");
+	ck_assert_ptr_eq(fyd, NULL);
+}
+END_TEST
+
+START_TEST(parse_slice)
+{
+	struct fy_parse_cfg cfg;
+	struct fy_parser *fyp;
+	struct fy_document *fyd;
+	struct fy_event *fye;
+	const struct fy_mark *fym;
+	int slices, rc;
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.flags = FYPCF_QUIET;
+
+	fyp = fy_parser_create(&cfg);
+	ck_assert_ptr_ne(fyp, NULL);
+
+	rc = fy_parser_set_string(fyp, "[ 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 ]\n");
+	ck_assert_int_eq(rc, 0);
+
+	ck_assert_ptr_eq(fy_parser_get_slice_mark(fyp), NULL);
+
+	/* 16 events in slices of 4, consumed after each slice */
+	slices = 0;
+	while ((rc = fy_parser_parse_slice(fyp, 4)) > 0) {
+		ck_assert_int_le(rc, 4);
+		slices++;
+
+		/* the queue is full until something is consumed */
+		ck_assert_int_eq(fy_parser_parse_slice(fyp, 4), 0);
+
+		while (rc-- > 0) {
+			fye = fy_parser_parse(fyp);
+			ck_assert_ptr_ne(fye, NULL);
+			fy_parser_event_free(fyp, fye);
+		}
+	}
+	ck_assert_int_eq(rc, 0);
+	ck_assert_int_eq(slices, 4);
+	fy_parser_destroy(fyp);
+
+	fyp = fy_parser_create(&cfg);
+	ck_assert_ptr_ne(fyp, NULL);
+
+	rc = fy_parser_set_string(fyp, "[ 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 ]\n");
+	ck_assert_int_eq(rc, 0);
+
+	/* stream start, document start, sequence start, "1" */
+	ck_assert_int_eq(fy_parser_parse_slice(fyp, 4), 4);
+	fym = fy_parser_get_slice_mark(fyp);
+	ck_assert_ptr_ne(fym, NULL);
+	ck_assert_int_eq(fym->input_pos, 3);
+
+	/* topped up to 6, parsed up to "3" */
+	ck_assert_int_eq(fy_parser_parse_slice(fyp, 6), 2);
+	ck_assert_int_eq(fy_parser_get_slice_mark(fyp)->input_pos, 9);
+
+	/* the document is built from the queued events and the rest */
+	fyd = fy_parse_load_document(fyp);
+	ck_assert_ptr_ne(fyd, NULL);
+	ck_assert_int_eq(fy_node_sequence_item_count(fy_document_root(fyd)), 10);
+	fy_parse_document_destroy(fyp, fyd);
+
+	fy_parser_destroy(fyp);
+}
+END_TEST
+
+START_TEST(parse_load_document_slice)
+{
+	struct fy_parse_cfg cfg;
+	struct fy_parser *fyp, *fyp_ref;
+	struct fy_document *fyd, *fyd_ref;
+	const struct fy_mark *fym;
+	char *buf, *p, *out, *out_ref;
+	char path[32];
+	size_t pos;
+	int i, ndocs, slices, rc;
+
+	/* two documents of nested collections, with anchors and aliases */
+	buf = malloc(64 * 400 + 64);
+	ck_assert_ptr_ne(buf, NULL);
+	p = buf;
+	for (i = 0; i < 400; i++) {
+		if (i == 0 || i == 200)
+			p += sprintf(p, "---\n");
+		if (i == 0 || i == 200)
+			p += sprintf(p, "- &a%d {k%d: [1, {x: y}], v: x%d}\n", i, i, i);
+		else
+			p += sprintf(p, "- {k%d: [1, *a%d], ? [c, d] : x%d}\n", i, i < 200 ? 0 : 200, i);
+	}
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.flags = FYPCF_QUIET | FYPCF_DEDUP_SCALARS;
+
+	fyp = fy_parser_create(&cfg);
+	ck_assert_ptr_ne(fyp, NULL);
+	rc = fy_parser_set_string(fyp, buf);
+	ck_assert_int_eq(rc, 0);
+
+	fyp_ref = fy_parser_create(&cfg);
+	ck_assert_ptr_ne(fyp_ref, NULL);
+	rc = fy_parser_set_string(fyp_ref, buf);
+	ck_assert_int_eq(rc, 0);
+
+	ndocs = 0;
+	slices = 0;
+	pos = 0;
+	for (;;) {
+		rc = fy_parse_load_document_slice(fyp, 7, &fyd);
+		ck_assert_int_ge(rc, 0);
+		slices++;
+
+		/* each slice picks up where the last one stopped */
+		fym = fy_parser_get_slice_mark(fyp);
+		ck_assert_ptr_ne(fym, NULL);
+		ck_assert_int_ge(fym->input_pos, pos);
+		pos = fym->input_pos;
+
+		if (rc > 0) {
+			ck_assert_ptr_eq(fyd, NULL);
+			continue;
+		}
+		if (!fyd)
+			break;
+
+		/* the same document as a single load gives */
+		fyd_ref = fy_parse_load_document(fyp_ref);
+		ck_assert_ptr_ne(fyd_ref, NULL);
+		out_ref = fy_emit_document_to_string(fyd_ref, FYECF_MODE_FLOW_ONELINE);
+		ck_assert_ptr_ne(out_ref, NULL);
+		out = fy_emit_document_to_string(fyd, FYECF_MODE_FLOW_ONELINE);
+		ck_assert_ptr_ne(out, NULL);
+		ck_assert_str_eq(out, out_ref);
+		ck_assert_int_eq(fy_node_sequence_item_count(fy_document_root(fyd)), 200);
+		snprintf(path, sizeof(path), "/[0]/k%d/[1]/x", ndocs * 200);
+		ck_assert_ptr_ne(fy_node_by_path(fy_document_root(fyd), path), NULL);
+		free(out);
+		free(out_ref);
+		fy_parse_document_destroy(fyp_ref, fyd_ref);
+
+		fy_parse_document_destroy(fyp, fyd);
+		ndocs++;
+	}
+	ck_assert_int_eq(ndocs, 2);
+	ck_assert_int_gt(slices, 400);
+
+	/* and nothing past the end */
+	ck_assert_int_eq(fy_parse_load_document_slice(fyp, 7, &fyd), 0);
+	ck_assert_ptr_eq(fyd, NULL);
+
+	fy_parser_destroy(fyp_ref);
+	fy_parser_destroy(fyp);
+
+	/* a document dropped halfway is freed with the parser */
+	fyp = fy_parser_create(&cfg);
+	ck_assert_ptr_ne(fyp, NULL);
+	rc = fy_parser_set_string(fyp, buf);
+	ck_assert_int_eq(rc, 0);
+	ck_assert_int_eq(fy_parse_load_document_slice(fyp, 100, &fyd), 1);
+	ck_assert_ptr_eq(fyd, NULL);
+	fy_parser_destroy(fyp);
+
+	/* errors are reported as with a single load */
+	fyp = fy_parser_create(&cfg);
+	ck_assert_ptr_ne(fyp, NULL);
+	rc = fy_parser_set_string(fyp, "{ a: [1, 2], b: 3, a: 4 }\n");
+	ck_assert_int_eq(rc, 0);
+	while ((rc = fy_parse_load_document_slice(fyp, 2, &fyd)) > 0)
+		;
+	ck_assert_int_eq(rc, -1);
+	ck_assert_ptr_eq(fyd, NULL);
+	fy_parser_destroy(fyp);
+
+	free(buf);
+}
+END_TEST
+
+static char *parse_ahead_emit_all(unsigned int flags, struct fy_executor *fyx,
+				  const char *yaml)
+{
+	struct fy_parse_cfg cfg;
+	struct fy_parser *fyp;
+	struct fy_document *fyd;
+	char *buf, *out, *tmp;
+	size_t len;
+	int rc;
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.flags = flags;
+	cfg.executor = fyx;
+
+	fyp = fy_parser_create(&cfg);
+	ck_assert_ptr_ne(fyp, NULL);
+
+	rc = fy_parser_set_string(fyp, yaml);
+	ck_assert_int_eq(rc, 0);
+
+	out = strdup("");
+	ck_assert_ptr_ne(out, NULL);
+	while ((fyd = fy_parse_load_document(fyp)) != NULL) {
+		buf = fy_emit_document_to_string(fyd, FYECF_MODE_FLOW_ONELINE);
+		ck_assert_ptr_ne(buf, NULL);
+		len = strlen(out);
+		tmp = realloc(out, len + strlen(buf) + 2);
+		ck_assert_ptr_ne(tmp, NULL);
+		out = tmp;
+		strcpy(out + len, buf);
+		strcat(out + len, "\n");
+		free(buf);
+		fy_parse_document_destroy(fyp, fyd);
+	}
+	ck_assert(!fy_parser_get_stream_error(fyp));
+
+	fy_parser_destroy(fyp);
+
+	return out;
+}
+
+START_TEST(parse_ahead)
+{
+	static const char *yaml =
+		"%TAG !e! tag:example.com,2019:\n"
+		"--- !e!foo { a: &x 1, b: [ *x, 2, 3 ] }\n"
+		"--- [ 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16,\n"
+		"      17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30 ]\n"
+		"--- scalar\n"
+		"...\n"
+		"--- { x: { y: { z: [ deep ] } } }\n";
+	struct diag_capture dc;
+	struct fy_parse_cfg cfg;
+	struct fy_executor_cfg xcfg;
+	struct fy_document *fyd;
+	struct fy_executor *fyx;
+	char *sync_out, *ahead_out, *big;
+	size_t len;
+	int i;
+
+	/* the same documents, parsed ahead or not */
+	sync_out = parse_ahead_emit_all(FYPCF_QUIET, NULL, yaml);
+	ahead_out = parse_ahead_emit_all(FYPCF_QUIET | FYPCF_PARSE_AHEAD, NULL, yaml);
+	ck_assert_str_eq(sync_out, ahead_out);
+	free(ahead_out);
+	free(sync_out);
+
+	/* many batches, more than the queue holds in one document */
+	big = malloc(64 * 6000 + 64);
+	ck_assert_ptr_ne(big, NULL);
+	len = 0;
+	for (i = 0; i < 6000; i++) {
+		if (i % 2000 == 0)
+			len += sprintf(big + len, "---\n");
+		len += sprintf(big + len, "- { k: v%d, n: [ %d, &a%d x, *a%d ] }\n",
+			       i, i, i, i);
+	}
+
+	memset(&xcfg, 0, sizeof(xcfg));
+	xcfg.num_threads = 1;
+	fyx = fy_executor_create(&xcfg);
+	ck_assert_ptr_ne(fyx, NULL);
+	sync_out = parse_ahead_emit_all(FYPCF_QUIET, NULL, big);
+	ahead_out = parse_ahead_emit_all(FYPCF_QUIET | FYPCF_PARSE_AHEAD, NULL, big);
+	ck_assert_str_eq(sync_out, ahead_out);
+	free(ahead_out);
+	ahead_out = parse_ahead_emit_all(FYPCF_QUIET | FYPCF_PARSE_AHEAD, fyx, big);
+	ck_assert_str_eq(sync_out, ahead_out);
+	free(ahead_out);
+	free(sync_out);
+	fy_executor_destroy(fyx);
+	free(big);
+
+	/* and the same error, at the same place */
+	memset(&dc, 0, sizeof(dc));
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.flags = FYPCF_QUIET | FYPCF_PARSE_AHEAD;
+	cfg.userdata = &dc;
+	cfg.diag = diag_capture_cb;
+
+	fyd = fy_document_build_from_string(&cfg, "foo: bar\n\"baz\" qux\n");
+	ck_assert_ptr_eq(fyd, NULL);
+
+	ck_assert_int_ne(dc.count, 0);
+	ck_assert_int_eq(dc.type, FYET_ERROR);
+	ck_assert_int_eq(dc.start_mark.line, 1);
+}
+END_TEST
+
+struct executor_sum {
+	struct fy_executor *fyx;
+	atomic_uint *total;
+	unsigned int count;
+};
+
+/* adds count to the total, splitting in halves on nested runs */
+static void executor_sum_task(void *arg)
+{
+	struct executor_sum *es = arg, half[2];
+	void *args[2];
+	int rc;
+
+	if (es->count <= 1) {
+		atomic_fetch_add(es->total, es->count);
+		return;
+	}
+
+	half[0] = *es;
+	half[0].count = es->count / 2;
+	half[1] = *es;
+	half[1].count = es->count - half[0].count;
+	args[0] = &half[0];
+	args[1] = &half[1];
+
+	rc = fy_executor_run(es->fyx, executor_sum_task, args, 2);
+	ck_assert_int_eq(rc, 0);
+}
+
+static int executor_inline_submit(void *pool, void (*fn)(void *arg), void *arg)
+{
+	(*(int *)pool)++;
+	fn(arg);
+	return 0;
+}
+
+/* holds on to the tasks, as a pool with all of its threads busy would */
+struct executor_deferred {
+	void (*fn[64])(void *arg);
+	void *arg[64];
+	unsigned int count;
+};
+
+static int executor_deferred_submit(void *pool, void (*fn)(void *arg), void *arg)
+{
+	struct executor_deferred *ed = pool;
+
+	if (ed->count >= 64)
+		return -1;
+	ed->fn[ed->count] = fn;
+	ed->arg[ed->count++] = arg;
+	return 0;
+}
+
+static void executor_deferred_run(struct executor_deferred *ed)
+{
+	unsigned int i;
+
+	for (i = 0; i < ed->count; i++)
+		ed->fn[i](ed->arg[i]);
+	ed->count = 0;
+}
+
+/* loads a document from each parser in turn, emitting them as it goes */
+static void executor_parse_many(struct fy_executor *fyx, const char *yaml,
+				const char *expected, unsigned int count)
+{
+	struct fy_parse_cfg cfg;
+	struct fy_parser *fyp[4];
+	struct fy_document *fyd;
+	char *out[4], *buf, *tmp;
+	unsigned int i, active;
+	size_t len;
+	int rc;
+
+	ck_assert_int_le(count, 4);
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.flags = FYPCF_QUIET | FYPCF_PARSE_AHEAD;
+	cfg.executor = fyx;
+
+	for (i = 0; i < count; i++) {
+		fyp[i] = fy_parser_create(&cfg);
+		ck_assert_ptr_ne(fyp[i], NULL);
+		rc = fy_parser_set_string(fyp[i], yaml);
+		ck_assert_int_eq(rc, 0);
+		out[i] = strdup("");
+		ck_assert_ptr_ne(out[i], NULL);
+	}
+
+	do {
+		active = 0;
+		for (i = 0; i < count; i++) {
+			if (!fyp[i])
+				continue;
+			fyd = fy_parse_load_document(fyp[i]);
+			if (!fyd) {
+				ck_assert(!fy_parser_get_stream_error(fyp[i]));
+				fy_parser_destroy(fyp[i]);
+				fyp[i] = NULL;
+				continue;
+			}
+			active++;
+			buf = fy_emit_document_to_string(fyd, FYECF_MODE_FLOW_ONELINE);
+			ck_assert_ptr_ne(buf, NULL);
+			len = strlen(out[i]);
+			tmp = realloc(out[i], len + strlen(buf) + 2);
+			ck_assert_ptr_ne(tmp, NULL);
+			out[i] = tmp;
+			strcpy(out[i] + len, buf);
+			strcat(out[i] + len, "\n");
+			free(buf);
+			fy_parse_document_destroy(fyp[i], fyd);
+		}
+	} while (active);
+
+	for (i = 0; i < count; i++) {
+		ck_assert_str_eq(out[i], expected);
+		free(out[i]);
+	}
+}
+
+static void executor_check_sum(struct fy_executor *fyx)
+{
+	struct executor_sum es[8];
+	void *args[8];
+	atomic_uint total;
+	unsigned int i;
+	int rc;
+
+	atomic_init(&total, 0);
+	for (i = 0; i < 8; i++) {
+		es[i].fyx = fyx;
+		es[i].total = &total;
+		es[i].count = 100 + i;
+		args[i] = &es[i];
+	}
+
+	rc = fy_executor_run(fyx, executor_sum_task, args, 8);
+	ck_assert_int_eq(rc, 0);
+	ck_assert_int_eq(atomic_load(&total), 8 * 100 + 28);
+}
+
+START_TEST(executor)
+{
+	static const char *yaml =
+		"--- { a: 1, b: [ 1, 2, 3 ] }\n"
+		"--- [ x, y, z ]\n";
+	struct fy_executor_cfg cfg;
+	struct fy_executor *fyx;
+	struct executor_deferred ed;
+	char *sync_out, *ahead_out, *many, *p;
+	size_t size;
+	int submitted, i, j;
+
+	/* the own pool, with nested runs */
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.num_threads = 3;
+	fyx = fy_executor_create(&cfg);
+	ck_assert_ptr_ne(fyx, NULL);
+	ck_assert_int_eq(fy_executor_num_threads(fyx), 3);
+
+	executor_check_sum(fyx);
+
+	/* parsing ahead on the pool */
+	sync_out = parse_ahead_emit_all(FYPCF_QUIET, NULL, yaml);
+	ahead_out = parse_ahead_emit_all(FYPCF_QUIET | FYPCF_PARSE_AHEAD, fyx, yaml);
+	ck_assert_str_eq(sync_out, ahead_out);
+	free(ahead_out);
+	free(sync_out);
+
+	fy_executor_destroy(fyx);
+
+	/* documents long enough to fill the queue, a few thousand events each */
+	size = 16 * (16 + 2000 * 8);
+	many = malloc(size);
+	ck_assert_ptr_ne(many, NULL);
+	p = many;
+	for (i = 0; i < 16; i++) {
+		p += sprintf(p, "--- [");
+		for (j = 0; j < 2000; j++)
+			p += sprintf(p, "%s%d", j ? ", " : " ", i * 2000 + j);
+		p += sprintf(p, " ]\n");
+	}
+	sync_out = parse_ahead_emit_all(FYPCF_QUIET, NULL, many);
+
+	/* more parsers than workers, none of them waits for the others */
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.num_threads = 1;
+	fyx = fy_executor_create(&cfg);
+	ck_assert_ptr_ne(fyx, NULL);
+
+	executor_parse_many(fyx, many, sync_out, 4);
+
+	fy_executor_destroy(fyx);
+
+	/* and when the tasks never get to run before the parsers are gone */
+	memset(&ed, 0, sizeof(ed));
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.submit = executor_deferred_submit;
+	cfg.pool = &ed;
+	fyx = fy_executor_create(&cfg);
+	ck_assert_ptr_ne(fyx, NULL);
+
+	executor_parse_many(fyx, many, sync_out, 3);
+	ck_assert_int_ne(ed.count, 0);
+	executor_deferred_run(&ed);
+
+	/* nested runs do not wait for a pool that never gets to them */
+	executor_check_sum(fyx);
+	ck_assert_int_ne(ed.count, 0);
+	executor_deferred_run(&ed);
+
+	fy_executor_destroy(fyx);
+
+	free(sync_out);
+	free(many);
+
+	/* an external executor gets everything */
+	submitted = 0;
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.submit = executor_inline_submit;
+	cfg.pool = &submitted;
+	fyx = fy_executor_create(&cfg);
+	ck_assert_ptr_ne(fyx, NULL);
+
+	executor_check_sum(fyx);
+	ck_assert_int_ne(submitted, 0);
+
+	fy_executor_destroy(fyx);
+}
+END_TEST
+
+static int flush_count_output(struct fy_emitter *emit, enum fy_emitter_write_type type,
+			      const char *str, int len, void *userdata)
+{
+	if (type == fyewt_flush)
+		(*(int *)userdata)++;
+	return len;
+}
+
+START_TEST(stream_low_latency)
+{
+	static const char *docs[2] = {
+		"--- [ 1, 2, 3 ]\n...\n",
+		"--- { a: b }\n...\n",
+	};
+	struct fy_parse_cfg cfg;
+	struct fy_emitter_cfg emit_cfg;
+	struct fy_parser *fyp;
+	struct fy_emitter *emit;
+	struct fy_document *fyd;
+	FILE *fp;
+	int fds[2], i, rc, flushes;
+	ssize_t wrote;
+
+	rc = pipe(fds);
+	ck_assert_int_eq(rc, 0);
+	fp = fdopen(fds[0], "r");
+	ck_assert_ptr_ne(fp, NULL);
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.flags = FYPCF_QUIET | FYPCF_STREAM_LOW_LATENCY;
+	fyp = fy_parser_create(&cfg);
+	ck_assert_ptr_ne(fyp, NULL);
+	rc = fy_parser_set_input_fp(fyp, "pipe", fp);
+	ck_assert_int_eq(rc, 0);
+
+	flushes = 0;
+	memset(&emit_cfg, 0, sizeof(emit_cfg));
+	emit_cfg.flags = FYECF_DEFAULT | FYECF_FLUSH_DOCUMENT;
+	emit_cfg.output = flush_count_output;
+	emit_cfg.userdata = &flushes;
+	emit = fy_emitter_create(&emit_cfg);
+	ck_assert_ptr_ne(emit, NULL);
+
+	/* each document is available while the writer is still there */
+	for (i = 0; i < 2; i++) {
+		wrote = write(fds[1], docs[i], strlen(docs[i]));
+		ck_assert_int_eq(wrote, strlen(docs[i]));
+
+		fyd = fy_parse_load_document(fyp);
+		ck_assert_ptr_ne(fyd, NULL);
+
+		rc = fy_emit_document(emit, fyd);
+		ck_assert_int_eq(rc, 0);
+		ck_assert_int_eq(flushes, i + 1);
+
+		fy_parse_document_destroy(fyp, fyd);
+	}
+
+	close(fds[1]);
+
+	fyd = fy_parse_load_document(fyp);
+	ck_assert_ptr_eq(fyd, NULL);
+	ck_assert(!fy_parser_get_stream_error(fyp));
+
+	fy_emitter_destroy(emit);
+	fy_parser_destroy(fyp);
+	fclose(fp);
+}
+END_TEST
+
+START_TEST(doc_overlay)
+{
+	struct fy_document *fyds[2], *fyd;
+	struct fy_overlay *fyo;
+	struct fy_overlay_node *fyon;
+	enum fy_emitter_cfg_flags flags;
+	char *buf, *buf_flat;
+	int i;
+
+	fyds[0] = fy_document_build_from_string(NULL, "{ a: 1, b: { x: 1, y: 2 }, c: [ 1, 2 ] }");
+	ck_assert_ptr_ne(fyds[0], NULL);
+	fyds[1] = fy_document_build_from_string(NULL, "{ b: { y: 3, z: 4 }, c: [ 3 ], d: 5 }");
+	ck_assert_ptr_ne(fyds[1], NULL);
+
+	fyo = fy_overlay_create(fyds, 2);
+	ck_assert_ptr_ne(fyo, NULL);
+
+	ck_assert_int_eq(fy_overlay_node_item_count(fy_overlay_root(fyo)), 4);
+
+	/* mappings merge, the upper layer wins */
+	fyon = fy_overlay_node_by_path(fy_overlay_root(fyo), "/b/y");
+	ck_assert_ptr_ne(fyon, NULL);
+	ck_assert_str_eq(fy_node_get_scalar0(fy_overlay_node_get_node(fyon)), "3");
+
+	fyon = fy_overlay_node_by_path(fy_overlay_root(fyo), "/b/x");
+	ck_assert_ptr_ne(fyon, NULL);
+	ck_assert_str_eq(fy_node_get_scalar0(fy_overlay_node_get_node(fyon)), "1");
+
+	/* sequences are replaced */
+	fyon = fy_overlay_node_by_path(fy_overlay_root(fyo), "/c/[0]");
+	ck_assert_ptr_ne(fyon, NULL);
+	ck_assert_str_eq(fy_node_get_scalar0(fy_overlay_node_get_node(fyon)), "3");
+	ck_assert_ptr_eq(fy_overlay_node_by_path(fy_overlay_root(fyo), "/c/[1]"), NULL);
+
+	buf = fy_emit_overlay_to_string(fyo, FYECF_MODE_FLOW_ONELINE);
+	ck_assert_ptr_ne(buf, NULL);
+	ck_assert_str_eq(buf, "{a: 1, b: {x: 1, y: 3, z: 4}, c: [3], d: 5}\n");
+	free(buf);
+
+	/* emitted without flattening, but the same as the flattened one */
+	fyd = fy_overlay_flatten(fyo);
+	ck_assert_ptr_ne(fyd, NULL);
+	for (i = 0; i < 2; i++) {
+		flags = !i ? FYECF_MODE_BLOCK : (FYECF_MODE_FLOW_ONELINE | FYECF_SORT_KEYS);
+		buf = fy_emit_overlay_to_string(fyo, flags);
+		ck_assert_ptr_ne(buf, NULL);
+		buf_flat = fy_emit_document_to_string(fyd, flags);
+		ck_assert_ptr_ne(buf_flat, NULL);
+		ck_assert_str_eq(buf, buf_flat);
+		free(buf_flat);
+		free(buf);
+	}
+	fy_document_destroy(fyd);
+
+	fy_overlay_destroy(fyo);
+
+	/* entries looked up before the mapping is merged are the same after */
+	fyo = fy_overlay_create(fyds, 2);
+	ck_assert_ptr_ne(fyo, NULL);
+	fyon = fy_overlay_node_by_path(fy_overlay_root(fyo), "/b");
+	ck_assert_ptr_ne(fyon, NULL);
+	ck_assert_ptr_eq(fy_overlay_node_by_path(fy_overlay_root(fyo), "/b"), fyon);
+	ck_assert_ptr_eq(fy_overlay_node_by_path(fy_overlay_root(fyo), "/e"), NULL);
+	ck_assert_int_eq(fy_overlay_node_item_count(fy_overlay_root(fyo)), 4);
+	ck_assert_ptr_eq(fy_overlay_node_by_path(fy_overlay_root(fyo), "/b"), fyon);
+	ck_assert_int_eq(fy_overlay_node_item_count(fyon), 3);
+	fy_overlay_destroy(fyo);
+
+	/* the layers are untouched */
+	buf = fy_emit_document_to_string(fyds[0], FYECF_MODE_FLOW_ONELINE);
+	ck_assert_ptr_ne(buf, NULL);
+	ck_assert_str_eq(buf, "{a: 1, b: {x: 1, y: 2}, c: [1, 2]}\n");
+	free(buf);
+
+	fy_document_destroy(fyds[1]);
+	fy_document_destroy(fyds[0]);
+}
+END_TEST
+
+START_TEST(doc_snapshot)
+{
+	struct fy_document *fyd, *fyd_val;
+	struct fy_snapshot *fys[3], *fysi;
+	struct fy_snapshot_slot *slot;
+	struct fy_overlay *fyo;
+	char *buf;
+	int i;
+
+	fyd = fy_document_build_from_string(NULL, "{ a: 1, b: { x: 1, y: 2 }, c: [ 1, { z: 2 } ] }");
+	ck_assert_ptr_ne(fyd, NULL);
+	fys[0] = fy_snapshot_create(fyd);
+	ck_assert_ptr_ne(fys[0], NULL);
+
+	fyd_val = fy_document_build_from_string(NULL, "{ w: 3 }");
+	ck_assert_ptr_ne(fyd_val, NULL);
+
+	/* replacing a mapping does not merge with the old one */
+	fys[1] = fy_document_update_path(fys[0], "/b", fy_document_root(fyd_val));
+	ck_assert_ptr_ne(fys[1], NULL);
+
+	/* through a sequence, creating a new key */
+	fys[2] = fy_document_update_path(fys[1], "/c/[1]/q", fy_document_root(fyd_val));
+	ck_assert_ptr_ne(fys[2], NULL);
+
+	fy_document_destroy(fyd_val);
+
+	/* the previous snapshots are unchanged */
+	fyo = fy_snapshot_overlay(fys[0]);
+	ck_assert_ptr_ne(fyo, NULL);
+	buf = fy_emit_overlay_to_string(fyo, FYECF_MODE_FLOW_ONELINE);
+	ck_assert_ptr_ne(buf, NULL);
+	ck_assert_str_eq(buf, "{a: 1, b: {x: 1, y: 2}, c: [1, {z: 2}]}\n");
+	free(buf);
+	fy_overlay_destroy(fyo);
+
+	fyo = fy_snapshot_overlay(fys[1]);
+	ck_assert_ptr_ne(fyo, NULL);
+	buf = fy_emit_overlay_to_string(fyo, FYECF_MODE_FLOW_ONELINE);
+	ck_assert_ptr_ne(buf, NULL);
+	ck_assert_str_eq(buf, "{a: 1, b: {w: 3}, c: [1, {z: 2}]}\n");
+	free(buf);
+	fy_overlay_destroy(fyo);
+
+	fyo = fy_snapshot_overlay(fys[2]);
+	ck_assert_ptr_ne(fyo, NULL);
+	buf = fy_emit_overlay_to_string(fyo, FYECF_MODE_FLOW_ONELINE);
+	ck_assert_ptr_ne(buf, NULL);
+	ck_assert_str_eq(buf, "{a: 1, b: {w: 3}, c: [1, {z: 2, q: {w: 3}}]}\n");
+	free(buf);
+	fy_overlay_destroy(fyo);
+
+	/* through the same sequence again, from its end */
+	fyd_val = fy_document_build_from_string(NULL, "8");
+	ck_assert_ptr_ne(fyd_val, NULL);
+	fysi = fy_document_update_path(fys[2], "/c/[-1]/z", fy_document_root(fyd_val));
+	ck_assert_ptr_ne(fysi, NULL);
+
+	/* indices out of range and scalars can't be traversed */
+	ck_assert_ptr_eq(fy_document_update_path(fysi, "/c/[2]", fy_document_root(fyd_val)), NULL);
+	ck_assert_ptr_eq(fy_document_update_path(fysi, "/a/x", fy_document_root(fyd_val)), NULL);
+	fy_document_destroy(fyd_val);
+
+	fyo = fy_snapshot_overlay(fysi);
+	ck_assert_ptr_ne(fyo, NULL);
+	ck_assert_str_eq(fy_node_get_scalar0(fy_overlay_node_get_node(
+			 fy_overlay_node_by_path(fy_overlay_root(fyo), "/c/[1]/z"))), "8");
+	ck_assert_int_eq(fy_overlay_node_item_count(
+			 fy_overlay_node_by_path(fy_overlay_root(fyo), "/c")), 2);
+	buf = fy_emit_overlay_to_string(fyo, FYECF_MODE_FLOW_ONELINE);
+	ck_assert_ptr_ne(buf, NULL);
+	ck_assert_str_eq(buf, "{a: 1, b: {w: 3}, c: [1, {z: 8, q: {w: 3}}]}\n");
+	free(buf);
+	fy_overlay_destroy(fyo);
+	fy_snapshot_unref(fysi);
+
+	/* dropping the older snapshots keeps the shared layers alive */
+	fy_snapshot_unref(fys[0]);
+	fy_snapshot_unref(fys[1]);
+
+	slot = fy_snapshot_slot_create(fys[2]);
+	ck_assert_ptr_ne(slot, NULL);
+	fy_snapshot_unref(fys[2]);
+
+	/* many updates, collapsing the layers now and then */
+	fyd_val = fy_document_build_from_string(NULL, "0");
+	ck_assert_ptr_ne(fyd_val, NULL);
+	for (i = 0; i < 40; i++) {
+		fysi = fy_snapshot_acquire(slot);
+		ck_assert_ptr_ne(fysi, NULL);
+		fys[0] = fy_document_update_path(fysi, "/a", fy_document_root(fyd_val));
+		ck_assert_ptr_ne(fys[0], NULL);
+		fy_snapshot_unref(fysi);
+		fy_snapshot_publish(slot, fys[0]);
+		fy_snapshot_unref(fys[0]);
+	}
+	fy_document_destroy(fyd_val);
+
+	fysi = fy_snapshot_acquire(slot);
+	fyo = fy_snapshot_overlay(fysi);
+	ck_assert_ptr_ne(fyo, NULL);
+	buf = fy_emit_overlay_to_string(fyo, FYECF_MODE_FLOW_ONELINE);
+	ck_assert_ptr_ne(buf, NULL);
+	ck_assert_str_eq(buf, "{a: 0, b: {w: 3}, c: [1, {z: 2, q: {w: 3}}]}\n");
+	free(buf);
+	fy_overlay_destroy(fyo);
+	fy_snapshot_unref(fysi);
+
+	fy_snapshot_slot_destroy(slot);
+}
+END_TEST
+
+struct snapshot_reader {
+	struct fy_snapshot_slot *slot;
+	atomic_uint *found;
+};
+
+/* looks up every key, the quoted ones having no text of their own yet */
+static void snapshot_reader_task(void *arg)
+{
+	struct snapshot_reader *sr = arg;
+	struct fy_snapshot *fys;
+	struct fy_overlay *fyo;
+	struct fy_overlay_node *fyon;
+	struct fy_node *fyn;
+	char key[16], value[16], yaml[16];
+	int i;
+
+	fys = fy_snapshot_acquire(sr->slot);
+	fyo = fy_snapshot_overlay(fys);
+	ck_assert_ptr_ne(fyo, NULL);
+
+	for (i = 0; i < 100; i++) {
+		snprintf(key, sizeof(key), "k\t%d", i);
+		snprintf(value, sizeof(value), "v\n%d", i);
+		snprintf(yaml, sizeof(yaml), "\"v\\n%d\"", i);
+		fyon = fy_overlay_node_mapping_lookup_by_string(fy_overlay_root(fyo), key);
+		fyn = fy_overlay_node_get_node(fyon);
+		if (fyn && !strcmp(fy_node_get_scalar0(fyn), value) &&
+		    fy_node_compare_string(fyn, yaml))
+			atomic_fetch_add(sr->found, 1);
+	}
+
+	fy_overlay_destroy(fyo);
+	fy_snapshot_unref(fys);
+}
+
+START_TEST(doc_snapshot_readers)
+{
+	struct fy_executor_cfg cfg;
+	struct fy_executor *fyx;
+	struct fy_document *fyd;
+	struct fy_snapshot *fys;
+	struct snapshot_reader sr[8];
+	void *args[8];
+	atomic_uint found;
+	char *yaml, *p;
+	int i, rc;
+
+	yaml = malloc(100 * 32 + 8);
+	ck_assert_ptr_ne(yaml, NULL);
+	p = yaml;
+	p += sprintf(p, "{");
+	for (i = 0; i < 100; i++)
+		p += sprintf(p, "%s\"k\\t%d\": \"v\\n%d\"", i ? ", " : " ", i, i);
+	p += sprintf(p, " }\n");
+
+	fyd = fy_document_build_from_string(NULL, yaml);
+	ck_assert_ptr_ne(fyd, NULL);
+	fys = fy_snapshot_create(fyd);
+	ck_assert_ptr_ne(fys, NULL);
+	sr[0].slot = fy_snapshot_slot_create(fys);
+	ck_assert_ptr_ne(sr[0].slot, NULL);
+	fy_snapshot_unref(fys);
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.num_threads = 4;
+	fyx = fy_executor_create(&cfg);
+	ck_assert_ptr_ne(fyx, NULL);
+
+	/* readers share the nodes (and tokens) of the snapshot */
+	atomic_init(&found, 0);
+	for (i = 0; i < 8; i++) {
+		sr[i].slot = sr[0].slot;
+		sr[i].found = &found;
+		args[i] = &sr[i];
+	}
+	rc = fy_executor_run(fyx, snapshot_reader_task, args, 8);
+	ck_assert_int_eq(rc, 0);
+	ck_assert_int_eq(atomic_load(&found), 8 * 100);
+
+	fy_executor_destroy(fyx);
+	fy_snapshot_slot_destroy(sr[0].slot);
+	free(yaml);
+}
+END_TEST
+
+START_TEST(doc_tape)
+{
+	static const char *yaml = "{ a: [ 1, { b: 2 }, 3 ], c: &x !!str 4, d: *x }";
+	struct fy_tape *fytp;
+	struct fy_document *fyd;
+	const char *text;
+	size_t len;
+	int root, pos, item, count;
+	char *buf;
+
+	fytp = fy_tape_build_from_string(NULL, yaml);
+	ck_assert_ptr_ne(fytp, NULL);
+
+	root = fy_tape_root(fytp);
+	ck_assert_int_eq(root, 0);
+	ck_assert(fy_tape_get_type(fytp, root) == FYNT_MAPPING);
+	ck_assert_int_eq(fy_tape_item_count(fytp, root), 3);
+
+	/* skipping over a subtree lands on the next key */
+	pos = fy_tape_mapping_lookup_by_string(fytp, root, "a");
+	ck_assert_int_ge(pos, 0);
+	ck_assert(fy_tape_get_type(fytp, pos) == FYNT_SEQUENCE);
+	ck_assert_int_eq(fy_tape_item_count(fytp, pos), 3);
+	text = fy_tape_get_scalar(fytp, fy_tape_skip(fytp, pos), &len);
+	ck_assert_ptr_ne(text, NULL);
+	ck_assert_int_eq(len, 1);
+	ck_assert(!memcmp(text, "c", 1));
+
+	count = 0;
+	for (item = fy_tape_iterate(fytp, pos, -1); item >= 0; item = fy_tape_iterate(fytp, pos, item))
+		count++;
+	ck_assert_int_eq(count, 3);
+
+	pos = fy_tape_by_path(fytp, root, "/a/[1]/b");
+	ck_assert_int_ge(pos, 0);
+	text = fy_tape_get_scalar(fytp, pos, &len);
+	ck_assert_int_eq(len, 1);
+	ck_assert(!memcmp(text, "2", 1));
+
+	pos = fy_tape_by_path(fytp, root, "/a/[-1]");
+	ck_assert_int_ge(pos, 0);
+	text = fy_tape_get_scalar(fytp, pos, &len);
+	ck_assert(!memcmp(text, "3", 1));
+
+	ck_assert_int_eq(fy_tape_by_path(fytp, root, "/a/[3]"), -1);
+	ck_assert_int_eq(fy_tape_by_path(fytp, root, "/e"), -1);
+
+	pos = fy_tape_by_path(fytp, root, "/d");
+	ck_assert(fy_tape_get_style(fytp, pos) == FYNS_ALIAS);
+
+	/* a regular document, tags and anchors included */
+	fyd = fy_tape_to_document(fytp);
+	ck_assert_ptr_ne(fyd, NULL);
+	fy_tape_destroy(fytp);
+
+	buf = fy_emit_document_to_string(fyd, FYECF_MODE_FLOW_ONELINE);
+	ck_assert_ptr_ne(buf, NULL);
+	ck_assert_str_eq(buf, "{a: [1, {b: 2}, 3], c: &x !!str 4, d: *x}\n");
+	free(buf);
+
+	fy_document_destroy(fyd);
+}
+END_TEST
+
+START_TEST(doc_tape_keys)
+{
+	struct fy_tape *fytp;
+	struct fy_document *fyd;
+	const char *text;
+	char *yaml, *p, *buf;
+	size_t len;
+	int i, pos;
+
+	/* large enough to be indexed, with a duplicate */
+	yaml = malloc(64 * 16 + 64);
+	ck_assert_ptr_ne(yaml, NULL);
+	p = yaml;
+	p += sprintf(p, "{ \"q\\tx\": \"a\\tb\"");
+	for (i = 0; i < 64; i++)
+		p += sprintf(p, ", k%d: %d", i, i);
+	p += sprintf(p, ", k7: dup }");
+
+	fytp = fy_tape_build_from_string(NULL, yaml);
+	ck_assert_ptr_ne(fytp, NULL);
+	for (i = 0; i < 64; i++) {
+		sprintf(p, "k%d", i);
+		pos = fy_tape_mapping_lookup_by_string(fytp, fy_tape_root(fytp), p);
+		ck_assert_int_ge(pos, 0);
+		text = fy_tape_get_scalar(fytp, pos, &len);
+		ck_assert_int_eq(len, strlen(p + 1));
+		ck_assert(!memcmp(text, p + 1, len));
+	}
+	ck_assert_int_eq(fy_tape_mapping_lookup_by_string(fytp, fy_tape_root(fytp), "k64"), -1);
+
+	/* escaped text is unescaped, both as a key and a value */
+	pos = fy_tape_mapping_lookup_by_string(fytp, fy_tape_root(fytp), "q\tx");
+	ck_assert_int_ge(pos, 0);
+	text = fy_tape_get_scalar(fytp, pos, &len);
+	ck_assert_int_eq(len, 3);
+	ck_assert(!memcmp(text, "a\tb", 3));
+
+	/* a duplicate key fails the conversion */
+	ck_assert_ptr_eq(fy_tape_to_document(fytp), NULL);
+	fy_tape_destroy(fytp);
+
+	fytp = fy_tape_build_from_string(NULL, "a: \"x\\ty\"\nb: |\n  l1\n  l2\nc: [ 'q' ]\n");
+	ck_assert_ptr_ne(fytp, NULL);
+	fyd = fy_tape_to_document(fytp);
+	fy_tape_destroy(fytp);
+	ck_assert_ptr_ne(fyd, NULL);
+
+	ck_assert_str_eq(fy_node_get_scalar0(fy_node_by_path(fy_document_root(fyd), "/b")), "l1\nl2\n");
+
+	buf = fy_emit_document_to_string(fyd, FYECF_MODE_FLOW_ONELINE);
+	ck_assert_ptr_ne(buf, NULL);
+	ck_assert_str_eq(buf, "{a: \"x\\ty\", b: \"l1\\nl2\\n\", c: ['q']}\n");
+	free(buf);
+
+	fy_document_destroy(fyd);
+	free(yaml);
+}
+END_TEST
+
+static char *walk_trace(struct fy_node *fyn, const char *skip_key)
+{
+	struct fy_walk *fyw;
+	const struct fy_walk_event *fywe;
+	const char *text;
+	char *buf, *s;
+
+	buf = malloc(256);
+	ck_assert_ptr_ne(buf, NULL);
+	s = buf;
+
+	fyw = fy_walk_begin(fyn);
+	ck_assert_ptr_ne(fyw, NULL);
+
+	/* one character per event: the scalar itself, or a bracket */
+	while ((fywe = fy_walk_next(fyw)) != NULL) {
+		switch (fy_node_get_type(fywe->fyn)) {
+		case FYNT_SCALAR:
+			if (fywe->type == FYWE_LEAVE)
+				continue;
+			text = fy_node_get_scalar0(fywe->fyn);
+			*s++ = text[0];
+			if (fywe->is_key && skip_key && !strcmp(text, skip_key))
+				*s++ = '!';
+			break;
+		case FYNT_SEQUENCE:
+			*s++ = fywe->type == FYWE_ENTER ? '[' : ']';
+			break;
+		case FYNT_MAPPING:
+			*s++ = fywe->type == FYWE_ENTER ? '{' : '}';
+			break;
+		}
+		*s++ = '0' + fywe->depth;
+
+		/* skip the value of the key */
+		if (fywe->type == FYWE_ENTER && !fywe->is_key && fywe->fynp && skip_key &&
+		    !strcmp(fy_node_get_scalar0(fy_node_pair_key(fywe->fynp)), skip_key))
+			fy_walk_skip_subtree(fyw);
+	}
+	*s = '\0';
+
+	fy_walk_end(fyw);
+
+	return buf;
+}
+
+START_TEST(doc_walk)
+{
+	struct fy_document *fyd;
+	char *trace;
+
+	fyd = fy_document_build_from_string(NULL, "{ a: [ 1, 2 ], b: { c: 3 }, d: 4 }");
+	ck_assert_ptr_ne(fyd, NULL);
+
+	trace = walk_trace(fy_document_root(fyd), NULL);
+	ck_assert_str_eq(trace, "{0a1[11222]1b1{1c232}1d141}0");
+	free(trace);
+
+	trace = walk_trace(fy_document_root(fyd), "b");
+	ck_assert_str_eq(trace, "{0a1[11222]1b!1{1}1d141}0");
+	free(trace);
+
+	/* a walk can start anywhere */
+	trace = walk_trace(fy_node_by_path(fy_document_root(fyd), "/a"), NULL);
+	ck_assert_str_eq(trace, "[01121]0");
+	free(trace);
+
+	fy_document_destroy(fyd);
+}
+END_TEST
+
+static int ypath_collect(struct fy_node *fyn, void *user)
+{
+	char *buf = user;
+
+	if (*buf)
+		strcat(buf, ",");
+	strcat(buf, fy_node_is_scalar(fyn) ? fy_node_get_scalar0(fyn) :
+		    fy_node_is_mapping(fyn) ? "{}" : "[]");
+	return 0;
+}
+
+/* the matches of a query, over the loaded document or streaming */
+static void ypath_check(const char *yaml, const char *expr, bool stream, const char *expected)
+{
+	struct fy_parse_cfg cfg;
+	struct fy_parser *fyp;
+	struct fy_document *fyd;
+	struct fy_ypath *ypath;
+	char buf[256];
+	int count;
+
+	ypath = fy_ypath_compile(expr);
+	ck_assert_ptr_ne(ypath, NULL);
+
+	buf[0] = '\0';
+	if (stream) {
+		memset(&cfg, 0, sizeof(cfg));
+		cfg.flags = FYPCF_QUIET;
+		fyp = fy_parser_create(&cfg);
+		ck_assert_ptr_ne(fyp, NULL);
+		ck_assert_int_eq(fy_parser_set_string(fyp, yaml), 0);
+		count = fy_ypath_exec_parser(ypath, fyp, ypath_collect, buf);
+		fy_parser_destroy(fyp);
+	} else {
+		fyd = fy_document_build_from_string(NULL, yaml);
+		ck_assert_ptr_ne(fyd, NULL);
+		count = fy_ypath_exec(ypath, fy_document_root(fyd), ypath_collect, buf);
+		fy_document_destroy(fyd);
+	}
+	ck_assert_int_ge(count, 0);
+	ck_assert_str_eq(buf, expected);
+
+	fy_ypath_destroy(ypath);
+}
+
+START_TEST(doc_ypath)
+{
+	static const char *yaml =
+		"items:\n"
+		"  - kind: Pod\n"
+		"    metadata: { name: a, labels: { app: web } }\n"
+		"    spec: { containers: [ { name: c1, image: nginx }, { name: c2, image: redis } ] }\n"
+		"  - kind: Service\n"
+		"    metadata: { name: b, labels: { app: db } }\n";
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		ypath_check(yaml, "/items/*/spec/containers/*/image", i, "nginx,redis");
+		ypath_check(yaml, "//labels/app", i, "web,db");
+		ypath_check(yaml, "//name", i, "a,c1,c2,b");
+		ypath_check(yaml, "/items/*[kind=Service]/metadata/name", i, "b");
+		ypath_check(yaml, "//containers/[name=c2]/image", i, "redis");
+		ypath_check(yaml, "/items[-1]/kind", i, "Service");
+		ypath_check(yaml, "/items/[0:1]/kind", i, "Pod");
+		ypath_check(yaml, "/items/[1:]/metadata", i, "{}");
+		ypath_check(yaml, "/items/*/nothing", i, "");
+		ypath_check(yaml, "", i, "{}");
+	}
+
+	/* streaming covers every document */
+	ypath_check("--- { a: 1 }\n--- { b: { a: 2 } }\n--- [ { a: 3 } ]\n", "//a", true, "1,2,3");
+
+	ck_assert_ptr_eq(fy_ypath_compile("/a/[1"), NULL);
+	ck_assert_ptr_eq(fy_ypath_compile("/a/[b]"), NULL);
+	ck_assert_ptr_eq(fy_ypath_compile("/a/'b"), NULL);
+}
+END_TEST
+
+START_TEST(doc_index)
+{
+	struct fy_document *fyd;
+	struct fy_document_index *by_kind, *by_name;
+	struct fy_node *fyn_items, *fyn;
 	void *iter;
-	int ret, count;
+	int count;
 
-	fyd = fy_document_build_from_string(NULL, "{ a: 5, { z: bar }: 1, z: 7, "
-				      "[ a, b, c] : 3, { a: whee } : 2 , "
-				      "b: 6, [ z ]: 4 }");
+	fyd = fy_document_build_from_string(NULL,
+		"items:\n"
+		"  - { kind: Deployment, metadata: { name: a } }\n"
+		"  - { kind: Service, metadata: { name: b } }\n"
+		"  - { kind: Deployment, metadata: { name: c } }\n");
 	ck_assert_ptr_ne(fyd, NULL);
+	fyn_items = fy_node_by_path(fy_document_root(fyd), "/items");
+	ck_assert_ptr_ne(fyn_items, NULL);
 
-	ret = fy_node_sort(fy_document_root(fyd), NULL, NULL);
-	ck_assert_int_eq(ret, 0);
+	by_kind = fy_document_build_index(fyd, "kind");
+	ck_assert_ptr_ne(by_kind, NULL);
+	by_name = fy_document_build_index(fyd, "metadata/name");
+	ck_assert_ptr_ne(by_name, NULL);
 
-	/* check for correct count value */
-	count = fy_node_mapping_item_count(fy_document_root(fyd));
-	ck_assert_int_eq(count, 7);
+	count = 0;
+	iter = NULL;
+	while ((fyn = fy_document_index_iterate(by_kind, "Deployment", (size_t)-1, &iter)) != NULL)
+		count++;
+	ck_assert_int_eq(count, 2);
 
-	/* forward iterator first */
+	fyn = fy_document_index_lookup(by_name, "b", (size_t)-1);
+	ck_assert_ptr_eq(fyn, fy_node_sequence_get_by_index(fyn_items, 1));
+	ck_assert_ptr_eq(fy_document_index_lookup(by_name, "x", (size_t)-1), NULL);
+
+	/* changes made through the node API are picked up */
+	fyn = fy_node_build_from_string(fyd, "{ kind: Deployment, metadata: { name: d } }");
+	ck_assert_ptr_ne(fyn, NULL);
+	ck_assert_int_eq(fy_node_sequence_append(fyn_items, fyn), 0);
+	ck_assert_ptr_eq(fy_document_index_lookup(by_name, "d", (size_t)-1), fyn);
+
+	fyn = fy_node_sequence_remove(fyn_items, fy_node_sequence_get_by_index(fyn_items, 0));
+	ck_assert_ptr_ne(fyn, NULL);
+	fy_node_free(fyn);
+
+	count = 0;
 	iter = NULL;
+	while ((fyn = fy_document_index_iterate(by_kind, "Deployment", (size_t)-1, &iter)) != NULL)
+		count++;
+	ck_assert_int_eq(count, 2);
+	ck_assert_ptr_eq(fy_document_index_lookup(by_name, "a", (size_t)-1), NULL);
 
-	fynp = fy_node_mapping_iterate(fy_document_root(fyd), &iter);
-	ck_assert_ptr_ne(fynp, NULL);
-	ck_assert_str_eq(fy_node_get_scalar0(fy_node_pair_value(fynp)), "1");
+	/* the remaining index goes away with the document */
+	fy_document_index_destroy(by_kind);
+	fy_document_destroy(fyd);
+}
+END_TEST
 
-	fynp = fy_node_mapping_iterate(fy_document_root(fyd), &iter);
-	ck_assert_ptr_ne(fynp, NULL);
-	ck_assert_str_eq(fy_node_get_scalar0(fy_node_pair_value(fynp)), "2");
+/* the number of nodes an index finds for a value */
+static int doc_index_count(struct fy_document_index *fydi, const char *value)
+{
+	void *iter = NULL;
+	int count = 0;
 
-	fynp = fy_node_mapping_iterate(fy_document_root(fyd), &iter);
-	ck_assert_ptr_ne(fynp, NULL);
-	ck_assert_str_eq(fy_node_get_scalar0(fy_node_pair_value(fynp)), "3");
+	while (fy_document_index_iterate(fydi, value, (size_t)-1, &iter) != NULL)
+		count++;
+	return count;
+}
 
-	fynp = fy_node_mapping_iterate(fy_document_root(fyd), &iter);
-	ck_assert_ptr_ne(fynp, NULL);
-	ck_assert_str_eq(fy_node_get_scalar0(fy_node_pair_value(fynp)), "4");
+/* an updated index finds what one built from scratch does */
+static void doc_index_same(struct fy_document *fyd, struct fy_document_index *fydi,
+			   const char *key_path, const char * const *values)
+{
+	struct fy_document_index *fydi_new;
 
-	fynp = fy_node_mapping_iterate(fy_document_root(fyd), &iter);
-	ck_assert_ptr_ne(fynp, NULL);
-	ck_assert_str_eq(fy_node_get_scalar0(fy_node_pair_value(fynp)), "5");
+	fydi_new = fy_document_build_index(fyd, key_path);
+	ck_assert_ptr_ne(fydi_new, NULL);
+	for (; *values; values++)
+		ck_assert_int_eq(doc_index_count(fydi, *values), doc_index_count(fydi_new, *values));
+	fy_document_index_destroy(fydi_new);
+}
 
-	fynp = fy_node_mapping_iterate(fy_document_root(fyd), &iter);
-	ck_assert_ptr_ne(fynp, NULL);
-	ck_assert_str_eq(fy_node_get_scalar0(fy_node_pair_value(fynp)), "6");
+START_TEST(doc_index_update)
+{
+	static const char * const names[] = { "x", "y", "z", "v", "w", NULL };
+	static const char * const tags[] = { "a", "b", "c", NULL };
+	struct fy_document *fyd, *fyd_patch;
+	struct fy_document_index *by_desc, *by_tag;
+	struct fy_node *fyn_root, *fyn_a, *fyn_b, *fyn;
+	void *iter;
+	char *buf, *s;
+	int i, depth;
 
-	fynp = fy_node_mapping_iterate(fy_document_root(fyd), &iter);
+	/* a descendant step finds a value from every collection above it */
+	fyd = fy_document_build_from_string(NULL,
+		"{ a: { name: x, b: { name: y } }, c: [ { name: y } ] }");
+	ck_assert_ptr_ne(fyd, NULL);
+	fyn_root = fy_document_root(fyd);
+	fyn_a = fy_node_by_path(fyn_root, "/a");
+	fyn_b = fy_node_by_path(fyn_root, "/a/b");
+
+	by_desc = fy_document_build_index(fyd, "//name");
+	ck_assert_ptr_ne(by_desc, NULL);
+	ck_assert_int_eq(doc_index_count(by_desc, "x"), 2);
+	ck_assert_int_eq(doc_index_count(by_desc, "y"), 6);
+
+	/* in document order */
+	iter = NULL;
+	ck_assert_ptr_eq(fy_document_index_iterate(by_desc, "y", (size_t)-1, &iter), fyn_root);
+	ck_assert_ptr_eq(fy_document_index_iterate(by_desc, "y", (size_t)-1, &iter), fyn_root);
+	ck_assert_ptr_eq(fy_document_index_iterate(by_desc, "y", (size_t)-1, &iter), fyn_a);
+	ck_assert_ptr_eq(fy_document_index_iterate(by_desc, "y", (size_t)-1, &iter), fyn_b);
+
+	/* a change deep down is seen from all the way up */
+	fyn = fy_node_build_from_string(fyd, "{ name: z }");
+	ck_assert_ptr_ne(fyn, NULL);
+	ck_assert_int_eq(fy_node_mapping_append(fyn_b, fy_node_build_from_string(fyd, "d"), fyn), 0);
+	ck_assert_int_eq(doc_index_count(by_desc, "z"), 4);
+	doc_index_same(fyd, by_desc, "//name", names);
+
+	/* replacing a value drops what was found under the old one */
+	fy_node_pair_set_value(fy_node_mapping_get_by_index(fyn_root, 1),
+			       fy_node_build_from_string(fyd, "{ name: v }"));
+	ck_assert_int_eq(doc_index_count(by_desc, "y"), 3);
+	ck_assert_int_eq(doc_index_count(by_desc, "v"), 2);
+	doc_index_same(fyd, by_desc, "//name", names);
+
+	/* and so does a patch */
+	fyd_patch = fy_document_build_from_string(NULL,
+		"[ { op: replace, path: /a/b, value: { name: w } },"
+		"  { op: remove, path: /a/name } ]");
+	ck_assert_ptr_ne(fyd_patch, NULL);
+	ck_assert_int_eq(fy_document_apply_json_patch(fyd, fy_document_root(fyd_patch)), 0);
+	fy_document_destroy(fyd_patch);
+	ck_assert_int_eq(doc_index_count(by_desc, "x"), 0);
+	ck_assert_int_eq(doc_index_count(by_desc, "z"), 0);
+	ck_assert_int_eq(doc_index_count(by_desc, "w"), 3);
+	doc_index_same(fyd, by_desc, "//name", names);
+
+	fy_document_destroy(fyd);
+
+	/* a deep document is walked once, not from every level */
+	depth = 2000;
+	buf = malloc(depth * 8 + 32);
+	ck_assert_ptr_ne(buf, NULL);
+	for (i = 0, s = buf; i < depth; i++)
+		s += sprintf(s, "{ c: ");
+	s += sprintf(s, "{ name: v }");
+	for (i = 0; i < depth; i++)
+		s += sprintf(s, " }");
+	fyd = fy_document_build_from_string(NULL, buf);
+	ck_assert_ptr_ne(fyd, NULL);
+	by_desc = fy_document_build_index(fyd, "//name");
+	ck_assert_ptr_ne(by_desc, NULL);
+	ck_assert_int_eq(doc_index_count(by_desc, "v"), depth + 1);
+	fy_document_destroy(fyd);
+	free(buf);
+
+	/* many equal values, appended after the last one is removed */
+	buf = malloc(1000 * 16);
+	ck_assert_ptr_ne(buf, NULL);
+	for (i = 0, s = buf; i < 1000; i++)
+		s += sprintf(s, "- { k: same }\n");
+	fyd = fy_document_build_from_string(NULL, buf);
+	ck_assert_ptr_ne(fyd, NULL);
+	fyn_root = fy_document_root(fyd);
+	by_tag = fy_document_build_index(fyd, "k");
+	ck_assert_ptr_ne(by_tag, NULL);
+	ck_assert_int_eq(doc_index_count(by_tag, "same"), 1000);
+
+	fy_node_free(fy_node_sequence_remove(fyn_root, fy_node_sequence_get_by_index(fyn_root, 999)));
+	ck_assert_int_eq(doc_index_count(by_tag, "same"), 999);
+	fyn = fy_node_build_from_string(fyd, "{ k: same }");
+	ck_assert_int_eq(fy_node_sequence_append(fyn_root, fyn), 0);
+	iter = NULL;
+	for (i = 0; (fyn_a = fy_document_index_iterate(by_tag, "same", (size_t)-1, &iter)) != NULL; i++)
+		fyn_b = fyn_a;
+	ck_assert_int_eq(i, 1000);
+	ck_assert_ptr_eq(fyn_b, fyn);
+	fy_document_destroy(fyd);
+	free(buf);
+
+	/* an insertion moves the matches of the positions after it */
+	fyd = fy_document_build_from_string(NULL,
+		"[ { tags: [ a, b ] }, { tags: [ b ] } ]");
+	ck_assert_ptr_ne(fyd, NULL);
+	fyn_root = fy_document_root(fyd);
+	by_tag = fy_document_build_index(fyd, "tags/[0]");
+	ck_assert_ptr_ne(by_tag, NULL);
+	ck_assert_ptr_eq(fy_document_index_lookup(by_tag, "a", (size_t)-1),
+			 fy_node_sequence_get_by_index(fyn_root, 0));
+	ck_assert_int_eq(doc_index_count(by_tag, "b"), 1);
+
+	ck_assert_int_eq(fy_node_sequence_prepend(fy_node_by_path(fyn_root, "/[0]/tags"),
+						  fy_node_build_from_string(fyd, "c")), 0);
+	ck_assert_int_eq(doc_index_count(by_tag, "a"), 0);
+	ck_assert_int_eq(doc_index_count(by_tag, "c"), 1);
+	doc_index_same(fyd, by_tag, "tags/[0]", tags);
+
+	fy_node_free(fy_node_sequence_remove(fy_node_by_path(fyn_root, "/[1]/tags"),
+					     fy_node_by_path(fyn_root, "/[1]/tags/[0]")));
+	ck_assert_int_eq(doc_index_count(by_tag, "b"), 0);
+	doc_index_same(fyd, by_tag, "tags/[0]", tags);
+
+	fy_document_destroy(fyd);
+}
+END_TEST
+
+/* apply a JSON patch and compare the result */
+static void json_patch_check(const char *yaml, const char *patch, const char *expected)
+{
+	struct fy_document *fyd, *fyd_patch, *fyd_expected;
+
+	fyd = fy_document_build_from_string(NULL, yaml);
+	ck_assert_ptr_ne(fyd, NULL);
+	fyd_patch = fy_document_build_from_string(NULL, patch);
+	ck_assert_ptr_ne(fyd_patch, NULL);
+
+	if (expected) {
+		fyd_expected = fy_document_build_from_string(NULL, expected);
+		ck_assert_ptr_ne(fyd_expected, NULL);
+		ck_assert_int_eq(fy_document_apply_json_patch(fyd, fy_document_root(fyd_patch)), 0);
+		ck_assert(fy_node_compare(fy_document_root(fyd), fy_document_root(fyd_expected)));
+		fy_document_destroy(fyd_expected);
+	} else {
+		/* a failed operation leaves the document as it was */
+		fyd_expected = fy_document_build_from_string(NULL, yaml);
+		ck_assert_ptr_ne(fyd_expected, NULL);
+		ck_assert_int_ne(fy_document_apply_json_patch(fyd, fy_document_root(fyd_patch)), 0);
+		ck_assert(fy_node_compare(fy_document_root(fyd), fy_document_root(fyd_expected)));
+		fy_document_destroy(fyd_expected);
+	}
+
+	fy_document_destroy(fyd_patch);
+	fy_document_destroy(fyd);
+}
+
+START_TEST(doc_json_patch)
+{
+	static const char *from =
+		"{ a: { b: 1, c: [ x, y, z ] }, d: \"t~/s\", e: [ 1, 2, 3 ] }";
+	static const char *to =
+		"{ a: { b: 2, c: [ x, z ], n: { m: 1 } }, e: [ 1, 2 ], f: [ 9 ] }";
+	struct fy_document *fyd, *fyd_to, *fyd_patch;
+	char *text;
+	int i, len;
+
+	json_patch_check("{ foo: bar }", "[ { op: add, path: /baz, value: qux } ]",
+			 "{ foo: bar, baz: qux }");
+	json_patch_check("{ foo: [ bar, baz ] }", "[ { op: add, path: /foo/1, value: qux } ]",
+			 "{ foo: [ bar, qux, baz ] }");
+	json_patch_check("{ foo: [ bar ] }", "[ { op: add, path: /foo/-, value: { x: 1 } } ]",
+			 "{ foo: [ bar, { x: 1 } ] }");
+	json_patch_check("{ baz: qux, foo: bar }", "[ { op: remove, path: /baz } ]",
+			 "{ foo: bar }");
+	json_patch_check("{ foo: [ bar, qux, baz ] }", "[ { op: remove, path: /foo/1 } ]",
+			 "{ foo: [ bar, baz ] }");
+	json_patch_check("{ baz: qux, foo: bar }", "[ { op: replace, path: /baz, value: boo } ]",
+			 "{ baz: boo, foo: bar }");
+	json_patch_check("{ foo: { bar: baz, waldo: fred }, qux: { corge: grault } }",
+			 "[ { op: move, from: /foo/waldo, path: /qux/thud } ]",
+			 "{ foo: { bar: baz }, qux: { corge: grault, thud: fred } }");
+	json_patch_check("{ foo: [ all, grass, cows, eat ] }",
+			 "[ { op: move, from: /foo/1, path: /foo/3 } ]",
+			 "{ foo: [ all, cows, eat, grass ] }");
+	json_patch_check("{ foo: bar }", "[ { op: move, from: /foo, path: /foo } ]",
+			 "{ foo: bar }");
+	json_patch_check("{ a: { b: [ 1 ] } }", "[ { op: copy, from: /a/b, path: /c } ]",
+			 "{ a: { b: [ 1 ] }, c: [ 1 ] }");
+	json_patch_check("{ \"a/b\": 1, \"m~n\": 2 }",
+			 "[ { op: test, path: /a~1b, value: 1 }, { op: remove, path: /m~0n } ]",
+			 "{ \"a/b\": 1 }");
+
+	/* failures */
+	json_patch_check("{ baz: qux }", "[ { op: test, path: /baz, value: bar } ]", NULL);
+	json_patch_check("{ foo: bar }", "[ { op: add, path: /baz/bat, value: qux } ]", NULL);
+	json_patch_check("{ foo: bar }", "[ { op: replace, path: /nope, value: qux } ]", NULL);
+	json_patch_check("{ foo: [ 1 ] }", "[ { op: add, path: /foo/5, value: 2 } ]", NULL);
+	json_patch_check("{ foo: { bar: 1 } }", "[ { op: move, from: /foo, path: /foo/bar/x } ]", NULL);
+	json_patch_check("{ foo: bar }", "[ { op: frob, path: /foo } ]", NULL);
+	json_patch_check("{ foo: { bar: 1 }, baz: 2 }",
+			 "[ { op: move, from: /foo/bar, path: /nope/x } ]", NULL);
+	json_patch_check("{ foo: , bar: 1 }", "[ { op: move, from: /foo, path: /bar/x } ]", NULL);
+	/* only the move of the first item makes the destination out of range */
+	json_patch_check("{ foo: [ a, b ] }", "[ { op: move, from: /foo/0, path: /foo/2 } ]", NULL);
+	json_patch_check("{ foo: [ a, b, c ] }", "[ { op: move, from: /foo/1, path: /foo/5 } ]", NULL);
+	/* a move onto itself still needs the source */
+	json_patch_check("{ foo: bar }", "[ { op: move, from: /nope, path: /nope } ]", NULL);
+
+	/* many operations on a big mapping go through its key index */
+	text = malloc(150 * 48);
+	ck_assert_ptr_ne(text, NULL);
+	len = 0;
+	for (i = 0; i < 100; i++)
+		len += sprintf(text + len, "- { op: add, path: /k%d, value: %d }\n", i, i);
+	for (i = 0; i < 100; i += 2)
+		len += sprintf(text + len, "- { op: remove, path: /k%d }\n", i);
+
+	fyd = fy_document_build_from_string(NULL, "{ }");
+	ck_assert_ptr_ne(fyd, NULL);
+	fyd_patch = fy_document_build_from_string(NULL, text);
+	ck_assert_ptr_ne(fyd_patch, NULL);
+	ck_assert_int_eq(fy_document_apply_json_patch(fyd, fy_document_root(fyd_patch)), 0);
+	ck_assert_int_eq(fy_node_mapping_item_count(fy_document_root(fyd)), 50);
+	ck_assert_ptr_eq(fy_node_by_path(fy_document_root(fyd), "/k10"), NULL);
+	ck_assert_ptr_ne(fy_node_by_path(fy_document_root(fyd), "/k11"), NULL);
+	fy_document_destroy(fyd_patch);
+
+	/* a failed move out of the indexed mapping keeps the key findable */
+	fyd_patch = fy_document_build_from_string(NULL,
+			"[ { op: move, from: /k11, path: /k13/x } ]");
+	ck_assert_ptr_ne(fyd_patch, NULL);
+	ck_assert_int_ne(fy_document_apply_json_patch(fyd, fy_document_root(fyd_patch)), 0);
+	ck_assert_int_eq(fy_node_mapping_item_count(fy_document_root(fyd)), 50);
+	ck_assert_str_eq(fy_node_get_scalar0(fy_node_by_path(fy_document_root(fyd), "/k11")), "11");
+	fy_document_destroy(fyd_patch);
+
+	fy_document_destroy(fyd);
+	free(text);
+
+	/* the diff patches one into the other */
+	fyd = fy_document_build_from_string(NULL, from);
+	ck_assert_ptr_ne(fyd, NULL);
+	fyd_to = fy_document_build_from_string(NULL, to);
+	ck_assert_ptr_ne(fyd_to, NULL);
+
+	fyd_patch = fy_node_diff_json_patch(fy_document_root(fyd), fy_document_root(fyd_to));
+	ck_assert_ptr_ne(fyd_patch, NULL);
+	ck_assert_int_eq(fy_document_apply_json_patch(fyd, fy_document_root(fyd_patch)), 0);
+	ck_assert(fy_node_compare(fy_document_root(fyd), fy_document_root(fyd_to)));
+	fy_document_destroy(fyd_patch);
+
+	/* and there's nothing left to patch */
+	fyd_patch = fy_node_diff_json_patch(fy_document_root(fyd), fy_document_root(fyd_to));
+	ck_assert_ptr_ne(fyd_patch, NULL);
+	ck_assert_int_eq(fy_node_sequence_item_count(fy_document_root(fyd_patch)), 0);
+	fy_document_destroy(fyd_patch);
+
+	fy_document_destroy(fyd_to);
+	fy_document_destroy(fyd);
+}
+END_TEST
+
+START_TEST(doc_merge_patch)
+{
+	static const struct {
+		const char *target, *patch, *result;
+	} tests[] = {
+		/* the example and test cases of RFC 7386 */
+		{ "{ title: Goodbye!, author: { givenName: John, familyName: Doe },"
+		  "  tags: [ example, sample ], content: This will be unchanged }",
+		  "{ title: Hello!, phoneNumber: +01-123-456-7890, author: { familyName: null },"
+		  "  tags: [ example ] }",
+		  "{ title: Hello!, author: { givenName: John }, tags: [ example ],"
+		  "  content: This will be unchanged, phoneNumber: +01-123-456-7890 }" },
+		{ "{ a: b }", "{ a: c }", "{ a: c }" },
+		{ "{ a: b }", "{ b: c }", "{ a: b, b: c }" },
+		{ "{ a: b }", "{ a: null }", "{ }" },
+		{ "{ a: [ b ] }", "{ a: c }", "{ a: c }" },
+		{ "{ a: c }", "{ a: [ b ] }", "{ a: [ b ] }" },
+		{ "{ a: { b: c } }", "{ a: { b: d, c: null } }", "{ a: { b: d } }" },
+		{ "[ a, b ]", "[ c, d ]", "[ c, d ]" },
+		{ "{ a: b }", "[ c ]", "[ c ]" },
+		{ "{ e: null }", "{ a: 1 }", "{ e: null, a: 1 }" },
+		{ "[ 1, 2 ]", "{ a: b, c: null }", "{ a: b }" },
+		{ "{ }", "{ a: { bb: { ccc: null } } }", "{ a: { bb: { } } }" },
+	};
+	struct fy_document *fyd, *fyd_patch, *fyd_expected;
+	struct fy_node *fyn;
+	unsigned int i;
+
+	for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+		fyd = fy_document_build_from_string(NULL, tests[i].target);
+		ck_assert_ptr_ne(fyd, NULL);
+		fyd_patch = fy_document_build_from_string(NULL, tests[i].patch);
+		ck_assert_ptr_ne(fyd_patch, NULL);
+		fyd_expected = fy_document_build_from_string(NULL, tests[i].result);
+		ck_assert_ptr_ne(fyd_expected, NULL);
+
+		fyn = fy_node_apply_merge_patch(fy_document_root(fyd), fy_document_root(fyd_patch));
+		ck_assert_ptr_ne(fyn, NULL);
+		ck_assert_ptr_eq(fyn, fy_document_root(fyd));
+		ck_assert(fy_node_compare(fy_document_root(fyd), fy_document_root(fyd_expected)));
+
+		fy_document_destroy(fyd_expected);
+		fy_document_destroy(fyd_patch);
+		fy_document_destroy(fyd);
+	}
+
+	/* a merge below the root replaces the node in its parent */
+	fyd = fy_document_build_from_string(NULL, "{ a: [ 1 ], b: 2 }");
+	ck_assert_ptr_ne(fyd, NULL);
+	fyd_patch = fy_document_build_from_string(NULL, "{ x: 1 }");
+	ck_assert_ptr_ne(fyd_patch, NULL);
+	fyn = fy_node_apply_merge_patch(fy_node_by_path(fy_document_root(fyd), "/a"),
+					fy_document_root(fyd_patch));
+	ck_assert_ptr_ne(fyn, NULL);
+	ck_assert_ptr_eq(fy_node_by_path(fy_document_root(fyd), "/a"), fyn);
+	ck_assert_ptr_ne(fy_node_by_path(fy_document_root(fyd), "/a/x"), NULL);
+	fy_document_destroy(fyd_patch);
+	fy_document_destroy(fyd);
+}
+END_TEST
+
+static void ordered_check(struct fy_node *fyn, const char *prefix,
+			  const char *first, const char *last, const char *expected)
+{
+	struct fy_node_pair *fynp;
+	void *iter = NULL;
+	char buf[256];
+	const char *key;
+	size_t len, pos = 0;
+
+	buf[0] = '\0';
+	for (;;) {
+		if (prefix)
+			fynp = fy_node_mapping_lookup_prefix(fyn, prefix, (size_t)-1, &iter);
+		else
+			fynp = fy_node_mapping_range_iterate(fyn, first, (size_t)-1,
+							     last, (size_t)-1, &iter);
+		if (!fynp)
+			break;
+		key = fy_node_get_scalar(fy_node_pair_key(fynp), &len);
+		ck_assert_ptr_ne(key, NULL);
+		ck_assert(pos + len + 2 < sizeof(buf));
+		pos += snprintf(buf + pos, sizeof(buf) - pos, "%s%.*s",
+				pos ? " " : "", (int)len, key);
+	}
+	ck_assert_str_eq(buf, expected);
+}
+
+START_TEST(doc_ordered_index)
+{
+	struct fy_document *fyd;
+	struct fy_node *fyn;
+	struct fy_node_pair *fynp;
+	void *iter;
+
+	fyd = fy_document_build_from_string(NULL,
+		"svc.b.timeout: 1\n"
+		"svc.a.retries: 2\n"
+		"other: 3\n"
+		"svc.a.timeout: 4\n"
+		"svc: 5\n"
+		"[ complex ]: 6\n"
+		"svcz: 7\n");
+	ck_assert_ptr_ne(fyd, NULL);
+	fyn = fy_document_root(fyd);
+
+	/* prefix scans in key order, the complex key is skipped */
+	ordered_check(fyn, "svc.", NULL, NULL, "svc.a.retries svc.a.timeout svc.b.timeout");
+	ordered_check(fyn, "svc.a.", NULL, NULL, "svc.a.retries svc.a.timeout");
+	ordered_check(fyn, "svc", NULL, NULL, "svc svc.a.retries svc.a.timeout svc.b.timeout svcz");
+	ordered_check(fyn, "nope", NULL, NULL, "");
+	ordered_check(fyn, "", NULL, NULL, "other svc svc.a.retries svc.a.timeout svc.b.timeout svcz");
+
+	/* ranges are half open, NULL bounds are open ended */
+	ordered_check(fyn, NULL, "svc.a", "svc.b", "svc.a.retries svc.a.timeout");
+	ordered_check(fyn, NULL, "svc.b.timeout", NULL, "svc.b.timeout svcz");
+	ordered_check(fyn, NULL, NULL, "svc", "other");
+	ordered_check(fyn, NULL, NULL, NULL, "other svc svc.a.retries svc.a.timeout svc.b.timeout svcz");
+
+	/* the index follows modifications */
+	ck_assert_int_eq(fy_node_mapping_create_ordered_index(fyn), 0);
+	ck_assert_int_eq(fy_node_mapping_append(fyn,
+				fy_node_build_from_string(fyd, "svc.a.delay"),
+				fy_node_build_from_string(fyd, "8")), 0);
+	fy_node_free(fy_node_mapping_remove_by_key(fyn,
+				fy_node_build_from_string(fyd, "svc.b.timeout")));
+	ordered_check(fyn, "svc.", NULL, NULL, "svc.a.delay svc.a.retries svc.a.timeout");
+
+	/* a modification ends an iteration */
+	iter = NULL;
+	ck_assert_ptr_ne(fy_node_mapping_lookup_prefix(fyn, "svc.", (size_t)-1, &iter), NULL);
+	ck_assert_int_eq(fy_node_mapping_append(fyn,
+				fy_node_build_from_string(fyd, "svc.c"),
+				fy_node_build_from_string(fyd, "9")), 0);
+	ck_assert_ptr_eq(fy_node_mapping_lookup_prefix(fyn, "svc.", (size_t)-1, &iter), NULL);
+
+	/* the order of the pairs is not affected */
+	iter = NULL;
+	fynp = fy_node_mapping_iterate(fyn, &iter);
 	ck_assert_ptr_ne(fynp, NULL);
-	ck_assert_str_eq(fy_node_get_scalar0(fy_node_pair_value(fynp)), "7");
+	ck_assert_str_eq(fy_node_get_scalar0(fy_node_pair_key(fynp)), "svc.a.retries");
+
+	/* not a mapping */
+	iter = NULL;
+	ck_assert_ptr_eq(fy_node_mapping_lookup_prefix(fy_node_by_path(fyn, "/other"),
+						       "x", (size_t)-1, &iter), NULL);
+	ck_assert_int_eq(fy_node_mapping_create_ordered_index(fy_node_by_path(fyn, "/other")), -1);
+
+	/* indexed mappings can be freed before the document */
+	fy_node_mapping_destroy_ordered_index(fyn);
+	ck_assert_int_eq(fy_node_mapping_create_ordered_index(fyn), 0);
+	fy_document_set_root(fyd, fy_node_build_from_string(fyd, "{ k: v }"));
+	ordered_check(fy_document_root(fyd), "k", NULL, NULL, "k");
+
+	fy_document_destroy(fyd);
+}
+END_TEST
 
+struct event_output {
+	char *buf;
+	size_t len;
+	size_t alloc;
+};
+
+static int event_output_fn(struct fy_emitter *emit, enum fy_emitter_write_type type,
+			   const char *str, int len, void *userdata)
+{
+	struct event_output *out = userdata;
+	char *buf;
+
+	if (out->len + len + 1 > out->alloc) {
+		out->alloc = (out->len + len + 1) * 2;
+		buf = realloc(out->buf, out->alloc);
+		ck_assert_ptr_ne(buf, NULL);
+		out->buf = buf;
+	}
+	memcpy(out->buf + out->len, str, len);
+	out->len += len;
+	out->buf[out->len] = '\0';
+	return len;
+}
+
+START_TEST(emit_event)
+{
+	static const char *inputs[] = {
+		"a: 1\nb: [ 1, 2 ]\nc: { x: y }\n",
+		"- a\n- - b\n  - c\n- {}\n- []\n- k: v\n  l: w\n",
+		"&a x: 1\n*a : 2\nt: !!str 3\n",
+		"? [ complex, key ]\n: value\n? { }\n: empty\n",
+		"text: |\n  literal\n  lines\nfolded: >\n  folded\n",
+		"%YAML 1.2\n---\nplain\n...\n",
+		"'single': \"double\"\n",
+		"[ a, { b: c }, [ d ] ]\n",
+	};
+	static const enum fy_emitter_cfg_flags modes[] = {
+		FYECF_DEFAULT,
+		FYECF_MODE_BLOCK,
+		FYECF_MODE_FLOW,
+		FYECF_MODE_JSON,
+	};
+	static const struct fy_parse_cfg cfg = { .flags = FYPCF_QUIET };
+	struct fy_emitter_cfg ecfg;
+	struct fy_emitter *emit;
+	struct fy_parser *fyp;
+	struct fy_event *fye;
+	struct fy_document *fyd;
+	struct event_output out;
+	char *expected;
+	unsigned int i, j;
+	int rc;
+
+	for (j = 0; j < sizeof(modes) / sizeof(modes[0]); j++) {
+		for (i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+
+			/* alias keys and tags do not exist in JSON */
+			if (modes[j] == FYECF_MODE_JSON && i == 2)
+				continue;
+
+			fyd = fy_document_build_from_string(NULL, inputs[i]);
+			ck_assert_ptr_ne(fyd, NULL);
+			expected = fy_emit_document_to_string(fyd, modes[j]);
+			ck_assert_ptr_ne(expected, NULL);
+			fy_document_destroy(fyd);
+
+			memset(&out, 0, sizeof(out));
+			memset(&ecfg, 0, sizeof(ecfg));
+			ecfg.flags = modes[j];
+			ecfg.output = event_output_fn;
+			ecfg.userdata = &out;
+			emit = fy_emitter_create(&ecfg);
+			ck_assert_ptr_ne(emit, NULL);
+
+			fyp = fy_parser_create(&cfg);
+			ck_assert_ptr_ne(fyp, NULL);
+			rc = fy_parser_set_string(fyp, inputs[i]);
+			ck_assert_int_eq(rc, 0);
+
+			while ((fye = fy_parser_parse(fyp)) != NULL) {
+				rc = fy_emit_event(emit, fye);
+				ck_assert_int_eq(rc, 0);
+				fy_parser_event_free(fyp, fye);
+			}
+
+			/* the same output as emitting the document */
+			ck_assert_ptr_ne(out.buf, NULL);
+			ck_assert_str_eq(out.buf, expected);
+
+			fy_parser_destroy(fyp);
+			fy_emitter_destroy(emit);
+			free(out.buf);
+			free(expected);
+		}
+	}
+}
+END_TEST
+
+struct pipeline_redact {
+	bool redact_next;
+};
+
+/* drop the drop keys */
+static int pipeline_drop(struct fy_pipeline_stage *stage, struct fy_event *fye, void *user)
+{
+	if (fye->type == FYET_SCALAR && fy_pipeline_stage_is_key(stage) &&
+	    !strcmp(fy_token_get_text0(fye->scalar.value), "drop")) {
+		fy_pipeline_stage_skip(stage);
+		return 0;
+	}
+	return fy_pipeline_stage_forward(stage, fye);
+}
+
+/* rename the old keys */
+static int pipeline_rename(struct fy_pipeline_stage *stage, struct fy_event *fye, void *user)
+{
+	if (fye->type == FYET_SCALAR && fy_pipeline_stage_is_key(stage) &&
+	    !strcmp(fy_token_get_text0(fye->scalar.value), "old"))
+		return fy_pipeline_stage_inject_scalar(stage, "new", (size_t)-1, FYSS_ANY);
+	return fy_pipeline_stage_forward(stage, fye);
+}
+
+/* redact the values of the password keys */
+static int pipeline_redact(struct fy_pipeline_stage *stage, struct fy_event *fye, void *user)
+{
+	struct pipeline_redact *r = user;
+
+	if (r->redact_next) {
+		r->redact_next = false;
+		if (fye->type == FYET_SCALAR)
+			return fy_pipeline_stage_inject_scalar(stage, "xxx", (size_t)-1, FYSS_ANY);
+	}
+	if (fye->type == FYET_SCALAR && fy_pipeline_stage_is_key(stage) &&
+	    !strcmp(fy_token_get_text0(fye->scalar.value), "password"))
+		r->redact_next = true;
+	return fy_pipeline_stage_forward(stage, fye);
+}
+
+/* add a version to the top level mapping */
+static int pipeline_default(struct fy_pipeline_stage *stage, struct fy_event *fye, void *user)
+{
+	int rc;
+
+	if (fye->type == FYET_MAPPING_END && fy_pipeline_stage_depth(stage) == 0) {
+		rc = fy_pipeline_stage_inject_scalar(stage, "version", (size_t)-1, FYSS_ANY);
+		if (!rc)
+			rc = fy_pipeline_stage_inject(stage, FYET_SEQUENCE_START);
+		if (!rc)
+			rc = fy_pipeline_stage_inject_scalar(stage, "1.0", (size_t)-1, FYSS_SINGLE_QUOTED);
+		if (!rc)
+			rc = fy_pipeline_stage_inject(stage, FYET_SEQUENCE_END);
+		if (rc)
+			return rc;
+	}
+	return fy_pipeline_stage_forward(stage, fye);
+}
+
+static int pipeline_fail(struct fy_pipeline_stage *stage, struct fy_event *fye, void *user)
+{
+	return fye->type == FYET_SCALAR ? -1 : fy_pipeline_stage_forward(stage, fye);
+}
+
+START_TEST(emit_auto_anchors)
+{
+	static const char *yaml =
+		"a: { x: 1, y: [ 2, 3 ] }\n"
+		"b: { x: 1, y: [ 2, 3 ] }\n"
+		"c: { x: 1, y: [ 2, 3 ] }\n"
+		"d: [ 2, 3 ]\n"
+		"e: &keep { x: 1, y: [ 2, 3 ] }\n"
+		"f: *keep\n";
+	struct fy_parse_cfg cfg;
+	struct fy_emitter_cfg ecfg;
+	struct fy_emitter *emit;
+	struct fy_document *fyd, *fyd_out;
+	struct event_output out;
+	char *output, *expanded;
+	int rc;
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.flags = FYPCF_QUIET | FYPCF_RESOLVE_DOCUMENT;
+
+	fyd = fy_document_build_from_string(NULL, yaml);
+	ck_assert_ptr_ne(fyd, NULL);
+
+	/* the sequences are too small by default, the anchored ones stay */
+	output = fy_emit_document_to_string(fyd, FYECF_MODE_FLOW_ONELINE | FYECF_WIDTH_INF |
+						 FYECF_AUTO_ANCHORS);
+	ck_assert_ptr_ne(output, NULL);
+	ck_assert_str_eq(output,
+			"{a: &a1 {x: 1, y: [2, 3]}, b: *a1, c: *a1, d: [2, 3], "
+			"e: &keep {x: 1, y: [2, 3]}, f: *keep}\n");
+
+	/* and it's the same content */
+	fyd_out = fy_document_build_from_string(&cfg, output);
+	ck_assert_ptr_ne(fyd_out, NULL);
+	expanded = fy_emit_document_to_string(fyd, FYECF_MODE_FLOW_ONELINE | FYECF_WIDTH_INF |
+						   FYECF_EXPAND_ALIASES);
+	ck_assert_ptr_ne(expanded, NULL);
+	ck_assert(fy_node_compare_string(fy_document_root(fyd_out), expanded));
+	fy_document_destroy(fyd_out);
+	free(expanded);
+	free(output);
+
+	/* with a lower threshold the sequences are shared too */
+	memset(&out, 0, sizeof(out));
+	memset(&ecfg, 0, sizeof(ecfg));
+	ecfg.flags = FYECF_MODE_FLOW_ONELINE | FYECF_WIDTH_INF | FYECF_AUTO_ANCHORS;
+	ecfg.output = event_output_fn;
+	ecfg.userdata = &out;
+	ecfg.auto_anchor_min = 3;
+	emit = fy_emitter_create(&ecfg);
+	ck_assert_ptr_ne(emit, NULL);
+	rc = fy_emit_document(emit, fyd);
+	ck_assert_int_eq(rc, 0);
+	fy_emitter_destroy(emit);
+	ck_assert_ptr_ne(out.buf, NULL);
+	ck_assert_str_eq(out.buf,
+			"{a: &a1 {x: 1, y: &a2 [2, 3]}, b: *a1, c: *a1, d: *a2, "
+			"e: &keep {x: 1, y: *a2}, f: *keep}\n");
+	free(out.buf);
+
+	/* expanding the aliases instead */
+	output = fy_emit_document_to_string(fyd, FYECF_MODE_FLOW_ONELINE | FYECF_WIDTH_INF |
+						 FYECF_EXPAND_ALIASES);
+	ck_assert_ptr_ne(output, NULL);
+	ck_assert_str_eq(output,
+			"{a: {x: 1, y: [2, 3]}, b: {x: 1, y: [2, 3]}, c: {x: 1, y: [2, 3]}, "
+			"d: [2, 3], e: &keep {x: 1, y: [2, 3]}, f: {x: 1, y: [2, 3]}}\n");
+	free(output);
+
+	fy_document_destroy(fyd);
+
+	/* generated names do not clash with the document's */
+	fyd = fy_document_build_from_string(NULL,
+			"- &a1 x\n- [ p, q, r ]\n- [ p, q, r ]\n- *a1\n");
+	ck_assert_ptr_ne(fyd, NULL);
+	output = fy_emit_document_to_string(fyd, FYECF_MODE_FLOW_ONELINE | FYECF_WIDTH_INF |
+						 FYECF_AUTO_ANCHORS);
+	ck_assert_ptr_ne(output, NULL);
+	ck_assert_str_eq(output, "[&a1 x, &a2 [p, q, r], *a2, *a1]\n");
+	free(output);
+	fy_document_destroy(fyd);
+
+	/* nothing inside an alias gets an anchor, nor what can't be aliased */
+	fyd = fy_document_build_from_string(NULL,
+			"- { x: [ p, q, r ], y: 1 }\n- { x: [ p, q, r ], y: 1 }\n"
+			"- [ s, t, u ]\n- &k [ s, t, u ]\n");
+	ck_assert_ptr_ne(fyd, NULL);
+	output = fy_emit_document_to_string(fyd, FYECF_MODE_FLOW_ONELINE | FYECF_WIDTH_INF |
+						 FYECF_AUTO_ANCHORS);
+	ck_assert_ptr_ne(output, NULL);
+	ck_assert_str_eq(output, "[&a1 {x: [p, q, r], y: 1}, *a1, [s, t, u], &k [s, t, u]]\n");
+	free(output);
+	fy_document_destroy(fyd);
+
+	/* a copy of an anchored subtree refers to the existing anchor */
+	fyd = fy_document_build_from_string(NULL,
+			"- &foo [ p, q, r ]\n- [ p, q, r ]\n- { a: [ p, q, r ] }\n");
+	ck_assert_ptr_ne(fyd, NULL);
+	output = fy_emit_document_to_string(fyd, FYECF_MODE_FLOW_ONELINE | FYECF_WIDTH_INF |
+						 FYECF_AUTO_ANCHORS);
+	ck_assert_ptr_ne(output, NULL);
+	ck_assert_str_eq(output, "[&foo [p, q, r], *foo, {a: *foo}]\n");
+	free(output);
+	fy_document_destroy(fyd);
+}
+END_TEST
+
+START_TEST(event_pipeline)
+{
+	static const struct fy_parse_cfg cfg = { .flags = FYPCF_QUIET };
+	struct pipeline_redact redact;
+	struct fy_emitter_cfg ecfg;
+	struct fy_emitter *emit;
+	struct fy_parser *fyp;
+	struct fy_pipeline *fypl;
+	struct event_output out;
+	int rc;
+
+	memset(&out, 0, sizeof(out));
+	memset(&ecfg, 0, sizeof(ecfg));
+	ecfg.flags = FYECF_DEFAULT;
+	ecfg.output = event_output_fn;
+	ecfg.userdata = &out;
+	emit = fy_emitter_create(&ecfg);
+	ck_assert_ptr_ne(emit, NULL);
+
+	fyp = fy_parser_create(&cfg);
+	ck_assert_ptr_ne(fyp, NULL);
+	rc = fy_parser_set_string(fyp,
+		"name: svc\n"
+		"password: hunter2\n"
+		"old: 1\n"
+		"nested:\n"
+		"  password: [ not, scalar ]\n"
+		"  drop: { a: 1, b: [ 2, 3 ] }\n"
+		"  keep: 2\n"
+		"  drop: 3\n"
+		"list: [ drop, old ]\n"
+		"---\n"
+		"other: doc\n");
+	ck_assert_int_eq(rc, 0);
+
+	fypl = fy_pipeline_create(fyp, emit);
+	ck_assert_ptr_ne(fypl, NULL);
+	memset(&redact, 0, sizeof(redact));
+	ck_assert_ptr_ne(fy_pipeline_add_stage(fypl, pipeline_drop, NULL), NULL);
+	ck_assert_ptr_ne(fy_pipeline_add_stage(fypl, pipeline_rename, NULL), NULL);
+	ck_assert_ptr_ne(fy_pipeline_add_stage(fypl, pipeline_redact, &redact), NULL);
+	ck_assert_ptr_ne(fy_pipeline_add_stage(fypl, pipeline_default, NULL), NULL);
+
+	rc = fy_pipeline_run(fypl);
+	ck_assert_int_eq(rc, 0);
+
+	ck_assert_ptr_ne(out.buf, NULL);
+	ck_assert_str_eq(out.buf,
+		"name: svc\n"
+		"password: xxx\n"
+		"new: 1\n"
+		"nested:\n"
+		"  password: [\n"
+		"      not,\n"
+		"      scalar\n"
+		"    ]\n"
+		"  keep: 2\n"
+		"list: [\n"
+		"    drop,\n"
+		"    old\n"
+		"  ]\n"
+		"version:\n"
+		"- '1.0'\n"
+		"---\n"
+		"other: doc\n"
+		"version:\n"
+		"- '1.0'\n");
+
+	fy_pipeline_destroy(fypl);
+	fy_parser_destroy(fyp);
+	free(out.buf);
+
+	/* stage errors stop the pipeline */
+	fyp = fy_parser_create(&cfg);
+	ck_assert_ptr_ne(fyp, NULL);
+	rc = fy_parser_set_string(fyp, "a: b\n");
+	ck_assert_int_eq(rc, 0);
+	fypl = fy_pipeline_create(fyp, NULL);
+	ck_assert_ptr_ne(fypl, NULL);
+	ck_assert_ptr_ne(fy_pipeline_add_stage(fypl, pipeline_fail, NULL), NULL);
+	ck_assert_int_eq(fy_pipeline_run(fypl), -1);
+	fy_pipeline_destroy(fypl);
+	fy_parser_destroy(fyp);
+
+	fy_emitter_destroy(emit);
+}
+END_TEST
+
+static int schema_check(struct fy_schema *fysc, const char *yaml, struct diag_capture *dc)
+{
+	struct fy_parse_cfg cfg;
+	struct fy_parser *fyp;
+	int rc;
+
+	memset(dc, 0, sizeof(*dc));
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.flags = FYPCF_QUIET;
+	cfg.userdata = dc;
+	cfg.diag = diag_capture_cb;
+
+	fyp = fy_parser_create(&cfg);
+	ck_assert_ptr_ne(fyp, NULL);
+	rc = fy_parser_set_string(fyp, yaml);
+	ck_assert_int_eq(rc, 0);
+
+	rc = fy_schema_validate_parser(fysc, fyp);
+
+	fy_parser_destroy(fyp);
+
+	return rc;
+}
+
+START_TEST(schema_validate)
+{
+	struct fy_document *fyd;
+	struct fy_schema *fysc;
+	struct diag_capture dc;
+
+	fyd = fy_document_build_from_string(NULL,
+		"type: object\n"
+		"required: [ name, port ]\n"
+		"additionalProperties: false\n"
+		"properties:\n"
+		"  name: { type: string, minLength: 1, pattern: '^[a-z]+$' }\n"
+		"  port: { type: integer, minimum: 1, exclusiveMaximum: 65536 }\n"
+		"  ratio: { type: number, maximum: 1 }\n"
+		"  mode: { enum: [ fast, slow ] }\n"
+		"  tags:\n"
+		"    type: array\n"
+		"    maxItems: 2\n"
+		"    items: { type: string }\n"
+		"  extra: { }\n");
+	ck_assert_ptr_ne(fyd, NULL);
+	fysc = fy_schema_compile(fy_document_root(fyd));
+	ck_assert_ptr_ne(fysc, NULL);
+	/* the schema is not referenced */
+	fy_document_destroy(fyd);
+
+	/* valid documents */
+	ck_assert_int_eq(schema_check(fysc,
+		"name: web\n"
+		"port: 0x50\n"
+		"ratio: 0.5\n"
+		"mode: fast\n"
+		"tags: [ a, b ]\n"
+		"extra: { anything: [ 1, { goes: true } ] }\n"
+		"---\n"
+		"{ port: 443, name: tls }\n", &dc), 0);
+	ck_assert_int_eq(dc.count, 0);
+
+	/* wrong type, reported at the value */
+	ck_assert_int_eq(schema_check(fysc,
+		"name: web\n"
+		"port: eighty\n", &dc), -1);
+	ck_assert_int_eq(dc.count, 1);
+	ck_assert_int_eq(dc.start_mark.line, 1);
+	ck_assert_int_eq(dc.start_mark.column, 6);
+
+	/* out of range */
+	ck_assert_int_eq(schema_check(fysc, "name: web\nport: 65536\n", &dc), -1);
+	ck_assert_int_eq(dc.start_mark.line, 1);
+	ck_assert_int_eq(schema_check(fysc, "name: web\nport: 80\nratio: 1.5\n", &dc), -1);
+	ck_assert_int_eq(dc.start_mark.line, 2);
+
+	/* enum, pattern and length */
+	ck_assert_int_eq(schema_check(fysc, "name: web\nport: 80\nmode: slower\n", &dc), -1);
+	ck_assert_int_eq(dc.start_mark.line, 2);
+	ck_assert_int_eq(schema_check(fysc, "name: Web\nport: 80\n", &dc), -1);
+	ck_assert_int_eq(dc.start_mark.line, 0);
+	ck_assert_int_eq(schema_check(fysc, "name: ''\nport: 80\n", &dc), -1);
+
+	/* arrays */
+	ck_assert_int_eq(schema_check(fysc, "name: web\nport: 80\ntags: [ a, b, c ]\n", &dc), -1);
+	ck_assert_int_eq(dc.start_mark.line, 2);
+	ck_assert_int_eq(dc.start_mark.column, 14);
+	ck_assert_int_eq(schema_check(fysc, "name: web\nport: 80\ntags: [ a, 1 ]\n", &dc), -1);
+
+	/* unexpected and missing keys */
+	ck_assert_int_eq(schema_check(fysc, "name: web\nprot: 80\n", &dc), -1);
+	ck_assert_int_eq(dc.start_mark.line, 1);
+	ck_assert_int_eq(dc.start_mark.column, 0);
+	ck_assert_int_eq(schema_check(fysc, "---\nname: web\n", &dc), -1);
+	ck_assert_int_eq(dc.start_mark.line, 1);
+
+	/* the first error stops validation, later documents are not parsed */
+	ck_assert_int_eq(schema_check(fysc,
+		"name: web\n"
+		"port: -1\n"
+		"---\n"
+		"[ not, even, valid\n", &dc), -1);
+	ck_assert_int_eq(dc.count, 1);
+	ck_assert_int_eq(dc.start_mark.line, 1);
+
+	/* parse errors fail too */
+	ck_assert_int_eq(schema_check(fysc, "name: [ web\n", &dc), -1);
+
+	fy_schema_destroy(fysc);
+
+	/* invalid schemas */
+	fyd = fy_document_build_from_string(NULL, "type: widget\n");
+	ck_assert_ptr_ne(fyd, NULL);
+	ck_assert_ptr_eq(fy_schema_compile(fy_document_root(fyd)), NULL);
+	fy_document_destroy(fyd);
+
+	fyd = fy_document_build_from_string(NULL, "{ minimum: low }\n");
+	ck_assert_ptr_ne(fyd, NULL);
+	ck_assert_ptr_eq(fy_schema_compile(fy_document_root(fyd)), NULL);
 	fy_document_destroy(fyd);
 }
 END_TEST
@@ -840,6 +3418,113 @@ START_TEST(doc_join_seq_to_map)
 }
 END_TEST
 
+START_TEST(doc_join_move)
+{
+	struct fy_document *fyd_tgt, *fyd_tgt2, *fyd_src;
+	struct fy_node *fyn;
+	char *output;
+	int ret;
+
+	fyd_tgt = fy_document_build_from_string(NULL, "{ foo: [ 1 ], bar: baz }");
+	ck_assert_ptr_ne(fyd_tgt, NULL);
+
+	/* sequences are appended, the source goes right away */
+	fyd_src = fy_document_build_from_string(NULL, "[ &a 2, *a, { x: y } ]");
+	ck_assert_ptr_ne(fyd_src, NULL);
+	ret = fy_node_insert_move(fy_node_by_path(fy_document_root(fyd_tgt), "/foo"),
+				  fy_document_root(fyd_src));
+	ck_assert_int_eq(ret, 0);
+	ck_assert_ptr_eq(fy_document_root(fyd_src), NULL);
+	fy_document_destroy(fyd_src);
+
+	/* mappings are merged */
+	fyd_src = fy_document_build_from_string(NULL, "{ bar: qux, baz: [ 3 ] }");
+	ck_assert_ptr_ne(fyd_src, NULL);
+	ret = fy_node_insert_move(fy_document_root(fyd_tgt), fy_document_root(fyd_src));
+	ck_assert_int_eq(ret, 0);
+	fy_document_destroy(fyd_src);
+
+	/* the anchor came along */
+	ck_assert_ptr_ne(fy_document_lookup_anchor(fyd_tgt, "a"), NULL);
+	output = fy_emit_document_to_string(fyd_tgt, FYECF_MODE_FLOW_ONELINE | FYECF_WIDTH_INF);
+	ck_assert_ptr_ne(output, NULL);
+	ck_assert_str_eq(output, "{foo: [1, &a 2, *a, {x: y}], bar: qux, baz: [3]}\n");
+	free(output);
+
+	/* anchors follow their nodes, but not over a name already taken */
+	fyd_src = fy_document_build_from_string(NULL, "[ &a dup, &c { k: &d v } ]");
+	ck_assert_ptr_ne(fyd_src, NULL);
+	fyn = fy_node_steal(fyd_tgt, fy_document_root(fyd_src));
+	ck_assert_ptr_ne(fyn, NULL);
+	ck_assert_ptr_eq(fy_document_lookup_anchor(fyd_src, "c"), NULL);
+	fy_document_destroy(fyd_src);
+	ck_assert_str_eq(fy_node_get_scalar0(fy_anchor_node(fy_document_lookup_anchor(fyd_tgt, "a"))), "2");
+	ck_assert_ptr_eq(fy_anchor_node(fy_document_lookup_anchor(fyd_tgt, "c")),
+			 fy_node_sequence_get_by_index(fyn, 1));
+	ck_assert_ptr_eq(fy_anchor_node(fy_document_lookup_anchor(fyd_tgt, "d")),
+			 fy_node_by_path(fy_node_sequence_get_by_index(fyn, 1), "/k"));
+	fy_node_free(fyn);
+	ck_assert_ptr_eq(fy_document_lookup_anchor(fyd_tgt, "c"), NULL);
+
+	/* a key can't be stolen, and stays where it is */
+	fyd_src = fy_document_build_from_string(NULL, "{ a: [ x, y ], b: c }");
+	ck_assert_ptr_ne(fyd_src, NULL);
+	fyn = fy_node_pair_key(fy_node_mapping_get_by_index(fy_document_root(fyd_src), 1));
+	ck_assert_ptr_ne(fyn, NULL);
+	ck_assert_ptr_eq(fy_node_steal(fyd_tgt, fyn), NULL);
+	output = fy_emit_node_to_string(fy_document_root(fyd_src),
+					FYECF_MODE_FLOW_ONELINE | FYECF_WIDTH_INF);
+	ck_assert_ptr_ne(output, NULL);
+	ck_assert_str_eq(output, "{a: [x, y], b: c}");
+	free(output);
+
+	/* a stolen mapping value takes its pair along */
+	fyn = fy_node_steal(fyd_tgt, fy_node_by_path(fy_document_root(fyd_src), "/a"));
+	ck_assert_ptr_ne(fyn, NULL);
+	output = fy_emit_node_to_string(fy_document_root(fyd_src),
+					FYECF_MODE_FLOW_ONELINE | FYECF_WIDTH_INF);
+	ck_assert_ptr_ne(output, NULL);
+	ck_assert_str_eq(output, "{b: c}");
+	free(output);
+	fy_document_destroy(fyd_src);
+
+	ret = fy_node_insert_move(fy_node_by_path(fy_document_root(fyd_tgt), "/bar"), fyn);
+	ck_assert_int_eq(ret, 0);
+
+	output = fy_emit_node_to_string(fy_node_by_path(fy_document_root(fyd_tgt), "/bar"),
+					FYECF_MODE_FLOW_ONELINE | FYECF_WIDTH_INF);
+	ck_assert_ptr_ne(output, NULL);
+	ck_assert_str_eq(output, "[x, y]");
+	free(output);
+
+	/* not into itself, but the source is consumed anyway */
+	ret = fy_node_insert_move(fy_node_by_path(fy_document_root(fyd_tgt), "/baz/[0]"),
+				  fy_node_by_path(fy_document_root(fyd_tgt), "/baz"));
+	ck_assert_int_eq(ret, -1);
+	output = fy_emit_document_to_string(fyd_tgt, FYECF_MODE_FLOW_ONELINE | FYECF_WIDTH_INF);
+	ck_assert_ptr_ne(output, NULL);
+	ck_assert_str_eq(output, "{foo: [1, &a 2, *a, {x: y}], bar: [x, y]}\n");
+	free(output);
+
+	/* nor with a conflicting tag directive, which leaves the source without it */
+	fyd_src = fy_document_build_from_string(NULL,
+			"%TAG !e! tag:one.example,2000:\n--- { k: !e!v w }\n");
+	ck_assert_ptr_ne(fyd_src, NULL);
+	fyd_tgt2 = fy_document_build_from_string(NULL,
+			"%TAG !e! tag:other.example,2000:\n--- [ !e!v z ]\n");
+	ck_assert_ptr_ne(fyd_tgt2, NULL);
+	ret = fy_node_insert_move(fy_document_root(fyd_tgt2),
+				  fy_node_by_path(fy_document_root(fyd_src), "/k"));
+	ck_assert_int_eq(ret, -1);
+	ck_assert_int_eq(fy_node_sequence_item_count(fy_document_root(fyd_tgt2)), 1);
+	ck_assert_ptr_eq(fy_node_by_path(fy_document_root(fyd_src), "/k"), NULL);
+	fy_document_destroy(fyd_tgt2);
+	fy_document_destroy(fyd_src);
+
+	fy_document_destroy(fyd_tgt);
+}
+END_TEST
+
 #if 0
 START_TEST(doc_join_tags)
 {
@@ -887,9 +3572,40 @@ TCase *libfyaml_case_core(void)
 
 	tcase_add_test(tc, doc_insert_remove_seq);
 	tcase_add_test(tc, doc_insert_remove_map);
+	tcase_add_test(tc, doc_insert_foreign);
 
 	tcase_add_test(tc, doc_sort);
 
+	tcase_add_test(tc, doc_tags_shared);
+	tcase_add_test(tc, doc_dedup_scalars);
+	tcase_add_test(tc, doc_spill);
+	tcase_add_test(tc, doc_memory_usage);
+
+	tcase_add_test(tc, doc_overlay);
+	tcase_add_test(tc, doc_snapshot);
+	tcase_add_test(tc, doc_snapshot_readers);
+	tcase_add_test(tc, doc_tape);
+	tcase_add_test(tc, doc_tape_keys);
+	tcase_add_test(tc, doc_walk);
+	tcase_add_test(tc, doc_ypath);
+	tcase_add_test(tc, doc_index);
+	tcase_add_test(tc, doc_index_update);
+	tcase_add_test(tc, doc_json_patch);
+	tcase_add_test(tc, doc_merge_patch);
+	tcase_add_test(tc, doc_ordered_index);
+	tcase_add_test(tc, emit_event);
+	tcase_add_test(tc, emit_auto_anchors);
+	tcase_add_test(tc, event_pipeline);
+	tcase_add_test(tc, schema_validate);
+
+	tcase_add_test(tc, parse_diag_report);
+	tcase_add_test(tc, parse_budget_events);
+	tcase_add_test(tc, parse_slice);
+	tcase_add_test(tc, parse_load_document_slice);
+	tcase_add_test(tc, parse_ahead);
+	tcase_add_test(tc, executor);
+	tcase_add_test(tc, stream_low_latency);
+
 	tcase_add_test(tc, doc_join_scalar_to_scalar);
 	tcase_add_test(tc, doc_join_scalar_to_map);
 	tcase_add_test(tc, doc_join_scalar_to_seq);
@@ -901,6 +3617,7 @@ TCase *libfyaml_case_core(void)
 	tcase_add_test(tc, doc_join_seq_to_scalar);
 	tcase_add_test(tc, doc_join_seq_to_seq);
 	tcase_add_test(tc, doc_join_seq_to_map);
+	tcase_add_test(tc, doc_join_move);
 
 #if 0
 	tcase_add_test(tc, doc_join_tags);
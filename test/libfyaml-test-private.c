@@ -22,6 +22,11 @@
 
 #include <libfyaml.h>
 #include "fy-parse.h"
+#include "fy-doc.h"
+#include "fy-parse-ahead.h"
+#include "fy-index.h"
+#include "fy-snapshot.h"
+#include "fy-tape.h"
 
 static const struct fy_parse_cfg default_parse_cfg = {
 	.search_path = "",
@@ -152,6 +157,464 @@ START_TEST(parse_simple)
 }
 END_TEST
 
+START_TEST(doc_node_pools)
+{
+	struct fy_document *fyd;
+	struct fy_node *fyn;
+	size_t nodes, pairs;
+	char *buf, *s;
+	int i;
+
+	/* the in-document node layout must stay compact */
+	ck_assert(sizeof(struct fy_node) <= 8 * sizeof(void *));
+	ck_assert(sizeof(struct fy_node_pair) <= 5 * sizeof(void *));
+
+	/* a sequence of single pair mappings */
+	buf = malloc(5000 * 32);
+	ck_assert_ptr_ne(buf, NULL);
+	for (i = 0, s = buf; i < 5000; i++)
+		s += sprintf(s, "- { k%d: %d }\n", i, i);
+
+	fyd = fy_document_build_from_string(NULL, buf);
+	ck_assert_ptr_ne(fyd, NULL);
+
+	nodes = 1 + 5000 * 3;
+	pairs = 5000;
+	ck_assert(fyd->node_pool.used == nodes);
+	ck_assert(fyd->pair_pool.used == pairs);
+
+	/* chunks double in size, at most half of the last one is unused */
+	ck_assert(fyd->node_pool.reserved <= 2 * nodes * fyd->node_pool.size);
+	ck_assert(fyd->pair_pool.reserved <= 2 * pairs * fyd->pair_pool.size);
+
+	/* nodes and pairs are found by their ids */
+	fyn = fy_node_sequence_get_by_index(fy_document_root(fyd), 4999);
+	ck_assert_ptr_ne(fyn, NULL);
+	ck_assert_ptr_eq(fy_tpool_ptr(&fyd->node_pool, fyn->id), fyn);
+	ck_assert_ptr_eq(fy_node_parent(fyn), fy_document_root(fyd));
+	ck_assert_ptr_eq(fy_node_pair_parent(fy_node_pair_list_head(&fyn->mapping)), fyn);
+	ck_assert_int_eq(fy_document_root(fyd)->sequence.tail, fyn->id);
+
+	/* freed objects go back to the pools */
+	fyn = fy_node_sequence_get_by_index(fy_document_root(fyd), 0);
+	ck_assert_ptr_ne(fyn, NULL);
+	fy_node_free(fy_node_sequence_remove(fy_document_root(fyd), fyn));
+	ck_assert(fyd->node_pool.used == nodes - 3);
+	ck_assert(fyd->pair_pool.used == pairs - 1);
+
+	fy_document_destroy(fyd);
+	free(buf);
+}
+END_TEST
+
+START_TEST(doc_index_incremental)
+{
+	struct fy_document *fyd;
+	struct fy_document_index *fydi;
+	struct fy_document_index_entry *fydie;
+	struct fy_node *fyn_root, *fyn, *fyn_value;
+	char *buf, *s;
+	int i;
+
+	buf = malloc(1000 * 32);
+	ck_assert_ptr_ne(buf, NULL);
+	for (i = 0, s = buf; i < 1000; i++)
+		s += sprintf(s, "- { name: n%d }\n", i);
+
+	fyd = fy_document_build_from_string(NULL, buf);
+	ck_assert_ptr_ne(fyd, NULL);
+	fyn_root = fy_document_root(fyd);
+
+	fydi = fy_document_build_index(fyd, "name");
+	ck_assert_ptr_ne(fydi, NULL);
+	ck_assert(fydi->entry_pool.used == 1000);
+
+	/* point an entry elsewhere; only a full build would set it right */
+	fyn_value = fy_node_by_path(fyn_root, "/[5]/name");
+	fydie = fy_text_hash_lookup(&fydi->nodes, (const char *)&fyn_value, sizeof(fyn_value));
+	ck_assert_ptr_ne(fydie, NULL);
+	fydie->fyn = fyn_root;
+
+	fyn = fy_node_build_from_string(fyd, "{ name: n1000 }");
+	ck_assert_ptr_ne(fyn, NULL);
+	ck_assert_int_eq(fy_node_sequence_append(fyn_root, fyn), 0);
+	ck_assert_ptr_eq(fy_document_index_lookup(fydi, "n1000", (size_t)-1), fyn);
+	ck_assert_ptr_eq(fy_document_index_lookup(fydi, "n5", (size_t)-1), fyn_root);
+	ck_assert(fydi->entry_pool.used == 1001);
+
+	/* the entries of a removed item go with it */
+	fy_node_free(fy_node_sequence_remove(fyn_root, fy_node_sequence_get_by_index(fyn_root, 0)));
+	ck_assert_ptr_eq(fy_document_index_lookup(fydi, "n0", (size_t)-1), NULL);
+	ck_assert_ptr_eq(fy_document_index_lookup(fydi, "n5", (size_t)-1), fyn_root);
+	ck_assert(fydi->entry_pool.used == 1000);
+
+	/* a new root indexes everything again */
+	fy_document_set_root(fyd, fy_node_copy(fyd, fyn_root));
+	fyn_root = fy_document_root(fyd);
+	ck_assert_ptr_eq(fy_document_index_lookup(fydi, "n5", (size_t)-1),
+			 fy_node_sequence_get_by_index(fyn_root, 4));
+
+	fy_document_destroy(fyd);
+	free(buf);
+}
+END_TEST
+
+START_TEST(doc_ordered_incremental)
+{
+	struct fy_document *fyd;
+	struct fy_ordered_index *fyoi;
+	struct fy_node *fyn_root, *fyn_key;
+	struct fy_node_pair *fynp;
+	void *iter;
+	char *buf, *s;
+	int i;
+
+	buf = malloc(1000 * 16);
+	ck_assert_ptr_ne(buf, NULL);
+	for (i = 999, s = buf; i >= 0; i--)
+		s += sprintf(s, "k%03d: %d\n", i, i);
+
+	fyd = fy_document_build_from_string(NULL, buf);
+	ck_assert_ptr_ne(fyd, NULL);
+	fyn_root = fy_document_root(fyd);
+
+	ck_assert_int_eq(fy_node_mapping_create_ordered_index(fyn_root), 0);
+	ck_assert_ptr_ne(fyd->ordered_maps, NULL);
+	fyoi = fy_text_hash_lookup(fyd->ordered_maps, (const char *)&fyn_root, sizeof(fyn_root));
+	ck_assert_ptr_ne(fyoi, NULL);
+	ck_assert_int_eq(fyoi->count, 1000);
+
+	/* mark an entry; only a build would set it right */
+	ck_assert_int_eq(fyoi->entries[5].pos, 994);
+	fyoi->entries[5].pos = -1;
+
+	/* pairs added at either end and removed are followed */
+	ck_assert_int_eq(fy_node_mapping_append(fyn_root,
+				fy_node_build_from_string(fyd, "k0055"),
+				fy_node_build_from_string(fyd, "x")), 0);
+	ck_assert_int_eq(fy_node_mapping_prepend(fyn_root,
+				fy_node_build_from_string(fyd, "k0001"),
+				fy_node_build_from_string(fyd, "y")), 0);
+	fy_node_free(fy_node_mapping_remove_by_key(fyn_root,
+				fy_node_build_from_string(fyd, "k000")));
+	fyn_key = fy_node_build_from_string(fyd, "k002");
+	fynp = fy_node_mapping_lookup_pair(fyn_root, fyn_key);
+	fy_node_free(fyn_key);
+	ck_assert_ptr_ne(fynp, NULL);
+	ck_assert_int_eq(fy_node_mapping_remove(fyn_root, fynp), 0);
+	fy_node_pair_free(fynp);
+
+	iter = NULL;
+	fynp = fy_node_mapping_lookup_prefix(fyn_root, "k00", (size_t)-1, &iter);
+	ck_assert_ptr_ne(fynp, NULL);
+	ck_assert_str_eq(fy_node_get_scalar0(fy_node_pair_key(fynp)), "k0001");
+	fynp = fy_node_mapping_lookup_prefix(fyn_root, "k00", (size_t)-1, &iter);
+	ck_assert_str_eq(fy_node_get_scalar0(fy_node_pair_key(fynp)), "k001");
+	fynp = fy_node_mapping_lookup_prefix(fyn_root, "k00", (size_t)-1, &iter);
+	ck_assert_str_eq(fy_node_get_scalar0(fy_node_pair_key(fynp)), "k003");
+	fynp = fy_node_mapping_lookup_prefix(fyn_root, "k00", (size_t)-1, &iter);
+	ck_assert_str_eq(fy_node_get_scalar0(fy_node_pair_key(fynp)), "k004");
+	fynp = fy_node_mapping_lookup_prefix(fyn_root, "k00", (size_t)-1, &iter);
+	ck_assert_str_eq(fy_node_get_scalar0(fy_node_pair_key(fynp)), "k005");
+	fynp = fy_node_mapping_lookup_prefix(fyn_root, "k00", (size_t)-1, &iter);
+	ck_assert_str_eq(fy_node_get_scalar0(fy_node_pair_key(fynp)), "k0055");
+
+	ck_assert_ptr_eq(fy_text_hash_lookup(fyd->ordered_maps, (const char *)&fyn_root,
+					     sizeof(fyn_root)), fyoi);
+	ck_assert_int_eq(fyoi->count, 1000);
+	ck_assert_str_eq(fy_node_get_scalar0(fy_node_pair_key(fyoi->entries[4].fynp)), "k005");
+	ck_assert_int_eq(fyoi->entries[4].pos, -1);
+
+	/* a change it can't follow builds it again */
+	ck_assert_int_eq(fy_node_sort(fyn_root, NULL, NULL), 0);
+	ck_assert_int_eq(fy_node_mapping_create_ordered_index(fyn_root), 0);
+	ck_assert_int_eq(fyoi->entries[4].pos, 4);
+
+	fy_document_destroy(fyd);
+	free(buf);
+}
+END_TEST
+
+START_TEST(doc_dedup_marks)
+{
+	struct fy_parse_cfg cfg;
+	struct fy_document *fyd, *fyd_plain;
+	struct fy_node *fyn;
+	int rc;
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.flags = FYPCF_QUIET | FYPCF_DEDUP_SCALARS;
+	fyd = fy_document_build_from_string(&cfg,
+			"- [ prod, eu ]\n"
+			"- [ prod, us ]\n"
+			"- { env: [ prod, eu ] }\n");
+	ck_assert_ptr_ne(fyd, NULL);
+	fyd_plain = fy_document_build_from_string(NULL, "[ { name: x } ]");
+	ck_assert_ptr_ne(fyd_plain, NULL);
+
+	/* a shared scalar copied or moved elsewhere still reports its own place */
+	fyn = fy_node_copy(fyd_plain, fy_node_by_path(fy_document_root(fyd), "/[2]/env/[0]"));
+	ck_assert_ptr_ne(fyn, NULL);
+	ck_assert_int_eq(fy_node_get_start_mark(fyn)->line, 2);
+	ck_assert_int_eq(fy_node_get_start_mark(fyn)->column, 11);
+	fy_node_free(fyn);
+
+	rc = fy_node_insert(fy_node_by_path(fy_document_root(fyd_plain), "/[0]/name"),
+			    fy_node_by_path(fy_document_root(fyd), "/[2]/env/[1]"));
+	ck_assert_int_eq(rc, 0);
+	fyn = fy_node_by_path(fy_document_root(fyd_plain), "/[0]/name");
+	ck_assert_int_eq(fy_node_get_start_mark(fyn)->line, 2);
+	ck_assert_int_eq(fy_node_get_start_mark(fyn)->column, 17);
+
+	fyn = fy_node_steal(fyd_plain, fy_node_by_path(fy_document_root(fyd), "/[2]/env/[0]"));
+	ck_assert_ptr_ne(fyn, NULL);
+	fy_document_destroy(fyd);
+	ck_assert_int_eq(fy_node_get_start_mark(fyn)->line, 2);
+	ck_assert_int_eq(fy_node_get_end_mark(fyn)->column, 15);
+	fy_node_free(fyn);
+
+	fy_document_destroy(fyd_plain);
+}
+END_TEST
+
+START_TEST(doc_snapshot_delta)
+{
+	struct fy_document *fyd, *fyd_val;
+	struct fy_snapshot *fys, *fys_new;
+	char *buf;
+
+	fyd = fy_document_build_from_string(NULL, "{ a: [ 1, [ 2, 3 ], { x: 4, y: 5 } ], b: 6 }");
+	ck_assert_ptr_ne(fyd, NULL);
+	fys = fy_snapshot_create(fyd);
+	ck_assert_ptr_ne(fys, NULL);
+	fyd_val = fy_document_build_from_string(NULL, "7");
+	ck_assert_ptr_ne(fyd_val, NULL);
+
+	/* only the path is in the delta, the sequences patched by index */
+	fys_new = fy_document_update_path(fys, "/a/[1]/[-1]", fy_document_root(fyd_val));
+	ck_assert_ptr_ne(fys_new, NULL);
+	ck_assert_int_eq(fys_new->npatches, 2);
+	buf = fy_emit_document_to_string(fys_new->fyd, FYECF_MODE_FLOW_ONELINE);
+	ck_assert_ptr_ne(buf, NULL);
+	ck_assert_str_eq(buf, "{a: {1: {1: 7}}}\n");
+	free(buf);
+	fy_snapshot_unref(fys);
+	fys = fys_new;
+
+	fys_new = fy_document_update_path(fys, "/a/[2]/y", fy_document_root(fyd_val));
+	ck_assert_ptr_ne(fys_new, NULL);
+	buf = fy_emit_document_to_string(fys_new->fyd, FYECF_MODE_FLOW_ONELINE);
+	ck_assert_ptr_ne(buf, NULL);
+	ck_assert_str_eq(buf, "{a: {2: {y: 7}}}\n");
+	free(buf);
+	fy_snapshot_unref(fys);
+	fys = fys_new;
+
+	fy_document_destroy(fyd_val);
+	fy_snapshot_unref(fys);
+}
+END_TEST
+
+START_TEST(doc_tape_spans)
+{
+	struct fy_tape *fytp;
+	struct fy_document *fyd;
+	struct fy_node *fyn;
+	int pos;
+
+	fytp = fy_tape_build_from_string(NULL, "a: \"x\\ty\"\nb: [ plain, 'q' ]\n");
+	ck_assert_ptr_ne(fytp, NULL);
+
+	/* only the text that isn't verbatim in the input is copied */
+	pos = fy_tape_by_path(fytp, fy_tape_root(fytp), "/a");
+	ck_assert(fytp->entries[pos].flags & FYTEF_TEXT);
+	pos = fy_tape_by_path(fytp, fy_tape_root(fytp), "/b/[1]");
+	ck_assert(!(fytp->entries[pos].flags & FYTEF_TEXT));
+	ck_assert_int_eq(fytp->entries[pos].span.offset, 23);
+	ck_assert_int_eq(fytp->text_count, 3);
+
+	fyd = fy_tape_to_document(fytp);
+	fy_tape_destroy(fytp);
+	ck_assert_ptr_ne(fyd, NULL);
+
+	/* the nodes still point where they came from */
+	fyn = fy_node_by_path(fy_document_root(fyd), "/b/[1]");
+	ck_assert_int_eq(fy_node_get_start_mark(fyn)->line, 1);
+	ck_assert_int_eq(fy_node_get_start_mark(fyn)->column, 13);
+	ck_assert_int_eq(fy_node_get_end_mark(fyn)->column, 14);
+
+	fy_document_destroy(fyd);
+}
+END_TEST
+
+START_TEST(stream_buffer_growth)
+{
+	struct fy_parse_cfg cfg;
+	struct fy_parser *fyp;
+	struct fy_document *fyd;
+	struct fy_input *fyi;
+	char msg[64];
+	FILE *fp;
+	int fds[2], i, rc, len;
+	ssize_t wrote;
+
+	rc = pipe(fds);
+	ck_assert_int_eq(rc, 0);
+	fp = fdopen(fds[0], "r");
+	ck_assert_ptr_ne(fp, NULL);
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.flags = FYPCF_QUIET | FYPCF_STREAM_LOW_LATENCY;
+	fyp = fy_parser_create(&cfg);
+	ck_assert_ptr_ne(fyp, NULL);
+	rc = fy_parser_set_input_fp(fyp, "pipe", fp);
+	ck_assert_int_eq(rc, 0);
+
+	/* many small messages, the input runs dry after each one */
+	for (i = 0; i < 2000; i++) {
+		len = snprintf(msg, sizeof(msg), "--- { seq: %d }\n...\n", i);
+		wrote = write(fds[1], msg, len);
+		ck_assert_int_eq(wrote, len);
+
+		fyd = fy_parse_load_document(fyp);
+		ck_assert_ptr_ne(fyd, NULL);
+		fy_parse_document_destroy(fyp, fyd);
+	}
+
+	/* the buffer grows with what is read, not with the number of reads */
+	fyi = fyp->current_input;
+	ck_assert_ptr_ne(fyi, NULL);
+	ck_assert(fyi->allocated <= fyi->read + fyi->chunk);
+
+	close(fds[1]);
+
+	fyd = fy_parse_load_document(fyp);
+	ck_assert_ptr_eq(fyd, NULL);
+	ck_assert(!fy_parser_get_stream_error(fyp));
+
+	fy_parser_destroy(fyp);
+	fclose(fp);
+}
+END_TEST
+
+/* the token an event is about, for comparing positions */
+static struct fy_token *parse_ahead_event_token(struct fy_event *fye)
+{
+	switch (fye->type) {
+	case FYET_STREAM_START:
+		return fye->stream_start.stream_start;
+	case FYET_STREAM_END:
+		return fye->stream_end.stream_end;
+	case FYET_DOCUMENT_START:
+		return fye->document_start.document_start;
+	case FYET_DOCUMENT_END:
+		return fye->document_end.document_end;
+	case FYET_ALIAS:
+		return fye->alias.anchor;
+	case FYET_SCALAR:
+		return fye->scalar.value;
+	case FYET_SEQUENCE_START:
+		return fye->sequence_start.sequence_start;
+	case FYET_SEQUENCE_END:
+		return fye->sequence_end.sequence_end;
+	case FYET_MAPPING_START:
+		return fye->mapping_start.mapping_start;
+	case FYET_MAPPING_END:
+		return fye->mapping_end.mapping_end;
+	default:
+		break;
+	}
+	return NULL;
+}
+
+START_TEST(parse_ahead_events)
+{
+	struct fy_parse_cfg cfg;
+	struct fy_parser *fyp_sync, *fyp;
+	struct fy_parse_ahead *fypa;
+	struct fy_event *fye;
+	struct fy_eventp *fyep;
+	struct fy_token *fyt, *fyt_sync;
+	char *yaml;
+	size_t len;
+	int i, rc, count, ready_count;
+	bool done;
+
+	/* three documents of 2000 items, nine events each */
+	yaml = malloc(32 * 6000 + 64);
+	ck_assert_ptr_ne(yaml, NULL);
+	len = 0;
+	for (i = 0; i < 6000; i++) {
+		if (i % 2000 == 0)
+			len += sprintf(yaml + len, "---\n");
+		len += sprintf(yaml + len, "- { k: v%d, n: [ %d, x ] }\n", i, i);
+	}
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.flags = FYPCF_QUIET;
+	fyp_sync = fy_parser_create(&cfg);
+	ck_assert_ptr_ne(fyp_sync, NULL);
+	rc = fy_parser_set_string(fyp_sync, yaml);
+	ck_assert_int_eq(rc, 0);
+
+	cfg.flags = FYPCF_QUIET | FYPCF_PARSE_AHEAD;
+	fyp = fy_parser_create(&cfg);
+	ck_assert_ptr_ne(fyp, NULL);
+	rc = fy_parser_set_string(fyp, yaml);
+	ck_assert_int_eq(rc, 0);
+
+	rc = fy_parse_ahead_start(fyp);
+	ck_assert_int_eq(rc, 0);
+	fypa = fyp->ahead;
+	ck_assert_ptr_ne(fypa, NULL);
+
+	/* the parsing thread fills the queue and waits for it to drain */
+	for (i = 0; i < 5000; i++) {
+		pthread_mutex_lock(&fypa->lock);
+		ready_count = fypa->ready_count;
+		done = fypa->done;
+		pthread_mutex_unlock(&fypa->lock);
+		if (ready_count >= FY_PARSE_AHEAD_MAX || done)
+			break;
+		usleep(1000);
+	}
+	ck_assert(!done);
+	ck_assert_int_ge(ready_count, FY_PARSE_AHEAD_MAX);
+	ck_assert_int_lt(ready_count, FY_PARSE_AHEAD_MAX + FY_PARSE_AHEAD_BATCH);
+
+	/* the events handed over in batches are the ones parsed directly */
+	count = 0;
+	while ((fyep = fy_parse_private(fyp)) != NULL) {
+		fye = fy_parser_parse(fyp_sync);
+		ck_assert_ptr_ne(fye, NULL);
+		ck_assert_int_eq(fyep->e.type, fye->type);
+
+		fyt = parse_ahead_event_token(&fyep->e);
+		fyt_sync = parse_ahead_event_token(fye);
+		ck_assert_int_eq(fyt != NULL, fyt_sync != NULL);
+		if (fyt) {
+			ck_assert_int_eq(fy_token_start_mark(fyt)->input_pos,
+					 fy_token_start_mark(fyt_sync)->input_pos);
+			ck_assert_str_eq(fy_token_get_text0(fyt), fy_token_get_text0(fyt_sync));
+		}
+
+		fy_parser_event_free(fyp_sync, fye);
+		fy_parser_event_free(fyp, &fyep->e);
+		count++;
+	}
+	ck_assert_ptr_eq(fy_parser_parse(fyp_sync), NULL);
+	ck_assert_int_eq(count, 3 * (2 + 2000 * 9 + 2) + 2);
+
+	/* it's all over, and the thread is gone */
+	ck_assert_ptr_eq(fyp->ahead, NULL);
+	ck_assert(!fy_parser_get_stream_error(fyp));
+
+	fy_parser_destroy(fyp);
+	fy_parser_destroy(fyp_sync);
+	free(yaml);
+}
+END_TEST
+
 TCase *libfyaml_case_private(void)
 {
 	TCase *tc;
@@ -162,5 +625,15 @@ TCase *libfyaml_case_private(void)
 	tcase_add_test(tc, scan_simple);
 	tcase_add_test(tc, parse_simple);
 
+	tcase_add_test(tc, doc_node_pools);
+	tcase_add_test(tc, doc_index_incremental);
+	tcase_add_test(tc, doc_ordered_incremental);
+	tcase_add_test(tc, doc_dedup_marks);
+	tcase_add_test(tc, doc_snapshot_delta);
+	tcase_add_test(tc, doc_tape_spans);
+
+	tcase_add_test(tc, stream_buffer_growth);
+	tcase_add_test(tc, parse_ahead_events);
+
 	return tc;
 }
@@ -39,6 +39,7 @@ static void display_usage(FILE *fp, char *progname)
 
 extern TCase *libfyaml_case_private(void);
 extern TCase *libfyaml_case_core(void);
+extern TCase *libfyaml_case_complexity(void);
 
 Suite *libfyaml_suite(void)
 {
@@ -48,6 +49,7 @@ Suite *libfyaml_suite(void)
 
 	suite_add_tcase(s, libfyaml_case_private());
 	suite_add_tcase(s, libfyaml_case_core());
+	suite_add_tcase(s, libfyaml_case_complexity());
 
 	return s;
 }